@@ -87,6 +87,8 @@ macro(cashbox_setup_options)
 
   option(cashbox_BUILD_FUZZ_TESTS "Enable fuzz testing executable" ${DEFAULT_FUZZER})
 
+  option(cashbox_BUILD_BENCHMARKS "Build the benchmark executables" ON)
+
 endmacro()
 
 macro(cashbox_global_options)
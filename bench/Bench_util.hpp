@@ -0,0 +1,104 @@
+#ifndef CASHBOX_BENCH_UTIL_HPP
+#define CASHBOX_BENCH_UTIL_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+// Small helpers shared by the benchmark executables; they print plain
+// tables to stdout and take no external benchmark framework;
+namespace bench {
+
+//------------------------------------------------------------------------------
+
+using Clock = std::chrono::steady_clock;
+
+inline std::uint64_t ns_since(Clock::time_point start)
+{
+  return static_cast<std::uint64_t>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+//------------------------------------------------------------------------------
+
+struct Latency_summary {
+  double mean_ns{0};
+  std::uint64_t p50_ns{0};
+  std::uint64_t p99_ns{0};
+  std::uint64_t p999_ns{0};
+  std::uint64_t max_ns{0};
+};
+
+// Sorts samples in place
+inline Latency_summary summarize(std::vector<std::uint64_t>& samples)
+{
+  Latency_summary res;
+  if (samples.empty())
+    return res;
+  std::sort(samples.begin(), samples.end());
+  const auto at{[&](double q) {
+    return samples[static_cast<std::size_t>(q * static_cast<double>(samples.size() - 1))];
+  }};
+  double sum{0};
+  for (const auto s : samples)
+    sum += static_cast<double>(s);
+  res.mean_ns = sum / static_cast<double>(samples.size());
+  res.p50_ns = at(0.5);
+  res.p99_ns = at(0.99);
+  res.p999_ns = at(0.999);
+  res.max_ns = samples.back();
+  return res;
+}
+
+inline void print_latency_header()
+{
+  std::printf("%-32s %10s %10s %10s %10s %12s\n",
+              "case", "mean ns", "p50 ns", "p99 ns", "p99.9 ns", "max ns");
+}
+
+inline void print_latency_row(std::string_view name, const Latency_summary& s)
+{
+  std::printf("%-32.*s %10.0f %10llu %10llu %10llu %12llu\n",
+              static_cast<int>(name.size()), name.data(), s.mean_ns,
+              static_cast<unsigned long long>(s.p50_ns),
+              static_cast<unsigned long long>(s.p99_ns),
+              static_cast<unsigned long long>(s.p999_ns),
+              static_cast<unsigned long long>(s.max_ns));
+}
+
+// Rate of n operations over elapsed ns, in millions per second
+inline double mops(std::uint64_t n, std::uint64_t elapsed_ns)
+{
+  return elapsed_ns ? static_cast<double>(n) * 1e3 / static_cast<double>(elapsed_ns) : 0.0;
+}
+
+// Keeps the optimizer from dropping a computed value
+template<class T>
+inline void do_not_optimize(const T& value)
+{
+#if defined(__GNUC__) || defined(__clang__)
+  asm volatile("" : : "r,m"(value) : "memory");
+#else
+  // No inline asm (MSVC): the value's address goes where the compiler
+  // has to assume it is read, and nothing moves across the fence
+  static const volatile void* volatile sink;
+  sink = &value;
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_BENCH_UTIL_HPP
@@ -0,0 +1,70 @@
+#ifndef CASHBOX_BENCH_PING_PONG_HPP
+#define CASHBOX_BENCH_PING_PONG_HPP
+
+//------------------------------------------------------------------------------
+
+#include "Bench_util.hpp"
+#include "library/core/Messaging.hpp"
+#include "library/core/Placement.hpp"
+
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// Request/reply round trip between two actors, the shape of the
+// atm <-> bank_machine exchange
+namespace bench {
+
+//------------------------------------------------------------------------------
+
+struct ping {
+  mutable Messaging::Sender reply_to;
+};
+
+struct pong {};
+
+//------------------------------------------------------------------------------
+
+inline Latency_summary round_trips(const Messaging::Actor_placement& client,
+                                   const Messaging::Actor_placement& server,
+                                   std::size_t n)
+{
+  Messaging::Receiver server_box;
+  Messaging::Receiver client_box;
+  server_box.set_wait_policy(server.wait);
+  client_box.set_wait_policy(client.wait);
+
+  auto server_thread{Messaging::start_placed(server, [&] {
+    try {
+      for (;;)
+        server_box.wait().handle<ping>([](const ping& msg) { msg.reply_to.send(pong{}); });
+    }
+    catch (const Messaging::Close_queue&) {
+    }
+  })};
+
+  std::vector<std::uint64_t> samples;
+  samples.reserve(n);
+  auto client_thread{Messaging::start_placed(client, [&] {
+    Messaging::Sender server_queue{server_box};
+    for (std::size_t i{0}; i < n; ++i) {
+      const auto start{Clock::now()};
+      server_queue.send(ping{client_box});
+      client_box.wait().handle<pong>([](const pong&) {});
+      samples.push_back(ns_since(start));
+    }
+  })};
+
+  client_thread.join();
+  Messaging::Sender{server_box}.send(Messaging::Close_queue{});
+  server_thread.join();
+  return summarize(samples);
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_BENCH_PING_PONG_HPP
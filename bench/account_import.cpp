@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Bank_machine.hpp"
+#include "library/core/Account_snapshot.hpp"
+
+//------------------------------------------------------------------------------
+
+// Bank startup from 10M accounts: the time from a file to a bank_machine
+// ready to run, parsing text on 1, 2, 4 and all hardware threads (in
+// account order and shuffled), and mapping a snapshot. The files have
+// just been written, so they are read from the page cache, not the disk.
+
+using Accounting::Account_snapshot;
+
+std::string temp_path(const char* name)
+{
+  return "/tmp/cashbox_bench_" + std::string{name};
+}
+
+void shuffle_lines(const std::string& from, const std::string& to)
+{
+  const auto image{Messaging::File_image::map(from, Messaging::File_access::sequential)};
+  const std::string_view text{reinterpret_cast<const char*>(image.data()), image.size()};
+  std::vector<std::string_view> lines;
+  for (std::size_t at{0}; at < text.size();) {
+    const auto end{text.find('\n', at)};
+    lines.push_back(text.substr(at, end + 1 - at));
+    at = end + 1;
+  }
+  std::shuffle(lines.begin(), lines.end(), std::mt19937_64{1});
+  std::ofstream out{to, std::ios::binary};
+  for (const auto l : lines)
+    out.write(l.data(), static_cast<std::streamsize>(l.size()));
+}
+
+// Ms to read the accounts, and to set up the bank over them
+template<class Load>
+std::pair<double, double> start_bank(const Account_snapshot& expected, Load&& load)
+{
+  auto start{bench::Clock::now()};
+  auto accounts{load()};
+  const auto read_ns{bench::ns_since(start)};
+  start = bench::Clock::now();
+  const bank_machine bank{std::move(accounts)};
+  const auto bank_ns{bench::ns_since(start)};
+
+  const auto& board{bank.published_balances()};
+  bool same{board.size() == expected.size()};
+  for (std::size_t i{0}; same && i < expected.size(); i += 9'973)
+    same = board.balance(expected.name(i)) == expected.balance(i);
+  if (!same)
+    std::printf("  WRONG accounts\n");
+  return {static_cast<double>(read_ns) / 1e6, static_cast<double>(bank_ns) / 1e6};
+}
+
+void print_row(const std::string& name, std::pair<double, double> ms)
+{
+  std::printf("%-28s %10.1f %10.1f %10.1f\n", name.c_str(), ms.first, ms.second,
+              ms.first + ms.second);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 10'000'000};
+  const unsigned hw{std::max(1u, std::thread::hardware_concurrency())};
+
+  const auto sorted_csv{temp_path("accounts.csv")};
+  const auto shuffled_csv{temp_path("accounts_shuffled.csv")};
+  const auto snapshot_file{temp_path("accounts.snap")};
+  {
+    const auto accounts{Accounting::synthetic_accounts(n)};
+    Accounting::write_accounts_csv(sorted_csv, accounts);
+    shuffle_lines(sorted_csv, shuffled_csv);
+    accounts.save(snapshot_file);
+  }
+  const auto expected{Account_snapshot::open(snapshot_file)};
+  std::printf("%zu accounts: text %.1f MiB, snapshot %.1f MiB\n", n,
+              static_cast<double>(std::ifstream{sorted_csv, std::ios::ate | std::ios::binary}.tellg()) / (1 << 20),
+              static_cast<double>(expected.bytes()) / (1 << 20));
+
+  std::printf("\n%-28s %10s %10s %10s\n", "startup", "read ms", "bank ms", "total ms");
+  std::vector<unsigned> thread_counts{1, 2, 4};
+  if (std::find(thread_counts.begin(), thread_counts.end(), hw) == thread_counts.end())
+    thread_counts.push_back(hw);
+  for (const auto& [name, file] : {std::pair{"text", sorted_csv},
+                                   std::pair{"shuffled text", shuffled_csv}})
+    for (const auto threads : thread_counts)
+      print_row(std::string{name} + ", " + std::to_string(threads) + " threads",
+                start_bank(expected, [&] {
+                  return Accounting::read_accounts_csv(file, Accounting::usd, threads);
+                }));
+  print_row("snapshot", start_bank(expected, [&] { return Account_snapshot::open(snapshot_file); }));
+
+  for (const auto& f : {sorted_csv, shuffled_csv, snapshot_file})
+    std::remove(f.c_str());
+  return 0;
+}
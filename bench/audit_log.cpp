@@ -0,0 +1,137 @@
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "library/core/Audit.hpp"
+
+//------------------------------------------------------------------------------
+
+// The audit log. First the leaf hashing alone: 1M records one at a time
+// through Sha256 and several at a time through sha256_64. Then what
+// record() costs the thread that calls it, on 1, 2 and 4 threads at
+// once, while the sealer hashes and writes behind it. Then verify_audit()
+// of the file that wrote (16M records, 1 GiB, by default) on 1, 2, 4 and
+// all hardware threads, read from the page cache, and once more with one
+// byte changed, which it must find.
+
+struct payment {
+  std::uint64_t id;
+  std::int64_t amount;
+};
+
+template<>
+struct Messaging::Trace_codec<payment> {
+  static constexpr std::uint16_t type{1};
+  static constexpr bool audited{true};
+  static void encode(const payment& msg, Trace_out& out)
+  {
+    out.put(msg.id);
+    out.put(msg.amount);
+  }
+};
+
+using Messaging::Trace_record;
+
+std::string temp_path(const char* name)
+{
+  return "/tmp/cashbox_bench_" + std::string{name};
+}
+
+//------------------------------------------------------------------------------
+
+void leaf_hashing(std::size_t n)
+{
+  std::vector<Trace_record> records(n);
+  for (std::size_t i{0}; i < n; ++i)
+    records[i].timestamp_ns = i;
+  std::vector<Crypto::Digest> one(n), multi(n);
+
+  auto t{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i)
+    one[i] = Crypto::Sha256{}.update(&records[i], sizeof(Trace_record)).finish();
+  const auto scalar_ns{bench::ns_since(t)};
+  t = bench::Clock::now();
+  Crypto::sha256_64({reinterpret_cast<const std::uint8_t*>(records.data()),
+                     n * sizeof(Trace_record)}, multi);
+  const auto multi_ns{bench::ns_since(t)};
+
+  const auto mib_s{[&](std::uint64_t ns) {
+    return static_cast<double>(n * sizeof(Trace_record)) / (1 << 20) / (static_cast<double>(ns) / 1e9);
+  }};
+  std::printf("leaf hashing, %zu records, %zu lanes\n", n, Crypto::detail::lanes);
+  std::printf("%-24s %10.1f MiB/s\n", "one at a time", mib_s(scalar_ns));
+  std::printf("%-24s %10.1f MiB/s\n", "sha256_64", mib_s(multi_ns));
+  if (one != multi)
+    std::printf("  WRONG: the digests differ\n");
+}
+
+// Ns per record() on each of threads threads, n records in all
+double recording(const std::string& path, std::size_t n, unsigned threads, Crypto::Digest& head)
+{
+  Messaging::Audit_log log{path};
+  const auto start{bench::Clock::now()};
+  {
+    std::vector<std::jthread> producers;
+    for (unsigned t{0}; t < threads; ++t)
+      producers.emplace_back([&, t] {
+        for (auto i{n * t / threads}; i < n * (t + 1) / threads; ++i)
+          log.record(0, payment{i + 1, static_cast<std::int64_t>(i % 1000)});
+      });
+  }
+  const auto elapsed{bench::ns_since(start)};
+  log.flush();
+  head = log.head();
+  return static_cast<double>(elapsed) * threads / static_cast<double>(n);
+}
+
+void verifying(const std::string& path, std::size_t n, const Crypto::Digest& head)
+{
+  std::vector<unsigned> thread_counts{1, 2, 4};
+  if (const auto hw{std::thread::hardware_concurrency()}; hw > 4)
+    thread_counts.push_back(hw);
+  const auto bytes{static_cast<double>(n * sizeof(Trace_record))};
+  std::printf("\nverify_audit, %zu records\n%-8s %10s %10s\n", n, "threads", "ms", "GiB/s");
+  for (const auto threads : thread_counts) {
+    const auto t{bench::Clock::now()};
+    const auto verdict{Messaging::verify_audit(path, threads)};
+    const auto elapsed{bench::ns_since(t)};
+    std::printf("%-8u %10.1f %10.2f\n", threads, static_cast<double>(elapsed) / 1e6,
+                bytes / (1 << 30) / (static_cast<double>(elapsed) / 1e9));
+    if (!verdict.ok() || verdict.records != n || verdict.head != head)
+      std::printf("  WRONG: %s\n", verdict.problem.c_str());
+  }
+
+  if (std::FILE* f{std::fopen(path.c_str(), "r+b")}) {  // One byte of a late record
+    std::fseek(f, static_cast<long>(bytes * 0.9), SEEK_SET);
+    const auto c{std::fgetc(f)};
+    std::fseek(f, static_cast<long>(bytes * 0.9), SEEK_SET);
+    std::fputc(c ^ 1, f);
+    std::fclose(f);
+  }
+  const auto verdict{Messaging::verify_audit(path)};
+  std::printf("one byte changed: %s at batch %llu of %llu\n",
+              verdict.ok() ? "WRONG, not found" : verdict.problem.c_str(),
+              static_cast<unsigned long long>(verdict.bad_batch.value_or(0)),
+              static_cast<unsigned long long>((n + (1 << 12) - 1) >> 12));
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 16'000'000};
+  leaf_hashing(1'000'000);
+
+  const auto path{temp_path("audit")};
+  Crypto::Digest head{};
+  std::printf("\nrecord(), %zu records\n%-8s %10s\n", n, "threads", "ns/record");
+  for (const unsigned threads : {4u, 2u, 1u})     // The last one's file is verified
+    std::printf("%-8u %10.1f\n", threads, recording(path, n, threads, head));
+
+  verifying(path, n, head);
+  std::remove(path.c_str());
+  return 0;
+}
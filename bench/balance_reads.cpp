@@ -0,0 +1,132 @@
+#include <pthread.h>
+#include <time.h>
+
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Bank_machine.hpp"
+
+//------------------------------------------------------------------------------
+
+// Balance queries and withdrawals from several atm-like clients against
+// one bank_machine with 1000 accounts, 95/5 and 50/50 reads to writes.
+// A write is always a withdraw round trip through the bank's queue; a read
+// is either a get_balance round trip (queue) or a read of the bank's
+// Balance_board (board). Reported per case: operations per second, mean
+// read latency, messages the bank handled and how busy the bank thread
+// was (its CPU time over the wall time; it blocks when idle).
+
+constexpr std::size_t accounts{1'000};
+
+enum class Reads { queue, board };
+
+struct Case_result {
+  std::uint64_t elapsed_ns;
+  std::uint64_t read_ns;
+  std::uint64_t reads;
+  std::uint64_t bank_messages;
+  std::uint64_t bank_cpu_ns;
+};
+
+std::uint64_t thread_cpu_ns(std::thread& t)
+{
+  clockid_t clock{};
+  timespec ts{};
+  if (pthread_getcpuclockid(t.native_handle(), &clock) != 0 || clock_gettime(clock, &ts) != 0)
+    return 0;
+  return static_cast<std::uint64_t>(ts.tv_sec) * 1'000'000'000 + static_cast<std::uint64_t>(ts.tv_nsec);
+}
+
+// One client: ops operations, read_percent of them balance reads
+void client(bank_machine& bank, Reads reads, unsigned read_percent, std::size_t ops,
+            std::uint64_t seed, std::uint64_t& read_ns, std::uint64_t& read_count)
+{
+  std::mt19937_64 rng{seed};
+  Messaging::Receiver incoming;
+  auto to_bank{bank.get_sender()};
+  const auto& board{bank.published_balances()};
+  for (std::size_t i{0}; i < ops; ++i) {
+    const auto account{"acc" + std::to_string(rng() % accounts)};
+    if (rng() % 100 < read_percent) {
+      const auto start{bench::Clock::now()};
+      if (reads == Reads::board)
+        bench::do_not_optimize(board.balance(account));
+      else {
+        to_bank.send(get_balance(account, incoming));
+        incoming.wait().handle<balance>([](const balance& msg) {
+          bench::do_not_optimize(msg.amount);
+        });
+      }
+      read_ns += bench::ns_since(start);
+      ++read_count;
+    }
+    else {
+      to_bank.send(withdraw(account, Accounting::Money::major(1), incoming));
+      incoming.wait()
+        .handle<withdraw_ok>([](const withdraw_ok&) {})
+        .handle<withdraw_denied>([](const withdraw_denied&) {});
+    }
+  }
+}
+
+Case_result run_case(Reads reads, unsigned read_percent, std::size_t ops, unsigned clients)
+{
+  std::vector<std::string> names;
+  for (std::size_t i{0}; i < accounts; ++i)
+    names.push_back("acc" + std::to_string(i));
+  bank_machine bank{Accounting::Money::major(1'000'000), names};
+  std::thread bank_thread{&bank_machine::run, &bank};
+
+  std::vector<std::uint64_t> read_ns(clients);
+  std::vector<std::uint64_t> read_count(clients);
+  std::vector<std::thread> threads;
+  const auto cpu_before{thread_cpu_ns(bank_thread)};
+  const auto start{bench::Clock::now()};
+  for (unsigned c{0}; c < clients; ++c)
+    threads.emplace_back(client, std::ref(bank), reads, read_percent, ops / clients, c + 1,
+                         std::ref(read_ns[c]), std::ref(read_count[c]));
+  for (auto& t : threads)
+    t.join();
+  Case_result res{};
+  res.elapsed_ns = bench::ns_since(start);
+  res.bank_cpu_ns = thread_cpu_ns(bank_thread) - cpu_before;
+  res.bank_messages = bank.mailbox().stats().pushed;
+  for (unsigned c{0}; c < clients; ++c) {
+    res.read_ns += read_ns[c];
+    res.reads += read_count[c];
+  }
+  bank.done();
+  bank_thread.join();
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t ops{argc > 1 ? std::stoul(argv[1]) : 400'000};
+  const unsigned clients{argc > 2 ? static_cast<unsigned>(std::stoul(argv[2])) : 4};
+
+  std::printf("%zu operations from %u clients, %zu accounts\n", ops, clients, accounts);
+  std::printf("%-8s %-6s %12s %12s %14s %14s\n",
+              "reads", "mix", "kops/s", "read ns", "bank messages", "bank busy %");
+  for (const auto percent : {95u, 50u}) {
+    for (const auto& [name, reads] : {std::pair{"queue", Reads::queue},
+                                      std::pair{"board", Reads::board}}) {
+      const auto r{run_case(reads, percent, ops, clients)};
+      char mix[16];
+      std::snprintf(mix, sizeof(mix), "%u/%u", percent, 100 - percent);
+      std::printf("%-8s %-6s %12.1f %12.0f %14llu %14.1f\n", name, mix,
+                  bench::mops(ops, r.elapsed_ns) * 1e3,
+                  r.reads ? static_cast<double>(r.read_ns) / static_cast<double>(r.reads) : 0.0,
+                  static_cast<unsigned long long>(r.bank_messages),
+                  100.0 * static_cast<double>(r.bank_cpu_ns) / static_cast<double>(r.elapsed_ns));
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,140 @@
+#include "Bench_util.hpp"
+#include "library/core/Broadcast.hpp"
+
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// One publisher fanning out to 1..16 subscriber threads: a Broadcast_channel
+// (one shared message, a cursor per subscriber) against sending a copy to
+// each subscriber's Receiver. Then one deliberately slow subscriber next to
+// a fast one, under each slow-subscriber policy.
+
+struct event {
+  char account[32];                 // A payload worth not copying
+  std::uint64_t amount;
+};
+
+//------------------------------------------------------------------------------
+
+std::uint64_t channel_run(std::size_t subscribers, std::size_t n)
+{
+  Messaging::Broadcast_channel<event> ch{4096};
+  std::vector<Messaging::Broadcast_channel<event>::Subscription> subs;
+  for (std::size_t i{0}; i < subscribers; ++i)
+    subs.push_back(ch.subscribe("sub" + std::to_string(i)));
+
+  std::vector<std::thread> threads;
+  std::vector<std::uint64_t> sums(subscribers);
+  for (std::size_t i{0}; i < subscribers; ++i)
+    threads.emplace_back([&, i] {
+      while (const auto msg{subs[i].next()})
+        sums[i] += msg->amount;
+    });
+
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i)
+    ch.publish_new(event{"acc1234", i});
+  ch.close();
+  for (auto& t : threads)
+    t.join();
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(sums);
+  return elapsed;
+}
+
+std::uint64_t copies_run(std::size_t subscribers, std::size_t n)
+{
+  std::vector<Messaging::Receiver> boxes(subscribers);
+  std::vector<Messaging::Sender> to;
+  for (auto& box : boxes)
+    to.emplace_back(box);
+
+  std::vector<std::thread> threads;
+  std::vector<std::uint64_t> sums(subscribers);
+  for (std::size_t i{0}; i < subscribers; ++i)
+    threads.emplace_back([&, i] {
+      try {
+        for (;;)
+          boxes[i].wait()
+            .handle<event>([&](const event& msg) { sums[i] += msg.amount; });
+      }
+      catch (const Messaging::Close_queue&) {
+      }
+    });
+
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i) {
+    const event msg{"acc1234", i};
+    for (auto& t : to)
+      t.send(msg);
+  }
+  for (auto& t : to)
+    t.send(Messaging::Close_queue{});
+  for (auto& t : threads)
+    t.join();
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(sums);
+  return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+void slow_subscriber(Messaging::Slow_subscriber policy, std::size_t n)
+{
+  Messaging::Broadcast_channel<event> ch{1024};
+  auto fast{ch.subscribe("fast")};
+  auto slow{ch.subscribe("slow", policy)};
+  std::thread fast_thread{[&] { while (fast.next()) {} }};
+  std::thread slow_thread{[&] {
+    while (slow.next())
+      std::this_thread::sleep_for(std::chrono::microseconds{20});
+  }};
+
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i)
+    ch.publish_new(event{"acc1234", i});
+  const auto elapsed{bench::ns_since(start)};
+  const auto stats{ch.stats()};
+  ch.close();
+  fast_thread.join();
+  slow_thread.join();
+
+  for (const auto& s : stats)
+    std::printf("%-12s %-6s %12.2f %10llu %10llu %10llu %8llu %6s\n",
+                policy == Messaging::Slow_subscriber::block ? "block"
+                : policy == Messaging::Slow_subscriber::drop ? "drop" : "disconnect",
+                s.name.c_str(), bench::mops(n, elapsed),
+                static_cast<unsigned long long>(s.received),
+                static_cast<unsigned long long>(s.dropped),
+                static_cast<unsigned long long>(s.lag),
+                static_cast<unsigned long long>(s.max_lag),
+                s.disconnected ? "yes" : "no");
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 200'000};
+
+  std::printf("messages: %zu, payload %zu bytes\n", n, sizeof(event));
+  std::printf("%-12s %14s %14s %16s %16s\n", "subscribers",
+              "channel Mmsg/s", "copies Mmsg/s", "channel Mdeliv/s", "copies Mdeliv/s");
+  for (const std::size_t subs : {1u, 2u, 4u, 8u, 16u}) {
+    const auto ch{channel_run(subs, n)};
+    const auto cp{copies_run(subs, n)};
+    std::printf("%-12zu %14.2f %14.2f %16.2f %16.2f\n", subs,
+                bench::mops(n, ch), bench::mops(n, cp),
+                bench::mops(n * subs, ch), bench::mops(n * subs, cp));
+  }
+
+  const std::size_t slow_n{n / 10};
+  std::printf("\n%zu messages, ring of 1024, slow subscriber sleeps 20 us per message\n", slow_n);
+  std::printf("%-12s %-6s %12s %10s %10s %10s %8s %6s\n", "policy", "sub",
+              "pub Mmsg/s", "received", "dropped", "lag", "max lag", "disc");
+  for (const auto policy : {Messaging::Slow_subscriber::block, Messaging::Slow_subscriber::drop,
+                            Messaging::Slow_subscriber::disconnect})
+    slow_subscriber(policy, slow_n);
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Card_router.hpp"
+#include "library/core/Prefix_routes.hpp"
+
+//------------------------------------------------------------------------------
+
+// Card routing. First lookups alone in a table of 100k issuer prefixes
+// (4 to 8 digits, 16 banks) for 16-digit card numbers, all over the table
+// and from a hot set of 1000 cards: Prefix_routes against probing a hash
+// map once per prefix length, longest first. Then a card_router passing
+// withdrawals on to 16 banks (threads that only count them), left alone
+// and while another thread swaps its table every millisecond.
+
+using Messaging::Prefix_routes;
+
+constexpr std::uint32_t banks{16};
+
+std::vector<Prefix_routes::Entry> make_prefixes(std::size_t n, std::uint64_t seed)
+{
+  std::mt19937_64 rng{seed};
+  std::unordered_map<std::string, std::uint32_t> seen;
+  std::vector<Prefix_routes::Entry> res;
+  while (res.size() < n) {
+    std::string p;
+    const auto length{4 + rng() % 5};
+    for (std::size_t i{0}; i < length; ++i)
+      p += static_cast<char>('0' + rng() % 10);
+    if (seen.emplace(p, 0).second)
+      res.push_back({p, static_cast<std::uint32_t>(rng() % banks)});
+  }
+  return res;
+}
+
+// n card numbers, drawn from distinct ones, or all different if 0
+std::vector<std::string> make_cards(std::size_t n, std::size_t distinct, std::uint64_t seed)
+{
+  std::mt19937_64 rng{seed};
+  const auto card{[&] {
+    std::string c;
+    for (std::size_t i{0}; i < 16; ++i)
+      c += static_cast<char>('0' + rng() % 10);
+    return c;
+  }};
+  std::vector<std::string> pool(distinct);
+  for (auto& c : pool)
+    c = card();
+  std::vector<std::string> res(n);
+  for (auto& c : res)
+    c = distinct ? pool[rng() % distinct] : card();
+  return res;
+}
+
+// The obvious way, for comparison
+struct Hashed_prefixes {
+  std::unordered_map<std::string_view, std::uint32_t> by_prefix;
+
+  explicit Hashed_prefixes(const std::vector<Prefix_routes::Entry>& entries)
+  {
+    for (const auto& e : entries)
+      by_prefix.emplace(e.prefix, e.route);
+  }
+
+  std::uint32_t find(std::string_view key) const
+  {
+    for (auto n{std::min(key.size(), Prefix_routes::max_prefix) + 1}; n-- > 0;)
+      if (const auto it{by_prefix.find(key.substr(0, n))}; it != by_prefix.end())
+        return it->second;
+    return Prefix_routes::no_route;
+  }
+};
+
+template<class Table>
+double lookups(const Table& table, const std::vector<std::string>& cards, std::uint64_t& checksum)
+{
+  const auto start{bench::Clock::now()};
+  for (const auto& c : cards)
+    checksum += table.find(c);
+  return bench::mops(cards.size(), bench::ns_since(start));
+}
+
+//------------------------------------------------------------------------------
+
+// Withdrawals per second through the router; with reload_every, another
+// thread swaps in one of two other tables at that interval meanwhile
+std::pair<double, std::uint64_t>
+route_withdrawals(const std::vector<Prefix_routes::Entry>& prefixes,
+                  const std::vector<std::string>& cards,
+                  std::optional<std::chrono::microseconds> reload_every)
+{
+  std::vector<std::unique_ptr<Messaging::Receiver>> sinks;
+  std::vector<Messaging::Sender> to_sinks;
+  for (std::uint32_t b{0}; b < banks; ++b) {
+    sinks.push_back(std::make_unique<Messaging::Receiver>());
+    to_sinks.push_back(*sinks.back());
+  }
+  std::atomic<std::uint64_t> delivered{0};
+  std::vector<std::thread> sink_threads;
+  for (auto& s : sinks)
+    sink_threads.emplace_back([&, s = s.get()] {
+      try {
+        for (;;)
+          s->wait().handle<withdraw>([&](const withdraw&) {
+            delivered.fetch_add(1, std::memory_order_relaxed);
+          });
+      }
+      catch (const Messaging::Close_queue&) {
+      }
+    });
+
+  card_router router{std::make_shared<const bank_routes>(Prefix_routes{prefixes}, to_sinks)};
+  std::thread router_thread{&card_router::run, &router};
+
+  // Built beforehand: building is the reloader's business, and what is
+  // measured here is whether the traffic notices the swap
+  const std::shared_ptr<const bank_routes> others[]{
+    std::make_shared<const bank_routes>(Prefix_routes{make_prefixes(prefixes.size(), 100)}, to_sinks),
+    std::make_shared<const bank_routes>(Prefix_routes{make_prefixes(prefixes.size(), 101)}, to_sinks)};
+  std::atomic<bool> stop{false};
+  std::thread reloader;
+  if (reload_every)
+    reloader = std::thread{[&] {
+      for (std::size_t i{0}; !stop.load(std::memory_order_relaxed); ++i) {
+        router.reload(others[i % 2]);
+        std::this_thread::sleep_for(*reload_every);
+      }
+    }};
+
+  auto to_router{router.get_sender()};
+  const auto start{bench::Clock::now()};
+  for (const auto& c : cards)
+    to_router.send(withdraw(c, Accounting::Money::major(20), Messaging::Sender{}));
+  while (delivered.load(std::memory_order_relaxed) + router.unrouted_count() < cards.size())
+    std::this_thread::yield();
+  const auto elapsed{bench::ns_since(start)};
+  stop.store(true);
+  if (reloader.joinable())
+    reloader.join();
+  router.done();
+  router_thread.join();
+  for (auto& s : to_sinks)
+    s.send(Messaging::Close_queue());
+  for (auto& t : sink_threads)
+    t.join();
+  return {bench::mops(cards.size(), elapsed) * 1e3, router.reload_count()};
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t prefix_count{argc > 1 ? std::stoul(argv[1]) : 100'000};
+  const std::size_t n{argc > 2 ? std::stoul(argv[2]) : 10'000'000};
+  const std::size_t messages{argc > 3 ? std::stoul(argv[3]) : 1'000'000};
+
+  const auto prefixes{make_prefixes(prefix_count, 1)};
+  const auto build_start{bench::Clock::now()};
+  const Prefix_routes table{prefixes};
+  const auto build_ns{bench::ns_since(build_start)};
+  const Hashed_prefixes hashed{prefixes};
+  std::printf("%zu prefixes -> %zu ranges, %zu KiB, built in %.1f ms\n", table.size(),
+              table.ranges(), table.bytes() / 1024, static_cast<double>(build_ns) / 1e6);
+
+  std::printf("\n%zu lookups\n%-8s %16s %16s\n", n, "cards", "Prefix_routes M/s", "hash probes M/s");
+  for (const auto& [name, distinct] : {std::pair{"all", std::size_t{0}},
+                                       std::pair{"hot", std::size_t{1'000}}}) {
+    const auto cards{make_cards(n, distinct, 2)};
+    std::uint64_t a{0}, b{0};
+    const auto fast{lookups(table, cards, a)};
+    const auto slow{lookups(hashed, cards, b)};
+    std::printf("%-8s %16.1f %16.1f%s\n", name, fast, slow, a == b ? "" : "  MISMATCH");
+  }
+
+  const auto cards{make_cards(messages, 0, 3)};
+  std::printf("\ncard_router, %zu withdrawals to %u banks\n%-20s %12s %10s\n",
+              messages, banks, "", "kmsg/s", "reloads");
+  for (const auto& [name, every] :
+       {std::pair{"steady", std::optional<std::chrono::microseconds>{}},
+        std::pair{"reload every 1 ms", std::optional{std::chrono::microseconds{1'000}}}}) {
+    const auto [rate, reloads]{route_withdrawals(prefixes, cards, every)};
+    std::printf("%-20s %12.1f %10llu\n", name, rate, static_cast<unsigned long long>(reloads));
+  }
+  return 0;
+}
@@ -0,0 +1,104 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "pos/Catalog.hpp"
+
+//------------------------------------------------------------------------------
+
+// Barcode lookups in a big catalog (10M products by default): building the
+// perfect-hash index, opening the saved index by mapping it, and random
+// lookups against the built index, the mapped one (first touch, then warm)
+// and a std::unordered_map from barcode to product, for comparison.
+
+template<class Find>
+std::uint64_t lookups(const std::vector<std::uint64_t>& codes, Find&& find)
+{
+  std::uint64_t found{0};
+  for (const auto code : codes)
+    found += find(code) != nullptr;
+  return found;
+}
+
+template<class Find>
+void row(const char* name, const std::vector<std::uint64_t>& codes, Find&& find)
+{
+  const auto start{bench::Clock::now()};
+  const auto found{lookups(codes, find)};
+  const auto elapsed{bench::ns_since(start)};
+  std::printf("%-28s %10.1f %12.2f %10llu\n", name,
+              static_cast<double>(elapsed) / static_cast<double>(codes.size()),
+              bench::mops(codes.size(), elapsed), static_cast<unsigned long long>(found));
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 10'000'000};
+  const std::string path{argc > 2 ? argv[2] : "cashbox_catalog.idx"};
+  const std::size_t probes{argc > 3 ? std::stoul(argv[3]) : 2'000'000};
+
+  auto start{bench::Clock::now()};
+  const auto products{Pos::synthetic_catalog(n)};
+  std::printf("products: %zu, generated in %.0f ms\n", n,
+              static_cast<double>(bench::ns_since(start)) / 1e6);
+
+  start = bench::Clock::now();
+  auto built{Pos::Catalog::build(products)};
+  std::printf("index built in %.0f ms, %.1f bytes/product (%.2f for the hash)\n",
+              static_cast<double>(bench::ns_since(start)) / 1e6,
+              static_cast<double>(built.bytes()) / static_cast<double>(n),
+              static_cast<double>(built.bytes() - n * sizeof(Pos::Product))
+                / static_cast<double>(n));
+  built.save(path);
+  built = Pos::Catalog{};
+
+  start = bench::Clock::now();
+  const auto mapped{Pos::Catalog::open(path)};
+  std::printf("index opened (mapped) in %.3f ms\n",
+              static_cast<double>(bench::ns_since(start)) / 1e6);
+
+  std::mt19937_64 rng{7};
+  std::vector<std::uint64_t> hits(probes);
+  std::vector<std::uint64_t> misses(probes);
+  for (auto& code : hits)
+    code = products[rng() % n].barcode;
+  for (auto& code : misses)
+    code = Pos::ean13(rng() % 1'000'000'000'000) + 1;   // Bad check digit
+
+  std::printf("%-28s %10s %12s %10s\n", "case", "ns/lookup", "Mlookups/s", "found");
+  row("mapped, first touch", hits, [&](std::uint64_t c) { return mapped.find(c); });
+  row("mapped, warm", hits, [&](std::uint64_t c) { return mapped.find(c); });
+  row("mapped, unknown codes", misses, [&](std::uint64_t c) { return mapped.find(c); });
+
+  std::vector<std::uint64_t> samples;
+  samples.reserve(100'000);
+  for (std::size_t i{0}; i < 100'000; ++i) {
+    const auto code{hits[i]};
+    const auto t{bench::Clock::now()};
+    bench::do_not_optimize(mapped.find(code));
+    samples.push_back(bench::ns_since(t));
+  }
+
+  {
+    std::unordered_map<std::uint64_t, const Pos::Product*> map;
+    map.reserve(n);
+    for (const auto& p : mapped.products())
+      map.emplace(p.barcode, &p);
+    row("unordered_map", hits, [&](std::uint64_t c) {
+      const auto it{map.find(c)};
+      return it == map.end() ? nullptr : it->second;
+    });
+  }
+
+  std::printf("\nsingle lookups, mapped and warm (clock overhead included)\n");
+  bench::print_latency_header();
+  bench::print_latency_row("find", bench::summarize(samples));
+  std::remove(path.c_str());
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include "Bench_util.hpp"
+#include "library/core/Messaging.hpp"
+
+#include <random>
+
+//------------------------------------------------------------------------------
+
+// Nine handler chain shaped like interface_machine::run, fed a skewed mix in
+// which the first registered type (tried last in chain order) dominates;
+// compares the static order with counted and adaptive dispatch. Messages are
+// queued up front, so no thread ever parks and only dispatch is measured.
+
+template<int N>
+struct msg {};
+
+//------------------------------------------------------------------------------
+
+std::uint64_t run(Messaging::Dispatch_mode mode, const std::vector<int>& kinds)
+{
+  Messaging::Receiver box;
+  box.set_dispatch_mode(mode);
+  Messaging::Sender to_box{box};
+  for (const auto k : kinds)
+    switch (k) {
+    case 0: to_box.send(msg<0>{}); break;
+    case 1: to_box.send(msg<1>{}); break;
+    case 2: to_box.send(msg<2>{}); break;
+    case 3: to_box.send(msg<3>{}); break;
+    case 4: to_box.send(msg<4>{}); break;
+    case 5: to_box.send(msg<5>{}); break;
+    case 6: to_box.send(msg<6>{}); break;
+    case 7: to_box.send(msg<7>{}); break;
+    default: to_box.send(msg<8>{}); break;
+    }
+  to_box.send(Messaging::Close_queue{});
+
+  std::uint64_t sum{0};
+  const auto start{bench::Clock::now()};
+  try {
+    for (;;)
+      box.wait()
+        .handle<msg<0>>([&](const msg<0>&) { sum += 1; })
+        .handle<msg<1>>([&](const msg<1>&) { sum += 2; })
+        .handle<msg<2>>([&](const msg<2>&) { sum += 3; })
+        .handle<msg<3>>([&](const msg<3>&) { sum += 4; })
+        .handle<msg<4>>([&](const msg<4>&) { sum += 5; })
+        .handle<msg<5>>([&](const msg<5>&) { sum += 6; })
+        .handle<msg<6>>([&](const msg<6>&) { sum += 7; })
+        .handle<msg<7>>([&](const msg<7>&) { sum += 8; })
+        .handle<msg<8>>([&](const msg<8>&) { sum += 9; });
+  }
+  catch (const Messaging::Close_queue&) {
+  }
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(sum);
+  return elapsed;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 2'000'000};
+
+  std::mt19937 gen{42};
+  std::discrete_distribution<int> skew{80, 4, 4, 2, 2, 2, 2, 2, 2};
+  std::vector<int> kinds(n);
+  for (auto& k : kinds)
+    k = skew(gen);
+
+  std::printf("messages: %zu, 80%% of them the first registered type\n", n);
+  std::printf("%-12s %12s %10s\n", "mode", "ns/message", "Mmsg/s");
+  for (const auto& [name, mode] : {std::pair{"fixed", Messaging::Dispatch_mode::fixed},
+                                   std::pair{"counted", Messaging::Dispatch_mode::counted},
+                                   std::pair{"adaptive", Messaging::Dispatch_mode::adaptive}}) {
+    const auto elapsed{run(mode, kinds)};
+    std::printf("%-12s %12.1f %10.2f\n", name,
+                static_cast<double>(elapsed) / static_cast<double>(n), bench::mops(n, elapsed));
+  }
+  return 0;
+}
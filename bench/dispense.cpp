@@ -0,0 +1,77 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "library/core/Dispense.hpp"
+
+//------------------------------------------------------------------------------
+
+// Note-dispensing decisions for random amounts (multiples of 10 up to 1000)
+// against random cassette stocks of 100 / 50 / 20 / 10 notes, some of them
+// nearly empty. Compares:
+//   table      - fewest notes, compile-time table, search when stock runs out;
+//   search     - fewest notes, always searching the stock;
+//   wear       - fullest cassettes first (always a search).
+
+using Accounting::Dispense_policy;
+using Accounting::Money;
+using Accounting::Note_dispenser;
+
+enum class Mode { table, search, wear };
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t decisions{argc > 1 ? std::stoul(argv[1]) : 2'000'000};
+  const std::size_t stocks{argc > 2 ? std::stoul(argv[2]) : 1'024};
+
+  std::mt19937_64 rng{42};
+  std::uniform_int_distribution<std::uint32_t> count{0, 60};
+  std::uniform_int_distribution<std::int64_t> tens{1, 100};
+
+  std::vector<Note_dispenser> base;
+  base.reserve(stocks);
+  for (std::size_t i{0}; i < stocks; ++i)
+    base.push_back({{Money::major(100), count(rng)}, {Money::major(50), count(rng)},
+                    {Money::major(20), count(rng)}, {Money::major(10), count(rng)}});
+  std::vector<Money> amounts(decisions);
+  for (auto& a : amounts)
+    a = Money::major(10 * tens(rng));
+
+  std::printf("decisions: %zu over %zu stocks\n", decisions, stocks);
+  std::printf("%-8s %10s %12s %12s %10s\n", "mode", "ns/dec", "Mdec/s", "table hits", "rejected");
+  for (const auto& [name, mode] : {std::pair{"table", Mode::table},
+                                   std::pair{"search", Mode::search},
+                                   std::pair{"wear", Mode::wear}}) {
+    auto dispensers{base};
+    if (mode != Mode::table)
+      for (auto& d : dispensers)
+        d.use_table(nullptr);
+    const auto policy{mode == Mode::wear ? Dispense_policy::balance_wear
+                                         : Dispense_policy::fewest_notes};
+    std::uint64_t notes{0};
+    const auto start{bench::Clock::now()};
+    for (std::size_t i{0}; i < decisions; ++i)
+      if (const auto plan{dispensers[i % stocks].plan(amounts[i], policy)})
+        notes += plan->notes();
+    const auto elapsed{bench::ns_since(start)};
+    bench::do_not_optimize(notes);
+
+    std::uint64_t hits{0};
+    std::uint64_t rejected{0};
+    for (const auto& d : dispensers) {
+      hits += d.stats().table_hits;
+      rejected += d.stats().rejected;
+    }
+    std::printf("%-8s %10.1f %12.2f %11.1f%% %9.1f%%\n", name,
+                static_cast<double>(elapsed) / static_cast<double>(decisions),
+                bench::mops(decisions, elapsed),
+                100.0 * static_cast<double>(hits) / static_cast<double>(decisions),
+                100.0 * static_cast<double>(rejected) / static_cast<double>(decisions));
+  }
+  return 0;
+}
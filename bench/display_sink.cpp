@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "library/core/Display_sink.hpp"
+
+//------------------------------------------------------------------------------
+
+// Screens of 1 to 1000 atms shown on one stream (/dev/null, so that the
+// terminal's own speed does not count): the old way, a line at a time
+// under one mutex with std::endl, against a Display_sink at 60 frames a
+// second. Up to four threads write, each for its share of the atms in
+// turn; lines per second, and writes to the stream per thousand lines.
+
+constexpr std::string_view screen_line{"Please enter your PIN (0-9)\n"};
+
+struct Result {
+  double lines_per_s;
+  double writes_per_kline;
+};
+
+template<class Write_line>
+double writing(std::size_t atms, std::size_t lines, Write_line write_line)
+{
+  const auto threads{static_cast<unsigned>(std::min<std::size_t>(atms, 4))};
+  const auto start{bench::Clock::now()};
+  {
+    std::vector<std::jthread> writers;
+    for (unsigned t{0}; t < threads; ++t)
+      writers.emplace_back([&, t] {
+        const auto mine{(atms - t + threads - 1) / threads};  // Atms t, t + threads, ...
+        for (std::size_t i{0}; i < lines / threads; ++i)
+          write_line(t + i % mine * threads);
+      });
+  }
+  return static_cast<double>(bench::ns_since(start));
+}
+
+Result with_mutex(std::size_t atms, std::size_t lines)
+{
+  std::ofstream out{"/dev/null"};
+  std::mutex iom;
+  const auto ns{writing(atms, lines, [&](std::size_t atm) {
+    std::lock_guard lk{iom};
+    if (atms > 1)
+      out << "atm " << atm << ": ";
+    out << screen_line.substr(0, screen_line.size() - 1) << std::endl;
+  })};
+  return {static_cast<double>(lines) / (ns / 1e9), 1000.0};
+}
+
+Result with_sink(std::size_t atms, std::size_t lines)
+{
+  std::ofstream out{"/dev/null"};
+  Messaging::Display_stats stats;
+  double ns;
+  {
+    Messaging::Display_sink sink{out};
+    std::vector<Messaging::Display_terminal*> terminals;
+    for (std::size_t a{0}; a < atms; ++a)
+      terminals.push_back(&sink.open(atms > 1 ? "atm " + std::to_string(a) : std::string{}));
+    ns = writing(atms, lines, [&](std::size_t atm) { terminals[atm]->write(screen_line); });
+    const auto start{bench::Clock::now()};
+    sink.flush();
+    ns += static_cast<double>(bench::ns_since(start));
+    stats = sink.stats();
+  }
+  return {static_cast<double>(lines) / (ns / 1e9),
+          static_cast<double>(stats.frames) * 1000.0 / static_cast<double>(lines)};
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t lines{argc > 1 ? std::stoul(argv[1]) : 2'000'000};
+  std::printf("%zu lines\n%-6s %16s %12s %16s %12s\n", lines, "atms", "mutex lines/s",
+              "writes/kl", "sink lines/s", "writes/kl");
+  for (const std::size_t atms : {1u, 10u, 100u, 1000u}) {
+    const auto m{with_mutex(atms, lines)};
+    const auto s{with_sink(atms, lines)};
+    std::printf("%-6zu %16.0f %12.1f %16.0f %12.2f\n", atms, m.lines_per_s, m.writes_per_kline,
+                s.lines_per_s, s.writes_per_kline);
+  }
+  return 0;
+}
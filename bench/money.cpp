@@ -0,0 +1,73 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "library/core/Money.hpp"
+
+//------------------------------------------------------------------------------
+
+// What overflow checking costs on the hot paths of reconciliation: totals
+// over a day's amounts (in cents) and comparing two ledgers. Compares:
+//   int64 unchecked   - plain += over the minor units (wraps silently);
+//   Money checked     - Money += per amount (overflow and currency checks);
+//   checked_sum       - batch sum in vector lanes, overflow flagged per lane;
+//   scalar compare    - first mismatch of two equal ledgers, one at a time;
+//   first_difference  - the same, a block of lanes at a time.
+
+template<class F>
+void row(const char* name, std::size_t n, F&& f)
+{
+  const auto start{bench::Clock::now()};
+  const auto result{f()};
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(result);
+  std::printf("%-20s %10.3f %12.1f %22lld\n", name,
+              static_cast<double>(elapsed) / static_cast<double>(n),
+              bench::mops(n, elapsed), static_cast<long long>(result));
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 100'000'000};
+
+  std::vector<std::int64_t> amounts(n);
+  std::mt19937_64 rng{42};
+  std::uniform_int_distribution<std::int64_t> cents{1, 1'000'000};
+  for (auto& a : amounts)
+    a = cents(rng);
+  const std::vector<std::int64_t> copy{amounts};
+
+  std::printf("amounts: %zu\n", n);
+  std::printf("%-20s %10s %12s %22s\n", "case", "ns/amount", "Mamounts/s", "result");
+
+  row("int64 unchecked", n, [&] {
+    std::int64_t total{0};
+    for (const auto a : amounts)
+      total += a;
+    return total;
+  });
+  row("Money checked", n, [&] {
+    auto total{Accounting::Money::minor(0)};
+    for (const auto a : amounts)
+      total += Accounting::Money::minor(a);
+    return total.minor_units();
+  });
+  row("checked_sum", n, [&] {
+    return Accounting::checked_sum(amounts).value_or(-1);
+  });
+  row("scalar compare", n, [&] {
+    std::size_t i{0};
+    while (i < n && amounts[i] == copy[i])
+      ++i;
+    return static_cast<std::int64_t>(i);
+  });
+  row("first_difference", n, [&] {
+    return static_cast<std::int64_t>(Accounting::first_difference(amounts, copy));
+  });
+  return 0;
+}
@@ -0,0 +1,169 @@
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Bank_machine.hpp"
+#include "atm/Pin_verifier.hpp"
+#include "library/core/Pin_store.hpp"
+
+//------------------------------------------------------------------------------
+
+// PIN verification under load. First a pin_verifier alone, with 1k, 10k
+// and 100k sessions each keeping one check in flight (one in ten with a
+// wrong PIN) for a number of rounds: verifications per second and the
+// latency of a check, taking batches as they come and one check at a
+// time. Then what a stream of PIN checks from 1000 sessions does to the
+// withdraw round trips of another client of the bank, hashing on the
+// bank's thread and on a pin_verifier. The cost of a hash is linear in
+// the iterations, which default lower here than Pin_store's so that the
+// 100k case takes seconds rather than minutes.
+
+using Accounting::Pin_store;
+
+std::shared_ptr<const Pin_store> session_pins(std::size_t sessions, std::uint32_t iterations)
+{
+  const auto record{Pin_store::make_record("1937", iterations)};
+  std::vector<std::pair<std::string, Accounting::Pin_record>> records;
+  records.reserve(sessions);
+  for (std::size_t i{0}; i < sessions; ++i)
+    records.emplace_back("s" + std::to_string(i), record);
+  return std::make_shared<const Pin_store>(std::move(records), iterations);
+}
+
+void verifier_alone(std::shared_ptr<const Pin_store> pins, std::size_t sessions, std::size_t rounds,
+                    unsigned workers, std::size_t max_batch)
+{
+  pin_verifier verifier{pins, workers, max_batch};
+  std::thread verifier_thread{&pin_verifier::run, &verifier};
+  Messaging::Receiver replies;
+  auto to_verifier{verifier.get_sender()};
+  std::vector<bench::Clock::time_point> sent(sessions);
+  const auto check{[&](std::size_t s) {
+    sent[s] = bench::Clock::now();
+    to_verifier.send(check_pin("s" + std::to_string(s), s % 10 ? "1937" : "0000",
+                               Messaging::Sender{}, replies));
+  }};
+
+  const auto total{sessions * rounds};
+  std::vector<std::uint64_t> latencies;
+  latencies.reserve(total);
+  std::size_t issued{0};
+  std::size_t wrong{0};
+  const auto start{bench::Clock::now()};
+  for (; issued < sessions; ++issued)
+    check(issued);
+  while (latencies.size() < total) {
+    replies.wait().handle<pin_checked>([&](const pin_checked& msg) {
+      std::size_t s{0};
+      std::from_chars(msg.account.data() + 1, msg.account.data() + msg.account.size(), s);
+      latencies.push_back(bench::ns_since(sent[s]));
+      wrong += msg.correct != (s % 10 != 0);
+      if (issued < total) {
+        check(s);
+        ++issued;
+      }
+    });
+  }
+  const auto elapsed{bench::ns_since(start)};
+  verifier.done();
+  verifier_thread.join();
+
+  const auto lat{bench::summarize(latencies)};
+  std::printf("%-10zu %-8zu %12.0f %10.1f %12.2f %12.2f %8zu\n", sessions, max_batch,
+              bench::mops(total, elapsed) * 1e6,
+              static_cast<double>(verifier.checks()) / static_cast<double>(verifier.batches()),
+              static_cast<double>(lat.p50_ns) / 1e6, static_cast<double>(lat.p99_ns) / 1e6, wrong);
+}
+
+// Withdraw round trips from one client while sessions PIN checks are
+// kept in flight through the same bank
+bench::Latency_summary withdraws_during_checks(std::uint32_t iterations, bool with_verifier,
+                                               unsigned workers, std::size_t withdraws)
+{
+  constexpr std::size_t sessions{1'000};
+  const std::pair<std::string, std::string> pins[]{{"acc1234", "1937"}};
+  bank_machine bank{Accounting::Money::major(1'000'000'000), default_accounts(),
+                    std::make_shared<const Pin_store>(pins, iterations)};
+  std::optional<pin_verifier> verifier;
+  std::thread verifier_thread;
+  if (with_verifier) {
+    verifier.emplace(bank.pin_store(), workers);
+    bank.use_pin_verifier(verifier->get_sender());
+    verifier_thread = std::thread{&pin_verifier::run, &*verifier};
+  }
+  std::thread bank_thread{&bank_machine::run, &bank};
+
+  std::atomic<bool> stop{false};
+  std::thread load{[&] {
+    Messaging::Receiver replies;
+    auto to_bank{bank.get_sender()};
+    for (std::size_t i{0}; i < sessions; ++i)
+      to_bank.send(verify_pin("acc1234", "1937", replies));
+    for (auto in_flight{sessions}; in_flight; --in_flight) {
+      replies.wait()
+        .handle<pin_verified>([](const pin_verified&) {})
+        .handle<pin_incorrect>([](const pin_incorrect&) {});
+      if (!stop.load(std::memory_order_relaxed)) {
+        to_bank.send(verify_pin("acc1234", "1937", replies));
+        ++in_flight;
+      }
+    }
+  }};
+
+  Messaging::Receiver incoming;
+  auto to_bank{bank.get_sender()};
+  std::vector<std::uint64_t> latencies;
+  for (std::size_t i{0}; i < withdraws; ++i) {
+    const auto start{bench::Clock::now()};
+    to_bank.send(withdraw("acc1234", Accounting::Money::major(1), incoming));
+    incoming.wait()
+      .handle<withdraw_ok>([](const withdraw_ok&) {})
+      .handle<withdraw_denied>([](const withdraw_denied&) {});
+    latencies.push_back(bench::ns_since(start));
+  }
+  stop.store(true, std::memory_order_relaxed);
+  load.join();
+  bank.done();
+  bank_thread.join();
+  if (verifier) {
+    verifier->done();
+    verifier_thread.join();
+  }
+  return bench::summarize(latencies);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::uint32_t iterations{argc > 1 ? static_cast<std::uint32_t>(std::stoul(argv[1])) : 256};
+  const std::size_t rounds{argc > 2 ? std::stoul(argv[2]) : 2};
+  const unsigned workers{argc > 3 ? static_cast<unsigned>(std::stoul(argv[3]))
+                                  : std::max(1u, std::thread::hardware_concurrency())};
+
+  std::printf("pin_verifier alone: %u iterations, %u workers, %zu rounds per session\n",
+              iterations, workers, rounds);
+  std::printf("%-10s %-8s %12s %10s %12s %12s %8s\n",
+              "sessions", "batch", "checks/s", "mean batch", "p50 ms", "p99 ms", "wrong");
+  for (const std::size_t sessions : {1'000u, 10'000u, 100'000u}) {
+    const auto pins{session_pins(sessions, iterations)};
+    for (const std::size_t max_batch : {std::size_t{1}, pin_verifier::default_max_batch})
+      verifier_alone(pins, sessions, rounds, workers, max_batch);
+  }
+
+  const std::size_t withdraws{200};
+  std::printf("\nwithdraw round trips during PIN checks from 1000 sessions, %zu each\n", withdraws);
+  bench::print_latency_header();
+  bench::print_latency_row("hashing on the bank's thread",
+                           withdraws_during_checks(iterations, false, workers, withdraws));
+  bench::print_latency_row("hashing on a pin_verifier",
+                           withdraws_during_checks(iterations, true, workers, withdraws));
+  return 0;
+}
@@ -0,0 +1,30 @@
+#include "Ping_pong.hpp"
+
+//------------------------------------------------------------------------------
+
+// Round trips with the two actor threads left to the scheduler, pinned,
+// and pinned plus spinning before they park
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 100'000};
+  const auto cpus{std::max(1U, std::thread::hardware_concurrency())};
+  const int client_cpu{0};
+  const int server_cpu{static_cast<int>(1 % cpus)};
+  const Messaging::Wait_policy spin{Messaging::Wait_strategy::spin};
+
+  Messaging::Actor_placement free_client, free_server;
+  Messaging::Actor_placement pinned_client{client_cpu, {}, {}};
+  Messaging::Actor_placement pinned_server{server_cpu, {}, {}};
+  Messaging::Actor_placement spin_client{client_cpu, {}, spin};
+  Messaging::Actor_placement spin_server{server_cpu, {}, spin};
+
+  std::printf("ping-pong round trips: %zu, cpus: %u\n", n, cpus);
+  if (cpus < 2)
+    std::printf("note: both actors share one cpu, spinning only steals its time slice\n");
+  bench::print_latency_header();
+  bench::print_latency_row("unpinned, park", bench::round_trips(free_client, free_server, n));
+  bench::print_latency_row("pinned, park", bench::round_trips(pinned_client, pinned_server, n));
+  bench::print_latency_row("pinned, spin-then-park", bench::round_trips(spin_client, spin_server, n));
+  return 0;
+}
@@ -0,0 +1,160 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "pos/Promotion_engine.hpp"
+#include "pos/Promotions.hpp"
+
+//------------------------------------------------------------------------------
+
+// Promotion evaluation for baskets of 25 scans against 100k rules (70%
+// buy-x-get-y, 25% bundles of 2 to 4 products, 5% percentages off a
+// category) over a 1M product catalog; half the scans are of products with
+// rules. Compares:
+//   incremental - Promotion_basket::add(), only the rules of the product
+//                 and its category;
+//   all rules   - every rule again after each scan (fewer scans);
+//   engine      - the incremental way behind a Promotion_engine actor,
+//                 a checkout per basket, until the last answer is back.
+// Checked baskets compare add() with evaluating every rule at checkout.
+
+constexpr std::size_t basket_size{25};
+
+std::vector<Pos::Promotion_rule> make_rules(const std::vector<Pos::Product>& products,
+                                            std::size_t n, std::mt19937_64& rng,
+                                            std::vector<std::uint32_t>& with_rules)
+{
+  std::vector<Pos::Promotion_rule> res;
+  res.reserve(n);
+  std::vector<bool> used(products.size());
+  const auto pick{[&] {
+    for (;;) {
+      const auto i{static_cast<std::uint32_t>(rng() % products.size())};
+      if (!used[i]) {
+        used[i] = true;
+        with_rules.push_back(i);
+        return i;
+      }
+    }
+  }};
+  for (std::size_t r{0}; r < n; ++r) {
+    const auto kind{r % 20};
+    if (kind < 14)
+      res.push_back(Pos::Promotion_rule::buy_x_get_y(
+        products[pick()].barcode, 1 + static_cast<std::uint32_t>(rng() % 3), 1));
+    else if (kind < 19) {
+      std::vector<Pos::Promotion_item> items;
+      std::int64_t full{0};
+      for (auto k{2 + rng() % 3}; k > 0; --k) {
+        const auto& p{products[pick()]};
+        items.push_back({p.barcode, 1});
+        full += p.price;
+      }
+      res.push_back(Pos::Promotion_rule::bundle(full * 9 / 10, std::move(items)));
+    }
+    else
+      res.push_back(Pos::Promotion_rule::percent_off(
+        static_cast<std::uint16_t>(rng() % Pos::synthetic_categories),
+        500 + static_cast<std::uint32_t>(rng() % 2'000)));
+  }
+  return res;
+}
+
+void row(const char* name, std::size_t scans, std::uint64_t elapsed, std::uint64_t evaluations)
+{
+  std::printf("%-14s %10zu %12.1f %12.0f %12.1f\n", name, scans,
+              static_cast<double>(elapsed) / static_cast<double>(scans),
+              static_cast<double>(scans) * 1e9 / static_cast<double>(elapsed),
+              static_cast<double>(evaluations) / static_cast<double>(scans));
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n_products{argc > 1 ? std::stoul(argv[1]) : 1'000'000};
+  const std::size_t n_rules{argc > 2 ? std::stoul(argv[2]) : 100'000};
+  const std::size_t scans{argc > 3 ? std::stoul(argv[3]) : 1'000'000};
+
+  std::mt19937_64 rng{11};
+  const auto products{Pos::synthetic_catalog(n_products)};
+  const auto catalog{Pos::Catalog::build(products)};
+  std::vector<std::uint32_t> with_rules;
+  const auto rules{make_rules(products, n_rules, rng, with_rules)};
+
+  auto start{bench::Clock::now()};
+  const Pos::Promotion_table table{catalog, rules};
+  std::printf("%zu rules over %zu products compiled in %.1f ms, %.1f MB\n", table.size(),
+              n_products, static_cast<double>(bench::ns_since(start)) / 1e6,
+              static_cast<double>(table.bytes()) / 1e6);
+
+  std::vector<const Pos::Product*> scanned(scans);
+  for (auto& p : scanned)
+    p = catalog.find(products[rng() % 2 ? with_rules[rng() % with_rules.size()]
+                                        : rng() % n_products].barcode);
+
+  std::printf("%-14s %10s %12s %12s %12s\n", "case", "scans", "ns/scan", "scans/s", "rules/scan");
+  {
+    Pos::Promotion_basket basket{table};
+    start = bench::Clock::now();
+    for (std::size_t i{0}; i < scans; ++i) {
+      basket.add(*scanned[i], 1);
+      if (i % basket_size == basket_size - 1) {
+        bench::do_not_optimize(basket.total());
+        basket.clear();
+      }
+    }
+    row("incremental", scans, bench::ns_since(start), basket.evaluations());
+  }
+  {
+    const auto few{std::min<std::size_t>(scans, 2'000)};
+    Pos::Promotion_basket basket{table};
+    start = bench::Clock::now();
+    for (std::size_t i{0}; i < few; ++i) {
+      basket.add(*scanned[i], 1);
+      bench::do_not_optimize(basket.evaluate_all());
+      if (i % basket_size == basket_size - 1)
+        basket.clear();
+    }
+    row("all rules", few, bench::ns_since(start), few * table.size());
+  }
+  {
+    Pos::Promotion_engine engine{table};
+    std::thread engine_thread{&Pos::Promotion_engine::run, &engine};
+    Messaging::Receiver replies;
+    auto to_engine{engine.get_sender()};
+    std::uint64_t finals{0};
+    start = bench::Clock::now();
+    for (std::size_t i{0}; i < scans; ++i) {
+      const auto b{i / basket_size};
+      to_engine.send(Pos::promotion_scan{replies, b, scanned[i], 1});
+      if (i % basket_size == basket_size - 1)
+        to_engine.send(Pos::promotion_checkout{replies, b});
+    }
+    while (finals < scans / basket_size)
+      replies.wait()
+        .handle<Pos::promotions_changed>([&](const Pos::promotions_changed&) {})
+        .handle<Pos::promotions_final>([&](const Pos::promotions_final&) { ++finals; });
+    const auto elapsed{bench::ns_since(start)};
+    engine.done();
+    engine_thread.join();
+    row("engine", scans, elapsed, engine.stats().evaluations);
+  }
+
+  std::size_t mismatches{0};
+  const std::size_t checked{std::min<std::size_t>(scans / basket_size, 1'000)};
+  Pos::Promotion_basket basket{table};
+  for (std::size_t b{0}; b < checked; ++b) {
+    basket.clear();
+    for (std::size_t i{b * basket_size}; i < (b + 1) * basket_size; ++i)
+      basket.add(*scanned[i], rng() % 4 ? 1 : 2);
+    basket.add(*scanned[b * basket_size], -1);      // A void
+    mismatches += basket.evaluate_all() != basket.by_class();
+  }
+  std::printf("checked baskets: %zu, mismatches: %zu\n", checked, mismatches);
+  return 0;
+}
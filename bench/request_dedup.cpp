@@ -0,0 +1,114 @@
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Bank_machine.hpp"
+#include "library/core/Request_cache.hpp"
+
+//------------------------------------------------------------------------------
+
+// Withdrawal deduplication. First the Request_cache alone, tracking 1M
+// ids: the find-then-insert a bank does per request, for new ids only and
+// with one request in ten a duplicate of a recent one, and its memory per
+// million tracked ids. Then a bank taking pipelined withdrawals without
+// ids and with them, each sent once and each sent twice, checking that
+// the duplicates debit nothing.
+
+using Messaging::Request_cache;
+
+//------------------------------------------------------------------------------
+
+// Ns per request of n requests arriving at capacity per window, so that
+// the cache is just big enough; one in dup_every (if not 0) repeats an id
+// among the last thousand
+double cache_alone(std::size_t capacity, std::uint32_t window, std::size_t n,
+                   std::size_t dup_every, std::uint64_t& checksum)
+{
+  Request_cache<std::uint8_t> cache{capacity, window};
+  const auto per_tick{capacity / window};
+  std::mt19937_64 rng{1};
+  std::vector<std::uint64_t> ids(n);
+  std::uint64_t next{0};
+  for (std::size_t i{0}; i < n; ++i)
+    ids[i] = dup_every && i > 1'000 && i % dup_every == 0 ? ids[i - 1 - rng() % 1'000] : ++next;
+
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto now{static_cast<std::uint32_t>(i / per_tick)};
+    if (const auto* seen{cache.find(ids[i])})
+      checksum += *seen;
+    else
+      cache.insert(ids[i], static_cast<std::uint8_t>(i), now);
+  }
+  const auto elapsed{bench::ns_since(start)};
+  const auto& s{cache.stats()};
+  std::printf("  %llu hits, %llu evictions, %llu early\n",
+              static_cast<unsigned long long>(s.hits), static_cast<unsigned long long>(s.evictions),
+              static_cast<unsigned long long>(s.early_evictions));
+  return static_cast<double>(elapsed) / static_cast<double>(n);
+}
+
+// Ns per withdrawal through a bank, n of them in flight at once, each
+// sent copies times; with_ids false sends them without ids
+double bank_withdrawals(std::size_t n, bool with_ids, std::size_t copies)
+{
+  const auto amount{Accounting::Money::major(1)};
+  const auto initial{Accounting::Money::major(1'000'000'000)};
+  bank_machine bank{initial};
+  bank.track_withdrawals({n, 60}, [] { return std::uint64_t{0}; });
+  std::thread bank_thread{&bank_machine::run, &bank};
+  Messaging::Receiver replies;
+  auto to_bank{bank.get_sender()};
+
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i)
+    for (std::size_t c{0}; c < copies; ++c)
+      to_bank.send(withdraw("acc1234", amount, replies, with_ids ? i + 1 : 0));
+  std::size_t denied{0};
+  for (std::size_t i{0}; i < n * copies; ++i)
+    replies.wait()
+      .handle<withdraw_ok>([](const withdraw_ok&) {})
+      .handle<withdraw_denied>([&](const withdraw_denied&) { ++denied; });
+  const auto elapsed{bench::ns_since(start)};
+  bank.done();
+  bank_thread.join();
+
+  const auto debited{(initial - bank.current_balance()).minor_units() / amount.minor_units()};
+  const auto expected{static_cast<std::int64_t>(with_ids ? n : n * copies)};
+  if (denied || debited != expected)
+    std::printf("  WRONG: %zu denied, %lld debited\n", denied, static_cast<long long>(debited));
+  return static_cast<double>(elapsed) / static_cast<double>(n * copies);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t tracked{argc > 1 ? std::stoul(argv[1]) : 1'000'000};
+  const std::size_t n{argc > 2 ? std::stoul(argv[2]) : 20'000'000};
+  const std::size_t withdrawals{argc > 3 ? std::stoul(argv[3]) : 1'000'000};
+  constexpr std::uint32_t window{100};
+
+  const Request_cache<withdrawal_record> sized{tracked, window};
+  std::printf("Request_cache tracking %zu ids: %.1f MiB, %.1f bytes per id\n", tracked,
+              static_cast<double>(sized.bytes()) / (1 << 20),
+              static_cast<double>(sized.bytes()) / static_cast<double>(tracked));
+
+  std::printf("\n%zu requests, a window of %u ticks\n", n, window);
+  std::uint64_t checksum{0};
+  const auto fresh{cache_alone(tracked, window, n, 0, checksum)};
+  std::printf("%-24s %8.1f ns/request\n", "new ids", fresh);
+  const auto dups{cache_alone(tracked, window, n, 10, checksum)};
+  std::printf("%-24s %8.1f ns/request\n", "1 in 10 a duplicate", dups);
+  bench::do_not_optimize(checksum);
+
+  std::printf("\nbank, %zu withdrawals in flight\n%-24s %12s\n", withdrawals, "", "ns/request");
+  std::printf("%-24s %12.1f\n", "no ids", bank_withdrawals(withdrawals, false, 1));
+  std::printf("%-24s %12.1f\n", "ids", bank_withdrawals(withdrawals, true, 1));
+  std::printf("%-24s %12.1f\n", "ids, each sent twice", bank_withdrawals(withdrawals, true, 2));
+  return 0;
+}
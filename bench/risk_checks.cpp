@@ -0,0 +1,122 @@
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Bench_util.hpp"
+#include "atm/Bank_machine.hpp"
+#include "library/core/Risk.hpp"
+
+//------------------------------------------------------------------------------
+
+// Cost of the bank's risk checks. First the checks alone on random
+// accounts, with time moving on a second every thousand requests: 80%
+// withdrawals (check and, if allowed, record), 20% PIN checks, one in ten
+// of them wrong. Then what they add to a withdraw round trip through a
+// bank_machine with 1000 accounts, against the same bank without them.
+
+using Accounting::Money;
+
+struct Request {
+  std::uint32_t account;
+  bool pin;
+  bool right;
+  Money amount;
+};
+
+std::vector<Request> make_requests(std::size_t n, std::size_t accounts, std::uint64_t seed)
+{
+  std::mt19937_64 rng{seed};
+  std::vector<Request> res(n);
+  for (auto& r : res) {
+    r.account = static_cast<std::uint32_t>(rng() % accounts);
+    r.pin = rng() % 5 == 0;
+    r.right = rng() % 10 != 0;
+    r.amount = Money::major(static_cast<std::int64_t>(10 * (1 + rng() % 20)));
+  }
+  return res;
+}
+
+void direct(std::size_t accounts, std::size_t n)
+{
+  const auto requests{make_requests(n, accounts, 3)};
+  Accounting::Risk_checks risk{accounts};
+  std::uint64_t allowed{0};
+  const auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto& r{requests[i]};
+    const auto now{i / 1'000};
+    if (r.pin) {
+      if (!risk.pin_allowed(r.account, now))
+        continue;
+      if (r.right)
+        risk.record_pin_success(r.account);
+      else
+        risk.record_pin_failure(r.account, now);
+    }
+    else if (risk.check_withdrawal(r.account, r.amount, now) == Accounting::Risk_verdict::allow) {
+      risk.record_withdrawal(r.account, r.amount, now);
+      ++allowed;
+    }
+  }
+  const auto elapsed{bench::ns_since(start)};
+  const auto s{risk.stats()};
+  std::printf("%-10zu %10.1f %10.1f %10llu %10llu %10llu %10llu\n", accounts,
+              static_cast<double>(elapsed) / static_cast<double>(n), bench::mops(n, elapsed),
+              static_cast<unsigned long long>(allowed),
+              static_cast<unsigned long long>(s.over_count + s.over_amount),
+              static_cast<unsigned long long>(s.locked),
+              static_cast<unsigned long long>(s.lockouts));
+}
+
+double bank_round_trip(bool with_risk, std::size_t n)
+{
+  std::vector<std::string> names;
+  for (std::size_t i{0}; i < 1'000; ++i)
+    names.push_back("acc" + std::to_string(i));
+  bank_machine bank{Money::major(1'000'000'000), names};
+  std::atomic<std::uint64_t> ticks{0};
+  if (with_risk)
+    bank.use_risk_checks({Money::major(1'000'000'000), 60'000},
+                         [&] { return ticks.load(std::memory_order_relaxed) / 1'000; });
+  std::thread bank_thread{&bank_machine::run, &bank};
+  const auto requests{make_requests(n, names.size(), 5)};
+  Messaging::Receiver incoming;
+  auto to_bank{bank.get_sender()};
+  const auto start{bench::Clock::now()};
+  for (const auto& r : requests) {
+    ticks.fetch_add(1, std::memory_order_relaxed);
+    to_bank.send(withdraw(names[r.account], r.amount, incoming));
+    incoming.wait()
+      .handle<withdraw_ok>([](const withdraw_ok&) {})
+      .handle<withdraw_denied>([](const withdraw_denied&) {});
+  }
+  const auto elapsed{bench::ns_since(start)};
+  bank.done();
+  bank_thread.join();
+  return static_cast<double>(elapsed) / static_cast<double>(n);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 10'000'000};
+  const std::size_t round_trips{argc > 2 ? std::stoul(argv[2]) : 200'000};
+
+  std::printf("risk checks alone, %zu requests\n", n);
+  std::printf("%-10s %10s %10s %10s %10s %10s %10s\n",
+              "accounts", "ns/req", "Mreq/s", "allowed", "over", "locked", "lockouts");
+  for (const std::size_t accounts : {1'000u, 100'000u, 1'000'000u, 10'000'000u})
+    direct(accounts, n);
+
+  std::printf("\nwithdraw round trips through bank_machine, %zu each\n", round_trips);
+  const auto without{bank_round_trip(false, round_trips)};
+  const auto with{bank_round_trip(true, round_trips)};
+  std::printf("without risk checks %10.0f ns\nwith risk checks    %10.0f ns (%+.0f ns)\n",
+              without, with, with - without);
+  return 0;
+}
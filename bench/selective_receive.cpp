@@ -0,0 +1,91 @@
+#include "Bench_util.hpp"
+#include "library/core/Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+// An actor waiting for replies while unrelated messages keep arriving: the
+// queue holds rounds of `noise` messages followed by one reply. The actor
+// takes the replies first and only then works off the rest. Compares:
+//   discard  - wait() for the reply, dropping everything else (loses work);
+//   requeue  - wait() handling the rest by sending it back to itself;
+//   receive  - selective receive, the rest stays stashed per type.
+
+struct reply { std::uint64_t n; };
+struct other { std::uint64_t n; };
+
+enum class Mode { discard, requeue, receive };
+
+struct Result {
+  std::uint64_t elapsed_ns;
+  std::uint64_t others_handled;
+};
+
+//------------------------------------------------------------------------------
+
+Result run(Mode mode, std::size_t rounds, std::size_t noise)
+{
+  Messaging::Receiver box;
+  box.set_stash_limit(rounds * noise);
+  Messaging::Sender to_box{box};
+  for (std::size_t r{0}; r < rounds; ++r) {
+    for (std::size_t i{0}; i < noise; ++i)
+      to_box.send(other{i});
+    to_box.send(reply{r});
+  }
+
+  std::uint64_t sum{0};
+  std::uint64_t others{0};
+  const auto start{bench::Clock::now()};
+  for (std::size_t r{0}; r < rounds; ++r) {
+    bool got{false};
+    while (!got)
+      switch (mode) {
+      case Mode::discard:
+        box.wait()
+          .handle<reply>([&](const reply& msg) { sum += msg.n; got = true; });
+        break;
+      case Mode::requeue:
+        box.wait()
+          .handle<reply>([&](const reply& msg) { sum += msg.n; got = true; })
+          .handle<other>([&](const other& msg) { to_box.send(msg); });
+        break;
+      case Mode::receive:
+        box.receive()
+          .handle<reply>([&](const reply& msg) { sum += msg.n; got = true; });
+        break;
+      }
+  }
+  to_box.send(Messaging::Close_queue{});
+  try {
+    for (;;)
+      box.wait()
+        .handle<other>([&](const other& msg) { sum += msg.n; ++others; });
+  }
+  catch (const Messaging::Close_queue&) {
+  }
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(sum);
+  return {elapsed, others};
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t rounds{argc > 1 ? std::stoul(argv[1]) : 2'000};
+  const std::size_t noise{argc > 2 ? std::stoul(argv[2]) : 8};
+  const auto total{rounds * (noise + 1)};
+
+  std::printf("rounds: %zu, other messages before each reply: %zu\n", rounds, noise);
+  std::printf("%-10s %12s %10s %16s\n", "mode", "ns/message", "Mmsg/s", "others handled");
+  for (const auto& [name, mode] : {std::pair{"discard", Mode::discard},
+                                   std::pair{"requeue", Mode::requeue},
+                                   std::pair{"receive", Mode::receive}}) {
+    const auto res{run(mode, rounds, noise)};
+    std::printf("%-10s %12.1f %10.2f %16llu\n", name,
+                static_cast<double>(res.elapsed_ns) / static_cast<double>(total),
+                bench::mops(total, res.elapsed_ns),
+                static_cast<unsigned long long>(res.others_handled));
+  }
+  return 0;
+}
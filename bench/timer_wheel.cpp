@@ -0,0 +1,133 @@
+#include "Bench_util.hpp"
+#include "library/core/Timer.hpp"
+
+#include <map>
+#include <numeric>
+#include <random>
+
+//------------------------------------------------------------------------------
+
+// Schedule and cancel rates of Timer_service with many timers pending,
+// against an ordered multimap (what one would write without a wheel), and
+// how late timers fire when a burst of them expires into one receiver.
+
+using namespace std::chrono_literals;
+
+struct timeout {
+  bench::Clock::time_point due;
+};
+
+//------------------------------------------------------------------------------
+
+struct Rates {
+  std::uint64_t schedule_ns;
+  std::uint64_t cancel_ns;
+};
+
+// Delays are seconds away, so nothing fires while measuring
+Rates wheel_rates(const std::vector<bench::Clock::duration>& delays,
+                  const std::vector<std::size_t>& cancel_order)
+{
+  Messaging::Timer_service timers;
+  Messaging::Receiver box;
+  std::vector<Messaging::Timer_id> ids(delays.size());
+
+  auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < delays.size(); ++i)
+    ids[i] = timers.schedule(delays[i], box, timeout{});
+  const auto scheduled{bench::ns_since(start)};
+
+  start = bench::Clock::now();
+  std::size_t cancelled{0};
+  for (const auto i : cancel_order)
+    cancelled += timers.cancel(ids[i]);
+  const auto cancel{bench::ns_since(start)};
+  bench::do_not_optimize(cancelled);
+  return {scheduled, cancel};
+}
+
+Rates multimap_rates(const std::vector<bench::Clock::duration>& delays,
+                     const std::vector<std::size_t>& cancel_order)
+{
+  std::mutex m;
+  std::multimap<bench::Clock::time_point, std::function<void()>> timers;
+  Messaging::Receiver box;
+  std::vector<decltype(timers)::iterator> ids(delays.size());
+
+  auto start{bench::Clock::now()};
+  for (std::size_t i{0}; i < delays.size(); ++i) {
+    Messaging::Sender to{box};
+    const auto when{bench::Clock::now() + delays[i]};
+    std::lock_guard lk{m};
+    ids[i] = timers.emplace(when, [to]() mutable { to.send(timeout{}); });
+  }
+  const auto scheduled{bench::ns_since(start)};
+
+  start = bench::Clock::now();
+  for (const auto i : cancel_order) {
+    std::lock_guard lk{m};
+    timers.erase(ids[i]);
+  }
+  const auto cancel{bench::ns_since(start)};
+  return {scheduled, cancel};
+}
+
+//------------------------------------------------------------------------------
+
+// n timers spread over 100 ms; lateness is measured at the receiver
+bench::Latency_summary burst_lateness(std::size_t n, std::mt19937& gen)
+{
+  Messaging::Timer_service timers;
+  Messaging::Receiver box;
+  std::uniform_int_distribution<long> spread{0, 100'000};
+  for (std::size_t i{0}; i < n; ++i) {
+    const auto delay{std::chrono::microseconds{spread(gen)}};
+    timers.schedule(delay, box, timeout{bench::Clock::now() + delay});
+  }
+
+  std::vector<std::uint64_t> late;
+  late.reserve(n);
+  while (late.size() < n)
+    box.wait()
+      .handle<timeout>([&](const timeout& msg) {
+        const auto now{bench::Clock::now()};
+        late.push_back(now > msg.due ? static_cast<std::uint64_t>(
+          std::chrono::duration_cast<std::chrono::nanoseconds>(now - msg.due).count()) : 0);
+      });
+  return bench::summarize(late);
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 500'000};
+
+  std::mt19937 gen{42};
+  std::uniform_int_distribution<long> ms{1'000, 600'000};
+  std::vector<bench::Clock::duration> delays(n);
+  for (auto& d : delays)
+    d = std::chrono::milliseconds{ms(gen)};
+  std::vector<std::size_t> cancel_order(n);
+  std::iota(cancel_order.begin(), cancel_order.end(), std::size_t{0});
+  std::shuffle(cancel_order.begin(), cancel_order.end(), gen);
+
+  std::printf("timers pending: %zu, delays 1 s .. 10 min, cancelled in random order\n", n);
+  std::printf("%-10s %14s %14s %14s %14s\n",
+              "timers", "schedule ns", "Mschedule/s", "cancel ns", "Mcancel/s");
+  for (const auto& [name, f] : {std::pair{"wheel", &wheel_rates},
+                                std::pair{"multimap", &multimap_rates}}) {
+    const auto r{f(delays, cancel_order)};
+    std::printf("%-10s %14.1f %14.2f %14.1f %14.2f\n", name,
+                static_cast<double>(r.schedule_ns) / static_cast<double>(n),
+                bench::mops(n, r.schedule_ns),
+                static_cast<double>(r.cancel_ns) / static_cast<double>(n),
+                bench::mops(n, r.cancel_ns));
+  }
+
+  const std::size_t burst{n / 5};
+  std::printf("\n%zu timers expiring over 100 ms into one receiver (1 ms ticks)\n", burst);
+  bench::print_latency_header();
+  bench::print_latency_row("lateness", burst_lateness(burst, gen));
+  return 0;
+}
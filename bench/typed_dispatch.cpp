@@ -0,0 +1,169 @@
+#include "Bench_util.hpp"
+#include "library/core/Typed_messaging.hpp"
+
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// Same nine message types through the type-erased Receiver (heap wrapped,
+// handler chain) and a Typed_receiver (variant slots, one visit). Run
+// once with the queue filled up front (push, pop and dispatch only) and
+// once with a producer thread; allocations are counted through a
+// replaced global operator new.
+
+namespace {
+std::atomic<std::uint64_t> allocations{0};
+}
+
+void* operator new(std::size_t n)
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p{std::malloc(n ? n : 1)})
+    return p;
+  throw std::bad_alloc();
+}
+
+void* operator new(std::size_t n, std::align_val_t align) // What pmr uses
+{
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  const auto a{static_cast<std::size_t>(align)};
+  if (void* p{std::aligned_alloc(a, (n + a - 1) / a * a)})
+    return p;
+  throw std::bad_alloc();
+}
+
+// Every operator new above allocates with malloc() or aligned_alloc(); GCC
+// cannot see that once these are inlined into library code
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+#pragma GCC diagnostic pop
+
+template<int N>
+struct msg { unsigned value; };
+
+using Typed_box = Messaging::Typed_receiver<
+  msg<0>, msg<1>, msg<2>, msg<3>, msg<4>, msg<5>, msg<6>, msg<7>, msg<8>>;
+
+//------------------------------------------------------------------------------
+
+template<class To>
+void send_kind(To& to, int kind, unsigned v)
+{
+  switch (kind) {
+  case 0: to.send(msg<0>{v}); break;
+  case 1: to.send(msg<1>{v}); break;
+  case 2: to.send(msg<2>{v}); break;
+  case 3: to.send(msg<3>{v}); break;
+  case 4: to.send(msg<4>{v}); break;
+  case 5: to.send(msg<5>{v}); break;
+  case 6: to.send(msg<6>{v}); break;
+  case 7: to.send(msg<7>{v}); break;
+  default: to.send(msg<8>{v}); break;
+  }
+}
+
+void drain(Messaging::Receiver& box, std::uint64_t& sum)
+{
+  try {
+    for (;;)
+      box.wait()
+        .handle<msg<0>>([&](const msg<0>& m) { sum += m.value; })
+        .handle<msg<1>>([&](const msg<1>& m) { sum += m.value + 1; })
+        .handle<msg<2>>([&](const msg<2>& m) { sum += m.value + 2; })
+        .handle<msg<3>>([&](const msg<3>& m) { sum += m.value + 3; })
+        .handle<msg<4>>([&](const msg<4>& m) { sum += m.value + 4; })
+        .handle<msg<5>>([&](const msg<5>& m) { sum += m.value + 5; })
+        .handle<msg<6>>([&](const msg<6>& m) { sum += m.value + 6; })
+        .handle<msg<7>>([&](const msg<7>& m) { sum += m.value + 7; })
+        .handle<msg<8>>([&](const msg<8>& m) { sum += m.value + 8; });
+  }
+  catch (const Messaging::Close_queue&) {
+  }
+}
+
+void drain(Typed_box& box, std::uint64_t& sum)
+{
+  try {
+    for (;;)
+      box.wait(Messaging::Overloaded{
+        [&](const msg<0>& m) { sum += m.value; },
+        [&](const msg<1>& m) { sum += m.value + 1; },
+        [&](const msg<2>& m) { sum += m.value + 2; },
+        [&](const msg<3>& m) { sum += m.value + 3; },
+        [&](const msg<4>& m) { sum += m.value + 4; },
+        [&](const msg<5>& m) { sum += m.value + 5; },
+        [&](const msg<6>& m) { sum += m.value + 6; },
+        [&](const msg<7>& m) { sum += m.value + 7; },
+        [&](const msg<8>& m) { sum += m.value + 8; }});
+  }
+  catch (const Messaging::Close_queue&) {
+  }
+}
+
+//------------------------------------------------------------------------------
+
+struct Result {
+  std::uint64_t elapsed_ns;
+  std::uint64_t allocations;
+};
+
+template<class Box, class To>
+Result run(const std::vector<int>& kinds, bool threaded)
+{
+  Box box;
+  To to{box};
+  std::uint64_t sum{0};
+  const auto allocated{allocations.load()};
+  const auto start{bench::Clock::now()};
+  if (threaded) {
+    std::thread consumer{[&] { drain(box, sum); }};
+    for (std::size_t i{0}; i < kinds.size(); ++i)
+      send_kind(to, kinds[i], static_cast<unsigned>(i));
+    to.send(Messaging::Close_queue{});
+    consumer.join();
+  }
+  else {
+    for (std::size_t i{0}; i < kinds.size(); ++i)
+      send_kind(to, kinds[i], static_cast<unsigned>(i));
+    to.send(Messaging::Close_queue{});
+    drain(box, sum);
+  }
+  const auto elapsed{bench::ns_since(start)};
+  bench::do_not_optimize(sum);
+  return {elapsed, allocations.load() - allocated};
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 2'000'000};
+
+  std::mt19937 gen{42};
+  std::uniform_int_distribution<int> kind{0, 8};
+  std::vector<int> kinds(n);
+  for (auto& k : kinds)
+    k = kind(gen);
+
+  std::printf("messages: %zu, nine types, uniform mix\n", n);
+  std::printf("%-26s %12s %10s %14s\n", "case", "ns/message", "Mmsg/s", "allocs/message");
+  for (const bool threaded : {false, true}) {
+    const auto erased{run<Messaging::Receiver, Messaging::Sender>(kinds, threaded)};
+    const auto typed{run<Typed_box, Typed_box::sender_type>(kinds, threaded)};
+    for (const auto& [name, r] : {std::pair{"type-erased", erased}, std::pair{"typed", typed}}) {
+      const std::string label{std::string{name} + (threaded ? " (2 threads)" : " (prefilled)")};
+      std::printf("%-26s %12.1f %10.2f %14.2f\n", label.c_str(),
+                  static_cast<double>(r.elapsed_ns) / static_cast<double>(n),
+                  bench::mops(n, r.elapsed_ns),
+                  static_cast<double>(r.allocations) / static_cast<double>(n));
+    }
+  }
+  return 0;
+}
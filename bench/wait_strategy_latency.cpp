@@ -0,0 +1,44 @@
+#include "Ping_pong.hpp"
+
+//------------------------------------------------------------------------------
+
+// Round trips for every Wait_strategy, with fixed and adaptive spin budgets;
+// both actors use the same policy and are pinned to different cpus when
+// there are at least two
+
+int main(int argc, char** argv)
+{
+  using Messaging::Wait_strategy;
+
+  const std::size_t n{argc > 1 ? std::stoul(argv[1]) : 100'000};
+  const auto cpus{std::max(1U, std::thread::hardware_concurrency())};
+
+  struct Case {
+    const char* name;
+    Messaging::Wait_policy policy;
+  };
+  const Case cases[]{
+    {"block", {Wait_strategy::block}},
+    {"spin, fixed budget", {Wait_strategy::spin, 20'000, 64, 8, false}},
+    {"spin, adaptive", {Wait_strategy::spin, 20'000, 64, 8, true}},
+    {"spin-yield-block, fixed", {Wait_strategy::spin_yield_block, 20'000, 64, 8, false}},
+    {"spin-yield-block, adaptive", {Wait_strategy::spin_yield_block, 20'000, 64, 8, true}},
+    {"busy-poll", {Wait_strategy::busy_poll}},
+  };
+
+  std::printf("ping-pong round trips: %zu, cpus: %u\n", n, cpus);
+  if (cpus < 2)
+    std::printf("note: both actors share one cpu; spinning and polling only pay off "
+                "with a core per actor\n");
+  bench::print_latency_header();
+  for (const auto& c : cases) {
+    if (c.policy.strategy == Wait_strategy::busy_poll && cpus < 2) {
+      std::printf("%-32s skipped, needs two cpus\n", c.name);
+      continue;
+    }
+    const Messaging::Actor_placement client{cpus > 1 ? std::optional{0} : std::nullopt, {}, c.policy};
+    const Messaging::Actor_placement server{cpus > 1 ? std::optional{1} : std::nullopt, {}, c.policy};
+    bench::print_latency_row(c.name, bench::round_trips(client, server, n));
+  }
+  return 0;
+}
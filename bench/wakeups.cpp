@@ -0,0 +1,117 @@
+#include "Bench_util.hpp"
+#include "library/core/Messaging.hpp"
+
+#include <sys/resource.h>
+#include <condition_variable>
+#include <mutex>
+#include <queue>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// Producers flood one consumer; compares the notify_all-on-every-push
+// scheme Simple_queue used to have with the targeted wakeups it has now.
+// Futex traffic is not visible from user space, so context switches
+// (getrusage) and notifications issued stand in for it.
+
+struct work {
+  unsigned value;
+};
+
+//------------------------------------------------------------------------------
+
+// The old Simple_queue push/pop
+class Notify_all_queue {
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::queue<std::shared_ptr<Messaging::Message_base>> q_;
+  std::uint64_t notifies_{0};
+public:
+  void push(work w)
+  {
+    std::lock_guard lk{m_};
+    q_.push(std::make_shared<Messaging::Wrapped_message<work>>(w));
+    ++notifies_;
+    cv_.notify_all();
+  }
+
+  std::shared_ptr<Messaging::Message_base> wait_and_pop()
+  {
+    std::unique_lock lk{m_};
+    cv_.wait(lk, [&] { return !q_.empty(); });
+    auto res{q_.front()};
+    q_.pop();
+    return res;
+  }
+
+  std::uint64_t notifies() const noexcept { return notifies_; }
+};
+
+//------------------------------------------------------------------------------
+
+struct Run {
+  std::uint64_t elapsed_ns;
+  std::uint64_t notifies;
+  long context_switches;
+};
+
+long context_switches()
+{
+  rusage ru{};
+  getrusage(RUSAGE_SELF, &ru);
+  return ru.ru_nvcsw + ru.ru_nivcsw;
+}
+
+template<class Produce, class Consume>
+Run flood(unsigned producers, std::size_t per_producer, Produce produce, Consume consume)
+{
+  const auto switches{context_switches()};
+  const auto start{bench::Clock::now()};
+  std::thread consumer{consume};
+  std::vector<std::thread> threads;
+  for (unsigned p{0}; p < producers; ++p)
+    threads.emplace_back([&] {
+      for (std::size_t i{0}; i < per_producer; ++i)
+        produce(static_cast<unsigned>(i));
+    });
+  for (auto& t : threads)
+    t.join();
+  consumer.join();
+  return {bench::ns_since(start), 0, context_switches() - switches};
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, char** argv)
+{
+  const std::size_t per_producer{argc > 1 ? std::stoul(argv[1]) : 250'000};
+
+  std::printf("%-12s %9s %12s %12s %14s %10s\n",
+              "queue", "producers", "messages", "notifies", "ctx switches", "Mmsg/s");
+  for (const unsigned producers : {1U, 2U, 4U}) {
+    const auto total{producers * per_producer};
+
+    Notify_all_queue old_q;
+    auto old_run{flood(producers, per_producer,
+      [&](unsigned v) { old_q.push({v}); },
+      [&] {
+        for (std::size_t i{0}; i < total; ++i)
+          bench::do_not_optimize(
+            dynamic_cast<Messaging::Wrapped_message<work>*>(old_q.wait_and_pop().get()));
+      })};
+    old_run.notifies = old_q.notifies();
+
+    Messaging::Receiver box;
+    Messaging::Sender to_box{box};
+    auto new_run{flood(producers, per_producer,
+      [&](unsigned v) { to_box.send(work{v}); },
+      [&] { for (std::size_t i{0}; i < total; ++i) box.wait().handle<work>([](const work&) {}); })};
+    new_run.notifies = box.stats().wakeups;
+
+    for (const auto& [name, run] : {std::pair{"notify_all", old_run}, std::pair{"targeted", new_run}})
+      std::printf("%-12s %9u %12zu %12llu %14ld %10.2f\n", name, producers, total,
+                  static_cast<unsigned long long>(run.notifies), run.context_switches,
+                  bench::mops(total, run.elapsed_ns));
+  }
+  return 0;
+}
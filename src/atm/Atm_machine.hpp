@@ -2,33 +2,131 @@
 #define ATM_MACHINE_HPP
 
 #include "Messages.hpp"
+#include "../library/core/Balance_board.hpp"
+#include "../library/core/Settlement.hpp"
+#include "../library/core/Timer.hpp"
+#include <atomic>
+#include <chrono>
+
+// How long the atm waits before giving up on a session
+struct atm_timeouts
+{
+  std::chrono::milliseconds session{30000}; // Customer idle, restarted on each key
+  std::chrono::milliseconds reply{5000};    // Bank answer to a request
+};
+
+// What a freshly serviced machine holds
+inline Accounting::Note_dispenser standard_cassettes()
+{
+  using Accounting::Money;
+  return {{Money::major(100), 500}, {Money::major(50), 1000},
+          {Money::major(20), 2000}, {Money::major(10), 2000}};
+}
+
+// Atms in this process so far: each numbers its withdrawals from its own
+// place in the count, which keeps request ids unique across the process
+inline std::atomic<std::uint32_t> atm_count{0};
+
+// What atms count in the Metrics registry, all atms of the process together
+struct atm_metrics
+{
+  Metrics::Counter sessions=Metrics::counter(
+    "cashbox_atm_sessions_total", "Cards inserted");
+  Metrics::Counter paid=Metrics::counter(
+    "cashbox_atm_withdrawals_total", "Withdrawals, by how they ended at the atm",
+    Metrics::label("result", "paid"));
+  Metrics::Counter denied=Metrics::counter(
+    "cashbox_atm_withdrawals_total", "", Metrics::label("result", "denied"));
+  Metrics::Counter cancelled=Metrics::counter(
+    "cashbox_atm_withdrawals_total", "", Metrics::label("result", "cancelled"));
+  Metrics::Counter timed_out=Metrics::counter(
+    "cashbox_atm_withdrawals_total", "", Metrics::label("result", "timed_out"));
+  Metrics::Counter cash=Metrics::counter(
+    "cashbox_atm_cash_paid_minor_total", "Cash paid out, in minor units");
+};
+
+inline atm_metrics const& atm_counters()
+{
+  static atm_metrics const counters;
+  return counters;
+}
 
 // Listing C.7 The ATM state machine
 class atm
 {
   mutable Messaging::Receiver incoming;
+  atm_metrics const& counters=atm_counters();
   Messaging::Sender bank;
-  Messaging::Sender interface_hardware;
+  interface_sender interface_hardware;
   void (atm::*state)() = nullptr;
   std::string account;
-  unsigned withdrawal_amount{0};
+  Accounting::Money withdrawal_amount;
+  Accounting::Note_dispenser cash;
+  Accounting::Dispense_plan withdrawal_notes;
   std::string pin;
+  Messaging::Timer_service* timers;
+  atm_timeouts timeouts;
+  Accounting::Balance_board const* balances;
+  Accounting::Journal_recorder* journal{nullptr};
+  std::uint64_t deadline{0};               // Carried by the timeout armed last
+  std::uint64_t request_id;                // Of the request last sent to the bank
+  Messaging::Timer_id deadline_timer;
+  // One deadline at a time; the state waiting on it decides what it means.
+  // deadline counts even without timers, so a replay sees the same numbers
+  void arm(std::chrono::milliseconds after)
+  {
+    disarm();
+    ++deadline;
+    if (timers)
+    {
+      deadline_timer=timers->schedule(after, incoming, atm_timeout(deadline));
+    }
+  }
+  void disarm()
+  {
+    if (timers)
+    {
+      timers->cancel(deadline_timer);
+    }
+    deadline_timer={};
+  }
+  // An answer to an earlier request, one the atm gave up waiting for,
+  // may still come in; only the answer to the request last sent counts
   void process_withdrawal()
   {
     incoming.wait()
       .handle<withdraw_ok>(
         [&](withdraw_ok const& msg)
         {
+          if (msg.request_id != request_id)
+          {
+            return;
+          }
+          cash.take(withdrawal_notes);
+          counters.paid.add();
+          counters.cash.add(static_cast<std::uint64_t>(withdrawal_amount.minor_units()));
+          if (journal)
+          {
+            journal->record(request_id, Accounting::Journal_kind::dispensed,
+                            withdrawal_amount,
+                            Accounting::Journal_entry::no_account,
+                            withdrawal_notes);
+          }
           interface_hardware.send(
-            issue_money(withdrawal_amount));
+            issue_money(withdrawal_amount, withdrawal_notes));
           bank.send(
-            withdrawal_processed(account, withdrawal_amount));
+            withdrawal_processed(account, withdrawal_amount, request_id));
           state=&atm::done_processing;
         }
         )
       .handle<withdraw_denied>(
         [&](withdraw_denied const& msg)
         {
+          if (msg.request_id != request_id)
+          {
+            return;
+          }
+          counters.denied.add();
           interface_hardware.send(display_insufficient_funds());
           state=&atm::done_processing;
 
@@ -37,12 +135,26 @@ class atm
       .handle<cancel_pressed>(
         [&](cancel_pressed const& msg)
         {
+          counters.cancelled.add();
           bank.send(
-            cancel_withdrawal(account, withdrawal_amount));
+            cancel_withdrawal(account, withdrawal_amount, request_id));
           interface_hardware.send(
             display_withdrawal_cancelled());
           state=&atm::done_processing;
         }
+        )
+      .handle<atm_timeout>(
+        [&](atm_timeout const& msg)
+        {
+          if (msg.deadline == deadline)
+          {
+            counters.timed_out.add();
+            bank.send(
+              cancel_withdrawal(account, withdrawal_amount, request_id));
+            interface_hardware.send(display_timed_out());
+            state=&atm::done_processing;
+          }
+        }
         );
   }
   void process_balance()
@@ -51,7 +163,13 @@ class atm
       .handle<balance>(
         [&](balance const& msg)
         {
+          if (msg.request_id != request_id)
+          {
+            return;
+          }
           interface_hardware.send(display_balance(msg.amount));
+          interface_hardware.send(display_withdrawal_options());
+          arm(timeouts.session);
           state=&atm::wait_for_action;
         }
         )
@@ -60,24 +178,55 @@ class atm
         {
           state=&atm::done_processing;
         }
+        )
+      .handle<atm_timeout>(
+        [&](atm_timeout const& msg)
+        {
+          if (msg.deadline == deadline)
+          {
+            interface_hardware.send(display_timed_out());
+            state=&atm::done_processing;
+          }
+        }
         );
   }
   void wait_for_action()
   {
-    interface_hardware.send(display_withdrawal_options());
     incoming.wait()
       .handle<withdraw_pressed>(
         [&](withdraw_pressed const& msg)
         {
+          // The cassettes are asked before the bank debits anything
+          auto const notes=cash.plan(msg.amount);
+          if (!notes)
+          {
+            interface_hardware.send(display_cannot_dispense(msg.amount));
+            interface_hardware.send(display_withdrawal_options());
+            arm(timeouts.session);
+            return;
+          }
           withdrawal_amount=msg.amount;
-          bank.send(withdraw(account, msg.amount, incoming));
+          withdrawal_notes=*notes;
+          bank.send(withdraw(account, msg.amount, incoming, ++request_id));
+          arm(timeouts.reply);
           state=&atm::process_withdrawal;
         }
         )
       .handle<balance_pressed>(
         [&](balance_pressed const& msg)
         {
-          bank.send(get_balance(account, incoming));
+          // The bank publishes balances, no need to queue up behind
+          // its withdrawals; accounts it does not publish are asked for
+          if (auto const amount=
+                balances ? balances->balance(account) : std::nullopt)
+          {
+            interface_hardware.send(display_balance(*amount));
+            interface_hardware.send(display_withdrawal_options());
+            arm(timeouts.session);
+            return;
+          }
+          bank.send(get_balance(account, incoming, ++request_id));
+          arm(timeouts.reply);
           state=&atm::process_balance;
         }
         )
@@ -86,6 +235,16 @@ class atm
         {
           state=&atm::done_processing;
         }
+        )
+      .handle<atm_timeout>(
+        [&](atm_timeout const& msg)
+        {
+          if (msg.deadline == deadline)
+          {
+            interface_hardware.send(display_timed_out());
+            state=&atm::done_processing;
+          }
+        }
         );
   }
   void verifying_pin()
@@ -94,12 +253,22 @@ class atm
       .handle<pin_verified>(
         [&](pin_verified const& msg)
         {
+          if (msg.request_id != request_id)
+          {
+            return;
+          }
+          interface_hardware.send(display_withdrawal_options());
+          arm(timeouts.session);
           state=&atm::wait_for_action;
         }
         )
       .handle<pin_incorrect>(
         [&](pin_incorrect const& msg)
         {
+          if (msg.request_id != request_id)
+          {
+            return;
+          }
           interface_hardware.send(
             display_pin_incorrect_message());
           state=&atm::done_processing;
@@ -110,6 +279,16 @@ class atm
         {
           state=&atm::done_processing;
         }
+        )
+      .handle<atm_timeout>(
+        [&](atm_timeout const& msg)
+        {
+          if (msg.deadline == deadline)
+          {
+            interface_hardware.send(display_timed_out());
+            state=&atm::done_processing;
+          }
+        }
         );
   }
   void getting_pin()
@@ -122,9 +301,14 @@ class atm
           pin+=msg.digit;
           if (pin.length() == pin_length)
           {
-            bank.send(verify_pin(account, pin, incoming));
+            bank.send(verify_pin(account, pin, incoming, ++request_id));
+            arm(timeouts.reply);
             state=&atm::verifying_pin;
           }
+          else
+          {
+            arm(timeouts.session);
+          }
         }
         )
       .handle<clear_last_pressed>(
@@ -134,6 +318,7 @@ class atm
           {
             pin.pop_back();
           }
+          arm(timeouts.session);
         }
         )
       .handle<cancel_pressed>(
@@ -141,41 +326,75 @@ class atm
         {
           state=&atm::done_processing;
         }
+        )
+      .handle<atm_timeout>(
+        [&](atm_timeout const& msg)
+        {
+          if (msg.deadline == deadline)
+          {
+            interface_hardware.send(display_timed_out());
+            state=&atm::done_processing;
+          }
+        }
         );
   }
   void waiting_for_card()
   {
-    interface_hardware.send(display_enter_card());
     incoming.wait()
       .handle<card_inserted>(
         [&](card_inserted const& msg)
         {
+          counters.sessions.add();
           account=msg.account;
           pin="";
           interface_hardware.send(display_enter_pin());
+          arm(timeouts.session);
           state=&atm::getting_pin;
         }
         );
   }
   void done_processing()
   {
+    disarm();
     interface_hardware.send(eject_card());
+    interface_hardware.send(display_enter_card());
     state=&atm::waiting_for_card;
   }
   atm(atm const&)=delete;
   atm& operator=(atm const&)=delete;
 public:
+  // Without timers the atm waits for ever, as before; without the bank's
+  // balances (see bank_machine::published_balances()) it asks the bank
   atm(Messaging::Sender bank_,
-      Messaging::Sender interface_hardware_):
-    bank(bank_), interface_hardware(interface_hardware_)
+      interface_sender interface_hardware_,
+      Messaging::Timer_service* timers_=nullptr,
+      atm_timeouts timeouts_={},
+      Accounting::Note_dispenser cash_=standard_cassettes(),
+      Accounting::Balance_board const* balances_=nullptr):
+    bank(bank_), interface_hardware(interface_hardware_),
+    cash(cash_), timers(timers_), timeouts(timeouts_), balances(balances_),
+    request_id(std::uint64_t(++atm_count) << 32)
   {}
+  // Records the cash it pays out in journal, for the day's settlement;
+  // must be called before run()
+  void use_journal(Accounting::Journal_recorder& journal_)
+  {
+    journal=&journal_;
+  }
   void done() const
   {
     get_sender().send(Messaging::Close_queue());
   }
-  void run()
+  // What a state shows is sent on the way into it, so that a state
+  // function only waits; step() can then re-enter it any number of times
+  void start()
   {
+    interface_hardware.send(display_enter_card());
     state=&atm::waiting_for_card;
+  }
+  void run()
+  {
+    start();
     try
     {
       for (;;)
@@ -185,11 +404,42 @@ public:
     }
     catch (Messaging::Close_queue const&) {
     }
+    disarm();
+  }
+  // Simulation (see Messaging::Sim_scheduler): handles one message on a
+  // single-threaded mailbox, after start(); false if there was none
+  bool step()
+  {
+    if (!incoming.pending())
+    {
+      return false;
+    }
+    try
+    {
+      (this->*state)();
+    }
+    catch (Messaging::Mailbox_empty const&) {   // Only unhandled mail was left
+    }
+    while (state == &atm::done_processing)
+    {
+      (this->*state)();
+    }
+    return true;
   }
   Messaging::Sender get_sender() const noexcept
   {
     return incoming;
   }
+  // Only meaningful once run() has returned
+  Accounting::Note_dispenser const& cassettes() const noexcept
+  {
+    return cash;
+  }
+  // For setting up the queue (tracing, placement) before run()
+  Messaging::Receiver& mailbox() const noexcept
+  {
+    return incoming;
+  }
 };
 
 #endif
@@ -2,17 +2,159 @@
 #define BANK_MACHINE_HPP
 
 #include "Messages.hpp"
+#include "../library/core/Balance_board.hpp"
+#include "../library/core/Pin_store.hpp"
+#include "../library/core/Request_cache.hpp"
+#include "../library/core/Risk.hpp"
+#include "../library/core/Settlement.hpp"
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+// The book's one account, which every card in the demos belongs to
+inline std::vector<std::string> default_accounts()
+{
+  return {"acc1234"};
+}
+
+// And its PIN
+inline std::shared_ptr<Accounting::Pin_store const> default_pins()
+{
+  std::pair<std::string, std::string> const pins[]{{"acc1234", "1937"}};
+  return std::make_shared<Accounting::Pin_store const>(pins);
+}
+
+// What became of a withdrawal the bank has seen, by its request id
+enum class withdrawal_state: std::uint8_t
+{
+  denied, approved, processed, cancelled
+};
+
+// What the bank keeps of it: for an approved one also what it took and
+// from which account, which is what a cancel gives back
+struct withdrawal_record
+{
+  Accounting::Money amount;
+  std::uint32_t account;
+  withdrawal_state state;
+};
+
+// How many withdrawals the bank remembers, and for how long at least (in
+// seconds of its request clock) if it is not to forget them early
+struct withdrawal_tracking
+{
+  std::size_t capacity{1 << 16};
+  std::uint32_t window{10 * 60};
+};
+
+// What banks count in the Metrics registry, all banks of the process together
+struct bank_metrics
+{
+  Metrics::Counter approved=Metrics::counter(
+    "cashbox_bank_withdrawals_total", "Withdrawals, by the bank's answer",
+    Metrics::label("result", "approved"));
+  Metrics::Counter denied=Metrics::counter(
+    "cashbox_bank_withdrawals_total", "", Metrics::label("result", "denied"));
+  Metrics::Counter duplicates=Metrics::counter(
+    "cashbox_bank_duplicate_withdrawals_total",
+    "Withdrawals delivered again, answered as the first time");
+  Metrics::Counter refunds=Metrics::counter(
+    "cashbox_bank_refunds_total", "Approved withdrawals cancelled and given back");
+  Metrics::Counter pin_correct=Metrics::counter(
+    "cashbox_bank_pin_checks_total", "PIN checks, by outcome",
+    Metrics::label("result", "correct"));
+  Metrics::Counter pin_incorrect=Metrics::counter(
+    "cashbox_bank_pin_checks_total", "", Metrics::label("result", "incorrect"));
+};
+
+inline bank_metrics const& bank_counters()
+{
+  static bank_metrics const counters;
+  return counters;
+}
 
 // Listing C.8 The bank state machine
+// Balances live on a Balance_board: the bank alone changes them, and an
+// atm given the board reads them without a round trip through the queue.
+// PINs are checked against hashes in a Pin_store; accounts it does not
+// know never get a PIN right. Withdrawals with a request id are carried
+// out once: a duplicate gets the first one's answer, and a cancel gives
+// back what an approved withdrawal took, once and only before it is
+// processed
 class bank_machine
 {
   mutable Messaging::Receiver incoming;
-  unsigned balance;
+  bank_metrics const& counters=bank_counters();
+  Accounting::Balance_board balances;
+  Accounting::Currency currency;
+  std::shared_ptr<Accounting::Pin_store const> pins;
+  std::optional<Messaging::Sender> verifier;
+  std::optional<Accounting::Risk_checks> risk;
+  std::function<std::uint64_t()> risk_clock;
+  Messaging::Request_cache<withdrawal_record> withdrawals;
+  std::function<std::uint64_t()> request_clock;
+  Accounting::Journal_recorder* journal{nullptr};
+  static std::uint64_t steady_seconds()
+  {
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count());
+  }
 public:
-  bank_machine():
-    balance(199)
+  explicit bank_machine(
+    Accounting::Money initial_balance=Accounting::Money::major(199),
+    std::vector<std::string> accounts=default_accounts(),
+    std::shared_ptr<Accounting::Pin_store const> pins_=default_pins()):
+    bank_machine(Accounting::Account_snapshot::build(accounts, initial_balance),
+                 std::move(pins_))
+  {}
+  // Accounts as imported (see Accounting::read_accounts_csv() and
+  // Accounting::Account_snapshot::open()), each with its own balance
+  explicit bank_machine(
+    Accounting::Account_snapshot accounts,
+    std::shared_ptr<Accounting::Pin_store const> pins_=default_pins()):
+    balances(std::move(accounts)),
+    currency(balances.currency()),
+    pins(std::move(pins_)),
+    withdrawals(withdrawal_tracking{}.capacity, withdrawal_tracking{}.window),
+    request_clock(steady_seconds)
   {}
 
+  // Hands PIN hashing to a pin_verifier (over pin_store()) instead of
+  // doing it on the bank's thread, where it would hold up the ledger;
+  // must be called before run()
+  void use_pin_verifier(Messaging::Sender verifier_)
+  {
+    verifier.emplace(verifier_);
+  }
+
+  // Withdrawals and PIN checks pass the risk checks first, in the seconds
+  // of clock; must be called before run()
+  void use_risk_checks(Accounting::Risk_policy const& policy,
+                       std::function<std::uint64_t()> clock)
+  {
+    risk.emplace(balances.size(), policy);
+    risk_clock=std::move(clock);
+  }
+  // Remembers withdrawals as tracking says, in the seconds of clock;
+  // must be called before run()
+  void track_withdrawals(withdrawal_tracking const& tracking,
+                         std::function<std::uint64_t()> clock)
+  {
+    withdrawals=Messaging::Request_cache<withdrawal_record>(
+      tracking.capacity, tracking.window);
+    request_clock=std::move(clock);
+  }
+  // Records what it debits and gives back in journal, for the day's
+  // settlement; must be called before run()
+  void use_journal(Accounting::Journal_recorder& journal_)
+  {
+    journal=&journal_;
+  }
   void done() const
   {
     get_sender().send(Messaging::Close_queue());
@@ -23,60 +165,261 @@ public:
     {
       for (;;)
       {
-        incoming.wait()
-          .handle<verify_pin>(
-            [&](verify_pin const& msg)
-            {
-              if (msg.pin == "1937")
-              {
-                msg.atm_queue.send(pin_verified());
-              }
-              else
-              {
-                msg.atm_queue.send(pin_incorrect());
-              }
-            }
-            )
-          .handle<withdraw>(
-            [&](withdraw const& msg)
-            {
-              if (balance >= msg.amount)
-              {
-                msg.atm_queue.send(withdraw_ok());
-                balance-=msg.amount;
-              }
-              else
-              {
-                msg.atm_queue.send(withdraw_denied());
-              }
-            }
-            )
-          .handle<get_balance>(
-            [&](get_balance const& msg)
+        handle_one();
+      }
+    }
+    catch (Messaging::Close_queue const&)
+    {
+    }
+  }
+  // Simulation (see Messaging::Sim_scheduler): handles one message on a
+  // single-threaded mailbox; false if there was none
+  bool step()
+  {
+    if (!incoming.pending())
+    {
+      return false;
+    }
+    try
+    {
+      handle_one();
+    }
+    catch (Messaging::Mailbox_empty const&) {   // Only unhandled mail was left
+    }
+    return true;
+  }
+private:
+  void handle_one()
+  {
+    incoming.wait()
+      .handle<verify_pin>(
+        [&](verify_pin const& msg)
+        {
+          auto const i=risk ? balances.find(msg.account) : std::nullopt;
+          if (i && !risk->pin_allowed(*i, risk_clock()))
+          {
+            msg.atm_queue.send(pin_incorrect(msg.request_id));  // Locked out
+          }
+          else if (verifier)
+          {
+            verifier->send(check_pin(msg.account, msg.pin, msg.atm_queue,
+                                     get_sender(), msg.request_id));
+          }
+          else
+          {
+            settle_pin(msg.account, pins->verify(msg.account, msg.pin),
+                       msg.atm_queue, msg.request_id);
+          }
+        }
+        )
+      .handle<pin_checked>(
+        [&](pin_checked const& msg)
+        {
+          settle_pin(msg.account, msg.correct, msg.atm_queue,
+                     msg.request_id);
+        }
+        )
+      .handle<withdraw>(
+        [&](withdraw const& msg)
+        {
+          if (auto const* const seen=withdrawals.find(msg.request_id))
+          {
+            counters.duplicates.add();
+            // A cancelled withdrawal was given back: it is no longer ok
+            if (seen->state == withdrawal_state::approved ||
+                seen->state == withdrawal_state::processed)
             {
-              msg.atm_queue.send(::balance(balance));
+              msg.atm_queue.send(withdraw_ok(msg.request_id));
             }
-            )
-          .handle<withdrawal_processed>(
-            [&](withdrawal_processed const& msg)
+            else
             {
+              msg.atm_queue.send(withdraw_denied(msg.request_id));
             }
-            )
-          .handle<cancel_withdrawal>(
-            [&](cancel_withdrawal const& msg)
+            return;
+          }
+          // An unknown account, a foreign or negative amount, or one past
+          // the risk limits is refused like an unaffordable one rather
+          // than thrown at the actor
+          auto const i=balances.find(msg.account);
+          auto const now=risk ? risk_clock() : 0;
+          if (i && msg.amount.currency() == currency &&
+              !msg.amount.is_negative() && balances.balance(*i) >= msg.amount &&
+              (!risk || risk->check_withdrawal(*i, msg.amount, now) ==
+                          Accounting::Risk_verdict::allow))
+          {
+            if (risk)
             {
+              risk->record_withdrawal(*i, msg.amount, now);
             }
-            );
+            // Published before the atm hears of it, so that the atm
+            // never reads a balance older than its own withdrawal
+            balances.publish(*i, balances.balance(*i)-msg.amount);
+            remember(msg.request_id, {msg.amount, static_cast<std::uint32_t>(*i),
+                                      withdrawal_state::approved});
+            counters.approved.add();
+            record(msg.request_id, Accounting::Journal_kind::debit,
+                   msg.amount, *i);
+            msg.atm_queue.send(withdraw_ok(msg.request_id));
+          }
+          else
+          {
+            remember(msg.request_id, {{}, 0, withdrawal_state::denied});
+            counters.denied.add();
+            msg.atm_queue.send(withdraw_denied(msg.request_id));
+          }
+        }
+        )
+      .handle<get_balance>(
+        [&](get_balance const& msg)
+        {
+          msg.atm_queue.send(::balance(
+            balances.balance(msg.account).value_or(
+              Accounting::Money::minor(0, currency)),
+            msg.request_id));
+        }
+        )
+      .handle<withdrawal_processed>(
+        [&](withdrawal_processed const& msg)
+        {
+          settle(msg.request_id, withdrawal_state::processed);
+        }
+        )
+      .handle<cancel_withdrawal>(
+        [&](cancel_withdrawal const& msg)
+        {
+          // Without an id, or once forgotten, there is no telling whether
+          // anything was taken, and nothing is given back. What is given
+          // back is what was taken, whatever the cancel says
+          if (auto const* const taken=settle(msg.request_id,
+                                             withdrawal_state::cancelled))
+          {
+            balances.publish(taken->account,
+                             balances.balance(taken->account)+taken->amount);
+            counters.refunds.add();
+            record(msg.request_id, Accounting::Journal_kind::refund,
+                   taken->amount, taken->account);
+          }
+        }
+        );
+  }
+  void remember(std::uint64_t request_id, withdrawal_record const& seen)
+  {
+    withdrawals.insert(request_id, seen,
+                       static_cast<std::uint32_t>(request_clock()));
+  }
+  void record(std::uint64_t request_id, Accounting::Journal_kind kind,
+              Accounting::Money amount, std::size_t account)
+  {
+    if (journal)
+    {
+      journal->record(request_id, kind, amount,
+                      static_cast<std::uint32_t>(account));
+    }
+  }
+  // Moves an approved withdrawal on to state; null if it was not one
+  withdrawal_record const* settle(std::uint64_t request_id,
+                                  withdrawal_state state)
+  {
+    auto* const seen=withdrawals.find(request_id);
+    if (!seen || seen->state != withdrawal_state::approved)
+    {
+      return nullptr;
+    }
+    seen->state=state;
+    return seen;
+  }
+  // Checks of one account in flight together were all let through by
+  // pin_allowed(), so a lockout may come a check or two late
+  void settle_pin(std::string const& account, bool correct,
+                  Messaging::Sender& atm_queue, std::uint64_t request_id)
+  {
+    auto const i=risk ? balances.find(account) : std::nullopt;
+    if (correct)
+    {
+      counters.pin_correct.add();
+      if (i)
+      {
+        risk->record_pin_success(*i);
       }
+      atm_queue.send(pin_verified(request_id));
     }
-    catch (Messaging::Close_queue const&)
+    else
     {
+      counters.pin_incorrect.add();
+      if (i)
+      {
+        risk->record_pin_failure(*i, risk_clock());
+      }
+      atm_queue.send(pin_incorrect(request_id));
     }
   }
+public:
   Messaging::Sender get_sender() const noexcept
   {
     return incoming;
   }
+  // What all accounts hold together; only meaningful once run() has
+  // returned
+  Accounting::Money current_balance() const
+  {
+    auto total=Accounting::Money::minor(0, currency);
+    for (std::size_t i=0; i != balances.size(); ++i)
+    {
+      total+=balances.balance(i);
+    }
+    return total;
+  }
+  // Accounts that hold something else than they opened with, and what;
+  // only meaningful once run() has returned
+  std::vector<std::pair<std::string_view, Accounting::Money>> moved_accounts() const
+  {
+    std::vector<std::pair<std::string_view, Accounting::Money>> res;
+    for (std::size_t i=0; i != balances.size(); ++i)
+    {
+      if (balances.balance(i) != balances.opening(i))
+      {
+        res.emplace_back(balances.account(i), balances.balance(i));
+      }
+    }
+    return res;
+  }
+  // Only meaningful once run() has returned; zero without risk checks
+  Accounting::Risk_stats risk_stats() const noexcept
+  {
+    return risk ? risk->stats() : Accounting::Risk_stats{};
+  }
+  // Only meaningful once run() has returned
+  Messaging::Request_cache_stats withdrawal_stats() const noexcept
+  {
+    return withdrawals.stats();
+  }
+  std::shared_ptr<Accounting::Pin_store const> const& pin_store() const noexcept
+  {
+    return pins;
+  }
+  // Readable from any thread while the bank runs
+  Accounting::Balance_board const& published_balances() const noexcept
+  {
+    return balances;
+  }
+  // For setting up the queue (tracing, placement) before run()
+  Messaging::Receiver& mailbox() const noexcept
+  {
+    return incoming;
+  }
 };
 
+// Ends a recording with where bank ended up, account by account, for
+// a replay to check; once run() has returned
+inline void record_bank_state(Messaging::Trace_recorder& tap,
+                              bank_machine const& bank)
+{
+  for (auto const& [account, balance] : bank.moved_accounts())
+  {
+    tap.record(atm_trace_queue::bank,
+               bank_account_state(std::string(account), balance));
+  }
+  tap.record(atm_trace_queue::bank, bank_state(bank.current_balance()));
+}
+
 #endif
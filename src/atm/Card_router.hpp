@@ -0,0 +1,161 @@
+#ifndef CARD_ROUTER_HPP
+#define CARD_ROUTER_HPP
+
+#include "Messages.hpp"
+#include "../library/core/Prefix_routes.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// Which bank serves which cards: a route number from table indexes banks
+struct bank_routes
+{
+  Messaging::Prefix_routes table;
+  mutable std::vector<Messaging::Sender> banks;
+  bank_routes(Messaging::Prefix_routes table_,
+              std::vector<Messaging::Sender> banks_):
+    table(std::move(table_)), banks(std::move(banks_))
+  {}
+};
+
+// Sent to a card_router: route by routes from now on
+struct routes_changed
+{
+  std::shared_ptr<bank_routes const> routes;
+  explicit routes_changed(std::shared_ptr<bank_routes const> routes_):
+    routes(std::move(routes_))
+  {}
+};
+
+// Stands between atms and banks in place of a bank: passes on whatever an
+// atm sends its bank to the bank of the longest prefix of the card's
+// account. New routes are built by whoever changes them and take over
+// between two messages, so traffic never waits for a rebuild. A card no
+// bank serves is refused as the bank would refuse an unknown account
+class card_router
+{
+  mutable Messaging::Receiver incoming;
+  std::shared_ptr<bank_routes const> routes;
+  std::atomic<std::uint64_t> routed{0};
+  std::atomic<std::uint64_t> unrouted{0};
+  std::atomic<std::uint64_t> reloads{0};
+  Messaging::Sender* bank_for(std::string const& account)
+  {
+    auto const r=routes->table.find(account);
+    if (r >= routes->banks.size())
+    {
+      unrouted.fetch_add(1, std::memory_order_relaxed);
+      return nullptr;
+    }
+    routed.fetch_add(1, std::memory_order_relaxed);
+    return &routes->banks[r];
+  }
+  template<class Msg, class Refusal>
+  void pass_on(Msg const& msg, Refusal refuse)
+  {
+    if (auto* const bank=bank_for(msg.account))
+    {
+      bank->send(msg);
+    }
+    else
+    {
+      refuse();
+    }
+  }
+public:
+  explicit card_router(std::shared_ptr<bank_routes const> routes_):
+    routes(std::move(routes_))
+  {}
+  void done() const
+  {
+    get_sender().send(Messaging::Close_queue());
+  }
+  // Any thread
+  void reload(std::shared_ptr<bank_routes const> routes_) const
+  {
+    get_sender().send(routes_changed(std::move(routes_)));
+  }
+  void run()
+  {
+    try
+    {
+      for (;;)
+      {
+        handle_one();
+      }
+    }
+    catch (Messaging::Close_queue const&)
+    {
+    }
+  }
+  Messaging::Sender get_sender() const noexcept
+  {
+    return incoming;
+  }
+  // Readable from any thread
+  std::uint64_t routed_count() const noexcept
+  {
+    return routed.load(std::memory_order_relaxed);
+  }
+  std::uint64_t unrouted_count() const noexcept
+  {
+    return unrouted.load(std::memory_order_relaxed);
+  }
+  std::uint64_t reload_count() const noexcept
+  {
+    return reloads.load(std::memory_order_relaxed);
+  }
+  // For setting up the queue (placement, timing) before run()
+  Messaging::Receiver& mailbox() const noexcept
+  {
+    return incoming;
+  }
+private:
+  void handle_one()
+  {
+    incoming.wait()
+      .handle<verify_pin>(
+        [&](verify_pin const& msg)
+        {
+          pass_on(msg, [&] { msg.atm_queue.send(pin_incorrect(msg.request_id)); });
+        }
+        )
+      .handle<withdraw>(
+        [&](withdraw const& msg)
+        {
+          pass_on(msg, [&] { msg.atm_queue.send(withdraw_denied(msg.request_id)); });
+        }
+        )
+      .handle<get_balance>(
+        [&](get_balance const& msg)
+        {
+          // No bank, no currency to say nothing in
+          pass_on(msg, [&] {
+            msg.atm_queue.send(::balance(Accounting::Money(), msg.request_id));
+          });
+        }
+        )
+      .handle<withdrawal_processed>(
+        [&](withdrawal_processed const& msg)
+        {
+          pass_on(msg, [] {});
+        }
+        )
+      .handle<cancel_withdrawal>(
+        [&](cancel_withdrawal const& msg)
+        {
+          pass_on(msg, [] {});
+        }
+        )
+      .handle<routes_changed>(
+        [&](routes_changed const& msg)
+        {
+          routes=msg.routes;
+          reloads.fetch_add(1, std::memory_order_relaxed);
+        }
+        );
+  }
+};
+
+#endif
@@ -2,13 +2,156 @@
 #define INTERFACE_MACHINE_HPP
 
 #include "Messages.hpp"
-#include <iostream>
+#include "../library/core/Display_sink.hpp"
+#include <functional>
+#include <sstream>
 
-// Listing C.9 The user-interface state machine
+// What the customer sees; lets a simulated customer react to the screen
+enum class screen
+{
+  issuing_money, insufficient_funds, enter_pin, enter_card, balance,
+  withdrawal_options, withdrawal_cancelled, pin_incorrect, timed_out,
+  cannot_dispense, card_ejected
+};
+
+// Listing C.9 The user-interface state machine, on a closed-set receiver:
+// leaving out a handler for one of interface_receiver's types fails to compile.
+// A screen is printed whole into text and handed to its terminal on a
+// Messaging::Display_sink, which shows the screens of many machines
+// without their waiting on each other or on the console
 class interface_machine
 {
-  mutable Messaging::Receiver incoming;
+  mutable interface_receiver incoming;
+  Messaging::Display_terminal* display;
+  std::ostringstream text;
+  std::function<void(screen)> watcher;
+  template<class Print>
+  void show(screen s, Print print)
+  {
+    if (display)
+    {
+      text.str(std::string{});
+      print(text);
+      display->write(text.view());
+    }
+    if (watcher)
+    {
+      watcher(s);
+    }
+  }
+  void handle_one()
+  {
+    incoming.wait(Messaging::Overloaded{
+        [&](issue_money const& msg)
+        {
+          show(screen::issuing_money, [&](std::ostream& os)
+          {
+            os << "Issuing "
+               << msg.amount;
+            char sep=':';
+            for (auto const& b : msg.notes.bundles)
+            {
+              if (b.count)
+              {
+                os << sep << ' ' << b.count << " x "
+                   << Accounting::Money::minor(b.denomination,
+                                               msg.amount.currency());
+                sep=',';
+              }
+            }
+            os << '\n';
+          });
+        },
+        [&](display_insufficient_funds const& msg)
+        {
+          show(screen::insufficient_funds, [&](std::ostream& os)
+          {
+            os << "Insufficient funds" << '\n';
+          });
+        },
+        [&](display_enter_pin const& msg)
+        {
+          show(screen::enter_pin, [&](std::ostream& os)
+          {
+            os << "Please enter your PIN (0-9)"
+               << '\n';
+          });
+        },
+        [&](display_enter_card const& msg)
+        {
+          show(screen::enter_card, [&](std::ostream& os)
+          {
+            os << "Please enter your card (I)"
+               << '\n';
+          });
+        },
+        [&](display_balance const& msg)
+        {
+          show(screen::balance, [&](std::ostream& os)
+          {
+            os << "The balance of your account is "
+               << msg.amount << '\n';
+          });
+        },
+        [&](display_withdrawal_options const& msg)
+        {
+          show(screen::withdrawal_options, [&](std::ostream& os)
+          {
+            os << "Withdraw 50? (w)" << '\n';
+            os << "Display balance? (b)"
+               << '\n';
+            os << "Cancel? (c)" << '\n';
+          });
+        },
+        [&](display_withdrawal_cancelled const& msg)
+        {
+          show(screen::withdrawal_cancelled, [&](std::ostream& os)
+          {
+            os << "Withdrawal cancelled"
+               << '\n';
+          });
+        },
+        [&](display_pin_incorrect_message const& msg)
+        {
+          show(screen::pin_incorrect, [&](std::ostream& os)
+          {
+            os << "PIN incorrect" << '\n';
+          });
+        },
+        [&](display_timed_out const& msg)
+        {
+          show(screen::timed_out, [&](std::ostream& os)
+          {
+            os << "Timed out" << '\n';
+          });
+        },
+        [&](display_cannot_dispense const& msg)
+        {
+          show(screen::cannot_dispense, [&](std::ostream& os)
+          {
+            os << "Cannot dispense " << msg.amount
+               << " from the notes available" << '\n';
+          });
+        },
+        [&](eject_card const& msg)
+        {
+          show(screen::card_ejected, [&](std::ostream& os)
+          {
+            os << "Ejecting card" << '\n';
+          });
+        }
+      });
+  }
 public:
+  // display may be null for a silent interface; otherwise it is this
+  // interface's alone, a terminal having one writer, and opened by the
+  // caller, since a sink keeps its terminals as long as it lives;
+  // watcher, if given, is told about every screen after it was shown
+  explicit interface_machine(
+    Messaging::Display_terminal* display_,
+    std::function<void(screen)> watcher_={}):
+    display(display_), watcher(std::move(watcher_))
+  {}
   void done() const
   {
     get_sender().send(Messaging::Close_queue());
@@ -19,103 +162,30 @@ public:
     {
       for (;;)
       {
-        incoming.wait()
-          .handle<issue_money>(
-            [&](issue_money const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "Issuing "
-                          << msg.amount << std::endl;
-              }
-            }
-            )
-          .handle<display_insufficient_funds>(
-            [&](display_insufficient_funds const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "Insufficient funds" << std::endl;
-              }
-            }
-            )
-          .handle<display_enter_pin>(
-            [&](display_enter_pin const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout
-                  << "Please enter your PIN (0-9)"
-                  << std::endl;
-              }
-            }
-            )
-          .handle<display_enter_card>(
-            [&](display_enter_card const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "Please enter your card (I)"
-                          << std::endl;
-              }
-            }
-            )
-          .handle<display_balance>(
-            [&](display_balance const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout
-                  << "The balance of your account is "
-                  << msg.amount << std::endl;
-              }
-            }
-            )
-          .handle<display_withdrawal_options>(
-            [&](display_withdrawal_options const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "Withdraw 50? (w)" << std::endl;
-                std::cout << "Display balance? (b)"
-                          << std::endl;
-                std::cout << "Cancel? (c)" << std::endl;
-              }
-            }
-            )
-          .handle<display_withdrawal_cancelled>(
-            [&](display_withdrawal_cancelled const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "Withdrawal cancelled"
-                          << std::endl;
-              }
-            }
-            )
-          .handle<display_pin_incorrect_message>(
-            [&](display_pin_incorrect_message const& msg)
-            {
-              {
-                std::lock_guard<std::mutex> lk(iom);
-                std::cout << "PIN incorrect" << std::endl;
-              }
-            }
-            )
-          .handle<eject_card>(
-            [&](eject_card const& msg)
-            {
-              std::lock_guard<std::mutex> lk(iom);
-              std::cout << "Ejecting card" << std::endl;
-            }
-            );
+        handle_one();
       }
     }
     catch (Messaging::Close_queue&)
     {
     }
   }
-  Messaging::Sender get_sender() const noexcept
+  // Simulation (see Messaging::Sim_scheduler): handles one message on a
+  // single-threaded mailbox; false if there was none
+  bool step()
+  {
+    if (!incoming.pending())
+    {
+      return false;
+    }
+    handle_one();
+    return true;
+  }
+  interface_sender get_sender() const noexcept
+  {
+    return incoming;
+  }
+  // For setting up the queue (tracing, placement) before run()
+  interface_receiver& mailbox() const noexcept
   {
     return incoming;
   }
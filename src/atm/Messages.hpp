@@ -3,49 +3,74 @@
 
 //------------------------------------------------------------------------------
 
+#include <cstdint>
 #include <string>
+#include "../library/core/Dispense.hpp"
 #include "../library/core/Messaging.hpp"
+#include "../library/core/Money.hpp"
+#include "../library/core/Typed_messaging.hpp"
 
 //------------------------------------------------------------------------------
 
-inline std::mutex iom;
-
 // Listing C.6 ATM messages
+// Every request to the bank carries a request id, and the bank's answer
+// the id of the request it answers, so that an atm can tell an answer
+// that comes after it stopped waiting from the one it is waiting for. A
+// withdrawal, and the cancel_withdrawal or withdrawal_processed that
+// settles it, carry the same request id; the bank carries out an id once
+// however often it is delivered. 0 is no id: each delivery counts
 struct withdraw
 {
   std::string account;
-  unsigned amount;
+  Accounting::Money amount;
   mutable Messaging::Sender atm_queue;
+  std::uint64_t request_id;
   withdraw(std::string const& account_,
-           unsigned amount_,
-           Messaging::Sender atm_queue_):
-    account(account_), amount(amount_), atm_queue(atm_queue_)
+           Accounting::Money amount_,
+           Messaging::Sender atm_queue_,
+           std::uint64_t request_id_=0):
+    account(account_), amount(amount_), atm_queue(atm_queue_),
+    request_id(request_id_)
   {}
 };
 
 struct withdraw_ok
-{};
+{
+  std::uint64_t request_id;
+  explicit withdraw_ok(std::uint64_t request_id_=0):
+    request_id(request_id_)
+  {}
+};
 
 struct withdraw_denied
-{};
+{
+  std::uint64_t request_id;
+  explicit withdraw_denied(std::uint64_t request_id_=0):
+    request_id(request_id_)
+  {}
+};
 
 struct cancel_withdrawal
 {
   std::string account;
-  unsigned amount;
+  Accounting::Money amount;
+  std::uint64_t request_id;
   cancel_withdrawal(std::string const& account_,
-                    unsigned amount_):
-    account(account_), amount(amount_)
+                    Accounting::Money amount_,
+                    std::uint64_t request_id_=0):
+    account(account_), amount(amount_), request_id(request_id_)
   {}
 };
 
 struct withdrawal_processed
 {
   std::string account;
-  unsigned amount;
+  Accounting::Money amount;
+  std::uint64_t request_id;
   withdrawal_processed(std::string const& account_,
-                       unsigned amount_):
-    account(account_), amount(amount_)
+                       Accounting::Money amount_,
+                       std::uint64_t request_id_=0):
+    account(account_), amount(amount_), request_id(request_id_)
   {}
 };
 
@@ -73,8 +98,8 @@ struct eject_card
 
 struct withdraw_pressed
 {
-  unsigned amount;
-  explicit withdraw_pressed(unsigned amount_):
+  Accounting::Money amount;
+  explicit withdraw_pressed(Accounting::Money amount_):
     amount(amount_)
   {}
 };
@@ -84,9 +109,11 @@ struct cancel_pressed
 
 struct issue_money
 {
-  unsigned amount;
-  explicit issue_money(unsigned amount_):
-    amount(amount_)
+  Accounting::Money amount;
+  Accounting::Dispense_plan notes;
+  issue_money(Accounting::Money amount_,
+              Accounting::Dispense_plan const& notes_):
+    amount(amount_), notes(notes_)
   {}
 };
 
@@ -95,17 +122,62 @@ struct verify_pin
   std::string account;
   std::string pin;
   mutable Messaging::Sender atm_queue;
+  std::uint64_t request_id;
   verify_pin(std::string const& account_, std::string const& pin_,
-             Messaging::Sender atm_queue_):
-      account(account_), pin(pin_), atm_queue(atm_queue_)
+             Messaging::Sender atm_queue_, std::uint64_t request_id_=0):
+      account(account_), pin(pin_), atm_queue(atm_queue_),
+      request_id(request_id_)
+  {}
+};
+
+// From the bank to the PIN verifiers (see pin_verifier), once the account
+// is known not to be locked out; the verdict goes back to bank_queue
+struct check_pin
+{
+  std::string account;
+  std::string pin;
+  mutable Messaging::Sender atm_queue;
+  mutable Messaging::Sender bank_queue;
+  std::uint64_t request_id;
+  check_pin(std::string const& account_, std::string const& pin_,
+            Messaging::Sender atm_queue_, Messaging::Sender bank_queue_,
+            std::uint64_t request_id_=0):
+    account(account_), pin(pin_), atm_queue(atm_queue_), bank_queue(bank_queue_),
+    request_id(request_id_)
+  {}
+};
+
+// The verdict, for the bank to count against the account and pass on to
+// the atm. Not traced: a replay verifies on the bank's own thread, which
+// gives the same answer
+struct pin_checked
+{
+  std::string account;
+  bool correct;
+  mutable Messaging::Sender atm_queue;
+  std::uint64_t request_id;
+  pin_checked(std::string const& account_, bool correct_,
+              Messaging::Sender atm_queue_, std::uint64_t request_id_=0):
+    account(account_), correct(correct_), atm_queue(atm_queue_),
+    request_id(request_id_)
   {}
 };
 
 struct pin_verified
-{};
+{
+  std::uint64_t request_id;
+  explicit pin_verified(std::uint64_t request_id_=0):
+    request_id(request_id_)
+  {}
+};
 
 struct pin_incorrect
-{};
+{
+  std::uint64_t request_id;
+  explicit pin_incorrect(std::uint64_t request_id_=0):
+    request_id(request_id_)
+  {}
+};
 
 struct display_enter_pin
 {};
@@ -129,23 +201,26 @@ struct get_balance
 {
   std::string account;
   mutable Messaging::Sender atm_queue;
-  get_balance(std::string const& account_, Messaging::Sender atm_queue_):
-    account(account_), atm_queue(atm_queue_)
+  std::uint64_t request_id;
+  get_balance(std::string const& account_, Messaging::Sender atm_queue_,
+              std::uint64_t request_id_=0):
+    account(account_), atm_queue(atm_queue_), request_id(request_id_)
   {}
 };
 
 struct balance
 {
-  unsigned amount;
-  explicit balance(unsigned amount_):
-    amount(amount_)
+  Accounting::Money amount;
+  std::uint64_t request_id;
+  explicit balance(Accounting::Money amount_, std::uint64_t request_id_=0):
+    amount(amount_), request_id(request_id_)
   {}
 };
 
 struct display_balance
 {
-  unsigned amount;
-  explicit display_balance(unsigned amount_):
+  Accounting::Money amount;
+  explicit display_balance(Accounting::Money amount_):
     amount(amount_)
   {}
 };
@@ -153,6 +228,40 @@ struct display_balance
 struct balance_pressed
 {};
 
+// Sent by the timer service into the atm's own queue; deadline tells
+// which wait it was armed for, anything else is stale
+struct atm_timeout
+{
+  std::uint64_t deadline;
+  explicit atm_timeout(std::uint64_t deadline_):
+    deadline(deadline_)
+  {}
+};
+
+struct display_timed_out
+{};
+
+// The cassettes cannot make up the amount; nothing was asked of the bank
+struct display_cannot_dispense
+{
+  Accounting::Money amount;
+  explicit display_cannot_dispense(Accounting::Money amount_):
+    amount(amount_)
+  {}
+};
+
+// Everything the interface hardware accepts; its queue holds them by value
+using interface_receiver = Messaging::Typed_receiver<
+  issue_money, display_insufficient_funds, display_enter_pin,
+  display_enter_card, display_balance, display_withdrawal_options,
+  display_withdrawal_cancelled, display_pin_incorrect_message,
+  display_timed_out, display_cannot_dispense, eject_card>;
+using interface_sender = interface_receiver::sender_type;
+
+//------------------------------------------------------------------------------
+
+#include "Trace_codec.hpp"
+
 //------------------------------------------------------------------------------
 
 #endif // ATM_MESSAGES_HPP
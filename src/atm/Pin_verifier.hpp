@@ -0,0 +1,210 @@
+#ifndef PIN_VERIFIER_HPP
+#define PIN_VERIFIER_HPP
+
+#include "Messages.hpp"
+#include "../library/core/Pin_store.hpp"
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// Checks PINs off the bank's thread. Checks queue up in the verifier;
+// each of its workers, whenever it is idle, is handed whatever has queued
+// since (up to max_batch, shared out among the idle workers) and hashes
+// that batch side by side (see Accounting::Pin_store::verify), answering
+// each check to its bank. A check arriving at a quiet time is a batch of
+// one and waits for nothing; under load batches fill up while the workers
+// are busy and each check gets cheaper
+class pin_verifier
+{
+  struct pin_batch
+  {
+    std::vector<check_pin> checks;
+  };
+  struct worker_idle
+  {
+    std::size_t worker;
+  };
+  class worker
+  {
+    mutable Messaging::Receiver incoming;
+    Accounting::Pin_store const& pins;
+    Messaging::Sender verifier;
+    std::size_t index;
+  public:
+    worker(Accounting::Pin_store const& pins_, Messaging::Sender verifier_,
+           std::size_t index_):
+      pins(pins_), verifier(verifier_), index(index_)
+    {}
+    void done() const
+    {
+      get_sender().send(Messaging::Close_queue());
+    }
+    void run()
+    {
+      try
+      {
+        for (;;)
+        {
+          verifier.send(worker_idle{index});
+          incoming.wait()
+            .handle<pin_batch>(
+              [&](pin_batch const& msg)
+              {
+                verify(msg);
+              }
+              );
+        }
+      }
+      catch (Messaging::Close_queue const&)
+      {
+      }
+    }
+    Messaging::Sender get_sender() const noexcept
+    {
+      return incoming;
+    }
+  private:
+    void verify(pin_batch const& batch)
+    {
+      std::vector<Accounting::Pin_check> checks;
+      checks.reserve(batch.checks.size());
+      for (auto const& c : batch.checks)
+      {
+        checks.push_back({c.account, c.pin});
+      }
+      auto const correct=std::make_unique<bool[]>(checks.size());
+      pins.verify(checks, {correct.get(), checks.size()});
+      for (std::size_t i=0; i != checks.size(); ++i)
+      {
+        auto const& c=batch.checks[i];
+        c.bank_queue.send(pin_checked(c.account, correct[i], c.atm_queue,
+                                      c.request_id));
+      }
+    }
+  };
+
+  mutable Messaging::Receiver incoming;
+  std::shared_ptr<Accounting::Pin_store const> pins;
+  std::vector<std::unique_ptr<worker>> workers;
+  std::size_t max_batch;
+  std::deque<check_pin> waiting;
+  std::vector<std::size_t> idle;
+  std::atomic<std::uint64_t> checks_seen{0};
+  std::atomic<std::uint64_t> batches_sent{0};
+public:
+  // Enough to fill the hashing lanes several times over
+  static constexpr std::size_t default_max_batch=4*Crypto::detail::lanes;
+
+  explicit pin_verifier(
+    std::shared_ptr<Accounting::Pin_store const> pins_,
+    unsigned workers_=std::max(1u, std::thread::hardware_concurrency()),
+    std::size_t max_batch_=default_max_batch):
+    pins(std::move(pins_)), max_batch(std::max<std::size_t>(1, max_batch_))
+  {
+    for (unsigned i=0; i != std::max(1u, workers_); ++i)
+    {
+      workers.push_back(std::make_unique<worker>(*pins, get_sender(), i));
+    }
+  }
+  void done() const
+  {
+    get_sender().send(Messaging::Close_queue());
+  }
+  // Runs the workers on threads of their own until done(); checks sent
+  // before done() are all answered
+  void run()
+  {
+    std::vector<std::thread> threads;
+    for (auto& w : workers)
+    {
+      threads.emplace_back(&worker::run, w.get());
+    }
+    try
+    {
+      for (;;)
+      {
+        do
+        {
+          take_one();
+        } while (incoming.pending());
+        hand_out();
+      }
+    }
+    catch (Messaging::Close_queue const&)
+    {
+    }
+    for (std::size_t w=0; !waiting.empty(); w=(w+1)%workers.size())
+    {
+      send(w, std::min(max_batch, waiting.size()));
+    }
+    for (auto& w : workers)
+    {
+      w->done();
+    }
+    for (auto& t : threads)
+    {
+      t.join();
+    }
+  }
+  Messaging::Sender get_sender() const noexcept
+  {
+    return incoming;
+  }
+  // Readable from any thread; checks() / batches() is the mean batch
+  std::uint64_t checks() const noexcept
+  {
+    return checks_seen.load(std::memory_order_relaxed);
+  }
+  std::uint64_t batches() const noexcept
+  {
+    return batches_sent.load(std::memory_order_relaxed);
+  }
+  std::size_t worker_count() const noexcept
+  {
+    return workers.size();
+  }
+private:
+  void take_one()
+  {
+    incoming.wait()
+      .handle<check_pin>(
+        [&](check_pin const& msg)
+        {
+          waiting.push_back(msg);
+        }
+        )
+      .handle<worker_idle>(
+        [&](worker_idle const& msg)
+        {
+          idle.push_back(msg.worker);
+        }
+        );
+  }
+  void hand_out()
+  {
+    while (!idle.empty() && !waiting.empty())
+    {
+      auto const share=(waiting.size()+idle.size()-1)/idle.size();
+      send(idle.back(), std::min(max_batch, share));
+      idle.pop_back();
+    }
+  }
+  void send(std::size_t w, std::size_t n)
+  {
+    pin_batch batch;
+    batch.checks.reserve(n);
+    for (std::size_t i=0; i != n; ++i)
+    {
+      batch.checks.push_back(std::move(waiting.front()));
+      waiting.pop_front();
+    }
+    checks_seen.fetch_add(n, std::memory_order_relaxed);
+    batches_sent.fetch_add(1, std::memory_order_relaxed);
+    workers[w]->get_sender().send(std::move(batch));
+  }
+};
+
+#endif
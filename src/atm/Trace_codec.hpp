@@ -0,0 +1,343 @@
+#ifndef ATM_TRACE_CODEC_HPP
+#define ATM_TRACE_CODEC_HPP
+
+//------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <string>
+#include "../library/core/Dispense.hpp"
+#include "../library/core/Money.hpp"
+#include "../library/core/Trace.hpp"
+
+//------------------------------------------------------------------------------
+
+// Binary trace encoding of the ATM messages (see Messaging::Trace_codec);
+// the ones that move money are audited as well (see Messaging::Audit_log)
+
+// Which receiver a record was delivered to
+namespace atm_trace_queue {
+  inline constexpr std::uint16_t atm{0};
+  inline constexpr std::uint16_t bank{1};
+  inline constexpr std::uint16_t interface{2};
+}
+
+enum class atm_trace_type : std::uint16_t {
+  withdraw = 1, withdraw_ok, withdraw_denied, cancel_withdrawal,
+  withdrawal_processed, card_inserted, digit_pressed, clear_last_pressed,
+  eject_card, withdraw_pressed, cancel_pressed, issue_money, verify_pin,
+  pin_verified, pin_incorrect, display_enter_pin, display_enter_card,
+  display_insufficient_funds, display_withdrawal_cancelled,
+  display_pin_incorrect_message, display_withdrawal_options, get_balance,
+  balance, display_balance, balance_pressed, atm_timeout, display_timed_out,
+  display_cannot_dispense, bank_state = 0x100, bank_opening, bank_account_state
+};
+
+// Not a message: appended once at the end of a recording, after a
+// bank_account_state for every account that moved, so that a replay can
+// check the bank ended up in the same state
+struct bank_state
+{
+  Accounting::Money balance;
+  explicit bank_state(Accounting::Money balance_):
+    balance(balance_)
+  {}
+};
+
+// Not a message either: what one account held at the end of a recording
+struct bank_account_state
+{
+  std::string account;
+  Accounting::Money balance;
+  bank_account_state(std::string const& account_,
+                     Accounting::Money balance_):
+    account(account_), balance(balance_)
+  {}
+};
+
+// Not a message either: the balance the recording started from, for
+// recordings not made with the default bank
+struct bank_opening
+{
+  Accounting::Money balance;
+  explicit bank_opening(Accounting::Money balance_):
+    balance(balance_)
+  {}
+};
+
+//------------------------------------------------------------------------------
+
+template<class Msg, atm_trace_type Type>
+struct atm_empty_codec
+{
+  static constexpr std::uint16_t type{static_cast<std::uint16_t>(Type)};
+  static void encode(Msg const&, Messaging::Trace_out&) {}
+  static Msg decode(Messaging::Trace_in&, Messaging::Sender const&)
+    { return Msg{}; }
+};
+
+template<class Msg, atm_trace_type Type>
+struct atm_amount_codec
+{
+  static constexpr std::uint16_t type{static_cast<std::uint16_t>(Type)};
+  static void encode(Msg const& msg, Messaging::Trace_out& out)
+    { out.put(msg.amount); }
+  static Msg decode(Messaging::Trace_in& in, Messaging::Sender const&)
+    { return Msg(in.get<Accounting::Money>()); }
+};
+
+// The bank's answers, which carry nothing but the id of the request
+template<class Msg, atm_trace_type Type>
+struct atm_reply_codec
+{
+  static constexpr std::uint16_t type{static_cast<std::uint16_t>(Type)};
+  static void encode(Msg const& msg, Messaging::Trace_out& out)
+    { out.put(msg.request_id); }
+  static Msg decode(Messaging::Trace_in& in, Messaging::Sender const&)
+    { return Msg(in.get<std::uint64_t>()); }
+};
+
+template<class Msg, atm_trace_type Type>
+struct atm_settlement_codec
+{
+  static constexpr std::uint16_t type{static_cast<std::uint16_t>(Type)};
+  static constexpr bool audited{true};
+  static void encode(Msg const& msg, Messaging::Trace_out& out)
+  {
+    out.put_string(msg.account);
+    out.put(msg.amount);
+    out.put(msg.request_id);
+  }
+  static Msg decode(Messaging::Trace_in& in, Messaging::Sender const&)
+  {
+    auto account{in.get_string()};
+    auto const amount{in.get<Accounting::Money>()};
+    return Msg(account, amount, in.get<std::uint64_t>());
+  }
+};
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+template<> struct Trace_codec<clear_last_pressed>
+  : atm_empty_codec<clear_last_pressed, atm_trace_type::clear_last_pressed> {};
+template<> struct Trace_codec<eject_card>
+  : atm_empty_codec<eject_card, atm_trace_type::eject_card> {};
+template<> struct Trace_codec<cancel_pressed>
+  : atm_empty_codec<cancel_pressed, atm_trace_type::cancel_pressed> {};
+template<> struct Trace_codec<display_enter_pin>
+  : atm_empty_codec<display_enter_pin, atm_trace_type::display_enter_pin> {};
+template<> struct Trace_codec<display_enter_card>
+  : atm_empty_codec<display_enter_card, atm_trace_type::display_enter_card> {};
+template<> struct Trace_codec<display_insufficient_funds>
+  : atm_empty_codec<display_insufficient_funds,
+                    atm_trace_type::display_insufficient_funds> {};
+template<> struct Trace_codec<display_withdrawal_cancelled>
+  : atm_empty_codec<display_withdrawal_cancelled,
+                    atm_trace_type::display_withdrawal_cancelled> {};
+template<> struct Trace_codec<display_pin_incorrect_message>
+  : atm_empty_codec<display_pin_incorrect_message,
+                    atm_trace_type::display_pin_incorrect_message> {};
+template<> struct Trace_codec<display_withdrawal_options>
+  : atm_empty_codec<display_withdrawal_options,
+                    atm_trace_type::display_withdrawal_options> {};
+template<> struct Trace_codec<balance_pressed>
+  : atm_empty_codec<balance_pressed, atm_trace_type::balance_pressed> {};
+template<> struct Trace_codec<display_timed_out>
+  : atm_empty_codec<display_timed_out, atm_trace_type::display_timed_out> {};
+
+template<> struct Trace_codec<withdraw_ok>
+  : atm_reply_codec<withdraw_ok, atm_trace_type::withdraw_ok> {};
+template<> struct Trace_codec<withdraw_denied>
+  : atm_reply_codec<withdraw_denied, atm_trace_type::withdraw_denied> {};
+template<> struct Trace_codec<pin_verified>
+  : atm_reply_codec<pin_verified, atm_trace_type::pin_verified> {};
+template<> struct Trace_codec<pin_incorrect>
+  : atm_reply_codec<pin_incorrect, atm_trace_type::pin_incorrect> {};
+
+template<> struct Trace_codec<withdraw_pressed>
+  : atm_amount_codec<withdraw_pressed, atm_trace_type::withdraw_pressed> {};
+template<> struct Trace_codec<display_balance>
+  : atm_amount_codec<display_balance, atm_trace_type::display_balance> {};
+template<> struct Trace_codec<display_cannot_dispense>
+  : atm_amount_codec<display_cannot_dispense,
+                     atm_trace_type::display_cannot_dispense> {};
+
+template<> struct Trace_codec<cancel_withdrawal>
+  : atm_settlement_codec<cancel_withdrawal,
+                         atm_trace_type::cancel_withdrawal> {};
+template<> struct Trace_codec<withdrawal_processed>
+  : atm_settlement_codec<withdrawal_processed,
+                         atm_trace_type::withdrawal_processed> {};
+
+template<> struct Trace_codec<withdraw>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::withdraw)};
+  static constexpr bool audited{true};
+  static void encode(withdraw const& msg, Trace_out& out)
+  {
+    out.put_string(msg.account);
+    out.put(msg.amount);
+    out.put(msg.request_id);
+  }
+  static withdraw decode(Trace_in& in, Sender const& reply_to)
+  {
+    auto account{in.get_string()};
+    auto const amount{in.get<Accounting::Money>()};
+    return withdraw(account, amount, reply_to, in.get<std::uint64_t>());
+  }
+};
+
+// Exactly fills a record: 16 bytes of amount, 32 of notes
+template<> struct Trace_codec<issue_money>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::issue_money)};
+  static constexpr bool audited{true};
+  static void encode(issue_money const& msg, Trace_out& out)
+  {
+    out.put(msg.amount);
+    out.put(msg.notes);
+  }
+  static issue_money decode(Trace_in& in, Sender const&)
+  {
+    auto amount{in.get<Accounting::Money>()};
+    return issue_money(amount, in.get<Accounting::Dispense_plan>());
+  }
+};
+
+template<> struct Trace_codec<card_inserted>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::card_inserted)};
+  static void encode(card_inserted const& msg, Trace_out& out)
+    { out.put_string(msg.account); }
+  static card_inserted decode(Trace_in& in, Sender const&)
+    { return card_inserted(in.get_string()); }
+};
+
+template<> struct Trace_codec<digit_pressed>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::digit_pressed)};
+  static void encode(digit_pressed const& msg, Trace_out& out)
+    { out.put(msg.digit); }
+  static digit_pressed decode(Trace_in& in, Sender const&)
+    { return digit_pressed(in.get<char>()); }
+};
+
+template<> struct Trace_codec<atm_timeout>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::atm_timeout)};
+  static void encode(atm_timeout const& msg, Trace_out& out)
+    { out.put(msg.deadline); }
+  static atm_timeout decode(Trace_in& in, Sender const&)
+    { return atm_timeout(in.get<std::uint64_t>()); }
+};
+
+template<> struct Trace_codec<verify_pin>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::verify_pin)};
+  static void encode(verify_pin const& msg, Trace_out& out)
+  {
+    out.put_string(msg.account);
+    out.put_string(msg.pin);
+    out.put(msg.request_id);
+  }
+  static verify_pin decode(Trace_in& in, Sender const& reply_to)
+  {
+    auto account{in.get_string()};
+    auto pin{in.get_string()};
+    return verify_pin(account, pin, reply_to, in.get<std::uint64_t>());
+  }
+};
+
+template<> struct Trace_codec<get_balance>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::get_balance)};
+  static void encode(get_balance const& msg, Trace_out& out)
+  {
+    out.put_string(msg.account);
+    out.put(msg.request_id);
+  }
+  static get_balance decode(Trace_in& in, Sender const& reply_to)
+  {
+    auto account{in.get_string()};
+    return get_balance(account, reply_to, in.get<std::uint64_t>());
+  }
+};
+
+template<> struct Trace_codec<balance>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::balance)};
+  static void encode(balance const& msg, Trace_out& out)
+  {
+    out.put(msg.amount);
+    out.put(msg.request_id);
+  }
+  static balance decode(Trace_in& in, Sender const&)
+  {
+    auto const amount{in.get<Accounting::Money>()};
+    return balance(amount, in.get<std::uint64_t>());
+  }
+};
+
+template<> struct Trace_codec<bank_state>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::bank_state)};
+  static void encode(bank_state const& msg, Trace_out& out)
+    { out.put(msg.balance); }
+  static bank_state decode(Trace_in& in, Sender const&)
+    { return bank_state(in.get<Accounting::Money>()); }
+};
+
+template<> struct Trace_codec<bank_account_state>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::bank_account_state)};
+  static void encode(bank_account_state const& msg, Trace_out& out)
+  {
+    out.put_string(msg.account);
+    out.put(msg.balance);
+  }
+  static bank_account_state decode(Trace_in& in, Sender const&)
+  {
+    auto account{in.get_string()};
+    return bank_account_state(account, in.get<Accounting::Money>());
+  }
+};
+
+template<> struct Trace_codec<bank_opening>
+{
+  static constexpr std::uint16_t type{
+    static_cast<std::uint16_t>(atm_trace_type::bank_opening)};
+  static void encode(bank_opening const& msg, Trace_out& out)
+    { out.put(msg.balance); }
+  static bank_opening decode(Trace_in& in, Sender const&)
+    { return bank_opening(in.get<Accounting::Money>()); }
+};
+
+}
+
+//------------------------------------------------------------------------------
+
+// Everything a replay feeds back into the actors
+using atm_trace_types = Messaging::Trace_types<
+  withdraw, withdraw_ok, withdraw_denied, cancel_withdrawal,
+  withdrawal_processed, card_inserted, digit_pressed, clear_last_pressed,
+  eject_card, withdraw_pressed, cancel_pressed, issue_money, verify_pin,
+  pin_verified, pin_incorrect, display_enter_pin, display_enter_card,
+  display_insufficient_funds, display_withdrawal_cancelled,
+  display_pin_incorrect_message, display_withdrawal_options, get_balance,
+  balance, display_balance, balance_pressed, atm_timeout, display_timed_out,
+  display_cannot_dispense>;
+
+//------------------------------------------------------------------------------
+
+#endif // ATM_TRACE_CODEC_HPP
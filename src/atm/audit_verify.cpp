@@ -0,0 +1,53 @@
+#include "../library/core/Audit.hpp"
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// Checks an audit file written by atm_app --audit: that every batch
+// matches its hashes and follows on from the one before, and, given the
+// head printed when it was written, that nothing was cut off the end.
+// Exits 3 if the file has been tampered with, so that a script can tell
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox audit file verifier"};
+  std::string audit_file;
+  app.add_option("audit", audit_file, "The audit file")->required();
+  std::optional<std::string> expected_head;
+  app.add_option("-e,--expect", expected_head, "The head it was written with, in hex");
+  unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+  app.add_option("-t,--threads", threads, "Threads hashing");
+  CLI11_PARSE(app, argc, argv);
+
+  const auto start{std::chrono::steady_clock::now()};
+  const auto verdict{Messaging::verify_audit(audit_file, std::max(1u, threads))};
+  const std::chrono::duration<double> took{std::chrono::steady_clock::now() - start};
+  const auto bytes{static_cast<double>(std::filesystem::file_size(audit_file))};
+
+  std::cout << verdict.batches << " batches, " << verdict.records << " records checked in "
+            << took.count() << " s (" << bytes / took.count() / (1 << 20) << " MiB/s)\n"
+            << "head " << Crypto::to_hex(verdict.head) << '\n';
+  if (!verdict.ok()) {
+    if (verdict.bad_batch)
+      std::cout << "batch " << *verdict.bad_batch << ": ";
+    std::cout << verdict.problem << '\n';
+    return 3;
+  }
+  if (expected_head && *expected_head != Crypto::to_hex(verdict.head)) {
+    std::cout << "head is not the one expected: batches are missing or were redone\n";
+    return 3;
+  }
+  std::cout << "ok\n";
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << e.what() << '\n';
+  return 1;
+}
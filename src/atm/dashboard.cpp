@@ -0,0 +1,444 @@
+#include "Atm_machine.hpp"
+#include "Bank_machine.hpp"
+#include "Card_router.hpp"
+#include "Interface_machine.hpp"
+
+#include "../library/core/Simulation.hpp"
+
+#include <CLI/CLI.hpp>
+#include <ftxui/dom/elements.hpp>
+#include <ftxui/screen/color.hpp>
+#include <ftxui/screen/screen.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// A customer at one atm, for ever: after think time a card (any of
+// cards), the right PIN (now and then a wrong one), then a withdrawal or
+// a look at the balance followed by cancel. Runs on the thread of the
+// atm's interface; waits on the timer service, never on that thread
+class customer
+{
+  std::optional<Messaging::Sender> atm_queue;  // Set once the atm exists
+  Messaging::Timer_service* timers;
+  std::chrono::microseconds think;
+  std::vector<std::string> const* cards;
+  std::atomic<bool> const* closing;
+  Messaging::Sim_random rng;
+  bool acted{false};
+public:
+  customer(Messaging::Timer_service* timers_, std::chrono::microseconds think_,
+           std::vector<std::string> const* cards_, std::atomic<bool> const* closing_,
+           std::uint64_t seed):
+    timers(timers_), think(think_), cards(cards_), closing(closing_), rng(seed)
+  {}
+  void use_atm(Messaging::Sender atm_queue_)
+  {
+    atm_queue.emplace(atm_queue_);
+  }
+  void on_screen(screen s)
+  {
+    switch (s)
+    {
+    case screen::enter_card:
+      if (!closing->load(std::memory_order_relaxed))
+      {
+        acted=false;
+        timers->schedule(think, *atm_queue,
+                         card_inserted((*cards)[rng.below(cards->size())]));
+      }
+      break;
+    case screen::enter_pin:
+      for (const char digit : rng.chance(5) ? "1111" : "1937")
+      {
+        if (digit)
+        {
+          atm_queue->send(digit_pressed(digit));
+        }
+      }
+      break;
+    case screen::withdrawal_options:
+      if (acted)
+      {
+        atm_queue->send(cancel_pressed());
+      }
+      else if (rng.chance(50))
+      {
+        atm_queue->send(withdraw_pressed(Accounting::Money::major(50)));
+      }
+      else
+      {
+        atm_queue->send(balance_pressed());
+      }
+      acted=true;
+      break;
+    default:
+      break;
+    }
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// One actor as the dashboard sees it: the counters its queue keeps anyway,
+// and a Handler_timing its thread writes and the dashboard reads, neither
+// side ever waiting for the other
+struct actor_probe {
+  std::string name;
+  bool shard;                       // A bank: its busy share is shown
+  std::function<Messaging::Queue_stats()> stats;
+  Messaging::Handler_timing timing;
+
+  template<class Mailbox>
+  actor_probe(std::string name_, Mailbox& mailbox, bool shard_ = false)
+    : name{std::move(name_)}, shard{shard_}, stats{[&mailbox] { return mailbox.stats(); }}
+  {
+    mailbox.time_handlers(&timing);
+  }
+};
+
+// Every probe read at one moment
+struct sample {
+  std::chrono::steady_clock::time_point at;
+  std::vector<std::uint64_t> pushed;
+  std::vector<std::uint64_t> queued;
+  std::vector<Messaging::Handler_times> times;
+};
+
+sample take_sample(const std::deque<actor_probe>& probes)
+{
+  sample res{std::chrono::steady_clock::now(), {}, {}, {}};
+  for (const auto& p : probes) {
+    const auto s{p.stats()};
+    res.pushed.push_back(s.pushed);
+    res.queued.push_back(s.queued);
+    res.times.push_back(p.timing.read());
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+std::string duration_text(std::uint64_t ns)
+{
+  char buf[32];
+  if (ns < 1'000)
+    std::snprintf(buf, sizeof buf, "%lluns", static_cast<unsigned long long>(ns));
+  else if (ns < 1'000'000)
+    std::snprintf(buf, sizeof buf, "%.1fus", static_cast<double>(ns) / 1e3);
+  else if (ns < 1'000'000'000)
+    std::snprintf(buf, sizeof buf, "%.1fms", static_cast<double>(ns) / 1e6);
+  else
+    std::snprintf(buf, sizeof buf, "%.2fs", static_cast<double>(ns) / 1e9);
+  return buf;
+}
+
+// One row of the table, printf style, cut to 160 characters
+[[gnu::format(printf, 1, 2)]]
+ftxui::Element line(const char* fmt, ...)
+{
+  char buf[160];
+  std::va_list args;
+  va_start(args, fmt);
+  std::vsnprintf(buf, sizeof buf, fmt, args);
+  va_end(args);
+  return ftxui::text(buf);
+}
+
+// The table, from the newest sample and the oldest one still in the
+// window: depths as they are now, rates and latencies over the window
+ftxui::Element dashboard(const std::deque<actor_probe>& probes, const sample& now,
+                         const sample& then, std::size_t atms, std::uint64_t frame)
+{
+  using namespace ftxui;
+  const auto window_ns{static_cast<double>(
+    std::chrono::duration_cast<std::chrono::nanoseconds>(now.at - then.at).count())};
+  const auto shards{std::count_if(probes.begin(), probes.end(), [](const auto& p) { return p.shard; })};
+
+  Elements rows;
+  rows.push_back(line("%-14s %8s %12s %9s %9s %9s %7s", "actor", "queued", "msgs/s",
+                      "p50", "p99", "p99.9", "busy") | bold);
+  rows.push_back(separator());
+  double total_rate{0};
+  for (std::size_t i{0}; i < probes.size(); ++i) {
+    const auto& p{probes[i]};
+    const auto times{now.times[i].since(then.times[i])};
+    const auto rate{window_ns > 0 ? static_cast<double>(now.pushed[i] - then.pushed[i]) * 1e9 / window_ns : 0.0};
+    const auto busy{window_ns > 0 ? std::min(1.0, static_cast<double>(times.busy_ns) / window_ns) : 0.0};
+    total_rate += rate;
+    auto row{line("%-14s %8llu %12.0f %9s %9s %9s %6.1f%%", p.name.c_str(),
+                  static_cast<unsigned long long>(now.queued[i]), rate,
+                  duration_text(times.quantile(0.5)).c_str(),
+                  duration_text(times.quantile(0.99)).c_str(),
+                  duration_text(times.quantile(0.999)).c_str(), busy * 100)};
+    if (p.shard) {
+      const auto shade{busy < 0.5 ? Color::Green : busy < 0.8 ? Color::Yellow : Color::Red};
+      row = hbox({row, text(" "), gauge(static_cast<float>(busy)) | color(shade)
+                                   | size(WIDTH, EQUAL, 20)});
+    }
+    rows.push_back(row);
+  }
+  rows.push_back(separator());
+  rows.push_back(line("%-14s %8s %12.0f", "all", "", total_rate));
+
+  return vbox({line("cashbox: %zu atms, %zu bank shards; window %.1f s, frame %llu", atms,
+                    static_cast<std::size_t>(shards), window_ns / 1e9,
+                    static_cast<unsigned long long>(frame)),
+               vbox(std::move(rows)) | border});
+}
+
+//------------------------------------------------------------------------------
+
+// Puts ftxui screens on a terminal a cell at a time: each frame is rendered
+// off screen and compared with the one shown, and only the cells that
+// differ are written, a cursor move starting each run of them. A frame
+// where nothing changed writes nothing at all
+class cell_painter
+{
+  std::ostream& out;
+  std::optional<ftxui::Screen> shown;
+  std::string buffer;
+  std::string style;                // Of the last cell written
+  static bool same(ftxui::Pixel const& a, ftxui::Pixel const& b)
+  {
+    return a.character == b.character && a.bold == b.bold && a.dim == b.dim
+      && a.inverted == b.inverted && a.underlined == b.underlined && a.blink == b.blink
+      && a.foreground_color == b.foreground_color && a.background_color == b.background_color;
+  }
+  static std::string style_of(ftxui::Pixel const& p)
+  {
+    std::string res{"\x1b[0"};
+    for (auto const& [on, code] : {std::pair{p.bold, ";1"}, std::pair{p.dim, ";2"},
+                                   std::pair{p.underlined, ";4"}, std::pair{p.blink, ";5"},
+                                   std::pair{p.inverted, ";7"}})
+    {
+      if (on)
+      {
+        res+=code;
+      }
+    }
+    return res + "m\x1b[" + p.foreground_color.Print(false) + "m\x1b["
+      + p.background_color.Print(true) + "m";
+  }
+public:
+  explicit cell_painter(std::ostream& out_):
+    out(out_)
+  {
+    out << "\x1b[?25l" << std::flush;  // No cursor flickering over the table
+  }
+  ~cell_painter()
+  {
+    out << "\x1b[0m\x1b[?25h" << std::flush;
+  }
+  cell_painter(cell_painter const&)=delete;
+  cell_painter& operator=(cell_painter const&)=delete;
+  // Cells written
+  std::size_t paint(ftxui::Screen& next)
+  {
+    bool const whole=!shown || shown->dimx() != next.dimx() || shown->dimy() != next.dimy();
+    buffer.clear();
+    if (whole)
+    {
+      buffer+="\x1b[2J";
+    }
+    style.clear();
+    std::size_t cells{0};
+    for (int y=0; y < next.dimy(); ++y)
+    {
+      bool in_run=false;
+      for (int x=0; x < next.dimx(); ++x)
+      {
+        auto const& p=next.PixelAt(x, y);
+        if (!whole && same(p, shown->PixelAt(x, y)))
+        {
+          in_run=false;
+          continue;
+        }
+        if (p.character.empty() && !in_run)   // The right half of a wide
+        {                                     // character, written with it
+          continue;
+        }
+        if (!in_run)
+        {
+          buffer+="\x1b["+std::to_string(y + 1)+";"+std::to_string(x + 1)+"H";
+          in_run=true;
+        }
+        if (auto s=style_of(p); s != style)
+        {
+          buffer+=s;
+          style=std::move(s);
+        }
+        buffer+=p.character.empty() ? std::string{} : p.character;
+        ++cells;
+      }
+    }
+    if (cells || whole)
+    {
+      buffer+="\x1b[0m\x1b["+std::to_string(next.dimy() + 1)+";1H";
+      out.write(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+      out.flush();
+    }
+    shown.emplace(next);
+    return cells;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Bank b serves the accounts starting "acc<b>"
+std::vector<std::string> shard_accounts(std::size_t bank, std::size_t n)
+{
+  std::vector<std::string> res;
+  for (std::size_t i{0}; i < n; ++i) {
+    char buf[32];
+    std::snprintf(buf, sizeof buf, "acc%zu%05zu", bank, i);
+    res.push_back(buf);
+  }
+  return res;
+}
+
+// Single round hashes, as atm_simulate's: the load is meant to show the
+// actors, not PBKDF2
+std::shared_ptr<Accounting::Pin_store const> shard_pins(const std::vector<std::string>& accounts)
+{
+  std::vector<std::pair<std::string, std::string>> pins;
+  for (const auto& a : accounts)
+    pins.emplace_back(a, "1937");
+  return std::make_shared<Accounting::Pin_store const>(pins, 1);
+}
+
+//------------------------------------------------------------------------------
+
+// Runs atms with their interfaces and simulated customers against banks,
+// each the shard of the accounts behind one card_router, and shows how
+// every actor is doing: how much mail waits for it, how much arrives, how
+// long its handlers take (p50, p99, p99.9 over a sliding window) and, for
+// the banks, the share of the time they are busy. Everything shown is
+// read from counters the actors' threads keep with plain stores; the
+// actors never wait for the dashboard. It redraws at most --fps times a
+// second, and only the cells that changed
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox operations dashboard"};
+  std::size_t atms{4};
+  app.add_option("-n,--atms", atms, "Atms, each with its interface and a customer");
+  std::size_t banks{2};
+  app.add_option("-b,--banks", banks, "Bank shards behind the card router (1-10)");
+  std::size_t accounts_per_bank{1000};
+  app.add_option("--accounts", accounts_per_bank, "Accounts each bank serves");
+  unsigned think_us{2000};
+  app.add_option("--think-us", think_us, "Microseconds a customer waits between sessions");
+  unsigned fps{10};
+  app.add_option("--fps", fps, "Most frames a second");
+  unsigned window_ms{1000};
+  app.add_option("--window-ms", window_ms, "Milliseconds rates and latencies are taken over");
+  unsigned seconds{0};
+  app.add_option("-s,--seconds", seconds, "Run this long (default: until q and enter)");
+  CLI11_PARSE(app, argc, argv);
+  if (!banks || banks > 10)
+    throw std::invalid_argument("--banks: 1 to 10 shards");
+  atms = std::max<std::size_t>(atms, 1);
+
+  Messaging::Timer_service timers;
+  std::atomic<bool> closing{false};
+  std::deque<actor_probe> probes;
+
+  std::deque<bank_machine> bank_shards;
+  std::vector<Messaging::Sender> to_banks;
+  std::vector<Messaging::Prefix_routes::Entry> prefixes;
+  std::vector<std::string> cards;
+  for (std::size_t b{0}; b < banks; ++b) {
+    auto accounts{shard_accounts(b, accounts_per_bank)};
+    auto& bank{bank_shards.emplace_back(Accounting::Account_snapshot::build(
+      accounts, Accounting::Money::major(1'000'000'000)), shard_pins(accounts))};
+    to_banks.push_back(bank.get_sender());
+    prefixes.push_back({"acc" + std::to_string(b), static_cast<std::uint32_t>(b)});
+    cards.insert(cards.end(), accounts.begin(), accounts.end());
+  }
+  card_router router{std::make_shared<bank_routes const>(
+    Messaging::Prefix_routes{prefixes}, to_banks)};
+
+  std::deque<customer> customers;
+  std::deque<interface_machine> interfaces;
+  std::deque<atm> machines;
+  const Accounting::Note_dispenser cassettes{{Accounting::Money::major(50), 4'000'000'000},
+                                             {Accounting::Money::major(20), 4'000'000'000}};
+  for (std::size_t a{0}; a < atms; ++a) {
+    auto& cust{customers.emplace_back(&timers, std::chrono::microseconds{think_us}, &cards,
+                                      &closing, a + 1)};
+    auto& ui{interfaces.emplace_back(nullptr, [&cust](screen s) { cust.on_screen(s); })};
+    auto& machine{machines.emplace_back(router.get_sender(), ui.get_sender(), &timers,
+                                        atm_timeouts{}, cassettes)};
+    cust.use_atm(machine.get_sender());
+  }
+  for (std::size_t a{0}; a < atms; ++a)
+    probes.emplace_back("atm " + std::to_string(a), machines[a].mailbox());
+  for (std::size_t a{0}; a < atms; ++a)
+    probes.emplace_back("interface " + std::to_string(a), interfaces[a].mailbox());
+  probes.emplace_back("card router", router.mailbox());
+  for (std::size_t b{0}; b < banks; ++b)
+    probes.emplace_back("bank " + std::to_string(b), bank_shards[b].mailbox(), true);
+
+  std::vector<std::thread> threads;
+  for (auto& bank : bank_shards)
+    threads.emplace_back(&bank_machine::run, &bank);
+  threads.emplace_back(&card_router::run, &router);
+  for (auto& ui : interfaces)
+    threads.emplace_back(&interface_machine::run, &ui);
+  for (auto& machine : machines)
+    threads.emplace_back(&atm::run, &machine);
+
+  {
+    std::jthread painter{[&](std::stop_token stop) {
+      cell_painter terminal{std::cout};
+      const auto frame{std::chrono::nanoseconds{std::chrono::seconds{1}} / std::max(1u, fps)};
+      const std::chrono::milliseconds window{std::max(1u, window_ms)};
+      std::deque<sample> history;
+      auto next{std::chrono::steady_clock::now()};
+      for (std::uint64_t n{1}; !stop.stop_requested(); ++n) {
+        history.push_back(take_sample(probes));
+        while (history.size() > 2 && history.back().at - history[1].at >= window)
+          history.pop_front();
+        auto doc{dashboard(probes, history.back(), history.front(), atms, n)};
+        auto screen{ftxui::Screen::Create(ftxui::Dimension::Full(), ftxui::Dimension::Fit(doc))};
+        ftxui::Render(screen, doc);
+        terminal.paint(screen);
+        next += frame;
+        std::this_thread::sleep_until(next);
+        next = std::max(next, std::chrono::steady_clock::now() - frame);  // No catching up
+      }
+    }};
+    if (seconds)
+      std::this_thread::sleep_for(std::chrono::seconds{seconds});
+    else
+      for (int c{0}; c != 'q' && c != EOF;)
+        c = std::getchar();
+  }
+
+  closing.store(true, std::memory_order_relaxed);
+  timers.stop();
+  for (auto& machine : machines)
+    machine.done();
+  for (auto& ui : interfaces)
+    ui.done();
+  router.done();
+  for (auto& bank : bank_shards)
+    bank.done();
+  for (auto& t : threads)
+    t.join();
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << "atm_dashboard: " << e.what() << '\n';
+  return 1;
+}
@@ -1,19 +1,219 @@
 #include "Atm_machine.hpp"
 #include "Bank_machine.hpp"
 #include "Interface_machine.hpp"
+#include "Pin_verifier.hpp"
+
+#include "../library/core/Placement.hpp"
+#include "../library/core/Logger_wrap.hpp"
+
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <optional>
+
+//------------------------------------------------------------------------------
+
+// "bank:cpu=2,node=0,spin=20000" -> {"bank", placement}
+std::map<std::string, Messaging::Actor_placement>
+parse_placements(const std::vector<std::string>& specs)
+{
+  std::map<std::string, Messaging::Actor_placement> res;
+  for (const auto& spec : specs) {
+    const auto colon{spec.find(':')};
+    const auto actor{spec.substr(0, colon)};
+    if (actor != "atm" && actor != "bank" && actor != "interface")
+      throw std::invalid_argument("--place: unknown actor " + actor);
+    res[actor] = Messaging::parse_placement(
+      colon == std::string::npos ? std::string_view{} : std::string_view{spec}.substr(colon + 1));
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+Messaging::Dispatch_mode parse_dispatch_mode(const std::string& s)
+{
+  if (s == "fixed")
+    return Messaging::Dispatch_mode::fixed;
+  if (s == "counted")
+    return Messaging::Dispatch_mode::counted;
+  if (s == "adaptive")
+    return Messaging::Dispatch_mode::adaptive;
+  throw std::invalid_argument("--dispatch: unknown mode " + s);
+}
+
+//------------------------------------------------------------------------------
+
+// Applies the queue side of a placement; the returned storage (if any)
+// must outlive the actor
+template<class Mailbox>
+std::unique_ptr<Messaging::Numa_queue_storage>
+place_mailbox(Mailbox& mailbox, const Messaging::Actor_placement& placement)
+{
+  mailbox.set_wait_policy(placement.wait);
+  if (!placement.numa_node)
+    return nullptr;
+  auto storage{std::make_unique<Messaging::Numa_queue_storage>(*placement.numa_node)};
+  mailbox.use_memory(storage->resource());
+  return storage;
+}
+
+//------------------------------------------------------------------------------
 
 // Listing C.10 The driving code
-int main()
+int main(int argc, const char** argv)
 try {
-  bank_machine bank;
-  interface_machine interface_hardware;
-  atm machine(bank.get_sender(), interface_hardware.get_sender());
-  std::thread bank_thread(&bank_machine::run, &bank);
-  std::thread if_thread(&interface_machine::run, &interface_hardware);
-  std::thread atm_thread(&atm::run, &machine);
+  CLI::App app{"cashbox atm"};
+  std::optional<std::string> record_file;
+  app.add_option("-r,--record", record_file,
+                 "Append every delivered message to a binary trace");
+  std::vector<std::string> place_specs;
+  app.add_option("-p,--place", place_specs,
+                 "Actor placement, e.g. bank:cpu=2,node=0,wait=yield,spin=20000 "
+                 "(actors: atm, bank, interface)");
+  std::string dispatch{"fixed"};
+  app.add_option("-d,--dispatch", dispatch,
+                 "Handler order: fixed, counted (log hit counters at exit) "
+                 "or adaptive (counted, hottest types tried first)");
+  atm_timeouts timeouts;
+  unsigned session_ms{static_cast<unsigned>(timeouts.session.count())};
+  app.add_option("--session-timeout", session_ms,
+                 "Milliseconds of customer inactivity before the card is ejected");
+  unsigned reply_ms{static_cast<unsigned>(timeouts.reply.count())};
+  app.add_option("--reply-timeout", reply_ms,
+                 "Milliseconds to wait for the bank before giving up");
+  std::optional<std::string> accounts_file;
+  app.add_option("-a,--accounts", accounts_file,
+                 "Accounts the bank serves: a snapshot or account,balance lines "
+                 "(default: the book's one account); needs --pins");
+  std::optional<std::string> pins_file;
+  app.add_option("--pins", pins_file,
+                 "PIN records of the accounts, account,iterations,salt,hash lines "
+                 "(make them with --hash-pin)");
+  std::optional<std::string> hash_pin;
+  app.add_option("--hash-pin", hash_pin,
+                 "Print the --pins line for account,PIN and exit");
+  std::optional<std::string> audit_file;
+  app.add_option("--audit", audit_file,
+                 "Append money-moving messages to a hash-chained audit file "
+                 "(check it with atm_audit_verify)");
+  std::optional<std::string> journal_file;
+  app.add_option("-j,--journal", journal_file,
+                 "Write what the bank debits and the atm pays out, for atm_settle");
+  bool no_risk_checks{false};
+  app.add_flag("--no-risk-checks", no_risk_checks,
+               "Let the bank skip withdrawal limits and PIN lockout");
+  std::optional<std::string> metrics_file;
+  app.add_option("--metrics", metrics_file,
+                 "Write metrics in the Prometheus text format to this file, "
+                 "every second and at exit");
+  std::optional<std::uint16_t> metrics_port;
+  app.add_option("--metrics-port", metrics_port,
+                 "Serve metrics over HTTP on 127.0.0.1 at this port");
+  unsigned pin_workers{std::max(1u, std::thread::hardware_concurrency())};
+  app.add_option("--pin-workers", pin_workers,
+                 "Threads hashing PINs for the bank (0: the bank's own thread)");
+  CLI11_PARSE(app, argc, argv);
+  if (hash_pin) {
+    const auto comma{hash_pin->find(',')};
+    if (comma == std::string::npos)
+      throw std::invalid_argument("--hash-pin: expected account,PIN");
+    std::cout << Accounting::pin_line(hash_pin->substr(0, comma),
+                                      Accounting::Pin_store::make_record(
+                                        std::string_view{*hash_pin}.substr(comma + 1)))
+              << '\n';
+    return 0;
+  }
+  if (accounts_file && !pins_file)
+    throw std::invalid_argument("--accounts needs --pins: the book's PIN is only "
+                                "that of its one account");
+  timeouts.session = std::chrono::milliseconds{session_ms};
+  timeouts.reply = std::chrono::milliseconds{reply_ms};
+  auto placements{parse_placements(place_specs)};
+  const auto dispatch_mode{parse_dispatch_mode(dispatch)};
+
+  std::vector<std::unique_ptr<Messaging::Numa_queue_storage>> queue_storage;
+  Messaging::Timer_service timers;
+  bank_machine bank{accounts_file ? Accounting::load_accounts(*accounts_file)
+                                  : Accounting::Account_snapshot::build(
+                                      default_accounts(), Accounting::Money::major(199)),
+                    pins_file ? std::make_shared<Accounting::Pin_store const>(
+                                  Accounting::read_pins(*pins_file))
+                              : default_pins()};
+  if (!no_risk_checks) {
+    // Seconds since start, as the timestamps of a recording (see replay)
+    bank.use_risk_checks({}, [start = std::chrono::steady_clock::now()] {
+      return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::steady_clock::now() - start).count());
+    });
+  }
+  std::optional<pin_verifier> verifier;
+  if (pin_workers) {
+    verifier.emplace(bank.pin_store(), pin_workers);
+    bank.use_pin_verifier(verifier->get_sender());
+  }
+  interface_machine interface_hardware{&Messaging::console_display().open()};
+  atm machine(bank.get_sender(), interface_hardware.get_sender(),
+              &timers, timeouts, standard_cassettes(), &bank.published_balances());
+  std::optional<Accounting::Journal_recorder> journal;
+  if (journal_file) {
+    journal.emplace(*journal_file);
+    bank.use_journal(*journal);
+    machine.use_journal(*journal);
+  }
+  std::optional<Messaging::Trace_recorder> recorder;
+  if (record_file) {
+    recorder.emplace(*record_file);
+    machine.mailbox().record_to(&*recorder, atm_trace_queue::atm);
+    bank.mailbox().record_to(&*recorder, atm_trace_queue::bank);
+    interface_hardware.mailbox().record_to(&*recorder, atm_trace_queue::interface);
+  }
+  std::optional<Messaging::Audit_log> audit;
+  if (audit_file) {
+    audit.emplace(*audit_file);
+    bank.mailbox().audit_to(&*audit, atm_trace_queue::bank);
+    interface_hardware.mailbox().audit_to(&*audit, atm_trace_queue::interface);
+  }
+  std::optional<Metrics::Http_exporter> metrics_http;
+  std::jthread metrics_writer;
+  if (metrics_file || metrics_port)
+  {
+    machine.mailbox().publish_metrics("atm");
+    bank.mailbox().publish_metrics("bank");
+    interface_hardware.mailbox().publish_metrics("interface");
+  }
+  if (metrics_port)
+  {
+    metrics_http.emplace(*metrics_port);
+  }
+  if (metrics_file)
+  {
+    metrics_writer = std::jthread{[&](std::stop_token stop) {
+      std::mutex m;
+      std::condition_variable_any tick;
+      std::unique_lock lk{m};
+      while (!tick.wait_for(lk, stop, std::chrono::seconds{1}, [&] { return stop.stop_requested(); }))
+        Metrics::Registry::instance().write_prometheus_file(*metrics_file);
+    }};
+  }
+  for (auto* mailbox : {&machine.mailbox(), &bank.mailbox()}) // The interface
+    mailbox->set_dispatch_mode(dispatch_mode);                 // visits, no order
+  queue_storage.push_back(place_mailbox(machine.mailbox(), placements["atm"]));
+  queue_storage.push_back(place_mailbox(bank.mailbox(), placements["bank"]));
+  queue_storage.push_back(place_mailbox(interface_hardware.mailbox(), placements["interface"]));
+  std::thread verifier_thread;
+  if (verifier)
+    verifier_thread = std::thread{&pin_verifier::run, &*verifier};
+  std::thread bank_thread{Messaging::start_placed(
+    placements["bank"], &bank_machine::run, &bank)};
+  std::thread if_thread{Messaging::start_placed(
+    placements["interface"], &interface_machine::run, &interface_hardware)};
+  std::thread atm_thread{Messaging::start_placed(
+    placements["atm"], &atm::run, &machine)};
   Messaging::Sender atmqueue(machine.get_sender());
   bool quit_pressed=false;
-  constexpr auto how_much_to_withdraw{50};
+  constexpr auto how_much_to_withdraw{Accounting::Money::major(50)};
   const auto which_card_we_inserted{std::string{"acc1234"}};
   while (!quit_pressed)
   {
@@ -58,8 +258,30 @@ try {
   atm_thread.join();
   bank_thread.join();
   if_thread.join();
+  Messaging::console_display().flush();
+  if (verifier) {
+    verifier->done();
+    verifier_thread.join();
+  }
+  timers.stop();
+  if (recorder)
+    record_bank_state(*recorder, bank);
+  if (audit) {
+    // To be kept apart from the file, which it vouches for
+    audit->flush();
+    std::clog << "audit head " << Crypto::to_hex(audit->head()) << '\n';
+  }
+  if (metrics_file) {
+    metrics_writer = {};
+    Metrics::Registry::instance().write_prometheus_file(*metrics_file);
+  }
+  if (dispatch_mode != Messaging::Dispatch_mode::fixed) {
+    Logger_wrap_sync log{std::clog};
+    Messaging::report_dispatch_stats(log);
+  }
   return 0;
 }
-catch (const std::exception&) {
-
+catch (const std::exception& e) {
+  std::cerr << "atm_app: " << e.what() << '\n';
+  return 1;
 }
@@ -0,0 +1,59 @@
+#include "../library/core/Account_snapshot.hpp"
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// Turns the text export of a bank's accounts into a snapshot once, so that
+// the bank can map it at startup instead of parsing millions of lines
+// every time; or makes up accounts, in either form, for trying out big
+// banks
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox accounts snapshot maker"};
+  std::optional<std::string> csv_file;
+  std::optional<std::size_t> generate;
+  auto* csv_opt{app.add_option("-c,--csv", csv_file,
+                               "Accounts as text: account,balance per line")};
+  app.add_option("-g,--generate", generate,
+                 "Make up this many accounts instead")
+    ->excludes(csv_opt);
+  unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+  app.add_option("-t,--threads", threads, "Threads parsing the text");
+  bool text{false};
+  app.add_flag("--text", text, "Write text rather than a snapshot");
+  std::string out_file;
+  app.add_option("-o,--output", out_file, "File to write")->required();
+  CLI11_PARSE(app, argc, argv);
+  if (!csv_file && !generate) {
+    std::cerr << "Need --csv or --generate\n";
+    return 2;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+  auto t{Clock::now()};
+  const auto accounts{csv_file ? Accounting::read_accounts_csv(*csv_file, Accounting::usd, threads)
+                               : Accounting::synthetic_accounts(*generate)};
+  const Ms read{Clock::now() - t};
+  t = Clock::now();
+  if (text)
+    Accounting::write_accounts_csv(out_file, accounts);
+  else
+    accounts.save(out_file);
+  const Ms saved{Clock::now() - t};
+
+  std::cout << accounts.size() << " accounts: read " << read.count() << " ms, written "
+            << saved.count() << " ms\n";
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << e.what() << '\n';
+  return 1;
+}
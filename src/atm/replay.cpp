@@ -0,0 +1,172 @@
+#include "Atm_machine.hpp"
+#include "Bank_machine.hpp"
+#include "Interface_machine.hpp"
+
+#include <CLI/CLI.hpp>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+
+//------------------------------------------------------------------------------
+
+// Feeds a trace recorded by atm_app --record back into fresh actors.
+// Each actor gets exactly the stream it received when recording; what the
+// actors send to each other during the replay is dropped, so the run is
+// determined by the trace alone.
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox trace replay"};
+  std::string trace_file;
+  app.add_option("trace", trace_file, "Trace written by atm_app --record")
+    ->required();
+  bool original_timing{false};
+  app.add_flag("-t,--original-timing", original_timing,
+               "Keep the recorded gaps between messages");
+  bool show_output{false};
+  app.add_flag("-o,--show-output", show_output,
+               "Print what the interface would have displayed");
+  bool no_risk_checks{false};
+  app.add_flag("--no-risk-checks", no_risk_checks,
+               "For traces recorded with atm_app --no-risk-checks");
+  std::optional<std::string> accounts_file;
+  app.add_option("-a,--accounts", accounts_file,
+                 "For traces recorded with atm_app --accounts");
+  std::optional<std::string> pins_file;
+  app.add_option("--pins", pins_file, "For traces recorded with atm_app --pins");
+  CLI11_PARSE(app, argc, argv);
+
+  const auto records{Messaging::read_trace(trace_file)};
+  const Messaging::Sender no_reply{};
+
+  Accounting::Money opening_balance{bank_machine{}.current_balance()};
+  for (const auto& rec : records)
+    if (rec.type == Messaging::Trace_codec<bank_opening>::type) {
+      Messaging::Trace_in in{rec};
+      opening_balance = Messaging::Trace_codec<bank_opening>::decode(in, no_reply).balance;
+    }
+
+  bank_machine bank{accounts_file ? Accounting::load_accounts(*accounts_file)
+                                  : Accounting::Account_snapshot::build(
+                                      default_accounts(), opening_balance),
+                    pins_file ? std::make_shared<Accounting::Pin_store const>(
+                                  Accounting::read_pins(*pins_file))
+                              : default_pins()};
+  // The bank's risk windows go by the recorded time of the message last
+  // fed, which is close to, not exactly, when the bank saw it when
+  // recording: a decision right at the edge of a window may come out
+  // differently
+  std::atomic<std::uint64_t> trace_seconds{0};
+  if (!no_risk_checks)
+    bank.use_risk_checks({}, [&] { return trace_seconds.load(std::memory_order_acquire); });
+  interface_machine interface_hardware{
+    show_output ? &Messaging::console_display().open() : nullptr};
+  // Balances read from the board were never messages; the replayed
+  // bank's board gives the atm the same path through its states
+  atm machine{Messaging::Sender{}, interface_sender{}, nullptr, {},
+              standard_cassettes(), &bank.published_balances()};
+
+  std::thread bank_thread(&bank_machine::run, &bank);
+  std::thread if_thread(&interface_machine::run, &interface_hardware);
+  std::thread atm_thread(&atm::run, &machine);
+
+  std::optional<Accounting::Money> expected_balance;
+  std::map<std::string, Accounting::Money, std::less<>> expected_accounts;
+  std::size_t replayed{0};
+  std::size_t truncated{0};
+  Messaging::Sender to_atm{machine.get_sender()};
+  Messaging::Sender to_bank{bank.get_sender()};
+  interface_sender to_interface{interface_hardware.get_sender()};
+
+  const auto start{std::chrono::steady_clock::now()};
+  for (const auto& rec : records) {
+    if (rec.type == Messaging::Trace_codec<bank_state>::type) {
+      Messaging::Trace_in in{rec};
+      expected_balance = Messaging::Trace_codec<bank_state>::decode(in, no_reply).balance;
+      continue;
+    }
+    if (rec.type == Messaging::Trace_codec<bank_account_state>::type) {
+      Messaging::Trace_in in{rec};
+      auto state{Messaging::Trace_codec<bank_account_state>::decode(in, no_reply)};
+      expected_accounts.insert_or_assign(std::move(state.account), state.balance);
+      continue;
+    }
+    if (original_timing)
+      std::this_thread::sleep_until(start + std::chrono::nanoseconds{rec.timestamp_ns});
+    trace_seconds.store(rec.timestamp_ns / 1'000'000'000, std::memory_order_release);
+    if (rec.truncated) {
+      ++truncated;
+      continue;
+    }
+    bool ok{false};
+    switch (rec.queue) {
+    case atm_trace_queue::atm:
+      ok = atm_trace_types::replay(rec, to_atm, no_reply);
+      break;
+    case atm_trace_queue::bank:
+      ok = atm_trace_types::replay(rec, to_bank, no_reply);
+      break;
+    case atm_trace_queue::interface:
+      ok = atm_trace_types::replay(rec, to_interface, no_reply);
+      break;
+    default:
+      break;
+    }
+    if (ok)
+      ++replayed;
+  }
+
+  bank.done();
+  machine.done();
+  interface_hardware.done();
+  atm_thread.join();
+  bank_thread.join();
+  if_thread.join();
+  const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+
+  if (show_output)
+    Messaging::console_display().flush();
+  std::cout << "Replayed " << replayed << " messages in " << elapsed.count()
+            << " s (" << static_cast<double>(replayed) / elapsed.count()
+            << " msg/s)\n";
+  if (truncated)
+    std::cout << truncated << " messages were too long to record whole and were skipped\n";
+
+  if (!expected_balance) {
+    std::cout << "Trace has no final bank state to verify\n";
+    return 0;
+  }
+  // Accounts the recording does not list had not moved
+  const auto& board{bank.published_balances()};
+  std::size_t mismatches{0};
+  const auto mismatch{[&](std::string_view account, const auto& recorded, const auto& now) {
+    if (++mismatches <= 10)
+      std::cout << "  " << account << ": recorded " << recorded << ", replayed " << now << '\n';
+  }};
+  for (std::size_t i{0}; i < board.size(); ++i) {
+    const auto it{expected_accounts.find(board.account(i))};
+    const auto expected{it != expected_accounts.end() ? it->second : board.opening(i)};
+    if (expected != board.balance(i))
+      mismatch(board.account(i), expected, board.balance(i));
+    if (it != expected_accounts.end())
+      expected_accounts.erase(it);
+  }
+  for (const auto& [account, expected] : expected_accounts)
+    mismatch(account, expected, "no such account");
+  if (mismatches || *expected_balance != bank.current_balance()) {
+    std::cout << "Bank state MISMATCH: recorded " << *expected_balance
+              << ", replayed " << bank.current_balance() << ", " << mismatches
+              << " accounts differ\n";
+    return 1;
+  }
+  std::cout << "Bank state matches: " << bank.current_balance() << " in "
+            << board.size() << " accounts\n";
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << "cashbox_replay: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,98 @@
+#include "../library/core/Account_snapshot.hpp"
+#include "../library/core/Settlement.hpp"
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+namespace {
+
+const char* describe(Accounting::Discrepancy_kind kind)
+{
+  switch (kind) {
+  case Accounting::Discrepancy_kind::unpaid: return "debited, not paid out";
+  case Accounting::Discrepancy_kind::unbooked: return "paid out, not debited";
+  case Accounting::Discrepancy_kind::mismatch: return "paid out, debited otherwise";
+  case Accounting::Discrepancy_kind::bad_notes: return "notes do not add up";
+  }
+  return "?";
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+// End of day: adds up a journal written by atm_app --journal, and reports
+// the totals and every withdrawal whose debits and cash disagree. Exits 3
+// if there were any, so that a script can tell
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox end-of-day settlement"};
+  std::string journal_file;
+  app.add_option("journal", journal_file, "The day's journal")->required();
+  std::optional<std::string> accounts_file;
+  app.add_option("-a,--accounts", accounts_file,
+                 "The accounts the bank served, as given to atm_app "
+                 "(default: the book's one account)");
+  unsigned threads{std::max(1u, std::thread::hardware_concurrency())};
+  app.add_option("-t,--threads", threads, "Threads adding up");
+  std::size_t shown{20};
+  app.add_option("-n,--discrepancies", shown, "Discrepancies to list");
+  bool by_account{false};
+  app.add_flag("--by-account", by_account, "List what each account was debited");
+  CLI11_PARSE(app, argc, argv);
+
+  using Accounting::Money;
+  const auto accounts{accounts_file ? Accounting::load_accounts(*accounts_file)
+                                    : Accounting::Account_snapshot::build(
+                                        std::vector<std::string>{"acc1234"}, Money::major(0))};
+  const Accounting::Journal_file journal{journal_file};
+  const auto entries{journal.entries()};
+  const auto currency{entries.empty() ? accounts.currency() : entries.front().currency};
+  const auto money{[&](std::int64_t minor) { return Money::minor(minor, currency); }};
+
+  const auto start{std::chrono::steady_clock::now()};
+  const auto day{Accounting::settle(entries, accounts.size(), threads)};
+  const std::chrono::duration<double, std::milli> took{std::chrono::steady_clock::now() - start};
+
+  std::cout << day.entries << " entries settled in " << took.count() << " ms\n"
+            << "debited   " << money(day.debited) << '\n'
+            << "refunded  " << money(day.refunded) << '\n'
+            << "net       " << money(day.debited - day.refunded) << '\n'
+            << "paid out  " << money(day.dispensed) << "\n\n";
+
+  std::cout << "terminal  withdrawals  debited  paid out\n";
+  for (const auto& t : day.terminals)
+    std::cout << (t.terminal ? std::to_string(t.terminal) : std::string{"untracked"}) << "  "
+              << t.withdrawals << "  " << money(t.debited) << "  " << money(t.dispensed) << '\n';
+
+  std::cout << "\ndenomination  notes\n";
+  for (const auto& d : day.denominations)
+    std::cout << money(d.denomination) << "  " << d.notes << '\n';
+
+  if (by_account) {
+    std::cout << "\naccount  debited\n";
+    for (std::size_t i{0}; i < day.account_debited.size(); ++i)
+      if (day.account_debited[i])
+        std::cout << accounts.name(i) << "  " << money(day.account_debited[i]) << '\n';
+  }
+
+  std::cout << '\n' << day.discrepancies.size() << " discrepancies\n";
+  for (std::size_t i{0}; i < std::min(shown, day.discrepancies.size()); ++i) {
+    const auto& d{day.discrepancies[i]};
+    std::cout << "atm " << (d.request_id >> 32) << " request " << (d.request_id & 0xffff'ffff)
+              << ": " << describe(d.kind) << ", debited " << money(d.debited)
+              << ", paid out " << money(d.dispensed) << '\n';
+  }
+  return day.discrepancies.empty() ? 0 : 3;
+}
+catch (const std::exception& e) {
+  std::cerr << e.what() << '\n';
+  return 1;
+}
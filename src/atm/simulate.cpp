@@ -0,0 +1,249 @@
+#include "Atm_machine.hpp"
+#include "Bank_machine.hpp"
+#include "Interface_machine.hpp"
+
+#include "../library/core/Simulation.hpp"
+
+#include <CLI/CLI.hpp>
+#include <algorithm>
+#include <chrono>
+#include <future>
+#include <limits>
+#include <optional>
+
+//------------------------------------------------------------------------------
+
+// A customer who reads the screen before pressing anything: card, PIN
+// (now and then a wrong one), then a withdrawal or a look at the balance
+// followed by cancel. Runs on whichever thread shows the screens.
+class customer
+{
+  std::optional<Messaging::Sender> atm_queue;  // Set once the atm exists
+  Messaging::Sim_random rng;
+  std::uint64_t sessions_left;
+  std::uint64_t sessions_done{0};
+  std::uint64_t sessions_total;
+  bool acted{false};
+  std::promise<void> all_done;
+public:
+  customer(std::uint64_t sessions, std::uint64_t seed):
+    rng(seed), sessions_left(sessions), sessions_total(sessions)
+  {}
+  void use_atm(Messaging::Sender atm_queue_)
+  {
+    atm_queue.emplace(atm_queue_);
+  }
+  std::future<void> finished()
+  {
+    return all_done.get_future();
+  }
+  void on_screen(screen s)
+  {
+    switch (s)
+    {
+    case screen::enter_card:
+      if (sessions_left)
+      {
+        --sessions_left;
+        acted=false;
+        atm_queue->send(card_inserted("acc1234"));
+      }
+      break;
+    case screen::enter_pin:
+      for (const char digit : rng.chance(5) ? "1111" : "1937")
+      {
+        if (digit)
+        {
+          atm_queue->send(digit_pressed(digit));
+        }
+      }
+      break;
+    case screen::withdrawal_options:
+      if (acted)
+      {
+        atm_queue->send(cancel_pressed());
+      }
+      else if (rng.chance(50))
+      {
+        atm_queue->send(withdraw_pressed(Accounting::Money::major(50)));
+      }
+      else
+      {
+        atm_queue->send(balance_pressed());
+      }
+      acted=true;
+      break;
+    case screen::card_ejected:
+      if (++sessions_done == sessions_total)
+      {
+        all_done.set_value();
+      }
+      break;
+    default:
+      break;
+    }
+  }
+  std::uint64_t completed() const noexcept
+  {
+    return sessions_done;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct run_result
+{
+  std::uint64_t sessions;
+  std::uint64_t messages;
+  double seconds;
+  Accounting::Money balance;
+  std::uint64_t rejected;   // Withdrawals the cassettes could not pay
+  std::uint64_t schedule_hash;
+};
+
+constexpr auto initial_balance{Accounting::Money::major(40'000'000)};
+
+// The book's PIN hashed with a single round: what is measured here is
+// the actors, and a session would otherwise cost milliseconds of hashing
+std::shared_ptr<Accounting::Pin_store const> quick_pins()
+{
+  std::pair<std::string, std::string> const pins[]{{"acc1234", "1937"}};
+  return std::make_shared<Accounting::Pin_store const>(pins, 1);
+}
+
+// Each session takes at most one 50 note, so a run of sessions never finds
+// these empty (up to 2^32 sessions); a refusal is then the dispenser's doing
+Accounting::Note_dispenser cassettes_for(std::uint64_t sessions)
+{
+  using Accounting::Money;
+  auto const notes{static_cast<std::uint32_t>(
+    std::min<std::uint64_t>(sessions, std::numeric_limits<std::uint32_t>::max()))};
+  return {{Money::major(50), notes}, {Money::major(20), notes}};
+}
+
+//------------------------------------------------------------------------------
+
+// All three actors on this thread, interleaved by a scheduler seeded with seed
+run_result simulated(std::uint64_t sessions, std::uint64_t seed,
+                     Messaging::Trace_recorder* tap)
+{
+  customer cust(sessions, ~seed);
+  bank_machine bank(initial_balance, default_accounts(), quick_pins());
+  interface_machine interface_hardware(nullptr, [&](screen s) { cust.on_screen(s); });
+  atm machine(bank.get_sender(), interface_hardware.get_sender(), nullptr, {},
+              cassettes_for(sessions));
+  cust.use_atm(machine.get_sender());
+  machine.mailbox().set_single_threaded(true);
+  bank.mailbox().set_single_threaded(true);
+  interface_hardware.mailbox().set_single_threaded(true);
+  if (tap) {
+    machine.mailbox().record_to(tap, atm_trace_queue::atm);
+    bank.mailbox().record_to(tap, atm_trace_queue::bank);
+    interface_hardware.mailbox().record_to(tap, atm_trace_queue::interface);
+  }
+
+  Messaging::Sim_scheduler scheduler(seed);
+  scheduler.add(machine);
+  scheduler.add(bank);
+  scheduler.add(interface_hardware);
+
+  if (tap)
+    tap->record(atm_trace_queue::bank, bank_opening(initial_balance));
+
+  const auto start{std::chrono::steady_clock::now()};
+  machine.start();
+  scheduler.run();
+  const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+  if (tap)
+    record_bank_state(*tap, bank);
+  return {cust.completed(), scheduler.steps(), elapsed.count(), bank.current_balance(),
+          machine.cassettes().stats().rejected, scheduler.schedule_hash()};
+}
+
+//------------------------------------------------------------------------------
+
+// The same customers against the actors on their own threads
+run_result threaded(std::uint64_t sessions, std::uint64_t seed)
+{
+  customer cust(sessions, ~seed);
+  auto finished{cust.finished()};
+  bank_machine bank(initial_balance, default_accounts(), quick_pins());
+  interface_machine interface_hardware(nullptr, [&](screen s) { cust.on_screen(s); });
+  atm machine(bank.get_sender(), interface_hardware.get_sender(), nullptr, {},
+              cassettes_for(sessions));
+  cust.use_atm(machine.get_sender());
+
+  const auto start{std::chrono::steady_clock::now()};
+  std::thread bank_thread(&bank_machine::run, &bank);
+  std::thread if_thread(&interface_machine::run, &interface_hardware);
+  std::thread atm_thread(&atm::run, &machine);
+  finished.wait();
+  bank.done();
+  machine.done();
+  interface_hardware.done();
+  atm_thread.join();
+  bank_thread.join();
+  if_thread.join();
+  const std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() - start};
+
+  const auto messages{machine.mailbox().stats().pushed + bank.mailbox().stats().pushed
+                      + interface_hardware.mailbox().stats().pushed};
+  return {cust.completed(), messages, elapsed.count(), bank.current_balance(),
+          machine.cassettes().stats().rejected, 0};
+}
+
+//------------------------------------------------------------------------------
+
+void report(const char* mode, const run_result& r)
+{
+  std::cout << mode << ": " << r.sessions << " sessions, " << r.messages
+            << " messages in " << r.seconds << " s, "
+            << static_cast<double>(r.sessions) / r.seconds << " sessions/s, "
+            << "bank balance " << r.balance << ", "
+            << r.rejected << " withdrawals refused by the cassettes\n";
+}
+
+//------------------------------------------------------------------------------
+
+// Runs many card -> PIN -> withdraw/balance sessions through the ATM actors,
+// driven by one seeded scheduler on one thread; the same seed gives the same
+// interleaving (and schedule hash) again. For comparison, runs the same
+// customers with every actor on its own thread.
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox ATM simulation"};
+  std::uint64_t sessions{1'000'000};
+  app.add_option("-n,--sessions", sessions, "Sessions to simulate");
+  std::uint64_t seed{1};
+  app.add_option("-s,--seed", seed, "Scheduler seed; the same seed replays the interleaving");
+  std::uint64_t threaded_sessions{20'000};
+  app.add_option("-t,--threaded-sessions", threaded_sessions,
+                 "Sessions for the threaded comparison run (0 to skip)");
+  std::optional<std::string> record_file;
+  app.add_option("-r,--record", record_file,
+                 "Record the simulated run as a trace for atm_replay");
+  CLI11_PARSE(app, argc, argv);
+
+  std::optional<Messaging::Trace_recorder> recorder;
+  if (record_file)
+    recorder.emplace(*record_file);
+
+  const auto sim{simulated(sessions, seed, recorder ? &*recorder : nullptr)};
+  report("simulated", sim);
+  std::cout << "  seed " << seed << ", schedule hash " << std::hex
+            << sim.schedule_hash << std::dec << '\n';
+
+  if (threaded_sessions) {
+    const auto thr{threaded(threaded_sessions, seed)};
+    report("threaded", thr);
+    std::cout << "  simulation is "
+              << (static_cast<double>(sim.sessions) / sim.seconds)
+                   / (static_cast<double>(thr.sessions) / thr.seconds)
+              << "x the threaded session rate\n";
+  }
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << "cashbox_simulate: " << e.what() << '\n';
+  return 1;
+}
@@ -0,0 +1,411 @@
+#ifndef CASHBOX_ACCOUNT_SNAPSHOT_HPP
+#define CASHBOX_ACCOUNT_SNAPSHOT_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "File_image.hpp"
+#include "Money.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+// An account as imported: its name and what it holds to begin with
+struct Opening_balance {
+  std::string_view account;
+  Money balance;
+};
+
+inline constexpr std::array<char, 8> accounts_magic{'C','B','A','C','C','T','S','1'};
+
+// Start of a snapshot file; offsets are in bytes from the start of the file
+struct Accounts_header {
+  std::array<char, 8> magic;
+  std::uint64_t count;
+  Currency currency;
+  std::uint32_t reserved;
+  std::uint64_t balances_at;        // count x int64 minor units
+  std::uint64_t offsets_at;         // (count + 1) x uint64, into the names
+  std::uint64_t names_at;
+  std::uint64_t names_size;
+};
+
+static_assert(std::is_trivially_copyable_v<Accounts_header>);
+
+namespace detail {
+  // Sorts accounts by name, unless they are already. The first 16 bytes
+  // of each name are packed big-endian into a key kept beside the
+  // account's index, so that most comparisons stay in the array being
+  // sorted rather than chase names all over memory (or a mapped file);
+  // only equal keys fall back to the names
+  inline void sort_by_account(std::vector<Opening_balance>& accounts)
+  {
+    const auto by_name{[](const Opening_balance& a, const Opening_balance& b) {
+      return a.account < b.account;
+    }};
+    if (std::is_sorted(accounts.begin(), accounts.end(), by_name))
+      return;
+    struct Key {
+      std::uint64_t hi, lo;
+      std::size_t index;
+    };
+    const auto pack{[](std::string_view s, std::size_t from) {
+      std::uint64_t res{0};
+      for (auto i{from}; i < from + 8; ++i)
+        res = res << 8 | (i < s.size() ? static_cast<unsigned char>(s[i]) : 0u);
+      return res;
+    }};
+    std::vector<Key> keys(accounts.size());
+    for (std::size_t i{0}; i < accounts.size(); ++i)
+      keys[i] = {pack(accounts[i].account, 0), pack(accounts[i].account, 8), i};
+    std::sort(keys.begin(), keys.end(), [&](const Key& a, const Key& b) {
+      if (a.hi != b.hi)
+        return a.hi < b.hi;
+      if (a.lo != b.lo)
+        return a.lo < b.lo;
+      return accounts[a.index].account < accounts[b.index].account;
+    });
+    std::vector<Opening_balance> res;
+    res.reserve(accounts.size());
+    for (const auto& k : keys)
+      res.push_back(accounts[k.index]);
+    accounts.swap(res);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// Accounts sorted by name with their opening balances, all in one
+// currency, as one run of bytes that is the same in memory and on disk:
+// the balances as an array of minor units, the names one after another
+// with an array of where each starts. open() maps a saved snapshot and is
+// ready at once, with nothing to parse or allocate per account; finding
+// an account is a binary search over the names in place;
+class Account_snapshot {
+  Messaging::File_image image_;
+  const Accounts_header* header_{nullptr};
+  const std::int64_t* balances_{nullptr};
+  const std::uint64_t* offsets_{nullptr};
+  const char* names_{nullptr};
+
+  static constexpr std::uint64_t align64(std::uint64_t n) noexcept
+    { return (n + 63) & ~std::uint64_t{63}; }
+
+  void attach()
+  {
+    if (image_.size() < sizeof(Accounts_header))
+      throw std::runtime_error("Account_snapshot: not a cashbox snapshot");
+    header_ = reinterpret_cast<const Accounts_header*>(image_.data());
+    const auto& h{*header_};
+    if (h.magic != accounts_magic || h.count >= image_.size()
+        || h.balances_at + h.count * 8 > image_.size()
+        || h.offsets_at + (h.count + 1) * 8 > image_.size()
+        || h.names_at + h.names_size > image_.size()
+        || h.balances_at % 8 || h.offsets_at % 8)
+      throw std::runtime_error("Account_snapshot: not a cashbox snapshot");
+    balances_ = reinterpret_cast<const std::int64_t*>(image_.data() + h.balances_at);
+    offsets_ = reinterpret_cast<const std::uint64_t*>(image_.data() + h.offsets_at);
+    names_ = reinterpret_cast<const char*>(image_.data() + h.names_at);
+    if (offsets_[h.count] != h.names_size)
+      throw std::runtime_error("Account_snapshot: not a cashbox snapshot");
+  }
+public:
+  Account_snapshot() = default;
+
+  // Sorts accounts by name (unless they are already) and lays them out;
+  // names must be unique and balances in currency
+  static Account_snapshot build(std::vector<Opening_balance> accounts, Currency currency = usd)
+  {
+    detail::sort_by_account(accounts);
+    std::uint64_t names_size{0};
+    for (std::size_t i{0}; i < accounts.size(); ++i) {
+      if (i && accounts[i - 1].account == accounts[i].account)
+        throw std::invalid_argument("Account_snapshot: duplicate account "
+                                    + std::string{accounts[i].account});
+      if (accounts[i].balance.currency() != currency)
+        throw std::invalid_argument("Account_snapshot: foreign balance for "
+                                    + std::string{accounts[i].account});
+      names_size += accounts[i].account.size();
+    }
+
+    const auto n{accounts.size()};
+    Accounts_header h{};
+    h.magic = accounts_magic;
+    h.count = n;
+    h.currency = currency;
+    h.balances_at = align64(sizeof(Accounts_header));
+    h.offsets_at = align64(h.balances_at + n * 8);
+    h.names_at = align64(h.offsets_at + (n + 1) * 8);
+    h.names_size = names_size;
+
+    Account_snapshot res;
+    res.image_ = Messaging::File_image{h.names_at + names_size};
+    auto* out{res.image_.writable()};
+    std::memcpy(out, &h, sizeof(h));
+    auto* balances{reinterpret_cast<std::int64_t*>(out + h.balances_at)};
+    auto* offsets{reinterpret_cast<std::uint64_t*>(out + h.offsets_at)};
+    auto* names{reinterpret_cast<char*>(out + h.names_at)};
+    std::uint64_t at{0};
+    for (std::size_t i{0}; i < n; ++i) {
+      balances[i] = accounts[i].balance.minor_units();
+      offsets[i] = at;
+      std::memcpy(names + at, accounts[i].account.data(), accounts[i].account.size());
+      at += accounts[i].account.size();
+    }
+    offsets[n] = at;
+    res.attach();
+    return res;
+  }
+
+  // Every account holding the same to begin with
+  static Account_snapshot build(std::span<const std::string> accounts, Money opening)
+  {
+    std::vector<Opening_balance> res;
+    res.reserve(accounts.size());
+    for (const auto& a : accounts)
+      res.push_back({a, opening});
+    return build(std::move(res), opening.currency());
+  }
+
+  // A saved snapshot, mapped rather than read
+  static Account_snapshot open(const std::string& path)
+  {
+    Account_snapshot res;
+    res.image_ = Messaging::File_image::map(path);
+    res.attach();
+    return res;
+  }
+
+  void save(const std::string& path) const
+  {
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file{
+      std::fopen(path.c_str(), "wb"), &std::fclose};
+    if (!file || std::fwrite(image_.data(), 1, image_.size(), file.get()) != image_.size())
+      throw std::runtime_error("Account_snapshot: cannot write " + path);
+  }
+
+  std::optional<std::size_t> find(std::string_view account) const noexcept
+  {
+    std::size_t lo{0}, n{size()};
+    while (n) {                             // First name not before account
+      const auto half{n / 2};
+      if (name(lo + half) < account) {
+        lo += half + 1;
+        n -= half + 1;
+      }
+      else
+        n = half;
+    }
+    if (lo == size() || name(lo) != account)
+      return std::nullopt;
+    return lo;
+  }
+
+  std::string_view name(std::size_t i) const noexcept
+    { return {names_ + offsets_[i], offsets_[i + 1] - offsets_[i]}; }
+
+  Money balance(std::size_t i) const noexcept
+    { return Money::minor(balances_[i], currency()); }
+
+  std::size_t size() const noexcept { return header_ ? header_->count : 0; }
+
+  Currency currency() const noexcept { return header_ ? header_->currency : usd; }
+
+  bool is_mapped() const noexcept { return image_.is_mapped(); }
+
+  std::size_t bytes() const noexcept { return image_.size(); }
+};
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+  // One line of an accounts file, without its end of line: false if bad
+  inline bool parse_account_line(std::string_view line, Currency currency,
+                                 std::vector<Opening_balance>& out)
+  {
+    if (!line.empty() && line.back() == '\r')
+      line.remove_suffix(1);
+    if (line.empty() || line.front() == '#')
+      return true;
+    const auto comma{line.find(',')};
+    if (comma == 0 || comma == std::string_view::npos)
+      return false;
+    const auto balance{parse_money(line.substr(comma + 1), currency)};
+    if (!balance)
+      return false;
+    out.push_back({line.substr(0, comma), *balance});
+    return true;
+  }
+
+  // Parses the lines of text, sorted by account; the position of the
+  // first bad line, if any
+  inline std::optional<std::size_t> parse_accounts(std::string_view text, std::size_t from,
+                                                   Currency currency,
+                                                   std::vector<Opening_balance>& out)
+  {
+    out.reserve(text.size() / 16);
+    for (std::size_t at{0}; at < text.size();) {
+      const auto end{std::min(text.find('\n', at), text.size())};
+      if (!parse_account_line(text.substr(at, end - at), currency, out))
+        return from + at;
+      at = end + 1;
+    }
+    sort_by_account(out);
+    return std::nullopt;
+  }
+}
+
+// Accounts as text, one a line: account,balance (balance as parse_money()
+// reads it); blank lines and lines starting with '#' are skipped. The file
+// is mapped and cut into as many pieces as there are threads, at line
+// ends; each thread parses and sorts its piece, the pieces are merged
+// pairwise, also in parallel, and the result laid out as a snapshot;
+inline Account_snapshot read_accounts_csv(const std::string& path, Currency currency = usd,
+                                          unsigned threads = std::max(1u, std::thread::hardware_concurrency()))
+{
+  const auto image{Messaging::File_image::map(path, Messaging::File_access::sequential)};
+  const std::string_view text{reinterpret_cast<const char*>(image.data()), image.size()};
+  std::vector<std::size_t> cuts{0};
+  for (unsigned t{1}; t < threads; ++t) {
+    const auto nl{text.find('\n', std::max(cuts.back(), text.size() / threads * t))};
+    if (nl == std::string_view::npos)
+      break;
+    cuts.push_back(nl + 1);
+  }
+  cuts.push_back(text.size());
+  const auto pieces{cuts.size() - 1};
+
+  std::vector<std::vector<Opening_balance>> parsed(pieces);
+  std::vector<std::optional<std::size_t>> bad(pieces);
+  {
+    std::vector<std::jthread> workers;
+    for (std::size_t p{1}; p < pieces; ++p)
+      workers.emplace_back([&, p] {
+        bad[p] = detail::parse_accounts(text.substr(cuts[p], cuts[p + 1] - cuts[p]), cuts[p],
+                                        currency, parsed[p]);
+      });
+    bad[0] = detail::parse_accounts(text.substr(0, cuts[1]), 0, currency, parsed[0]);
+  }
+  for (const auto& at : bad)
+    if (at)
+      throw std::runtime_error("read_accounts_csv(): " + path + ':'
+                               + std::to_string(std::count(text.begin(), text.begin() + *at, '\n') + 1)
+                               + ": bad line");
+
+  std::vector<std::size_t> starts{0};
+  for (const auto& p : parsed)
+    starts.push_back(starts.back() + p.size());
+  std::vector<Opening_balance> res;
+  res.reserve(starts.back());
+  for (auto& p : parsed) {
+    res.insert(res.end(), p.begin(), p.end());
+    std::vector<Opening_balance>{}.swap(p);
+  }
+  const auto by_name{[](const Opening_balance& a, const Opening_balance& b) {
+    return a.account < b.account;
+  }};
+  for (std::size_t width{1}; width < pieces; width *= 2) {
+    std::vector<std::jthread> workers;
+    for (std::size_t p{0}; p + width < pieces; p += 2 * width)
+      workers.emplace_back([&, p] {
+        const auto first{res.begin() + static_cast<std::ptrdiff_t>(starts[p])};
+        const auto middle{res.begin() + static_cast<std::ptrdiff_t>(starts[p + width])};
+        const auto last{res.begin()
+                        + static_cast<std::ptrdiff_t>(starts[std::min(p + 2 * width, pieces)])};
+        std::inplace_merge(first, middle, last, by_name);
+      });
+  }
+  return Account_snapshot::build(std::move(res), currency);
+}
+
+// A snapshot if the file starts like one, else accounts as text
+inline Account_snapshot load_accounts(const std::string& path)
+{
+  std::array<char, 8> magic{};
+  if (std::ifstream in{path, std::ios::binary};
+      in.read(magic.data(), magic.size()) && magic == accounts_magic)
+    return Account_snapshot::open(path);
+  return read_accounts_csv(path);
+}
+
+// Writes accounts as read_accounts_csv() reads them
+inline void write_accounts_csv(const std::string& path, const Account_snapshot& accounts)
+{
+  std::unique_ptr<std::FILE, int(*)(std::FILE*)> file{
+    std::fopen(path.c_str(), "wb"), &std::fclose};
+  if (!file)
+    throw std::runtime_error("write_accounts_csv(): cannot open " + path);
+  const auto digits{accounts.currency().minor_digits()};
+  std::uint64_t scale{1};
+  for (auto d{digits}; d; --d)
+    scale *= 10;
+  std::string line;
+  for (std::size_t i{0}; i < accounts.size(); ++i) {
+    const auto minor{accounts.balance(i).minor_units()};
+    const auto magnitude{minor < 0 ? 0 - static_cast<std::uint64_t>(minor)
+                                   : static_cast<std::uint64_t>(minor)};
+    line.assign(accounts.name(i));
+    line += minor < 0 ? ",-" : ",";
+    line += std::to_string(magnitude / scale);
+    if (digits) {
+      const auto frac{std::to_string(magnitude % scale)};
+      line.append(".").append(digits - frac.size(), '0').append(frac);
+    }
+    line += '\n';
+    if (std::fwrite(line.data(), 1, line.size(), file.get()) != line.size())
+      throw std::runtime_error("write_accounts_csv(): cannot write " + path);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// n made-up accounts, "ac" and ten digits, in no particular order, with
+// balances of up to 10000.00, for trying out and benchmarking big banks
+inline Account_snapshot synthetic_accounts(std::size_t n, Currency currency = usd,
+                                           std::uint64_t seed = 1)
+{
+  constexpr std::uint64_t numbers{10'000'000'000};
+  if (n > numbers)
+    throw std::invalid_argument("synthetic_accounts(): too many accounts");
+  std::vector<char> names(n * 12 + 1);     // And snprintf's last NUL
+  std::vector<Opening_balance> res;
+  res.reserve(n);
+  const auto offset{seed % numbers};
+  for (std::uint64_t i{0}; i < n; ++i) {
+    // i -> number is a bijection on [0, numbers): 9999999967 is prime;
+    // the product goes in two parts, 99999 x 10^5 + 99967, each of which
+    // fits in 64 bits
+    const auto number{((i * 99'999 % numbers) * 100'000 + i * 99'967 + offset) % numbers};
+    auto* name{names.data() + i * 12};
+    std::snprintf(name, 13, "ac%010llu", static_cast<unsigned long long>(number));
+    res.push_back({{name, 12}, Money::minor(static_cast<std::int64_t>(number % 1'000'001), currency)});
+  }
+  return Account_snapshot::build(std::move(res), currency);
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_ACCOUNT_SNAPSHOT_HPP
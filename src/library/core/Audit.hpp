@@ -0,0 +1,372 @@
+#ifndef CASHBOX_AUDIT_HPP
+#define CASHBOX_AUDIT_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "File_image.hpp"
+#include "Sha256.hpp"
+#include "Trace.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Traceable types whose codec says `static constexpr bool audited{true};`
+template<class Msg>
+concept Audited = Traceable<Msg> && requires { requires Trace_codec<Msg>::audited; };
+
+inline constexpr std::array<char, 8> audit_magic{'C','B','A','U','D','I','T','1'};
+
+// Precedes each batch of records in an audit file. chain is the SHA-256
+// of the previous batch's chain (zeros for the first), then root,
+// sequence, count and reserved as laid out here, so that changing,
+// dropping or reordering any record or batch breaks every chain after it;
+struct Audit_batch_header {
+  std::uint64_t sequence;           // From 0
+  std::uint32_t count;              // Records that follow
+  std::uint32_t reserved;
+  Crypto::Digest root;              // Of the records' Merkle tree
+  Crypto::Digest chain;
+  std::array<std::uint8_t, 48> padding;   // Keeps the records aligned
+};
+
+static_assert(sizeof(Audit_batch_header) == 128);
+static_assert(std::is_trivially_copyable_v<Audit_batch_header>);
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+  // Merkle root of records: each one's SHA-256 a leaf, nodes the SHA-256
+  // of their two children, a lone node at the end of a level carried up
+  // as it is. Leaves and nodes are all 64-byte messages, hashed a level
+  // at a time in place in level, several per SIMD pass. The count is
+  // chained, which fixes the tree's shape, so leaves and nodes need no
+  // telling apart;
+  inline Crypto::Digest audit_root(std::span<const Trace_record> records,
+                                   std::vector<Crypto::Digest>& level)
+  {
+    if (records.empty())
+      return {};
+    level.resize(records.size());
+    Crypto::sha256_64({reinterpret_cast<const std::uint8_t*>(records.data()),
+                       records.size_bytes()}, level);
+    while (level.size() > 1) {
+      const auto pairs{level.size() / 2};
+      const auto odd{level.size() % 2};
+      // Node i only overwrites digests its group has already read
+      Crypto::sha256_64({reinterpret_cast<const std::uint8_t*>(level.data()),
+                         pairs * 2 * sizeof(Crypto::Digest)}, {level.data(), pairs});
+      if (odd)
+        level[pairs] = level.back();
+      level.resize(pairs + odd);
+    }
+    return level.front();
+  }
+
+  inline Crypto::Digest audit_chain(const Crypto::Digest& previous, const Audit_batch_header& h)
+  {
+    return Crypto::Sha256{}
+      .update(std::span<const std::uint8_t>{previous})
+      .update(std::span<const std::uint8_t>{h.root})
+      .update(&h.sequence, sizeof(h.sequence))
+      .update(&h.count, sizeof(h.count))
+      .update(&h.reserved, sizeof(h.reserved))
+      .finish();
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// An append-only, tamper-evident record of audited messages, tapped from
+// receivers like a trace (see Receiver::audit_to()). record() only copies
+// the encoded message into the batch being filled; a background thread
+// seals full batches (and partly full ones after seal_after), hashing the
+// records into a Merkle tree and chaining its root onto the previous
+// batch's, and writes them out. The chain only shows that the file is as
+// it was written up to head(); keep the head somewhere the file's writer
+// cannot reach, and have verify_audit() check against it;
+class Audit_log {
+  using Batch = std::vector<Trace_record>;
+
+  std::mutex m_;
+  std::condition_variable work_;    // Wakes the sealer
+  std::condition_variable sealed_;  // Wakes flush()
+  Batch open_;                      // Being filled
+  std::deque<Batch> full_;          // Waiting to be sealed
+  std::vector<Batch> spare_;        // Written out, for reuse
+  const std::size_t batch_size_;
+  const std::chrono::milliseconds seal_after_;
+  std::uint64_t total_{0};
+  std::uint64_t handed_over_{0};    // Batches
+  std::uint64_t written_{0};
+  bool stopping_{false};
+  std::exception_ptr error_;
+  Crypto::Digest head_{};
+  std::FILE* file_;
+  std::vector<Crypto::Digest> level_;   // Sealer only
+  std::jthread sealer_;
+
+  void hand_over()                  // Requires m_ to be held
+  {
+    full_.push_back(std::move(open_));
+    if (spare_.empty())
+      open_ = Batch{};
+    else {
+      open_ = std::move(spare_.back());
+      spare_.pop_back();
+    }
+    open_.reserve(batch_size_);
+    ++handed_over_;
+    work_.notify_one();
+  }
+
+  void write_batch(const Batch& batch, std::uint64_t sequence, const Crypto::Digest& previous,
+                   Crypto::Digest& chain)
+  {
+    Audit_batch_header h{};
+    h.sequence = sequence;
+    h.count = static_cast<std::uint32_t>(batch.size());
+    h.root = detail::audit_root(batch, level_);
+    h.chain = chain = detail::audit_chain(previous, h);
+    if (std::fwrite(&h, sizeof(h), 1, file_) != 1
+        || std::fwrite(batch.data(), sizeof(Trace_record), batch.size(), file_) != batch.size()
+        || std::fflush(file_) != 0)
+      throw std::runtime_error("Audit_log: write failed");
+  }
+
+  void seal()
+  {
+    std::unique_lock lk{m_};
+    for (;;) {
+      const bool woken{work_.wait_for(lk, seal_after_, [&] { return stopping_ || !full_.empty(); })};
+      if (full_.empty() && !open_.empty() && (!woken || stopping_))
+        hand_over();
+      if (full_.empty()) {
+        if (stopping_)
+          return;
+        continue;
+      }
+      auto batch{std::move(full_.front())};
+      full_.pop_front();
+      const auto previous{head_};
+      const auto sequence{written_};
+      lk.unlock();
+      Crypto::Digest chain{};
+      std::exception_ptr error;
+      try {
+        write_batch(batch, sequence, previous, chain);
+      }
+      catch (...) {
+        error = std::current_exception();
+      }
+      batch.clear();
+      lk.lock();
+      if (error && !error_)
+        error_ = error;
+      if (!error)
+        head_ = chain;
+      spare_.push_back(std::move(batch));
+      ++written_;
+      sealed_.notify_all();
+    }
+  }
+public:
+  explicit Audit_log(const std::string& fname, std::size_t batch_size = 1 << 12,
+                     std::chrono::milliseconds seal_after = std::chrono::milliseconds{100})
+    : batch_size_{std::clamp<std::size_t>(batch_size, 1, std::numeric_limits<std::uint32_t>::max())},
+      seal_after_{seal_after}, file_{std::fopen(fname.c_str(), "wb")}
+  {
+    if (!file_)
+      throw std::runtime_error("Audit_log: cannot open " + fname);
+    std::array<char, sizeof(Trace_record)> header{};
+    std::memcpy(header.data(), audit_magic.data(), audit_magic.size());
+    if (std::fwrite(header.data(), 1, header.size(), file_) != header.size()) {
+      std::fclose(file_);
+      throw std::runtime_error("Audit_log: write failed");
+    }
+    open_.reserve(batch_size_);
+    sealer_ = std::jthread{[this] { seal(); }};
+  }
+
+  Audit_log(const Audit_log&) = delete;
+  Audit_log& operator=(const Audit_log&) = delete;
+
+  template<class Msg>
+  void record(std::uint16_t queue, const Msg& msg)
+  {
+    if constexpr (Audited<Msg>) {
+      Trace_record head{};          // Unused payload is hashed too: zeros
+      head.timestamp_ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::system_clock::now().time_since_epoch()).count());
+      head.queue = queue;
+      head.type = Trace_codec<Msg>::type;
+      Trace_payload payload;
+      Trace_out out{payload};
+      Trace_codec<Msg>::encode(msg, out);
+      std::lock_guard lk{m_};
+      trace_records(head, payload, [&](const Trace_record& rec) {
+        open_.push_back(rec);
+        if (open_.size() == batch_size_)
+          hand_over();
+      });
+      ++total_;
+    }
+  }
+
+  // Seals and writes out everything recorded so far; rethrows what went
+  // wrong writing, if anything did
+  void flush()
+  {
+    std::unique_lock lk{m_};
+    if (!open_.empty())
+      hand_over();
+    const auto until{handed_over_};
+    sealed_.wait(lk, [&] { return written_ >= until; });
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+
+  // The chain of the last batch written
+  Crypto::Digest head()
+  {
+    std::lock_guard lk{m_};
+    return head_;
+  }
+
+  std::uint64_t recorded()
+  {
+    std::lock_guard lk{m_};
+    return total_;
+  }
+
+  ~Audit_log()
+  {
+    {
+      std::lock_guard lk{m_};
+      stopping_ = true;
+    }
+    work_.notify_one();
+    sealer_.join();
+    std::fclose(file_);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+struct Audit_verdict {
+  std::uint64_t batches{0};         // Good ones, from the start
+  std::uint64_t records{0};         // In them
+  Crypto::Digest head{};            // Chain of the last good batch
+  std::optional<std::uint64_t> bad_batch;   // The first that is not
+  std::string problem;
+
+  bool ok() const noexcept { return problem.empty(); }
+};
+
+// Checks an audit file: every batch's root against its records and its
+// chain against the batch before. The headers are walked first, which
+// touches one page per batch; then the batches, which hold each other's
+// inputs, are checked in any order, shared out between threads in runs
+// of a few. The first bad batch, and everything after it, is not to be
+// trusted;
+inline Audit_verdict verify_audit(const std::string& fname,
+                                  unsigned threads = std::max(1u, std::thread::hardware_concurrency()))
+{
+  const auto image{File_image::map(fname, File_access::sequential)};
+  const auto* const base{image.data()};
+  Audit_verdict res;
+  if (image.size() < sizeof(Trace_record)
+      || std::memcmp(base, audit_magic.data(), audit_magic.size()) != 0) {
+    res.problem = "not a cashbox audit file";
+    return res;
+  }
+
+  std::vector<std::size_t> offsets;
+  for (std::size_t at{sizeof(Trace_record)}; at < image.size();) {
+    const auto* h{reinterpret_cast<const Audit_batch_header*>(base + at)};
+    if (image.size() - at < sizeof(Audit_batch_header)
+        || (image.size() - at - sizeof(Audit_batch_header)) / sizeof(Trace_record) < h->count) {
+      res.bad_batch = offsets.size();
+      res.problem = "truncated";
+      break;
+    }
+    offsets.push_back(at);
+    at += sizeof(Audit_batch_header) + std::size_t{h->count} * sizeof(Trace_record);
+  }
+
+  const auto header{[&](std::size_t b) {
+    return reinterpret_cast<const Audit_batch_header*>(base + offsets[b]);
+  }};
+  constexpr std::size_t run{8};
+  std::atomic<std::size_t> next{0};
+  std::atomic<std::size_t> first_bad{offsets.size()};
+  const auto check{[&] {
+    std::vector<Crypto::Digest> level;
+    for (std::size_t from; (from = next.fetch_add(run, std::memory_order_relaxed)) < offsets.size();)
+      for (auto b{from}; b < std::min(from + run, offsets.size()); ++b) {
+        if (b >= first_bad.load(std::memory_order_relaxed))
+          return;
+        const auto* h{header(b)};
+        const std::span<const Trace_record> records{
+          reinterpret_cast<const Trace_record*>(h + 1), h->count};
+        const auto previous{b ? header(b - 1)->chain : Crypto::Digest{}};
+        if (h->sequence != b || detail::audit_root(records, level) != h->root
+            || detail::audit_chain(previous, *h) != h->chain) {
+          auto seen{first_bad.load(std::memory_order_relaxed)};
+          while (b < seen && !first_bad.compare_exchange_weak(seen, b, std::memory_order_relaxed)) {
+          }
+          return;
+        }
+      }
+  }};
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t{1}; t < threads; ++t)
+      workers.emplace_back(check);
+    check();
+  }
+
+  const auto good{first_bad.load()};
+  if (good < offsets.size()) {
+    res.bad_batch = good;
+    res.problem = "batch does not match its hashes";
+  }
+  res.batches = good;
+  for (std::size_t b{0}; b < good; ++b)
+    res.records += header(b)->count;
+  if (good)
+    res.head = header(good - 1)->chain;
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_AUDIT_HPP
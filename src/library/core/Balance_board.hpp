@@ -0,0 +1,81 @@
+#ifndef CASHBOX_BALANCE_BOARD_HPP
+#define CASHBOX_BALANCE_BOARD_HPP
+
+//------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Account_snapshot.hpp"
+#include "Money.hpp"
+#include "Seqlock.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+// The balances of a fixed set of accounts, each in its own cache line
+// behind a Seqlock: the bank actor that owns the accounts writes, anyone
+// may read at any time without asking it. Accounts are given at
+// construction and never change, so finding one needs no lock either.
+// The names stay in the snapshot they came in, mapped or not; only the
+// balances are copied out, into their slots;
+class Balance_board {
+  struct alignas(64) Slot {
+    Messaging::Seqlock<Money> balance;
+  };
+
+  Account_snapshot accounts_;
+  std::unique_ptr<Slot[]> slots_;
+public:
+  explicit Balance_board(Account_snapshot accounts)
+    : accounts_{std::move(accounts)}, slots_{std::make_unique<Slot[]>(accounts_.size())}
+  {
+    for (std::size_t i{0}; i < accounts_.size(); ++i)
+      slots_[i].balance.store(accounts_.balance(i));
+  }
+
+  Balance_board(const std::vector<std::string>& accounts, Money opening)
+    : Balance_board{Account_snapshot::build(accounts, opening)} {}
+
+  Balance_board(const Balance_board&) = delete;
+  Balance_board& operator=(const Balance_board&) = delete;
+
+  std::optional<std::size_t> find(std::string_view account) const noexcept
+    { return accounts_.find(account); }
+
+  // Any thread, never blocks the writer
+  Money balance(std::size_t i) const noexcept { return slots_[i].balance.load(); }
+
+  std::optional<Money> balance(std::string_view account) const noexcept
+  {
+    const auto i{find(account)};
+    return i ? std::optional{balance(*i)} : std::nullopt;
+  }
+
+  // Only the owner of the accounts, one thread at a time
+  void publish(std::size_t i, Money balance) noexcept { slots_[i].balance.store(balance); }
+
+  // What account i held when the board was made
+  Money opening(std::size_t i) const noexcept { return accounts_.balance(i); }
+
+  std::size_t size() const noexcept { return accounts_.size(); }
+
+  std::string_view account(std::size_t i) const noexcept { return accounts_.name(i); }
+
+  Currency currency() const noexcept { return accounts_.currency(); }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_BALANCE_BOARD_HPP
@@ -0,0 +1,312 @@
+#ifndef CASHBOX_BROADCAST_HPP
+#define CASHBOX_BROADCAST_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// What a publisher does about a subscriber a whole ring behind;
+enum class Slow_subscriber {
+  block,            // Wait for it; nothing is ever lost
+  drop,             // Skip it past what is about to be overwritten
+  disconnect        // Cut it off; its next() returns nullptr
+};
+
+struct Subscriber_stats {
+  std::string name;
+  Slow_subscriber policy;
+  std::uint64_t received;
+  std::uint64_t dropped;
+  std::uint64_t lag;                // Published but not yet taken
+  std::uint64_t max_lag;            // As seen by the subscriber when taking
+  bool disconnected;
+};
+
+//------------------------------------------------------------------------------
+
+// One publisher side, any number of subscribers, each seeing every message
+// published after it subscribed, in order. Messages are published once as
+// shared_ptr<const Msg> into a ring of sequence-numbered slots; a subscriber
+// is just a cursor into it, so fan-out copies a pointer, never the payload.
+// As in a disruptor, the publisher may only reuse a slot once every gating
+// (block) cursor is past it; drop and disconnect subscribers are never
+// waited for and take from the ring under their own (uncontended) lock, so
+// the publisher can move them on safely. Publishers are serialized by a
+// mutex; subscribers never take it;
+template<class Msg>
+class Broadcast_channel {
+  struct Subscriber {
+    std::string name;
+    Slow_subscriber policy;
+    alignas(64) std::atomic<std::uint64_t> cursor;  // Next sequence to take
+    std::atomic<bool> detached{false};              // Subscription gone
+    std::atomic<bool> disconnected{false};
+    std::mutex m;                                   // Not for block
+    std::atomic<std::uint64_t> received{0};
+    std::atomic<std::uint64_t> dropped{0};
+    std::atomic<std::uint64_t> max_lag{0};
+
+    Subscriber(std::string n, Slow_subscriber p, std::uint64_t start)
+      : name{std::move(n)}, policy{p}, cursor{start} {}
+  };
+
+  const std::size_t mask_;
+  std::vector<std::shared_ptr<const Msg>> ring_;
+
+  std::mutex publish_m_;                      // Publishers, subscriber list
+  std::uint64_t next_{0};                     // Guarded by publish_m_
+  std::vector<std::shared_ptr<Subscriber>> subscribers_;
+
+  alignas(64) std::atomic<std::uint64_t> published_{0};
+  std::atomic<bool> closed_{false};
+
+  std::mutex wait_m_;                         // Parking subscribers
+  std::condition_variable wait_cv_;
+  std::atomic<unsigned> waiters_{0};
+
+  // Requires publish_m_; makes the slot of seq free to overwrite
+  void claim(std::uint64_t seq)
+  {
+    if (seq <= mask_)
+      return;
+    const auto oldest{seq - mask_};           // First sequence still kept
+    for (const auto& sub : subscribers_) {
+      if (sub->detached.load(std::memory_order_relaxed)
+          || sub->disconnected.load(std::memory_order_relaxed)
+          || sub->cursor.load(std::memory_order_acquire) >= oldest)
+        continue;
+      switch (sub->policy) {
+      case Slow_subscriber::block:
+        for (unsigned spins{0}; sub->cursor.load(std::memory_order_acquire) < oldest
+                                && !sub->detached.load(std::memory_order_relaxed); ++spins)
+          if (spins < 64)
+            cpu_relax();
+          else                                // It may share our CPU
+            std::this_thread::yield();
+        break;
+      case Slow_subscriber::drop: {
+        std::lock_guard lk{sub->m};
+        const auto cur{sub->cursor.load(std::memory_order_relaxed)};
+        if (cur < oldest) {
+          sub->dropped.fetch_add(oldest - cur, std::memory_order_relaxed);
+          sub->cursor.store(oldest, std::memory_order_release);
+        }
+        break;
+      }
+      case Slow_subscriber::disconnect: {
+        std::lock_guard lk{sub->m};
+        if (sub->cursor.load(std::memory_order_relaxed) < oldest)
+          sub->disconnected.store(true, std::memory_order_release);
+        break;
+      }
+      }
+    }
+  }
+
+  void wake_subscribers()
+  {
+    if (waiters_.load()) {                    // seq_cst: pairs with park()
+      { std::lock_guard lk{wait_m_}; }
+      wait_cv_.notify_all();
+    }
+  }
+
+  template<class Pred>
+  void park(Pred ready)
+  {
+    std::unique_lock lk{wait_m_};
+    waiters_.fetch_add(1);
+    wait_cv_.wait(lk, [&] { return ready() || closed_.load(); });
+    waiters_.fetch_sub(1);
+  }
+public:
+  class Subscription {
+    Broadcast_channel* ch_{nullptr};
+    std::shared_ptr<Subscriber> sub_;
+    Adaptive_wait waiter_;
+
+    bool ready() const noexcept
+    {
+      return sub_->cursor.load(std::memory_order_relaxed)
+               < ch_->published_.load()       // seq_cst: pairs with publish()
+             || sub_->disconnected.load(std::memory_order_relaxed);
+    }
+
+    // Takes the message at the cursor, if there is one
+    std::shared_ptr<const Msg> take()
+    {
+      if (!ch_)
+        return nullptr;
+      const auto published{ch_->published_.load(std::memory_order_acquire)};
+      auto lk{sub_->policy == Slow_subscriber::block
+        ? std::unique_lock<std::mutex>{} : std::unique_lock{sub_->m}};
+      if (sub_->disconnected.load(std::memory_order_acquire))
+        return nullptr;
+      const auto cur{sub_->cursor.load(std::memory_order_relaxed)};
+      if (cur >= published)
+        return nullptr;
+      auto res{ch_->ring_[cur & ch_->mask_]};
+      sub_->cursor.store(cur + 1, std::memory_order_release);
+      sub_->received.fetch_add(1, std::memory_order_relaxed);
+      if (published - cur > sub_->max_lag.load(std::memory_order_relaxed))
+        sub_->max_lag.store(published - cur, std::memory_order_relaxed);
+      return res;
+    }
+  public:
+    // Subscribed to nothing, like one moved from or unsubscribed: next()
+    // returns nullptr at once
+    Subscription() = default;
+
+    Subscription(Broadcast_channel* ch, std::shared_ptr<Subscriber> sub)
+      : ch_{ch}, sub_{std::move(sub)} {}
+
+    Subscription(Subscription&& other) noexcept
+      : ch_{std::exchange(other.ch_, nullptr)}, sub_{std::move(other.sub_)},
+        waiter_{other.waiter_} {}
+
+    Subscription& operator=(Subscription&& other) noexcept
+    {
+      if (this != &other) {
+        unsubscribe();
+        ch_ = std::exchange(other.ch_, nullptr);
+        sub_ = std::move(other.sub_);
+        waiter_ = other.waiter_;
+      }
+      return *this;
+    }
+
+    ~Subscription() { unsubscribe(); }
+
+    // Spin, yield or poll before parking, as for a Receiver
+    void set_wait_policy(const Wait_policy& policy) { waiter_.set_policy(policy); }
+
+    // Next message, waiting for one; nullptr once the channel is closed
+    // and drained, or this subscriber was disconnected
+    std::shared_ptr<const Msg> next()
+    {
+      if (!ch_)
+        return nullptr;
+      for (;;) {
+        if (auto msg{take()})
+          return msg;
+        if (sub_->disconnected.load(std::memory_order_acquire))
+          return nullptr;
+        if (ch_->closed_.load() && !ready())
+          return nullptr;
+        waiter_.await([this] { return ready(); });
+        if (!ready())
+          ch_->park([this] { return ready(); });
+      }
+    }
+
+    // Next message if one is waiting
+    std::shared_ptr<const Msg> try_next() { return take(); }
+
+    std::uint64_t lag() const noexcept
+    {
+      if (!ch_)
+        return 0;
+      return ch_->published_.load(std::memory_order_relaxed)
+               - sub_->cursor.load(std::memory_order_relaxed);
+    }
+
+    std::uint64_t dropped() const noexcept
+      { return sub_ ? sub_->dropped.load(std::memory_order_relaxed) : 0; }
+
+    bool disconnected() const noexcept
+      { return sub_ && sub_->disconnected.load(std::memory_order_relaxed); }
+
+    void unsubscribe()
+    {
+      if (!ch_)
+        return;
+      sub_->detached.store(true, std::memory_order_relaxed);
+      std::lock_guard lk{ch_->publish_m_};
+      std::erase(ch_->subscribers_, sub_);
+      ch_ = nullptr;
+    }
+  };
+
+  // capacity is rounded up to a power of two
+  explicit Broadcast_channel(std::size_t capacity = 1024)
+    : mask_{std::bit_ceil(capacity < 2 ? std::size_t{2} : capacity) - 1},
+      ring_(mask_ + 1) {}
+
+  Broadcast_channel(const Broadcast_channel&) = delete;
+  Broadcast_channel& operator=(const Broadcast_channel&) = delete;
+
+  // Sees what is published from now on; the subscription must not
+  // outlive the channel
+  Subscription subscribe(std::string name, Slow_subscriber policy = Slow_subscriber::block)
+  {
+    std::lock_guard lk{publish_m_};
+    subscribers_.push_back(std::make_shared<Subscriber>(std::move(name), policy, next_));
+    return Subscription{this, subscribers_.back()};
+  }
+
+  void publish(std::shared_ptr<const Msg> msg)
+  {
+    {
+      std::lock_guard lk{publish_m_};
+      const auto seq{next_};
+      claim(seq);
+      ring_[seq & mask_] = std::move(msg);
+      next_ = seq + 1;
+      published_.store(next_);                // seq_cst: pairs with park()
+    }
+    wake_subscribers();
+  }
+
+  template<class... Args>
+  void publish_new(Args&&... args)
+    { publish(std::make_shared<const Msg>(std::forward<Args>(args)...)); }
+
+  // Subscribers get what is left, then nullptr
+  void close()
+  {
+    closed_.store(true);
+    { std::lock_guard lk{wait_m_}; }
+    wait_cv_.notify_all();
+  }
+
+  std::vector<Subscriber_stats> stats()
+  {
+    std::lock_guard lk{publish_m_};
+    std::vector<Subscriber_stats> res;
+    for (const auto& sub : subscribers_)
+      res.push_back({sub->name, sub->policy,
+                     sub->received.load(std::memory_order_relaxed),
+                     sub->dropped.load(std::memory_order_relaxed),
+                     next_ - std::min(next_, sub->cursor.load(std::memory_order_relaxed)),
+                     sub->max_lag.load(std::memory_order_relaxed),
+                     sub->disconnected.load(std::memory_order_relaxed)});
+    return res;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_BROADCAST_HPP
@@ -0,0 +1,362 @@
+#ifndef CASHBOX_DISPENSE_HPP
+#define CASHBOX_DISPENSE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <numeric>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
+
+#include "Money.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+inline constexpr std::size_t max_cassettes{4};
+
+// So many notes out of one cassette
+struct Note_bundle {
+  std::uint32_t denomination{0};    // Minor units
+  std::uint16_t count{0};
+  std::uint8_t cassette{0};
+};
+
+// Which notes make up an amount; bundles with a zero count are unused.
+// Trivially copyable and small enough to travel in a trace record;
+struct Dispense_plan {
+  std::array<Note_bundle, max_cassettes> bundles{};
+
+  std::uint32_t notes() const noexcept
+  {
+    std::uint32_t n{0};
+    for (const auto& b : bundles)
+      n += b.count;
+    return n;
+  }
+
+  std::int64_t total() const noexcept
+  {
+    std::int64_t sum{0};
+    for (const auto& b : bundles)
+      sum += std::int64_t{b.denomination} * b.count;
+    return sum;
+  }
+};
+
+static_assert(std::is_trivially_copyable_v<Dispense_plan>);
+static_assert(sizeof(Dispense_plan) == 32);
+
+enum class Dispense_policy {
+  fewest_notes,     // Minimum number of notes
+  balance_wear      // Draw from the fullest cassettes first
+};
+
+//------------------------------------------------------------------------------
+
+// Minimum-note combinations for every amount up to a limit, assuming every
+// denomination is in stock: entry i is the amount i * step, which takes
+// `notes` notes, the first of denomination `first`; following `first`
+// down to zero spells the whole combination;
+struct Note_entry {
+  static constexpr std::uint8_t unreachable{0xff};
+
+  std::uint8_t notes{unreachable};
+  std::uint8_t first{0};
+};
+
+struct Note_table_view {
+  std::span<const std::int64_t> denominations;  // Descending, minor units
+  std::int64_t step;                            // Their gcd
+  std::span<const std::uint32_t> strides;       // Denominations in steps
+  std::span<const Note_entry> entries;
+
+  std::int64_t limit() const noexcept
+    { return static_cast<std::int64_t>(entries.size() - 1) * step; }
+};
+
+// Built at compile time, one per denomination set in common use; the
+// dispenser only walks it at run time;
+template<std::int64_t Limit, std::int64_t... Denoms>
+class Note_table {
+  static_assert(sizeof...(Denoms) > 0 && sizeof...(Denoms) <= max_cassettes);
+  static_assert(((Denoms > 0) && ...));
+
+  static constexpr std::array<std::int64_t, sizeof...(Denoms)> denominations_{Denoms...};
+  static_assert(std::is_sorted(denominations_.rbegin(), denominations_.rend()),
+                "Note_table: denominations must be given in descending order");
+
+  static constexpr std::int64_t step_{[] {
+    std::int64_t g{0};
+    for (const auto d : denominations_)
+      g = std::gcd(g, d);
+    return g;
+  }()};
+
+  static constexpr std::size_t size_{static_cast<std::size_t>(Limit / step_) + 1};
+
+  static constexpr std::array<std::uint32_t, sizeof...(Denoms)> strides_{
+    static_cast<std::uint32_t>(Denoms / step_)...};
+
+  static constexpr std::array<Note_entry, size_> build()
+  {
+    std::array<Note_entry, size_> t{};
+    t[0].notes = 0;
+    for (std::size_t i{1}; i < size_; ++i)
+      for (std::uint8_t j{0}; j < denominations_.size(); ++j) {
+        const std::size_t k{strides_[j]};
+        if (k > i || t[i - k].notes >= Note_entry::unreachable - 1)
+          continue;
+        if (t[i - k].notes + 1 < t[i].notes) {
+          t[i].notes = static_cast<std::uint8_t>(t[i - k].notes + 1);
+          t[i].first = j;
+        }
+      }
+    return t;
+  }
+
+  static constexpr std::array<Note_entry, size_> entries_{build()};
+public:
+  static constexpr Note_table_view view{denominations_, step_, strides_, entries_};
+};
+
+// Denomination sets in minor units, up to 1000 major units of a
+// two-digit currency (100000 units of one without minor digits)
+inline constexpr std::array<const Note_table_view*, 5> common_note_tables{
+  &Note_table<100'000, 10'000, 5'000, 2'000, 1'000>::view,  // 100 50 20 10
+  &Note_table<100'000, 10'000, 5'000, 2'000>::view,         // 100 50 20
+  &Note_table<100'000, 10'000, 5'000, 1'000>::view,         // 100 50 10; yen
+  &Note_table<100'000, 5'000, 2'000, 1'000, 500>::view,     // 50 20 10 5
+  &Note_table<100'000, 2'000, 1'000>::view                  // 20 10
+};
+
+// The table for exactly these denominations (descending), if there is one
+inline const Note_table_view* find_note_table(std::span<const std::int64_t> denominations) noexcept
+{
+  for (const auto* t : common_note_tables)
+    if (std::ranges::equal(t->denominations, denominations))
+      return t;
+  return nullptr;
+}
+
+//------------------------------------------------------------------------------
+
+struct Cassette {
+  Money denomination;
+  std::uint32_t count;
+};
+
+struct Dispense_stats {
+  std::uint64_t table_hits;         // Answered by the table alone
+  std::uint64_t searches;           // Stock or policy needed a search
+  std::uint64_t rejected;           // No combination in stock
+};
+
+// Decides which notes to dispense and keeps the cassette inventory. With a
+// table for its denominations, a fewest-notes decision is a walk down the
+// table; only when that would empty a cassette, or for amounts past the
+// table's limit, does it search the combinations the stock allows. Not
+// thread-safe: owned by the one actor driving the hardware;
+class Note_dispenser {
+  Currency currency_;
+  std::size_t cassettes_{0};
+  std::array<std::int64_t, max_cassettes> denominations_{};   // Descending
+  std::array<std::uint32_t, max_cassettes> counts_{};
+  std::array<std::uint8_t, max_cassettes> slot_{};            // Physical cassette
+  std::int64_t step_{0};                                      // gcd of the above
+  const Note_table_view* table_{nullptr};
+  mutable Dispense_stats stats_{};
+
+  struct Search {
+    std::array<std::size_t, max_cassettes> order;
+    std::array<std::int64_t, max_cassettes + 1> stock{};  // Value from a level on
+    std::array<std::int64_t, max_cassettes + 1> step{};   // gcd from a level on
+    std::array<std::uint32_t, max_cassettes> take{};
+    std::array<std::uint32_t, max_cassettes> best{};
+    std::uint32_t best_notes{0xffff'ffff};
+    bool first_fit;
+  };
+
+  // Depth-first over the cassettes in s.order, most notes of each first
+  void search(Search& s, std::size_t level, std::int64_t left, std::uint32_t notes) const
+  {
+    if (!left) {
+      if (notes < s.best_notes) {
+        s.best_notes = notes;
+        s.best = s.take;
+      }
+      return;
+    }
+    if (level == cassettes_ || left > s.stock[level] || left % s.step[level])
+      return;
+    const auto c{s.order[level]};
+    const auto d{denominations_[c]};
+    if (!s.first_fit && notes + (left + d - 1) / d >= s.best_notes)
+      return;                           // Cannot beat the best even in d notes
+    auto n{static_cast<std::uint32_t>(std::min<std::int64_t>({counts_[c], left / d, 0xffff}))};
+    for (;; --n) {
+      s.take[c] = n;
+      search(s, level + 1, left - d * n, notes + n);
+      if (!n || (s.first_fit && s.best_notes != 0xffff'ffff))
+        break;
+    }
+    s.take[c] = 0;
+  }
+
+  Dispense_plan to_plan(const std::array<std::uint32_t, max_cassettes>& take) const
+  {
+    Dispense_plan plan;
+    std::size_t b{0};
+    for (std::size_t c{0}; c < cassettes_; ++c)
+      if (take[c])
+        plan.bundles[b++] = {static_cast<std::uint32_t>(denominations_[c]),
+                             static_cast<std::uint16_t>(take[c]), slot_[c]};
+    return plan;
+  }
+
+  // The table's answer, if the stock covers it
+  std::optional<Dispense_plan> from_table(std::int64_t amount) const
+  {
+    if (amount > table_->limit())
+      return std::nullopt;
+    std::array<std::uint32_t, max_cassettes> take{};
+    auto i{static_cast<std::size_t>(amount / table_->step)};
+    if (table_->entries[i].notes == Note_entry::unreachable)
+      return std::nullopt;
+    while (i) {
+      const auto& e{table_->entries[i]};
+      if (++take[e.first] > counts_[e.first])
+        return std::nullopt;
+      i -= table_->strides[e.first];
+    }
+    return to_plan(take);
+  }
+
+  std::size_t index_of(std::size_t cassette) const
+  {
+    for (std::size_t i{0}; i < cassettes_; ++i)
+      if (slot_[i] == cassette)
+        return i;
+    throw std::out_of_range("Note_dispenser: no such cassette");
+  }
+public:
+  // At most max_cassettes, all in one currency; the cassette order is
+  // the physical one, the one Note_bundle::cassette refers to
+  Note_dispenser(std::initializer_list<Cassette> cassettes)
+  {
+    if (!cassettes.size() || cassettes.size() > max_cassettes)
+      throw std::invalid_argument("Note_dispenser: 1 to max_cassettes cassettes");
+    currency_ = cassettes.begin()->denomination.currency();
+    std::array<std::size_t, max_cassettes> by_value{};
+    std::iota(by_value.begin(), by_value.begin() + cassettes.size(), std::size_t{0});
+    std::sort(by_value.begin(), by_value.begin() + cassettes.size(), [&](auto a, auto b) {
+      return cassettes.begin()[a].denomination.minor_units()
+               > cassettes.begin()[b].denomination.minor_units();
+    });
+    for (const auto i : std::span{by_value}.first(cassettes.size())) {
+      const auto& c{cassettes.begin()[i]};
+      if (c.denomination.currency() != currency_ || c.denomination.minor_units() <= 0
+          || c.denomination.minor_units() > 0xffff'ffff)
+        throw std::invalid_argument("Note_dispenser: bad denomination");
+      denominations_[cassettes_] = c.denomination.minor_units();
+      counts_[cassettes_] = c.count;
+      slot_[cassettes_] = static_cast<std::uint8_t>(i);
+      step_ = std::gcd(step_, c.denomination.minor_units());
+      ++cassettes_;
+    }
+    use_table(find_note_table(std::span{denominations_}.first(cassettes_)));
+  }
+
+  // A table for other denominations would give wrong answers, so it is
+  // ignored; nullptr always searches
+  void use_table(const Note_table_view* table) noexcept
+  {
+    table_ = table && std::ranges::equal(table->denominations,
+                                         std::span{denominations_}.first(cassettes_))
+      ? table : nullptr;
+  }
+
+  bool has_table() const noexcept { return table_ != nullptr; }
+
+  // The notes for amount out of the current stock, or nullopt if the
+  // stock cannot make it up exactly; takes nothing out
+  std::optional<Dispense_plan> plan(Money amount,
+                                    Dispense_policy policy = Dispense_policy::fewest_notes) const
+  {
+    const auto units{amount.minor_units()};
+    if (amount.currency() != currency_ || units <= 0 || units % step_) {
+      ++stats_.rejected;
+      return std::nullopt;
+    }
+    if (table_ && policy == Dispense_policy::fewest_notes)
+      if (auto res{from_table(units)}) {
+        ++stats_.table_hits;
+        return res;
+      }
+
+    ++stats_.searches;
+    Search s{};
+    std::iota(s.order.begin(), s.order.begin() + cassettes_, std::size_t{0});
+    s.first_fit = policy == Dispense_policy::balance_wear;
+    if (s.first_fit)
+      std::stable_sort(s.order.begin(), s.order.begin() + cassettes_,
+                       [&](auto a, auto b) { return counts_[a] > counts_[b]; });
+    for (auto l{cassettes_}; l--;) {
+      const auto c{s.order[l]};
+      s.stock[l] = s.stock[l + 1] + denominations_[c] * counts_[c];
+      s.step[l] = std::gcd(s.step[l + 1], counts_[c] ? denominations_[c] : 0);
+    }
+    search(s, 0, units, 0);
+    if (s.best_notes == 0xffff'ffff) {
+      ++stats_.rejected;
+      return std::nullopt;
+    }
+    return to_plan(s.best);
+  }
+
+  // Takes plan's notes out of the cassettes; a plan from plan() is good
+  // until the stock changes
+  void take(const Dispense_plan& plan)
+  {
+    for (const auto& b : plan.bundles)
+      if (b.count && (b.cassette >= cassettes_ || count(b.cassette) < b.count))
+        throw std::logic_error("Note_dispenser::take(): plan does not fit the stock");
+    for (const auto& b : plan.bundles)
+      if (b.count)
+        counts_[index_of(b.cassette)] -= b.count;
+  }
+
+  // Sets the number of notes in physical cassette `cassette`
+  void load(std::size_t cassette, std::uint32_t count)
+  {
+    counts_[index_of(cassette)] = count;
+  }
+
+  std::size_t cassettes() const noexcept { return cassettes_; }
+
+  std::uint32_t count(std::size_t cassette) const { return counts_[index_of(cassette)]; }
+
+  Money denomination(std::size_t cassette) const
+    { return Money::minor(denominations_[index_of(cassette)], currency_); }
+
+  Currency currency() const noexcept { return currency_; }
+
+  Dispense_stats stats() const noexcept { return stats_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_DISPENSE_HPP
@@ -0,0 +1,235 @@
+#ifndef CASHBOX_DISPLAY_SINK_HPP
+#define CASHBOX_DISPLAY_SINK_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+struct Display_stats {
+  std::uint64_t frames;             // That wrote something: one write each
+  std::uint64_t bytes;
+  std::uint64_t stalls;             // Writes that waited for room
+};
+
+//------------------------------------------------------------------------------
+
+class Display_sink;
+
+// What one terminal has to show, on its way to a Display_sink: a ring of
+// bytes with one writer (the terminal's actor) and one reader (the
+// sink's renderer), each owning its own counter on its own cache line, so
+// that neither ever takes a lock. A writer finding the ring full asks for
+// a frame straight away and waits for it to make room; nothing is
+// dropped;
+class Display_terminal {
+  friend class Display_sink;
+
+  alignas(64) std::atomic<std::uint64_t> written_{0};
+  std::atomic<std::uint64_t> stalls_{0};
+  alignas(64) std::atomic<std::uint64_t> read_{0};
+  bool line_start_{true};           // Renderer only
+  Display_sink* sink_;
+  const std::string label_;
+  std::vector<char> ring_;          // Size is a power of two
+
+  inline void request_frame();
+public:
+  Display_terminal(Display_sink& sink, std::string label, std::size_t capacity)
+    : sink_{&sink}, label_{std::move(label)},
+      ring_(std::bit_ceil(std::max<std::size_t>(capacity, 64))) {}
+
+  Display_terminal(const Display_terminal&) = delete;
+  Display_terminal& operator=(const Display_terminal&) = delete;
+
+  // From the terminal's one writer
+  void write(std::string_view text)
+  {
+    const auto mask{ring_.size() - 1};
+    auto w{written_.load(std::memory_order_relaxed)};
+    bool stalled{false};
+    while (!text.empty()) {
+      const auto room{ring_.size() - (w - read_.load(std::memory_order_acquire))};
+      if (!room) {
+        if (!stalled)
+          request_frame();
+        stalled = true;
+        std::this_thread::yield();
+        continue;
+      }
+      const auto n{std::min(room, text.size())};
+      const auto at{w & mask};
+      const auto first{std::min(n, ring_.size() - at)};
+      std::copy_n(text.data(), first, ring_.data() + at);
+      std::copy_n(text.data() + first, n - first, ring_.data());
+      w += n;
+      written_.store(w, std::memory_order_release);
+      text.remove_prefix(n);
+    }
+    if (stalled)
+      stalls_.fetch_add(1, std::memory_order_relaxed);
+  }
+
+  const std::string& label() const noexcept { return label_; }
+};
+
+//------------------------------------------------------------------------------
+
+// Shows the output of any number of terminals on one stream. A renderer
+// thread wakes at most max_fps times a second (or sooner for a terminal
+// that has filled its ring), takes the complete lines each terminal has
+// written since the last frame, skipping the ones that wrote nothing, and
+// writes them out in one write and one flush. A
+// terminal's lines stay together and in order; lines of a labelled
+// terminal are prefixed with its label. Terminals are opened before or
+// while it runs and live as long as the sink;
+class Display_sink {
+  friend class Display_terminal;
+
+  std::ostream* out_;
+  const std::chrono::nanoseconds frame_;
+  const std::size_t capacity_;
+  std::mutex m_;                    // Opening terminals and rendering, never writing
+  std::condition_variable wake_;
+  std::atomic<bool> urgent_{false}; // A terminal is full
+  std::deque<Display_terminal> terminals_;
+  std::string frame_text_;
+  std::atomic<std::uint64_t> frames_{0};
+  std::atomic<std::uint64_t> bytes_{0};
+  std::atomic<bool> stopping_{false};
+  std::jthread renderer_;
+
+  // Appends what t has for this frame; whole lines only, unless
+  // everything must go
+  void take(Display_terminal& t, bool everything)
+  {
+    const auto r{t.read_.load(std::memory_order_relaxed)};
+    auto w{t.written_.load(std::memory_order_acquire)};
+    const auto mask{t.ring_.size() - 1};
+    const bool full{w - r == t.ring_.size()};
+    if (!everything && !full) {
+      while (w != r && t.ring_[(w - 1) & mask] != '\n')
+        --w;
+    }
+    for (auto i{r}; i != w; ++i) {
+      const auto c{t.ring_[i & mask]};
+      if (t.line_start_ && !t.label_.empty()) {
+        frame_text_ += t.label_;
+        frame_text_ += ": ";
+      }
+      frame_text_ += c;
+      t.line_start_ = c == '\n';
+    }
+    t.read_.store(w, std::memory_order_release);
+  }
+
+  void render(bool everything)      // Requires m_ to be held
+  {
+    frame_text_.clear();
+    for (auto& t : terminals_)
+      if (t.written_.load(std::memory_order_relaxed) != t.read_.load(std::memory_order_relaxed))
+        take(t, everything);
+    if (frame_text_.empty())
+      return;
+    out_->write(frame_text_.data(), static_cast<std::streamsize>(frame_text_.size()));
+    out_->flush();
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    bytes_.fetch_add(frame_text_.size(), std::memory_order_relaxed);
+  }
+
+  void run()
+  {
+    auto next{std::chrono::steady_clock::now()};
+    std::unique_lock lk{m_};
+    while (!stopping_.load(std::memory_order_acquire)) {
+      next += frame_;
+      wake_.wait_until(lk, next, [&] {
+        return urgent_.load(std::memory_order_relaxed) || stopping_.load(std::memory_order_relaxed);
+      });
+      urgent_.store(false, std::memory_order_relaxed);
+      render(false);
+      next = std::max(next, std::chrono::steady_clock::now() - frame_);  // No catching up
+    }
+  }
+public:
+  explicit Display_sink(std::ostream& out, unsigned max_fps = 60, std::size_t capacity = 1 << 16)
+    : out_{&out}, frame_{std::chrono::nanoseconds{std::chrono::seconds{1}} / std::max(1u, max_fps)},
+      capacity_{capacity}, renderer_{[this] { run(); }} {}
+
+  Display_sink(const Display_sink&) = delete;
+  Display_sink& operator=(const Display_sink&) = delete;
+
+  // Lines shown with no label when label is empty
+  Display_terminal& open(std::string label = {})
+  {
+    std::lock_guard lk{m_};
+    return terminals_.emplace_back(*this, std::move(label), capacity_);
+  }
+
+  // Shows everything written so far now, rather than at the next frame
+  void flush()
+  {
+    std::lock_guard lk{m_};
+    render(true);
+  }
+
+  Display_stats stats()
+  {
+    std::lock_guard lk{m_};
+    std::uint64_t stalls{0};
+    for (const auto& t : terminals_)
+      stalls += t.stalls_.load(std::memory_order_relaxed);
+    return {frames_.load(std::memory_order_relaxed), bytes_.load(std::memory_order_relaxed), stalls};
+  }
+
+  ~Display_sink()
+  {
+    {
+      std::lock_guard lk{m_};
+      stopping_.store(true, std::memory_order_release);
+    }
+    wake_.notify_one();
+    renderer_.join();
+    flush();
+  }
+};
+
+inline void Display_terminal::request_frame()
+{
+  sink_->urgent_.store(true, std::memory_order_relaxed);
+  sink_->wake_.notify_one();
+}
+
+// The process's sink on std::cout, started on first use
+inline Display_sink& console_display()
+{
+  static Display_sink sink{std::cout};
+  return sink;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_DISPLAY_SINK_HPP
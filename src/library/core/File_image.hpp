@@ -0,0 +1,125 @@
+#ifndef CASHBOX_FILE_IMAGE_HPP
+#define CASHBOX_FILE_IMAGE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// How a mapped file is going to be read, for the kernel's read-ahead
+enum class File_access {
+  random,                           // Scattered lookups
+  sequential                        // Front to back, once
+};
+
+// A read-only run of bytes, either owned or mapped from a file; mapping
+// makes opening a big index cost no more than touching what is used;
+class File_image {
+  std::vector<std::uint64_t> owned_;          // 8-byte aligned
+  void* mapped_{nullptr};
+  std::size_t size_{0};
+
+  void release() noexcept
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    if (mapped_)
+      ::munmap(mapped_, size_);
+#endif
+    mapped_ = nullptr;
+  }
+public:
+  File_image() = default;
+
+  explicit File_image(std::size_t size) : owned_((size + 7) / 8), size_{size} {}
+
+  File_image(File_image&& other) noexcept
+    : owned_{std::move(other.owned_)}, mapped_{std::exchange(other.mapped_, nullptr)},
+      size_{std::exchange(other.size_, 0)} {}
+
+  File_image& operator=(File_image&& other) noexcept
+  {
+    if (this != &other) {
+      release();
+      owned_ = std::move(other.owned_);
+      mapped_ = std::exchange(other.mapped_, nullptr);
+      size_ = std::exchange(other.size_, 0);
+    }
+    return *this;
+  }
+
+  ~File_image() { release(); }
+
+  // Maps path read-only where the platform can, reads it in elsewhere
+  static File_image map(const std::string& path, File_access access = File_access::random)
+  {
+    File_image res;
+#if defined(__unix__) || defined(__APPLE__)
+    const int fd{::open(path.c_str(), O_RDONLY)};
+    if (fd < 0)
+      throw std::runtime_error("File_image: cannot open " + path);
+    struct stat st {};
+    if (::fstat(fd, &st) != 0 || st.st_size <= 0) {
+      ::close(fd);
+      throw std::runtime_error("File_image: cannot map " + path);
+    }
+    res.size_ = static_cast<std::size_t>(st.st_size);
+    res.mapped_ = ::mmap(nullptr, res.size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (res.mapped_ == MAP_FAILED) {
+      res.mapped_ = nullptr;
+      throw std::runtime_error("File_image: cannot map " + path);
+    }
+    ::madvise(res.mapped_, res.size_,
+              access == File_access::random ? MADV_RANDOM : MADV_SEQUENTIAL);
+#else
+    (void)access;
+    std::ifstream in{path, std::ios::binary | std::ios::ate};
+    if (!in)
+      throw std::runtime_error("File_image: cannot open " + path);
+    res = File_image{static_cast<std::size_t>(in.tellg())};
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(res.owned_.data()), static_cast<std::streamsize>(res.size_)))
+      throw std::runtime_error("File_image: cannot read " + path);
+#endif
+    return res;
+  }
+
+  const std::byte* data() const noexcept
+  {
+    return mapped_ ? static_cast<const std::byte*>(mapped_)
+                   : reinterpret_cast<const std::byte*>(owned_.data());
+  }
+
+  // Only for an owned image being filled in
+  std::byte* writable() noexcept { return reinterpret_cast<std::byte*>(owned_.data()); }
+
+  std::size_t size() const noexcept { return size_; }
+
+  bool is_mapped() const noexcept { return mapped_ != nullptr; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_FILE_IMAGE_HPP
@@ -0,0 +1,139 @@
+#ifndef CASHBOX_HANDLER_TIMING_HPP
+#define CASHBOX_HANDLER_TIMING_HPP
+
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Log-linear buckets, as in HDR histograms: values below 2^sub_bits get a
+// bucket each, every power of two above is split into 2^sub_bits buckets,
+// so a bucket is never wider than 1/8 of its values (12.5%) and 496 of
+// them cover all of std::uint64_t;
+struct Log_buckets {
+  static constexpr unsigned sub_bits{3};
+  static constexpr std::uint64_t sub_mask{(1u << sub_bits) - 1};
+  static constexpr std::size_t count{(64 - sub_bits + 1) << sub_bits};
+
+  static constexpr std::size_t index(std::uint64_t v) noexcept
+  {
+    if (v <= sub_mask)
+      return v;
+    const auto shift{static_cast<unsigned>(std::bit_width(v)) - 1 - sub_bits};
+    return ((shift + 1) << sub_bits) | ((v >> shift) & sub_mask);
+  }
+
+  // Smallest value of bucket i
+  static constexpr std::uint64_t lower(std::size_t i) noexcept
+  {
+    if (i <= sub_mask)
+      return i;
+    const auto shift{(i >> sub_bits) - 1};
+    return ((std::uint64_t{1} << sub_bits) | (i & sub_mask)) << shift;
+  }
+
+  // Largest value of bucket i
+  static constexpr std::uint64_t upper(std::size_t i) noexcept
+    { return i + 1 < count ? lower(i + 1) - 1 : ~std::uint64_t{0}; }
+
+  // The upper end of the bucket holding the q quantile (0 <= q <= 1) of
+  // total values counted in counts; 0 if there are none
+  static std::uint64_t quantile(const std::array<std::uint64_t, count>& counts,
+                                std::uint64_t total, double q) noexcept
+  {
+    if (!total)
+      return 0;
+    const auto rank{static_cast<std::uint64_t>(q * static_cast<double>(total - 1))};
+    std::uint64_t seen{0};
+    for (std::size_t i{0}; i < count; ++i)
+      if ((seen += counts[i]) > rank)
+        return upper(i);
+    return upper(count - 1);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// A Handler_timing as read at one moment; subtract an earlier one for
+// what happened in between;
+struct Handler_times {
+  std::uint64_t handled{0};         // Messages dispatched
+  std::uint64_t busy_ns{0};         // In handlers, all told
+  std::array<std::uint64_t, Log_buckets::count> counts{};
+
+  Handler_times since(const Handler_times& earlier) const noexcept
+  {
+    Handler_times res;
+    res.handled = handled - earlier.handled;
+    res.busy_ns = busy_ns - earlier.busy_ns;
+    for (std::size_t i{0}; i < counts.size(); ++i)
+      res.counts[i] = counts[i] - earlier.counts[i];
+    return res;
+  }
+
+  // The upper end of the bucket holding the q quantile (0 <= q <= 1), in
+  // ns; 0 if nothing was handled
+  std::uint64_t quantile(double q) const noexcept
+    { return Log_buckets::quantile(counts, handled, q); }
+};
+
+//------------------------------------------------------------------------------
+
+// How long one actor's handlers take: set on a receiver (see
+// Receiver::time_handlers()), every dispatch is timed and counted here by
+// the actor's own thread, with plain stores, no lock and no locked
+// instruction; any other thread may read it at any time. A read can see
+// one dispatch in some of the counters and not yet in others;
+class Handler_timing {
+  alignas(64) std::atomic<std::uint64_t> handled_{0};
+  std::atomic<std::uint64_t> busy_ns_{0};
+  std::array<std::atomic<std::uint64_t>, Log_buckets::count> counts_{};
+
+  static void bump(std::atomic<std::uint64_t>& c, std::uint64_t by) noexcept
+    { c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed); }
+public:
+  using Clock = std::chrono::steady_clock;
+
+  Handler_timing() = default;
+  Handler_timing(const Handler_timing&) = delete;
+  Handler_timing& operator=(const Handler_timing&) = delete;
+
+  // The actor's thread only
+  void record(Clock::duration took) noexcept
+  {
+    const auto ns{static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(took).count())};
+    bump(counts_[Log_buckets::index(ns)], 1);
+    bump(busy_ns_, ns);
+    bump(handled_, 1);
+  }
+
+  // Any thread
+  Handler_times read() const noexcept
+  {
+    Handler_times res;
+    res.handled = handled_.load(std::memory_order_relaxed);
+    res.busy_ns = busy_ns_.load(std::memory_order_relaxed);
+    for (std::size_t i{0}; i < counts_.size(); ++i)
+      res.counts[i] = counts_[i].load(std::memory_order_relaxed);
+    return res;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_HANDLER_TIMING_HPP
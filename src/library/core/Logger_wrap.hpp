@@ -13,6 +13,11 @@
 #include <sstream>
 #include <ctime>
 #include <syncstream>
+#include <chrono>
+#include <cctype>
+#include <string>
+
+#include "Metrics.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -121,6 +126,34 @@ inline Lg_lvl string_to_lg_lvl(const std::string& ll)
 
 //------------------------------------------------------------------------------
 
+// What loggers count in the Metrics registry: lines by level, bytes, and
+// how long writing a line takes;
+struct Log_metrics {
+  std::vector<Metrics::Counter> lines;      // By Lg_lvl
+  Metrics::Counter bytes{Metrics::counter("cashbox_log_bytes_total",
+                                          "Bytes of log lines written")};
+  Metrics::Histogram write_ns{Metrics::histogram("cashbox_log_write_seconds",
+                                                 "Time to write a log line", {}, 1e-9)};
+  Log_metrics()
+  {
+    for (const auto& name : lg_lvl_names()) {
+      std::string level;
+      for (const char c : name.substr(0, name.find(':')))
+        level += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+      lines.push_back(Metrics::counter("cashbox_log_lines_total", "Log lines written, by level",
+                                       Metrics::label("level", level)));
+    }
+  }
+};
+
+inline const Log_metrics& log_metrics()
+{
+  static const Log_metrics metrics;
+  return metrics;
+}
+
+//------------------------------------------------------------------------------
+
 // Common mechanism of logging, that uses iostream;
 // Uses logging levels;
 class Logger_wrap {
@@ -130,6 +163,16 @@ protected:
   Lg_lvl curr;
   std::ostringstream buf;
 
+  // A line of size bytes written at curr, which took took
+  void count_line(std::size_t size, std::chrono::steady_clock::duration took) const
+  {
+    const auto& metrics{log_metrics()};
+    metrics.lines[static_cast<size_t>(lg_lvl_to_int(curr))].add();
+    metrics.bytes.add(size);
+    metrics.write_ns.record(static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+  }
+
 public:
   class Tmp_log;
 
@@ -148,9 +191,11 @@ public:
   {
     if (!out || str.empty())
       return;
+    const auto start{std::chrono::steady_clock::now()};
     out << now_date_time() << ' ' << lg_lvl_to_string(curr)
         << str << '\n';
     out.flush();
+    count_line(str.size(), std::chrono::steady_clock::now() - start);
   }
 
   template<class T>
@@ -242,11 +287,15 @@ public:
 
   virtual void write(const std::string& str) override
   {
-    std::osyncstream sout{out};
-    if (!sout || str.empty())
-      return;
-    sout << now_date_time() + ' ' + lg_lvl_to_string(curr) + str + '\n';
-    sout.flush();
+    const auto start{std::chrono::steady_clock::now()};
+    {
+      std::osyncstream sout{out};
+      if (!sout || str.empty())
+        return;
+      sout << now_date_time() + ' ' + lg_lvl_to_string(curr) + str + '\n';
+      sout.flush();
+    }
+    count_line(str.size(), std::chrono::steady_clock::now() - start);
   }
 };
 
@@ -6,7 +6,32 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
 #include <memory>
+#include <memory_resource>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdlib>
+#include <numeric>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#if __has_include(<cxxabi.h>)
+#include <cxxabi.h>
+#endif
+
+#include "Audit.hpp"
+#include "Handler_timing.hpp"
+#include "Metrics.hpp"
+#include "Trace.hpp"
 
 //------------------------------------------------------------------------------
 
@@ -14,8 +39,24 @@ namespace Messaging {
 
 //------------------------------------------------------------------------------
 
+using Type_tag = const void*;   // Identifies a message type without RTTI
+
+template<class Msg>
+inline constexpr char type_tag_anchor{};
+
+template<class Msg>
+constexpr Type_tag type_tag() noexcept { return &type_tag_anchor<Msg>; }
+
+//------------------------------------------------------------------------------
+
 struct Message_base { // Base class of your queue entries
+  Message_base() = default;
+  explicit Message_base(Type_tag type) noexcept : type_{type} {}
   virtual ~Message_base() = default;
+
+  Type_tag type() const noexcept { return type_; }
+private:
+  Type_tag type_{nullptr};
 };
 
 //------------------------------------------------------------------------------
@@ -23,7 +64,8 @@ struct Message_base { // Base class of your queue entries
 template<class Msg>   // Each message type has a specialization.
 struct Wrapped_message : Message_base {
 
-  explicit Wrapped_message(const Msg& contents) : contents_(contents) {}
+  explicit Wrapped_message(const Msg& contents)
+    : Message_base{type_tag<Msg>()}, contents_(contents) {}
 
   const auto& contents() const noexcept { return contents_; }
 
@@ -33,29 +75,555 @@ private:
 
 //------------------------------------------------------------------------------
 
+inline void cpu_relax() noexcept    // Hint to the core that we are spinning
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_ia32_pause();
+#elif defined(__aarch64__)
+  asm volatile("yield");
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+enum class Wait_strategy {
+  block,            // Park on the condition variable straight away
+  spin,             // Poll with a pause hint first, then park
+  spin_yield_block, // As spin, then give the time slice away a few times
+  busy_poll         // Never park; burns a core for the lowest latency
+};
+
+//------------------------------------------------------------------------------
+
+// How a consumer waits on an empty queue;
+// with adaptive on, the spin budget follows the gaps between recent
+// arrivals: short gaps grow it up to max_spin, gaps the spin did not
+// cover shrink it down to min_spin, so an idle actor stops burning CPU;
+struct Wait_policy {
+  Wait_strategy strategy{Wait_strategy::block};
+  unsigned max_spin{20'000};        // Polls
+  unsigned min_spin{64};
+  unsigned yields{8};               // For spin_yield_block
+  bool adaptive{true};
+};
+
+//------------------------------------------------------------------------------
+
+// The consumer side of a Wait_policy: spins, yields or polls until ready()
+// or the budget runs out, parking is left to the caller; the spin budget
+// follows the gaps between recent messages;
+class Adaptive_wait {
+  Wait_policy policy_;
+  unsigned avg_gap_{0};
+  unsigned spin_budget_{0};
+
+  void learn_gap(unsigned polls) noexcept
+  {
+    if (!policy_.adaptive)
+      return;
+    avg_gap_ = static_cast<unsigned>(         // EWMA over the last ~8 waits
+      (std::uint64_t{avg_gap_} * 7 + polls) / 8);
+    const auto want{avg_gap_ < policy_.max_spin / 2 ? avg_gap_ * 2 : 0U};
+    spin_budget_ = want < policy_.min_spin ? policy_.min_spin : want;
+  }
+public:
+  void set_policy(const Wait_policy& policy) noexcept
+  {
+    policy_ = policy;
+    if (policy_.min_spin > policy_.max_spin)
+      policy_.min_spin = policy_.max_spin;
+    avg_gap_ = policy_.max_spin / 2;
+    spin_budget_ = policy_.max_spin;
+  }
+
+  template<class Ready>
+  void await(Ready ready)
+  {
+    switch (policy_.strategy) {
+    case Wait_strategy::block:
+      return;
+    case Wait_strategy::busy_poll:
+      while (!ready())
+        cpu_relax();
+      return;
+    case Wait_strategy::spin:
+    case Wait_strategy::spin_yield_block:
+      break;
+    }
+
+    for (unsigned polls{0}; polls < spin_budget_; ++polls) {
+      if (ready()) {
+        learn_gap(polls);
+        return;
+      }
+      cpu_relax();
+    }
+    if (policy_.strategy == Wait_strategy::spin_yield_block)
+      for (auto yields{policy_.yields}; yields && !ready(); --yields)
+        std::this_thread::yield();
+    learn_gap(policy_.max_spin);    // The gap was at least as long as
+  }                                 // we are willing to spin
+};
+
+//------------------------------------------------------------------------------
+
+enum class Dispatch_mode {
+  fixed,            // Handlers are tried in chain order, nothing is counted
+  counted,          // As fixed, with per-handler hit counters
+  adaptive          // Counted, and the most frequent types are tried first
+};
+
+//------------------------------------------------------------------------------
+
+template<class Msg>
+std::string type_name()
+{
+  const char* const raw{typeid(Msg).name()};
+#if __has_include(<cxxabi.h>)
+  int status{0};
+  std::unique_ptr<char, void(*)(void*)> demangled{
+    abi::__cxa_demangle(raw, nullptr, nullptr, &status), &std::free};
+  if (status == 0 && demangled)
+    return demangled.get();
+#endif
+  return raw;
+}
+
+//------------------------------------------------------------------------------
+
+// Hit counters of one handler chain, i.e. of one wait().handle<>()...
+// call site, shared by every receiver dispatching through it;
+// also keeps the hottest-first order used by Dispatch_mode::adaptive,
+// packed as 4-bit handler indices;
+class Dispatch_profile {
+  std::vector<std::string> names_;  // Handled types, in handle<>() order
+  std::unique_ptr<std::atomic<std::uint64_t>[]> hits_;
+  std::atomic<std::uint64_t> unhandled_{0};
+  std::atomic<std::uint64_t> order_{0};
+
+  void resort() noexcept
+  {
+    std::array<std::size_t, max_adaptive> idx{};
+    std::array<std::uint64_t, max_adaptive> count{};
+    const auto n{names_.size()};
+    for (std::size_t i{0}; i < n; ++i) {
+      idx[i] = n - 1 - i;         // Ties keep the chain order:
+      count[idx[i]] = hits(idx[i]); // the last handle<>() first
+    }
+    std::stable_sort(idx.begin(), idx.begin() + static_cast<std::ptrdiff_t>(n),
+      [&](auto a, auto b) { return count[a] > count[b]; });
+    order_.store(pack(idx, n), std::memory_order_relaxed);
+  }
+
+  template<class Indices>
+  static std::uint64_t pack(const Indices& idx, std::size_t n) noexcept
+  {
+    std::uint64_t res{0};
+    for (auto i{n}; i-- > 0;)
+      res = res << 4 | idx[i];
+    return res;
+  }
+public:
+  static constexpr std::size_t max_adaptive{16};   // Fits order_
+  static constexpr std::uint64_t resort_every{1024};
+
+  explicit Dispatch_profile(std::vector<std::string> names);
+
+  Dispatch_profile(const Dispatch_profile&) = delete;
+  Dispatch_profile& operator=(const Dispatch_profile&) = delete;
+
+  std::size_t size() const noexcept { return names_.size(); }
+  const std::string& name(std::size_t i) const { return names_[i]; }
+  std::uint64_t hits(std::size_t i) const noexcept
+    { return hits_[i].load(std::memory_order_relaxed); }
+  std::uint64_t unhandled() const noexcept
+    { return unhandled_.load(std::memory_order_relaxed); }
+  std::uint64_t order() const noexcept
+    { return order_.load(std::memory_order_relaxed); }
+
+  // Plain load and store rather than a locked add: when receivers on
+  // several threads share a chain an increment may get lost, which
+  // statistics can live with;
+  void hit(std::size_t i) noexcept
+  {
+    const auto n{hits_[i].load(std::memory_order_relaxed) + 1};
+    hits_[i].store(n, std::memory_order_relaxed);
+    if (n % resort_every == 0 && names_.size() <= max_adaptive)
+      resort();
+  }
+
+  void miss() noexcept { unhandled_.fetch_add(1, std::memory_order_relaxed); }
+};
+
+//------------------------------------------------------------------------------
+
+// Every Dispatch_profile ever created; profiles live as long as the program;
+class Dispatch_registry {
+  mutable std::mutex m_;
+  std::vector<const Dispatch_profile*> profiles_;
+public:
+  static Dispatch_registry& instance()
+  {
+    static Dispatch_registry registry;
+    return registry;
+  }
+
+  void add(const Dispatch_profile* profile)
+  {
+    std::lock_guard lk{m_};
+    profiles_.push_back(profile);
+  }
+
+  std::vector<const Dispatch_profile*> profiles() const
+  {
+    std::lock_guard lk{m_};
+    return profiles_;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+inline Dispatch_profile::Dispatch_profile(std::vector<std::string> names)
+  : names_{std::move(names)},
+    hits_{std::make_unique<std::atomic<std::uint64_t>[]>(names_.size())}
+{
+  if (names_.size() <= max_adaptive)
+    resort();
+  Dispatch_registry::instance().add(this);
+}
+
+//------------------------------------------------------------------------------
+
+// Writes the counters of every handler chain that saw a message, one line
+// per handler; log is anything taking operator<< per line, e.g. Logger_wrap;
+template<class Log>
+void report_dispatch_stats(Log& log)
+{
+  std::size_t site{0};
+  for (const auto* prof : Dispatch_registry::instance().profiles()) {
+    std::uint64_t total{prof->unhandled()};
+    for (std::size_t i{0}; i < prof->size(); ++i)
+      total += prof->hits(i);
+    ++site;
+    if (!total)
+      continue;
+    log << "dispatch site " << site << ": " << total << " messages, "
+        << prof->unhandled() << " unhandled";
+    for (std::size_t i{0}; i < prof->size(); ++i)
+      log << "  " << prof->name(i) << ": " << prof->hits(i) << " ("
+          << 100.0 * static_cast<double>(prof->hits(i)) / static_cast<double>(total)
+          << "%)";
+  }
+}
+
+//------------------------------------------------------------------------------
+
+struct Queue_stats {
+  std::uint64_t pushed;             // Messages pushed
+  std::uint64_t wakeups;            // Times a parked consumer was notified
+  std::uint64_t stash_dropped;      // Set aside by a selective receive and
+                                    // pushed out by the stash limit
+  std::uint64_t queued;             // Waiting when read, set aside ones not
+};                                  // counted; readable from any thread
+
+// A queue's series in the Metrics registry, labelled with its name (see
+// Receiver::publish_metrics())
+struct Queue_metrics {
+  Metrics::Counter messages;        // Pushed
+  Metrics::Histogram handler_ns;    // Per dispatch
+  Metrics::Callback depth;          // Queued, read when collected
+};
+
+//------------------------------------------------------------------------------
+
+class Close_queue;
+
+// Thrown instead of waiting by a single-threaded queue that runs dry
+class Mailbox_empty {};
+
+//------------------------------------------------------------------------------
+
+// Multiple producers, a single consumer (the actor owning the receiver):
+// push() only notifies when that consumer is parked on an empty queue;
 class Simple_queue {
+  using Storage = std::pmr::deque<std::shared_ptr<Message_base>>;
+
   std::mutex m_;
   std::condition_variable cv_;
-  std::queue<std::shared_ptr<Message_base>> q_; // Internal queue stores
-                                                // pointers to message_base
+  std::pmr::memory_resource* mem_{std::pmr::get_default_resource()};
+  std::queue<std::shared_ptr<Message_base>, Storage> q_; // Internal queue stores
+                                                         // pointers to message_base
+  std::atomic<std::size_t> size_{0};            // Lets the consumer poll
+                                                // without taking m_
+  bool parked_{false};                          // Consumer is in cv_.wait
+  bool single_threaded_{false};
+  std::atomic<std::uint64_t> pushed_{0};
+  std::atomic<std::uint64_t> wakeups_{0};
+  Dispatch_mode dispatch_mode_{Dispatch_mode::fixed};
+  Adaptive_wait waiter_;                        // Consumer side only
+  Trace_recorder* tap_{nullptr};                // Optional recording tap
+  std::uint16_t tap_queue_{0};
+  Audit_log* audit_{nullptr};                   // Optional audit tap
+  std::uint16_t audit_queue_{0};
+  Handler_timing* timing_{nullptr};             // Optional, consumer side
+  std::unique_ptr<Queue_metrics> metrics_;      // Optional
+
+  struct Stashed {
+    std::uint64_t seq;                          // Arrival order
+    std::shared_ptr<Message_base> msg;
+  };
+  // Consumer side only: what selective receives passed over, per type;
+  // everything stashed is older than anything still in q_
+  std::unordered_map<Type_tag, std::deque<Stashed>> stash_;
+  std::size_t stashed_{0};
+  std::size_t stash_limit_{4096};
+  std::uint64_t taken_{0};                      // Messages taken from q_
+  std::atomic<std::uint64_t> stash_dropped_{0};
 public:
   template<class T>
   void push(T&& msg)
+  {
+    if (single_threaded_) {
+      enqueue(std::forward<T>(msg));
+      pushed_.store(pushed_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      if (metrics_)
+        metrics_->messages.add();
+      return;
+    }
+    bool wake;
+    {
+      std::lock_guard lk{m_};
+      enqueue(std::forward<T>(msg));
+      wake = parked_ && q_.size() == 1; // Only the empty to non-empty
+    }                                   // transition can find it asleep
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    if (metrics_)
+      metrics_->messages.add();
+    // Notify outside the lock, so the woken consumer does not block on m_
+    if (wake) {
+      wakeups_.fetch_add(1, std::memory_order_relaxed);
+      cv_.notify_one();
+    }
+  }
+
+  // Queue nodes and wrapped messages are allocated from mem from now on;
+  // only allowed while the queue is empty, mem must outlive the queue;
+  void use_memory(std::pmr::memory_resource* mem)
   {
     std::lock_guard lk{m_};
+    if (!q_.empty())
+      throw std::logic_error("Simple_queue::use_memory(): queue is not empty");
+    mem_ = mem ? mem : std::pmr::get_default_resource();
+    q_ = std::queue<std::shared_ptr<Message_base>, Storage>{Storage{mem_}};
+  }
+
+  // Must be set before the consumer starts waiting
+  void set_wait_policy(const Wait_policy& policy)
+  {
+    std::lock_guard lk{m_};
+    waiter_.set_policy(policy);
+  }
+
+  // Must be set before the consumer starts waiting
+  void set_dispatch_mode(Dispatch_mode mode)
+  {
+    std::lock_guard lk{m_};
+    dispatch_mode_ = mode;
+  }
+
+  Dispatch_mode dispatch_mode() const noexcept { return dispatch_mode_; }
+
+  // For simulation: producers and the consumer all run on one thread, so
+  // nothing is locked and nobody waits; popping an empty queue throws
+  // Mailbox_empty instead; must be set before anything is sent
+  void set_single_threaded(bool on)
+  {
+    std::lock_guard lk{m_};
+    single_threaded_ = on;
+  }
+
+  // Messages the consumer has yet to take, set aside ones included;
+  // exact on the consumer's thread only
+  std::size_t pending() const noexcept
+    { return size_.load(std::memory_order_relaxed) + stashed_; }
+
+  // Must be set before the consumer starts waiting
+  void set_stash_limit(std::size_t limit)
+  {
+    std::lock_guard lk{m_};
+    stash_limit_ = limit;
+  }
+
+  Queue_stats stats() const noexcept
+  {
+    return {pushed_.load(std::memory_order_relaxed),
+            wakeups_.load(std::memory_order_relaxed),
+            stash_dropped_.load(std::memory_order_relaxed),
+            size_.load(std::memory_order_relaxed)};
+  }
+
+  void record_to(Trace_recorder* tap, std::uint16_t queue_id)
+  {
+    std::lock_guard lk{m_};
+    tap_ = tap;
+    tap_queue_ = queue_id;
+  }
+
+  void audit_to(Audit_log* audit, std::uint16_t queue_id)
+  {
+    std::lock_guard lk{m_};
+    audit_ = audit;
+    audit_queue_ = queue_id;
+  }
+
+  // Must be set before the consumer starts waiting
+  void time_handlers(Handler_timing* timing)
+  {
+    std::lock_guard lk{m_};
+    timing_ = timing;
+  }
+
+  // Counts messages, times handlers and reads the depth into the Metrics
+  // registry, labelled queue=name; must be called before anything is sent
+  void publish_metrics(std::string_view name)
+  {
+    std::lock_guard lk{m_};
+    const auto labels{Metrics::label("queue", name)};
+    metrics_ = std::make_unique<Queue_metrics>(Queue_metrics{
+      Metrics::counter("cashbox_queue_messages_total", "Messages pushed", labels),
+      Metrics::histogram("cashbox_handler_seconds", "Time in handlers per message",
+                         labels, 1e-9),
+      Metrics::Callback{"cashbox_queue_depth", "Messages waiting", labels,
+                        [this] { return static_cast<double>(size_.load(std::memory_order_relaxed)); }}});
+  }
+
+  bool timed() const noexcept { return timing_ || metrics_; }
+
+  // One dispatch, by the consumer
+  void handled_in(Handler_timing::Clock::duration took)
+  {
+    if (timing_)
+      timing_->record(took);
+    if (metrics_)
+      metrics_->handler_ns.record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+  }
+
+  std::shared_ptr<Message_base> wait_and_pop()
+  {
+    if (auto* oldest{stashed_ ? oldest_stashed() : nullptr}) // Older than anything in q_
+      return take_stashed(*oldest);
+    return pop();
+  }
+
+  // Oldest message of one of types (or a Close_queue); messages of other
+  // types stay behind for a later receive, up to the stash limit
+  std::shared_ptr<Message_base> wait_and_pop_matching(std::span<const Type_tag> types)
+  {
+    if (stashed_) {
+      std::deque<Stashed>* oldest{nullptr};
+      for (const auto type : types)
+        if (auto it{stash_.find(type)}; it != stash_.end() && !it->second.empty()
+            && (!oldest || it->second.front().seq < oldest->front().seq))
+          oldest = &it->second;
+      if (oldest)
+        return take_stashed(*oldest);
+    }
+    for (;;) {
+      auto msg{pop()};
+      if (msg->type() == type_tag<Close_queue>()
+          || std::find(types.begin(), types.end(), msg->type()) != types.end())
+        return msg;
+      stash(std::move(msg));
+    }
+  }
+private:
+  template<class T>
+  void enqueue(T&& msg)             // Requires m_ unless single-threaded
+  {
+    using Msg = std::decay_t<T>;
+    if (tap_)                       // Record in delivery order
+      tap_->record(tap_queue_, static_cast<const Msg&>(msg));
+    if constexpr (Audited<Msg>)
+      if (audit_)
+        audit_->record(audit_queue_, static_cast<const Msg&>(msg));
     // Wrap posted message and store pointer
-    q_.push(std::make_shared<Wrapped_message<T>>(std::forward<T>(msg)));
-    cv_.notify_all();
+    q_.push(std::allocate_shared<Wrapped_message<Msg>>(
+      std::pmr::polymorphic_allocator<>{mem_}, std::forward<T>(msg)));
+    size_.store(q_.size(), std::memory_order_release);
   }
 
-  auto wait_and_pop()
+  std::shared_ptr<Message_base> pop()
   {
+    if (single_threaded_) {
+      if (q_.empty())
+        throw Mailbox_empty{};
+      return take_front();
+    }
+    // Spin, yield or poll as the policy says; parking is left to the cv below
+    if (!ready())
+      waiter_.await([this] { return ready(); });
     std::unique_lock lk{m_};
-    cv_.wait(lk, [&] { return !q_.empty(); }); // Block until queue isn't empty
-    auto res{q_.front()};
+    while (q_.empty()) {            // Block until queue isn't empty
+      parked_ = true;
+      cv_.wait(lk);
+      parked_ = false;
+    }
+    return take_front();
+  }
+
+  std::shared_ptr<Message_base> take_front()
+  {
+    auto res{std::move(q_.front())};
     q_.pop();
+    size_.store(q_.size(), std::memory_order_relaxed);
+    ++taken_;
+    return res;
+  }
+
+  void stash(std::shared_ptr<Message_base> msg)
+  {
+    if (stashed_ >= stash_limit_) { // Make room by dropping the oldest
+      stash_dropped_.fetch_add(1, std::memory_order_relaxed);
+      auto* oldest{oldest_stashed()};
+      if (!oldest)                  // A limit of 0 keeps nothing
+        return;
+      take_stashed(*oldest);
+    }
+    const auto type{msg->type()};
+    stash_[type].push_back({taken_, std::move(msg)});
+    ++stashed_;
+  }
+
+  // The list whose front is the oldest message stashed; nullptr if none is
+  std::deque<Stashed>* oldest_stashed()
+  {
+    std::deque<Stashed>* oldest{nullptr};
+    for (auto& [type, list] : stash_)
+      if (!list.empty() && (!oldest || list.front().seq < oldest->front().seq))
+        oldest = &list;
+    return oldest;
+  }
+
+  std::shared_ptr<Message_base> take_stashed(std::deque<Stashed>& list)
+  {
+    auto res{std::move(list.front().msg)};
+    list.pop_front();
+    --stashed_;
     return res;
   }
+
+  bool ready() const noexcept { return size_.load(std::memory_order_acquire) != 0; }
+};
+
+//------------------------------------------------------------------------------
+
+// One handler of a chain, type-erased for Dispatch_mode::counted/adaptive
+struct Dispatch_entry {
+  Type_tag type;
+  void (*call)(void* self, const Message_base& msg);
+  void* self;
 };
 
 //------------------------------------------------------------------------------
@@ -66,34 +634,122 @@ class Template_dispatcher {
   Previous_dispatcher*const prev_;
   Func f_;
   bool chained_;
+  bool selective_;
+
+  // Handlers up to and including this one; entry depth - 1 is ours
+  static constexpr std::size_t depth{Previous_dispatcher::depth + 1};
 
   template<class Other_dispatcher, class Other_msg, class Other_func>
   friend class Template_dispatcher; // Template_dispatcher instantiations are
                                     // friends of each other.
   void wait_and_dispatch()
   {
-    for (;;)
-      if (dispatch(q_->wait_and_pop()))
+    const auto mode{q_->dispatch_mode()};
+    const bool timed{q_->timed()};
+    for (;;) {
+      const auto msg{selective_ ? q_->wait_and_pop_matching(handled_types())
+                                : q_->wait_and_pop()};
+      const auto start{timed ? Handler_timing::Clock::now() : Handler_timing::Clock::time_point{}};
+      const bool handled{mode == Dispatch_mode::fixed ? dispatch(msg)
+                                                      : dispatch_profiled(*msg, mode)};
+      if (timed)
+        q_->handled_in(Handler_timing::Clock::now() - start);
+      if (handled)
         break;                      // If you handle the message,
-  }                                 // break out of the loop.
+    }                               // break out of the loop.
+  }
 
   bool dispatch(const std::shared_ptr<Message_base>& msg)
   {
-    if (auto*const wrapper =                              // Check the message
-        dynamic_cast<Wrapped_message<Msg>*>(msg.get())) { // type and call
-                                                          // the function.
-      f_(wrapper->contents());
-      return true;
+    if (msg->type() == type_tag<Msg>()) { // Check the message type
+      f_(static_cast<const Wrapped_message<Msg>&>(*msg).contents()); // and call
+      return true;                                                   // the function.
     }
     return prev_->dispatch(msg);    // Chain to the previous dispatcher.
   }
+
+  static Dispatch_profile& profile()   // One per handler chain
+  {
+    static Dispatch_profile prof{handled_names()};
+    return prof;
+  }
+
+  static std::vector<std::string> handled_names()
+  {
+    auto names{Previous_dispatcher::handled_names()};
+    names.push_back(type_name<Msg>());
+    return names;
+  }
+
+  static bool check_close(const Message_base& msg)
+    { return Previous_dispatcher::check_close(msg); }
+
+  template<std::size_t N>
+  static void collect_types(std::array<Type_tag, N>& types)
+  {
+    types[depth - 1] = type_tag<Msg>();
+    Previous_dispatcher::collect_types(types);
+  }
+
+  static const std::array<Type_tag, depth>& handled_types()
+  {
+    static const auto types{[] {
+      std::array<Type_tag, depth> res{};
+      collect_types(res);
+      return res;
+    }()};
+    return types;
+  }
+
+  static void invoke(void* self, const Message_base& msg)
+  {
+    static_cast<Template_dispatcher*>(self)->f_(
+      static_cast<const Wrapped_message<Msg>&>(msg).contents());
+  }
+
+  template<std::size_t N>
+  void collect(std::array<Dispatch_entry, N>& entries)
+  {
+    entries[depth - 1] = {type_tag<Msg>(), &Template_dispatcher::invoke, this};
+    prev_->collect(entries);
+  }
+
+  bool dispatch_profiled(const Message_base& msg, Dispatch_mode mode)
+  {
+    auto& prof{profile()};
+    std::array<Dispatch_entry, depth> entries;
+    collect(entries);
+
+    const auto try_entry{[&](std::size_t i) {
+      if (entries[i].type != msg.type())
+        return false;
+      prof.hit(i);
+      entries[i].call(entries[i].self, msg);
+      return true;
+    }};
+
+    if (mode == Dispatch_mode::adaptive && depth <= Dispatch_profile::max_adaptive) {
+      auto order{prof.order()};     // Hottest first
+      for (std::size_t k{0}; k < depth; ++k, order >>= 4)
+        if (try_entry(order & 0xF))
+          return true;
+    }
+    else {
+      for (auto i{depth}; i-- > 0;) // Chain order: the last handle<>() first
+        if (try_entry(i))
+          return true;
+    }
+    prof.miss();
+    return Previous_dispatcher::check_close(msg);
+  }
 public:
   Template_dispatcher(Simple_queue*const q, Previous_dispatcher*const prev, Func&& f):
-    q_{q}, prev_{prev}, f_{std::move(f)}, chained_{false}
+    q_{q}, prev_{prev}, f_{std::move(f)}, chained_{false},
+    selective_{prev->selective_}
   { prev_->chained_ = true; }
 
   Template_dispatcher(Simple_queue*const q, Previous_dispatcher*const prev, const Func& f):
-    q_{q}, prev_{prev}, f_{f}, chained_{false}
+    q_{q}, prev_{prev}, f_{f}, chained_{false}, selective_{prev->selective_}
   { prev_->chained_ = true; }
 
   Template_dispatcher(Template_dispatcher const&) = delete;
@@ -101,7 +757,7 @@ public:
 
   Template_dispatcher(Template_dispatcher&& other) :
     q_{other.q_}, prev_{other.prev_}, f_{std::move(other.f_)},
-    chained_{other.chained_}
+    chained_{other.chained_}, selective_{other.selective_}
   { other.chained_ = true; }
 
   template<class Other_msg, class Other_func>
@@ -128,6 +784,7 @@ class Close_queue {}; // The message for closing the queue
 class Dispatcher {
   Simple_queue*const q_;
   bool chained_;
+  bool selective_;                  // Leave unhandled messages queued
 
   template<class Other_dispatcher, class Msg, class Func>
   friend class Template_dispatcher; // Allow Template_dispatcher instances to
@@ -138,22 +795,38 @@ class Dispatcher {
       dispatch(q_->wait_and_pop());
   }
 
+  static constexpr std::size_t depth{0};
+
   static bool dispatch(  // dispatch() checks for a close_queue message, and throws.
     const std::shared_ptr<Message_base>& msg)
   {
-    if (dynamic_cast<Wrapped_message<Close_queue>*>(msg.get()))
+    return check_close(*msg);
+  }
+
+  static bool check_close(const Message_base& msg)
+  {
+    if (msg.type() == type_tag<Close_queue>())
       throw Close_queue();
     return false;
   }
+
+  static std::vector<std::string> handled_names() { return {}; }
+
+  template<std::size_t N>
+  void collect(std::array<Dispatch_entry, N>&) {}
+
+  template<std::size_t N>
+  static void collect_types(std::array<Type_tag, N>&) {}
 public:
 
-  explicit Dispatcher(Simple_queue*const q) : q_{q}, chained_{false} {}
+  explicit Dispatcher(Simple_queue*const q, bool selective = false)
+    : q_{q}, chained_{false}, selective_{selective} {}
 
   Dispatcher(Dispatcher const&) = delete;
   Dispatcher& operator=(Dispatcher const&) = delete;
 
   Dispatcher(Dispatcher&& other) :
-    q_{other.q_}, chained_{other.chained_}
+    q_{other.q_}, chained_{other.chained_}, selective_{other.selective_}
   {
     other.chained_ = true; // The source shouldn't
                            // wait for messages.
@@ -202,6 +875,50 @@ public:
   }
   Dispatcher wait()     // Waiting for a queue creates a dispatcher
     { return Dispatcher(&q_); }
+
+  // Selective receive: receive().handle<A>().handle<B>() takes the oldest
+  // A or B, other messages stay queued for a later wait() or receive();
+  // set aside messages are indexed per type, so finding a match is O(1)
+  // in the number of messages passed over
+  Dispatcher receive()
+    { return Dispatcher(&q_, true); }
+
+  // How many messages receive() may set aside; past it the oldest is dropped
+  void set_stash_limit(std::size_t limit) { q_.set_stash_limit(limit); }
+
+  // See Simple_queue::set_single_threaded()
+  void set_single_threaded(bool on) { q_.set_single_threaded(on); }
+
+  std::size_t pending() const noexcept { return q_.pending(); }
+
+  // Every message pushed from now on is also appended to tap
+  // as coming to queue_id; nullptr detaches the tap;
+  void record_to(Trace_recorder* tap, std::uint16_t queue_id)
+    { q_.record_to(tap, queue_id); }
+
+  // Every audited message (see Audited) pushed from now on is also
+  // appended to audit as coming to queue_id; nullptr detaches it;
+  void audit_to(Audit_log* audit, std::uint16_t queue_id)
+    { q_.audit_to(audit, queue_id); }
+
+  // Every dispatch from now on is timed into timing, which must outlive
+  // the receiver's use; nullptr stops it; must be called before anyone
+  // waits on the receiver
+  void time_handlers(Handler_timing* timing) { q_.time_handlers(timing); }
+
+  // See Simple_queue::publish_metrics()
+  void publish_metrics(std::string_view name) { q_.publish_metrics(name); }
+
+  // See Simple_queue::use_memory(), must be called before anything is sent
+  void use_memory(std::pmr::memory_resource* mem) { q_.use_memory(mem); }
+
+  // See Wait_policy; must be called before anyone waits on the receiver
+  void set_wait_policy(const Wait_policy& policy) { q_.set_wait_policy(policy); }
+
+  // See Dispatch_mode; must be called before anyone waits on the receiver
+  void set_dispatch_mode(Dispatch_mode mode) { q_.set_dispatch_mode(mode); }
+
+  Queue_stats stats() const noexcept { return q_.stats(); }
 };
 
 //------------------------------------------------------------------------------
@@ -0,0 +1,613 @@
+#ifndef CASHBOX_METRICS_HPP
+#define CASHBOX_METRICS_HPP
+
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+#if defined(__unix__) || defined(__APPLE__)
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "Handler_timing.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Metrics {
+
+//------------------------------------------------------------------------------
+
+using Messaging::Log_buckets;
+
+constexpr std::size_t max_counters{1024};     // Counters and gauges, all told
+constexpr std::size_t max_histograms{128};
+
+enum class Kind : std::uint8_t { counter, gauge, histogram };
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+
+inline void bump(std::atomic<std::uint64_t>& c, std::uint64_t by) noexcept
+  { c.store(c.load(std::memory_order_relaxed) + by, std::memory_order_relaxed); }
+
+struct alignas(64) Histogram_shard {
+  std::atomic<std::uint64_t> count{0};
+  std::atomic<std::uint64_t> sum{0};
+  std::array<std::atomic<std::uint64_t>, Log_buckets::count> counts{};
+};
+
+// One thread's part of every metric: the thread holding it is the only
+// one to write it, with plain loads and stores; a collector reads it at
+// any time. Histograms are allocated on a thread's first record(). A
+// shared shard (the registry's, for threads past their own) is written
+// by any number of threads at once, with read-modify-writes;
+struct alignas(64) Shard {
+  std::array<std::atomic<std::uint64_t>, max_counters> values{};
+  std::array<std::atomic<Histogram_shard*>, max_histograms> histograms{};
+  const bool shared{false};
+
+  void add(std::atomic<std::uint64_t>& c, std::uint64_t by) noexcept
+  {
+    if (shared)
+      c.fetch_add(by, std::memory_order_relaxed);
+    else
+      bump(c, by);
+  }
+
+  Histogram_shard& histogram(std::size_t slot)
+  {
+    auto* h{histograms[slot].load(std::memory_order_acquire)};
+    if (!h) {
+      auto fresh{std::make_unique<Histogram_shard>()};
+      if (histograms[slot].compare_exchange_strong(h, fresh.get(), std::memory_order_acq_rel,
+                                                   std::memory_order_acquire))
+        h = fresh.release();        // Else h is the one another thread put there
+    }
+    return *h;
+  }
+
+  Shard() = default;
+  explicit Shard(bool shared_) noexcept : shared{shared_} {}
+  Shard(const Shard&) = delete;
+  Shard& operator=(const Shard&) = delete;
+
+  ~Shard()
+  {
+    for (auto& h : histograms)
+      delete h.load(std::memory_order_relaxed);
+  }
+};
+
+inline thread_local Shard* this_thread_shard{nullptr};
+
+struct Shard_lease;
+Shard& attach();                    // After Registry
+
+inline Shard& shard()
+{
+  auto* const s{this_thread_shard};
+  return s ? *s : attach();
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+// Metrics as handles: a name in the registry and a slot in every thread's
+// shard. Copy them freely; all copies are the same metric
+
+// Only goes up
+class Counter {
+  std::size_t slot_;
+public:
+  explicit Counter(std::size_t slot) noexcept : slot_{slot} {}
+
+  void add(std::uint64_t n = 1) const noexcept
+  {
+    auto& s{detail::shard()};
+    s.add(s.values[slot_], n);
+  }
+
+  std::uint64_t value() const;      // Every thread's, merged
+
+  std::size_t slot() const noexcept { return slot_; }
+};
+
+// Goes up and down, by adds from any number of threads (e.g. sessions
+// open); a value that is read rather than kept is a Callback
+class Gauge {
+  std::size_t slot_;
+public:
+  explicit Gauge(std::size_t slot) noexcept : slot_{slot} {}
+
+  void add(std::int64_t n) const noexcept
+  {
+    auto& s{detail::shard()};
+    s.add(s.values[slot_], static_cast<std::uint64_t>(n));
+  }
+
+  void sub(std::int64_t n) const noexcept { add(-n); }
+
+  std::int64_t value() const;
+
+  std::size_t slot() const noexcept { return slot_; }
+};
+
+// What a histogram holds, merged
+struct Histogram_data {
+  std::uint64_t count{0};
+  std::uint64_t sum{0};
+  std::array<std::uint64_t, Log_buckets::count> counts{};
+
+  std::uint64_t quantile(double q) const noexcept
+    { return Log_buckets::quantile(counts, count, q); }
+};
+
+// Values in Log_buckets, e.g. latencies in ns
+class Histogram {
+  std::size_t slot_;
+public:
+  explicit Histogram(std::size_t slot) noexcept : slot_{slot} {}
+
+  void record(std::uint64_t v) const
+  {
+    auto& s{detail::shard()};
+    auto& h{s.histogram(slot_)};
+    s.add(h.counts[Log_buckets::index(v)], 1);
+    s.add(h.sum, v);
+    s.add(h.count, 1);
+  }
+
+  Histogram_data value() const;
+
+  std::size_t slot() const noexcept { return slot_; }
+};
+
+//------------------------------------------------------------------------------
+
+// The process's metrics. Registering (or looking up: a name and labels
+// registered again give back the same metric) takes a lock; adding to a
+// metric never does, it only touches the calling thread's shard. Each
+// thread gets a shard of its own on first use and hands it back when it
+// ends, for the next new thread to carry on from; collecting sums every
+// shard ever handed out, so nothing counted is lost;
+class Registry {
+  friend struct detail::Shard_lease;
+  friend class Callback;
+
+  struct Family {
+    std::string name;
+    std::string help;
+    Kind kind;
+    double scale;                   // Histograms: of exported values
+  };
+
+  struct Series {
+    std::size_t family;
+    std::string labels;             // name="value",...
+    std::size_t slot;
+    std::uint64_t callback_id;      // 0 if not a callback gauge
+    std::function<double()> read;
+  };
+
+  mutable std::mutex m_;
+  std::vector<Family> families_;
+  std::vector<Series> series_;
+  std::size_t counters_{0};
+  std::size_t histograms_{0};
+  std::uint64_t callbacks_{0};
+  std::vector<std::unique_ptr<detail::Shard>> shards_;
+  std::vector<detail::Shard*> free_;
+  detail::Shard late_{true};        // Shared, for threads past their own shard's end
+
+  Registry() = default;
+
+  std::size_t family(std::string_view name, std::string_view help, Kind kind, double scale)
+  {
+    for (std::size_t f{0}; f < families_.size(); ++f)
+      if (families_[f].name == name) {
+        if (families_[f].kind != kind)
+          throw std::invalid_argument("Metrics: " + std::string{name} + " has another kind");
+        return f;
+      }
+    families_.push_back({std::string{name}, std::string{help}, kind, scale});
+    return families_.size() - 1;
+  }
+
+  std::size_t add(std::string_view name, std::string_view help, std::string_view labels,
+                  Kind kind, double scale = 1)
+  {
+    std::lock_guard lk{m_};
+    const auto f{family(name, help, kind, scale)};
+    for (const auto& s : series_)
+      if (s.family == f && s.labels == labels && !s.callback_id)
+        return s.slot;
+    auto& used{kind == Kind::histogram ? histograms_ : counters_};
+    if (used == (kind == Kind::histogram ? max_histograms : max_counters))
+      throw std::length_error("Metrics: too many metrics of a kind");
+    series_.push_back({f, std::string{labels}, used, 0, {}});
+    return used++;
+  }
+
+  detail::Shard* lease()
+  {
+    std::lock_guard lk{m_};
+    if (!free_.empty()) {
+      auto* const s{free_.back()};
+      free_.pop_back();
+      return s;
+    }
+    return shards_.emplace_back(std::make_unique<detail::Shard>()).get();
+  }
+
+  void give_back(detail::Shard* s)
+  {
+    std::lock_guard lk{m_};
+    free_.push_back(s);
+  }
+
+  void remove_callback(std::uint64_t id)
+  {
+    std::lock_guard lk{m_};
+    std::erase_if(series_, [&](const Series& s) { return s.callback_id == id; });
+  }
+
+  template<class F>
+  void each_shard(F f) const        // Requires m_ to be held
+  {
+    for (const auto& s : shards_)
+      f(*s);
+    f(late_);
+  }
+
+  std::uint64_t sum(std::size_t slot) const   // Requires m_ to be held
+  {
+    std::uint64_t res{0};
+    each_shard([&](const detail::Shard& s) { res += s.values[slot].load(std::memory_order_relaxed); });
+    return res;
+  }
+
+  Histogram_data merge(std::size_t slot) const  // Requires m_ to be held
+  {
+    Histogram_data res;
+    each_shard([&](const detail::Shard& s) {
+      const auto* h{s.histograms[slot].load(std::memory_order_acquire)};
+      if (!h)
+        return;
+      res.count += h->count.load(std::memory_order_relaxed);
+      res.sum += h->sum.load(std::memory_order_relaxed);
+      for (std::size_t i{0}; i < Log_buckets::count; ++i)
+        res.counts[i] += h->counts[i].load(std::memory_order_relaxed);
+    });
+    return res;
+  }
+
+  static std::string with_labels(const std::string& labels, std::string_view more = {})
+  {
+    if (labels.empty() && more.empty())
+      return {};
+    return "{" + labels + (labels.empty() || more.empty() ? "" : ",") + std::string{more} + "}";
+  }
+
+  static std::string number(double v)
+  {
+    char buf[32];
+    std::snprintf(buf, sizeof buf, "%.10g", v);
+    return buf;
+  }
+public:
+  static Registry& instance()
+  {
+    static Registry registry;
+    return registry;
+  }
+
+  Registry(const Registry&) = delete;
+  Registry& operator=(const Registry&) = delete;
+
+  Counter counter(std::string_view name, std::string_view help, std::string_view labels = {})
+    { return Counter{add(name, help, labels, Kind::counter)}; }
+
+  Gauge gauge(std::string_view name, std::string_view help, std::string_view labels = {})
+    { return Gauge{add(name, help, labels, Kind::gauge)}; }
+
+  // Values are exported times scale: 1e-9 for ns recorded and seconds
+  // exported, as Prometheus would have it
+  Histogram histogram(std::string_view name, std::string_view help,
+                      std::string_view labels = {}, double scale = 1)
+    { return Histogram{add(name, help, labels, Kind::histogram, scale)}; }
+
+  std::uint64_t counter_value(std::size_t slot) const
+  {
+    std::lock_guard lk{m_};
+    return sum(slot);
+  }
+
+  Histogram_data histogram_value(std::size_t slot) const
+  {
+    std::lock_guard lk{m_};
+    return merge(slot);
+  }
+
+  // Every metric in the Prometheus text exposition format (0.0.4);
+  // histograms get a bucket per power of two up to 2^40, each the count
+  // of values below it
+  void write_prometheus(std::ostream& os) const
+  {
+    std::lock_guard lk{m_};
+    for (std::size_t f{0}; f < families_.size(); ++f) {
+      const auto& fam{families_[f]};
+      os << "# HELP " << fam.name << ' ' << fam.help << '\n'
+         << "# TYPE " << fam.name << ' '
+         << (fam.kind == Kind::counter ? "counter" : fam.kind == Kind::gauge ? "gauge" : "histogram")
+         << '\n';
+      for (const auto& s : series_) {
+        if (s.family != f)
+          continue;
+        if (s.read)
+          os << fam.name << with_labels(s.labels) << ' ' << number(s.read()) << '\n';
+        else if (fam.kind == Kind::counter)
+          os << fam.name << with_labels(s.labels) << ' ' << sum(s.slot) << '\n';
+        else if (fam.kind == Kind::gauge)
+          os << fam.name << with_labels(s.labels) << ' '
+             << static_cast<std::int64_t>(sum(s.slot)) << '\n';
+        else {
+          const auto h{merge(s.slot)};
+          std::uint64_t below{0};
+          std::size_t i{0};
+          for (unsigned k{0}; k <= 40; ++k) {
+            for (; i < Log_buckets::count && Log_buckets::upper(i) < (std::uint64_t{1} << k); ++i)
+              below += h.counts[i];
+            os << fam.name << "_bucket"
+               << with_labels(s.labels, "le=\"" + number(std::ldexp(fam.scale, static_cast<int>(k))) + "\"")
+               << ' ' << below << '\n';
+          }
+          os << fam.name << "_bucket" << with_labels(s.labels, "le=\"+Inf\"") << ' ' << h.count << '\n'
+             << fam.name << "_sum" << with_labels(s.labels) << ' '
+             << number(static_cast<double>(h.sum) * fam.scale) << '\n'
+             << fam.name << "_count" << with_labels(s.labels) << ' ' << h.count << '\n';
+        }
+      }
+    }
+  }
+
+  std::string prometheus() const
+  {
+    std::ostringstream os;
+    write_prometheus(os);
+    return os.str();
+  }
+
+  // Written to fname + ".tmp" and renamed over fname, so that whoever
+  // picks the file up (e.g. node_exporter's textfile collector) never
+  // sees half of it
+  void write_prometheus_file(const std::string& fname) const
+  {
+    const auto text{prometheus()};
+    const auto tmp{fname + ".tmp"};
+    std::FILE* f{std::fopen(tmp.c_str(), "wb")};
+    if (!f)
+      throw std::runtime_error("Metrics: cannot write " + tmp);
+    const bool ok{std::fwrite(text.data(), 1, text.size(), f) == text.size()};
+    if (std::fclose(f) != 0 || !ok || std::rename(tmp.c_str(), fname.c_str()) != 0)
+      throw std::runtime_error("Metrics: cannot write " + fname);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+inline std::uint64_t Counter::value() const { return Registry::instance().counter_value(slot_); }
+
+inline std::int64_t Gauge::value() const
+  { return static_cast<std::int64_t>(Registry::instance().counter_value(slot_)); }
+
+inline Histogram_data Histogram::value() const { return Registry::instance().histogram_value(slot_); }
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+
+// Holds a thread's shard for as long as the thread runs
+struct Shard_lease {
+  Shard* shard{Registry::instance().lease()};
+
+  Shard_lease() = default;
+  Shard_lease(const Shard_lease&) = delete;
+  Shard_lease& operator=(const Shard_lease&) = delete;
+
+  ~Shard_lease()
+  {
+    this_thread_shard = &Registry::instance().late_;
+    Registry::instance().give_back(shard);
+  }
+};
+
+inline Shard& attach()
+{
+  thread_local Shard_lease lease;
+  this_thread_shard = lease.shard;
+  return *lease.shard;
+}
+
+}
+
+//------------------------------------------------------------------------------
+
+// A gauge read when metrics are collected, for as long as the Callback
+// lives; read must be safe to call from any thread, and cheap
+class Callback {
+  std::uint64_t id_{0};
+public:
+  Callback() = default;
+
+  Callback(std::string_view name, std::string_view help, std::string_view labels,
+           std::function<double()> read)
+  {
+    auto& r{Registry::instance()};
+    std::lock_guard lk{r.m_};
+    const auto f{r.family(name, help, Kind::gauge, 1)};
+    id_ = ++r.callbacks_;
+    r.series_.push_back({f, std::string{labels}, 0, id_, std::move(read)});
+  }
+
+  Callback(Callback&& other) noexcept : id_{std::exchange(other.id_, 0)} {}
+
+  Callback& operator=(Callback&& other) noexcept
+  {
+    if (this != &other) {
+      reset();
+      id_ = std::exchange(other.id_, 0);
+    }
+    return *this;
+  }
+
+  ~Callback() { reset(); }
+
+  void reset()
+  {
+    if (id_)
+      Registry::instance().remove_callback(std::exchange(id_, 0));
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Shorthands for the process's registry
+inline Counter counter(std::string_view name, std::string_view help, std::string_view labels = {})
+  { return Registry::instance().counter(name, help, labels); }
+
+inline Gauge gauge(std::string_view name, std::string_view help, std::string_view labels = {})
+  { return Registry::instance().gauge(name, help, labels); }
+
+inline Histogram histogram(std::string_view name, std::string_view help,
+                           std::string_view labels = {}, double scale = 1)
+  { return Registry::instance().histogram(name, help, labels, scale); }
+
+// name="value", escaped for the exposition format
+inline std::string label(std::string_view name, std::string_view value)
+{
+  std::string res{name};
+  res += "=\"";
+  for (const char c : value) {
+    switch (c) {
+    case '\\': res += "\\\\"; break;
+    case '"':  res += "\\\""; break;
+    case '\n': res += "\\n"; break;
+    default:   res += c;
+    }
+  }
+  return res + '"';
+}
+
+//------------------------------------------------------------------------------
+
+// Serves the registry's metrics over HTTP on 127.0.0.1 only, to whatever
+// asks (GET /metrics or any other path), one connection at a time, from a
+// thread of its own; port 0 takes any free port (see port());
+class Http_exporter {
+  int fd_{-1};
+  std::uint16_t port_{0};
+  std::jthread thread_;
+
+#if defined(__unix__) || defined(__APPLE__)
+  static void serve(int client)
+  {
+    char request[1024];             // Read what the client sent, for
+    pollfd p{client, POLLIN, 0};    // its sake; the answer is the same
+    if (::poll(&p, 1, 1000) > 0 && ::recv(client, request, sizeof request, 0) < 0)
+      return;
+    const auto body{Registry::instance().prometheus()};
+    const auto head{"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                    "Content-Length: " + std::to_string(body.size()) + "\r\nConnection: close\r\n\r\n"};
+    for (const auto& part : {head, body})
+      for (std::size_t sent{0}; sent < part.size();) {
+        const auto n{::send(client, part.data() + sent, part.size() - sent, MSG_NOSIGNAL)};
+        if (n <= 0)
+          return;
+        sent += static_cast<std::size_t>(n);
+      }
+  }
+
+  void run(std::stop_token stop)
+  {
+    while (!stop.stop_requested()) {
+      pollfd p{fd_, POLLIN, 0};
+      if (::poll(&p, 1, 100) <= 0)  // Now and then, to see stop
+        continue;
+      const int client{::accept(fd_, nullptr, nullptr)};
+      if (client < 0)
+        continue;
+      serve(client);
+      ::close(client);
+    }
+  }
+#endif
+public:
+  explicit Http_exporter(std::uint16_t port)
+  {
+#if defined(__unix__) || defined(__APPLE__)
+    fd_ = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd_ < 0)
+      throw std::runtime_error("Http_exporter: no socket");
+    const int on{1};
+    ::setsockopt(fd_, SOL_SOCKET, SO_REUSEADDR, &on, sizeof on);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    socklen_t len{sizeof addr};
+    if (::bind(fd_, reinterpret_cast<sockaddr*>(&addr), sizeof addr) != 0 || ::listen(fd_, 8) != 0
+        || ::getsockname(fd_, reinterpret_cast<sockaddr*>(&addr), &len) != 0) {
+      ::close(fd_);
+      throw std::runtime_error("Http_exporter: cannot listen on port " + std::to_string(port));
+    }
+    port_ = ntohs(addr.sin_port);
+    thread_ = std::jthread{[this](std::stop_token stop) { run(stop); }};
+#else
+    (void)port;
+    throw std::runtime_error("Http_exporter: not supported on this platform");
+#endif
+  }
+
+  Http_exporter(const Http_exporter&) = delete;
+  Http_exporter& operator=(const Http_exporter&) = delete;
+
+  ~Http_exporter()
+  {
+    thread_ = {};                   // Stops and joins
+#if defined(__unix__) || defined(__APPLE__)
+    if (fd_ >= 0)
+      ::close(fd_);
+#endif
+  }
+
+  std::uint16_t port() const noexcept { return port_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_METRICS_HPP
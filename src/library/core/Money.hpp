@@ -0,0 +1,352 @@
+#ifndef CASHBOX_MONEY_HPP
+#define CASHBOX_MONEY_HPP
+
+//------------------------------------------------------------------------------
+
+#include <charconv>
+#include <compare>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <ostream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+// ISO 4217 code and the number of minor digits, packed into 32 bits so
+// that the check in every Money operation is one register compare;
+// trivially copyable, so it goes into traces and flat tables as is;
+class Currency {
+  std::uint32_t packed_{pack('X', 'X', 'X', 0)};    // XXX: no currency
+
+  static constexpr std::uint32_t pack(char a, char b, char c, std::uint8_t digits) noexcept
+  {
+    return static_cast<std::uint32_t>(static_cast<unsigned char>(a))
+      | static_cast<std::uint32_t>(static_cast<unsigned char>(b)) << 8
+      | static_cast<std::uint32_t>(static_cast<unsigned char>(c)) << 16
+      | static_cast<std::uint32_t>(digits) << 24;
+  }
+public:
+  constexpr Currency() noexcept = default;
+
+  constexpr Currency(const char (&code)[4], std::uint8_t minor_digits) noexcept
+    : packed_{pack(code[0], code[1], code[2], minor_digits)} {}
+
+  constexpr std::uint8_t minor_digits() const noexcept
+    { return static_cast<std::uint8_t>(packed_ >> 24); }
+
+  constexpr bool operator==(const Currency&) const = default;
+
+  std::string code() const
+  {
+    return {static_cast<char>(packed_ & 0xff), static_cast<char>((packed_ >> 8) & 0xff),
+            static_cast<char>((packed_ >> 16) & 0xff)};
+  }
+};
+
+inline constexpr Currency usd{"USD", 2};
+inline constexpr Currency eur{"EUR", 2};
+inline constexpr Currency gbp{"GBP", 2};
+inline constexpr Currency jpy{"JPY", 0};
+
+//------------------------------------------------------------------------------
+
+// a + b and a - b on int64 with an overflow flag; no branches, and
+// usable in constant expressions;
+constexpr bool add_overflows(std::int64_t a, std::int64_t b, std::int64_t& res) noexcept
+{
+  res = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) + static_cast<std::uint64_t>(b));
+  return ((a ^ res) & (b ^ res)) < 0;   // Both operands differ in sign from res
+}
+
+constexpr bool sub_overflows(std::int64_t a, std::int64_t b, std::int64_t& res) noexcept
+{
+  res = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) - static_cast<std::uint64_t>(b));
+  return ((a ^ b) & (a ^ res)) < 0;     // Signs differed and res took b's
+}
+
+constexpr bool mul_overflows(std::int64_t a, std::int64_t b, std::int64_t& res) noexcept
+{
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_mul_overflow(a, b, &res);
+#else
+  if (a == 0 || b == 0) {
+    res = 0;
+    return false;
+  }
+  res = static_cast<std::int64_t>(static_cast<std::uint64_t>(a) * static_cast<std::uint64_t>(b));
+  return (a == -1 && b == std::numeric_limits<std::int64_t>::min())
+    || (b == -1 && a == std::numeric_limits<std::int64_t>::min())
+    || res / b != a;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+// An amount in minor units (cents) of one currency. Arithmetic is checked:
+// overflow throws std::overflow_error and mixing currencies throws
+// std::invalid_argument; both checks are folded into one predictable
+// branch. Ordering amounts of different currencies throws as well;
+class Money {
+  std::int64_t minor_{0};
+  Currency currency_{};
+
+  constexpr Money(std::int64_t minor, Currency currency) noexcept
+    : minor_{minor}, currency_{currency} {}
+
+  [[noreturn]] static void fail(bool overflow)
+  {
+    if (overflow)
+      throw std::overflow_error("Money: arithmetic overflow");
+    throw std::invalid_argument("Money: currencies differ");
+  }
+
+  constexpr void require_same(const Money& other) const
+  {
+    if (currency_ != other.currency_) [[unlikely]]
+      fail(false);
+  }
+public:
+  constexpr Money() noexcept = default;   // Zero, no currency
+
+  static constexpr Money minor(std::int64_t units, Currency currency = usd) noexcept
+    { return Money{units, currency}; }
+
+  static constexpr Money major(std::int64_t units, Currency currency = usd)
+  {
+    std::int64_t scale{1};
+    for (auto d{currency.minor_digits()}; d; --d)
+      scale *= 10;
+    std::int64_t res{0};
+    if (mul_overflows(units, scale, res)) [[unlikely]]
+      fail(true);
+    return Money{res, currency};
+  }
+
+  constexpr std::int64_t minor_units() const noexcept { return minor_; }
+  constexpr Currency currency() const noexcept { return currency_; }
+  constexpr bool is_zero() const noexcept { return minor_ == 0; }
+  constexpr bool is_negative() const noexcept { return minor_ < 0; }
+
+  constexpr Money& operator+=(const Money& other)
+  {
+    std::int64_t res{0};
+    const bool overflow{add_overflows(minor_, other.minor_, res)};
+    if (overflow | (currency_ != other.currency_)) [[unlikely]]
+      fail(overflow);
+    minor_ = res;
+    return *this;
+  }
+
+  constexpr Money& operator-=(const Money& other)
+  {
+    std::int64_t res{0};
+    const bool overflow{sub_overflows(minor_, other.minor_, res)};
+    if (overflow | (currency_ != other.currency_)) [[unlikely]]
+      fail(overflow);
+    minor_ = res;
+    return *this;
+  }
+
+  constexpr Money& operator*=(std::int64_t factor)
+  {
+    std::int64_t res{0};
+    if (mul_overflows(minor_, factor, res)) [[unlikely]]
+      fail(true);
+    minor_ = res;
+    return *this;
+  }
+
+  friend constexpr Money operator+(Money a, const Money& b) { return a += b; }
+  friend constexpr Money operator-(Money a, const Money& b) { return a -= b; }
+  friend constexpr Money operator*(Money a, std::int64_t factor) { return a *= factor; }
+  friend constexpr Money operator*(std::int64_t factor, Money a) { return a *= factor; }
+
+  constexpr Money operator-() const { return Money{0, currency_} - *this; }
+
+  constexpr bool operator==(const Money&) const = default;
+
+  constexpr std::strong_ordering operator<=>(const Money& other) const
+  {
+    require_same(other);
+    return minor_ <=> other.minor_;
+  }
+};
+
+static_assert(std::is_trivially_copyable_v<Money>);
+
+// "12.34 USD"
+inline std::ostream& operator<<(std::ostream& os, const Money& m)
+{
+  const auto digits{m.currency().minor_digits()};
+  std::uint64_t scale{1};
+  for (auto d{digits}; d; --d)
+    scale *= 10;
+  const auto minor{m.minor_units()};
+  const auto magnitude{minor < 0 ? 0 - static_cast<std::uint64_t>(minor)
+                                 : static_cast<std::uint64_t>(minor)};
+  if (minor < 0)
+    os << '-';
+  os << magnitude / scale;
+  if (digits) {
+    auto frac{std::to_string(magnitude % scale)};
+    os << '.' << std::string(digits - frac.size(), '0') << frac;
+  }
+  return os << ' ' << m.currency().code();
+}
+
+// "12.34" (or "-12.34", "12", "12.3") in currency's minor units; nullopt
+// on anything else, on more fraction digits than the currency has, or if
+// it does not fit;
+inline std::optional<Money> parse_money(std::string_view text, Currency currency = usd)
+{
+  const bool negative{!text.empty() && text.front() == '-'};
+  if (negative)
+    text.remove_prefix(1);
+  const auto dot{text.find('.')};
+  const auto whole{text.substr(0, dot)};
+  const auto frac{dot == std::string_view::npos ? std::string_view{} : text.substr(dot + 1)};
+  const auto digits{currency.minor_digits()};
+  const auto is_digit{[](char c) { return c >= '0' && c <= '9'; }};
+  if (whole.empty() || !is_digit(whole.front()) || frac.size() > digits
+      || (dot != std::string_view::npos && (frac.empty() || !is_digit(frac.front()))))
+    return std::nullopt;
+
+  std::int64_t units{0};
+  auto [end, ec]{std::from_chars(whole.data(), whole.data() + whole.size(), units)};
+  if (ec != std::errc{} || end != whole.data() + whole.size())
+    return std::nullopt;
+  std::int64_t minor{0};
+  if (!frac.empty()) {
+    auto [fend, fec]{std::from_chars(frac.data(), frac.data() + frac.size(), minor)};
+    if (fec != std::errc{} || fend != frac.data() + frac.size())
+      return std::nullopt;
+  }
+  for (auto d{frac.size()}; d < digits; ++d)
+    minor *= 10;
+
+  std::int64_t scale{1};
+  for (auto d{digits}; d; --d)
+    scale *= 10;
+  std::int64_t res{0};
+  if (mul_overflows(units, scale, res) || add_overflows(res, minor, res))
+    return std::nullopt;
+  return Money::minor(negative ? -res : res, currency);
+}
+
+//------------------------------------------------------------------------------
+
+// Batch operations over flat arrays of minor units (one currency), for
+// reconciliation; written over GCC/Clang vector types, which compile to
+// whatever SIMD the target has, with a scalar fallback elsewhere;
+
+namespace detail {
+#if defined(__GNUC__) || defined(__clang__)
+inline constexpr std::size_t lanes{8};
+typedef std::int64_t Lanes __attribute__((vector_size(lanes * sizeof(std::int64_t))));
+typedef std::uint64_t Ulanes __attribute__((vector_size(sizeof(Lanes))));
+#endif
+}
+
+// Sum of amounts; nullopt if it does not fit in 64 bits. Lanes add
+// independently and flag their own overflow; only if one did is the sum
+// redone exactly, so intermediate excursions never cause false alarms;
+inline std::optional<std::int64_t> checked_sum(std::span<const std::int64_t> amounts) noexcept
+{
+  std::size_t i{0};
+  std::int64_t total{0};
+  bool overflow{false};
+#if defined(__GNUC__) || defined(__clang__)
+  using detail::Lanes;
+  Lanes sum{};
+  Lanes flags{};
+  for (; i + detail::lanes <= amounts.size(); i += detail::lanes) {
+    Lanes v;                            // Unaligned load
+    __builtin_memcpy(&v, amounts.data() + i, sizeof(v));
+    const auto s{__builtin_convertvector(__builtin_convertvector(sum, detail::Ulanes)
+                                         + __builtin_convertvector(v, detail::Ulanes), Lanes)};
+    flags |= (sum ^ s) & (v ^ s);
+    sum = s;
+  }
+  std::int64_t any{0};
+  for (std::size_t l{0}; l < detail::lanes; ++l) {
+    any |= flags[l];
+    overflow |= add_overflows(total, sum[l], total);
+  }
+  if (any < 0)
+    overflow = true;
+#endif
+  for (; i < amounts.size(); ++i)
+    overflow |= add_overflows(total, amounts[i], total);
+  if (!overflow)
+    return total;
+
+  // Slow path, rare by construction: the exact sum in two words, high
+  // and low, as a 128-bit one would have it, which not every compiler has
+  std::uint64_t low{0};
+  std::int64_t high{0};
+  for (const auto a : amounts) {
+    const auto before{low};
+    low += static_cast<std::uint64_t>(a);
+    high += (a < 0 ? -1 : 0) + (low < before ? 1 : 0);
+  }
+  const auto exact{static_cast<std::int64_t>(low)};
+  if (high != (exact < 0 ? -1 : 0))     // Does not fit in the low word
+    return std::nullopt;
+  return exact;
+}
+
+// Index of the first position where a and b differ, or the length of the
+// shorter one if that is a prefix of the other;
+inline std::size_t first_difference(std::span<const std::int64_t> a,
+                                    std::span<const std::int64_t> b) noexcept
+{
+  const auto n{a.size() < b.size() ? a.size() : b.size()};
+  std::size_t i{0};
+#if defined(__GNUC__) || defined(__clang__)
+  using detail::Lanes;
+  for (; i + detail::lanes <= n; i += detail::lanes) {
+    Lanes va, vb;
+    __builtin_memcpy(&va, a.data() + i, sizeof(va));
+    __builtin_memcpy(&vb, b.data() + i, sizeof(vb));
+    const auto diff{va ^ vb};
+    std::int64_t any{0};
+    for (std::size_t l{0}; l < detail::lanes; ++l)
+      any |= diff[l];
+    if (any)
+      break;                            // The scalar loop finds the lane
+  }
+#endif
+  for (; i < n; ++i)
+    if (a[i] != b[i])
+      return i;
+  return n;
+}
+
+// Positions where a and b differ (up to the shorter length)
+inline std::size_t count_differences(std::span<const std::int64_t> a,
+                                     std::span<const std::int64_t> b) noexcept
+{
+  const auto n{a.size() < b.size() ? a.size() : b.size()};
+  std::size_t count{0};
+  for (std::size_t i{0}; i < n; ++i)    // Plain enough to vectorize as is
+    count += a[i] != b[i];
+  return count;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_MONEY_HPP
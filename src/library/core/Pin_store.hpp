@@ -0,0 +1,298 @@
+#ifndef CASHBOX_PIN_STORE_HPP
+#define CASHBOX_PIN_STORE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <optional>
+#include <random>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+#include "Sha256.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+// What is kept of a PIN: a random salt and the leading half of its
+// PBKDF2-HMAC-SHA256 under that salt. A PIN has at most a few million
+// values, so 128 bits of hash lose nothing, and two records share a
+// cache line
+struct Pin_record {
+  std::array<std::uint8_t, 16> salt;
+  std::array<std::uint8_t, 16> hash;
+};
+
+static_assert(sizeof(Pin_record) == 32);
+
+struct Pin_check {
+  std::string_view account;
+  std::string_view pin;
+};
+
+namespace detail {
+  // Looks at every byte whatever the first difference, so the time taken
+  // says nothing about how much of a guess was right
+  inline bool same_hash(const std::array<std::uint8_t, 16>& a,
+                        const Crypto::Digest& b) noexcept
+  {
+    unsigned diff{0};
+    for (std::size_t i{0}; i < a.size(); ++i)
+      diff |= static_cast<unsigned>(a[i] ^ b[i]);
+    return diff == 0;
+  }
+
+  inline void append_hex(std::string& out, std::span<const std::uint8_t> bytes)
+  {
+    constexpr std::string_view digits{"0123456789abcdef"};
+    for (const auto b : bytes) {
+      out += digits[b >> 4];
+      out += digits[b & 0xf];
+    }
+  }
+
+  // False unless text is exactly 2 * out.size() hex digits
+  inline bool parse_hex(std::string_view text, std::span<std::uint8_t> out) noexcept
+  {
+    if (text.size() != 2 * out.size())
+      return false;
+    const auto nibble{[](char c) {
+      return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10
+           : c >= 'A' && c <= 'F' ? c - 'A' + 10 : -1;
+    }};
+    for (std::size_t i{0}; i < out.size(); ++i) {
+      const auto hi{nibble(text[2 * i])};
+      const auto lo{nibble(text[2 * i + 1])};
+      if (hi < 0 || lo < 0)
+        return false;
+      out[i] = static_cast<std::uint8_t>(hi << 4 | lo);
+    }
+    return true;
+  }
+}
+
+//------------------------------------------------------------------------------
+
+// Salted PIN hashes of a fixed set of accounts. Read-only once built, so
+// any number of threads may verify at once. Hashing is deliberately
+// slow (iterations rounds of HMAC), which is why verify() takes batches:
+// their hashes run side by side in SIMD lanes (see Crypto::pbkdf2_sha256).
+// An unknown account is hashed against a decoy record like any other, so
+// it takes just as long to be refused
+class Pin_store {
+  std::vector<std::string> accounts_;           // Sorted
+  std::vector<Pin_record> records_;             // In the same order
+  std::uint32_t iterations_;
+  Pin_record decoy_;
+
+  static Pin_record salted(std::mt19937_64& rng)
+  {
+    Pin_record r{};
+    for (auto& b : r.salt)
+      b = static_cast<std::uint8_t>(rng());
+    return r;
+  }
+
+  static std::mt19937_64 salt_source()
+  {
+    std::random_device rd;
+    return std::mt19937_64{(std::uint64_t{rd()} << 32) ^ rd()};
+  }
+
+  void sort_and_check()
+  {
+    std::vector<std::size_t> order(accounts_.size());
+    for (std::size_t i{0}; i < order.size(); ++i)
+      order[i] = i;
+    std::sort(order.begin(), order.end(),
+              [&](auto a, auto b) { return accounts_[a] < accounts_[b]; });
+    std::vector<std::string> accounts;
+    std::vector<Pin_record> records;
+    accounts.reserve(order.size());
+    records.reserve(order.size());
+    for (const auto i : order) {
+      accounts.push_back(std::move(accounts_[i]));
+      records.push_back(records_[i]);
+    }
+    if (std::adjacent_find(accounts.begin(), accounts.end()) != accounts.end())
+      throw std::invalid_argument("Pin_store: duplicate account");
+    accounts_ = std::move(accounts);
+    records_ = std::move(records);
+  }
+public:
+  static constexpr std::uint32_t default_iterations{4'096};
+
+  // Hashes the PIN of each (account, PIN) under a fresh salt
+  explicit Pin_store(std::span<const std::pair<std::string, std::string>> pins,
+                     std::uint32_t iterations = default_iterations)
+    : iterations_{iterations}
+  {
+    auto rng{salt_source()};
+    decoy_ = salted(rng);
+    accounts_.reserve(pins.size());
+    records_.reserve(pins.size());
+    std::vector<Crypto::Pbkdf2_job> jobs;
+    jobs.reserve(pins.size());
+    for (const auto& [account, pin] : pins) {
+      accounts_.push_back(account);
+      records_.push_back(salted(rng));
+      jobs.push_back({pin, records_.back().salt});
+    }
+    std::vector<Crypto::Digest> hashes(jobs.size());
+    Crypto::pbkdf2_sha256(jobs, iterations_, hashes);
+    for (std::size_t i{0}; i < hashes.size(); ++i)
+      std::copy_n(hashes[i].begin(), records_[i].hash.size(), records_[i].hash.begin());
+    sort_and_check();
+  }
+
+  // Records made earlier with the same iteration count (see make_record())
+  Pin_store(std::vector<std::pair<std::string, Pin_record>> records, std::uint32_t iterations)
+    : iterations_{iterations}
+  {
+    auto rng{salt_source()};
+    decoy_ = salted(rng);
+    accounts_.reserve(records.size());
+    records_.reserve(records.size());
+    for (auto& [account, record] : records) {
+      accounts_.push_back(std::move(account));
+      records_.push_back(record);
+    }
+    sort_and_check();
+  }
+
+  static Pin_record make_record(std::string_view pin, std::uint32_t iterations = default_iterations)
+  {
+    auto rng{salt_source()};
+    auto r{salted(rng)};
+    const auto h{Crypto::pbkdf2_sha256(pin, r.salt, iterations)};
+    std::copy_n(h.begin(), r.hash.size(), r.hash.begin());
+    return r;
+  }
+
+  std::optional<std::size_t> find(std::string_view account) const noexcept
+  {
+    const auto it{std::lower_bound(accounts_.begin(), accounts_.end(), account)};
+    if (it == accounts_.end() || *it != account)
+      return std::nullopt;
+    return static_cast<std::size_t>(it - accounts_.begin());
+  }
+
+  // out[i] for checks[i]: whether the PIN is that of the account
+  void verify(std::span<const Pin_check> checks, std::span<bool> out) const
+  {
+    std::vector<Crypto::Pbkdf2_job> jobs(checks.size());
+    std::vector<const Pin_record*> against(checks.size());  // Null if unknown
+    for (std::size_t i{0}; i < checks.size(); ++i) {
+      const auto at{find(checks[i].account)};
+      against[i] = at ? &records_[*at] : nullptr;
+      jobs[i] = {checks[i].pin, (at ? records_[*at] : decoy_).salt};
+    }
+    std::vector<Crypto::Digest> hashes(jobs.size());
+    Crypto::pbkdf2_sha256(jobs, iterations_, hashes);
+    for (std::size_t i{0}; i < checks.size(); ++i)
+      out[i] = detail::same_hash((against[i] ? *against[i] : decoy_).hash, hashes[i])
+               && against[i] != nullptr;
+  }
+
+  bool verify(std::string_view account, std::string_view pin) const
+  {
+    const auto at{find(account)};
+    const auto& against{at ? records_[*at] : decoy_};
+    return detail::same_hash(against.hash, Crypto::pbkdf2_sha256(pin, against.salt, iterations_))
+           && at.has_value();
+  }
+
+  std::size_t size() const noexcept { return accounts_.size(); }
+
+  std::uint32_t iterations() const noexcept { return iterations_; }
+
+  // Table memory, names included
+  std::size_t bytes() const noexcept
+  {
+    std::size_t res{sizeof(*this) + records_.capacity() * sizeof(Pin_record)
+                    + accounts_.capacity() * sizeof(std::string)};
+    for (const auto& a : accounts_)
+      if (a.capacity() > std::string{}.capacity())
+        res += a.capacity() + 1;
+    return res;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// One line of a PIN file: account,iterations,salt,hash, the last two in hex
+inline std::string pin_line(std::string_view account, const Pin_record& record,
+                            std::uint32_t iterations = Pin_store::default_iterations)
+{
+  std::string res{account};
+  res += ',';
+  res += std::to_string(iterations);
+  res += ',';
+  detail::append_hex(res, record.salt);
+  res += ',';
+  detail::append_hex(res, record.hash);
+  return res;
+}
+
+// PIN records as pin_line() writes them, one a line, all with the same
+// iteration count; blank lines and lines starting with '#' are skipped.
+// The PINs themselves never need to be written down;
+inline Pin_store read_pins(const std::string& path)
+{
+  std::ifstream in{path};
+  if (!in)
+    throw std::runtime_error("read_pins(): cannot open " + path);
+  std::vector<std::pair<std::string, Pin_record>> records;
+  std::optional<std::uint32_t> iterations;
+  std::string line;
+  for (std::size_t line_no{1}; std::getline(in, line); ++line_no) {
+    if (line.empty() || line.front() == '#')
+      continue;
+    const auto bad{[&] {
+      return std::runtime_error("read_pins(): " + path + ':' + std::to_string(line_no)
+                                + ": bad line");
+    }};
+    const auto c1{line.find(',')};
+    const auto c2{line.find(',', c1 + 1)};
+    const auto c3{line.find(',', c2 + 1)};
+    if (c1 == 0 || c1 == std::string::npos || c2 == std::string::npos
+        || c3 == std::string::npos)
+      throw bad();
+    const std::string_view text{line};
+    std::uint32_t n{0};
+    const auto rounds{text.substr(c1 + 1, c2 - c1 - 1)};
+    if (const auto [end, ec]{std::from_chars(rounds.data(), rounds.data() + rounds.size(), n)};
+        ec != std::errc{} || end != rounds.data() + rounds.size() || n == 0)
+      throw bad();
+    if (iterations && *iterations != n)
+      throw std::runtime_error("read_pins(): " + path + ':' + std::to_string(line_no)
+                               + ": iteration count differs from the lines before");
+    iterations = n;
+    Pin_record r{};
+    if (!detail::parse_hex(text.substr(c2 + 1, c3 - c2 - 1), r.salt)
+        || !detail::parse_hex(text.substr(c3 + 1), r.hash))
+      throw bad();
+    records.emplace_back(line.substr(0, c1), r);
+  }
+  return Pin_store{std::move(records), iterations.value_or(Pin_store::default_iterations)};
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_PIN_STORE_HPP
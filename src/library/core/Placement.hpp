@@ -0,0 +1,272 @@
+#ifndef CASHBOX_PLACEMENT_HPP
+#define CASHBOX_PLACEMENT_HPP
+
+//------------------------------------------------------------------------------
+
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <memory_resource>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Where and how an actor thread runs; everything is optional,
+// a default constructed placement leaves the thread to the scheduler;
+struct Actor_placement {
+  std::optional<int> cpu;       // Pin the thread to this CPU
+  std::optional<int> numa_node; // Keep queue storage (and the thread,
+                                // if no cpu given) on this node
+  Wait_policy wait;             // How to wait on an empty queue
+};
+
+//------------------------------------------------------------------------------
+
+inline int parse_placement_int(std::string_view s, std::string_view what)
+{
+  int value{0};
+  const auto [p, ec] = std::from_chars(s.data(), s.data() + s.size(), value);
+  if (ec != std::errc{} || p != s.data() + s.size() || value < 0)
+    throw std::invalid_argument("parse_placement(): bad " + std::string{what});
+  return value;
+}
+
+//------------------------------------------------------------------------------
+
+inline Wait_strategy parse_wait_strategy(std::string_view s)
+{
+  if (s == "block")
+    return Wait_strategy::block;
+  if (s == "spin")
+    return Wait_strategy::spin;
+  if (s == "yield")
+    return Wait_strategy::spin_yield_block;
+  if (s == "poll")
+    return Wait_strategy::busy_poll;
+  throw std::invalid_argument("parse_placement(): unknown wait " + std::string{s});
+}
+
+//------------------------------------------------------------------------------
+
+// Parses "cpu=2,node=0,wait=yield,spin=20000,adaptive=0" (any subset,
+// any order); wait is one of block, spin, yield, poll; a spin budget
+// alone implies wait=spin;
+inline Actor_placement parse_placement(std::string_view spec)
+{
+  Actor_placement res;
+  while (!spec.empty()) {
+    const auto comma{spec.find(',')};
+    const auto item{spec.substr(0, comma)};
+    spec = comma == std::string_view::npos ? std::string_view{} : spec.substr(comma + 1);
+
+    const auto eq{item.find('=')};
+    if (eq == std::string_view::npos)
+      throw std::invalid_argument("parse_placement(): expected key=value");
+    const auto key{item.substr(0, eq)};
+    const auto value{item.substr(eq + 1)};
+    if (key == "cpu")
+      res.cpu = parse_placement_int(value, key);
+    else if (key == "node")
+      res.numa_node = parse_placement_int(value, key);
+    else if (key == "wait")
+      res.wait.strategy = parse_wait_strategy(value);
+    else if (key == "spin") {
+      res.wait.max_spin = static_cast<unsigned>(parse_placement_int(value, key));
+      if (res.wait.strategy == Wait_strategy::block)
+        res.wait.strategy = Wait_strategy::spin;
+    }
+    else if (key == "adaptive")
+      res.wait.adaptive = parse_placement_int(value, key) != 0;
+    else
+      throw std::invalid_argument("parse_placement(): unknown key " + std::string{key});
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+// CPUs of a NUMA node, from sysfs "0-3,8-11" list; empty if unknown;
+inline std::vector<int> numa_node_cpus(int node)
+{
+  std::vector<int> cpus;
+  std::ifstream ifs{"/sys/devices/system/node/node" + std::to_string(node) + "/cpulist"};
+  std::string list;
+  if (!(ifs >> list))
+    return cpus;
+
+  std::string_view rest{list};
+  while (!rest.empty()) {
+    const auto comma{rest.find(',')};
+    const auto range{rest.substr(0, comma)};
+    rest = comma == std::string_view::npos ? std::string_view{} : rest.substr(comma + 1);
+
+    const auto dash{range.find('-')};
+    const auto first{parse_placement_int(range.substr(0, dash), "cpulist")};
+    const auto last{dash == std::string_view::npos
+      ? first : parse_placement_int(range.substr(dash + 1), "cpulist")};
+    for (auto cpu{first}; cpu <= last; ++cpu)
+      cpus.push_back(cpu);
+  }
+  return cpus;
+}
+
+//------------------------------------------------------------------------------
+
+// Restricts the calling thread to the given CPUs; false if the platform
+// does not support it or the kernel refused;
+inline bool set_current_thread_affinity(const std::vector<int>& cpus)
+{
+#ifdef __linux__
+  if (cpus.empty())
+    return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  for (const auto cpu : cpus)
+    if (cpu >= 0 && cpu < CPU_SETSIZE)
+      CPU_SET(static_cast<std::size_t>(cpu), &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpus;
+  return false;
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+inline bool apply_to_current_thread(const Actor_placement& placement)
+{
+  if (placement.cpu)
+    return set_current_thread_affinity({*placement.cpu});
+  if (placement.numa_node)
+    return set_current_thread_affinity(numa_node_cpus(*placement.numa_node));
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+// Starts a thread that applies placement to itself before running f;
+template<class Func, class... Args>
+std::thread start_placed(const Actor_placement& placement, Func&& f, Args&&... args)
+{
+  return std::thread{
+    [placement](auto&& func, auto&&... as) {
+      apply_to_current_thread(placement);
+      std::invoke(std::forward<decltype(func)>(func),
+                  std::forward<decltype(as)>(as)...);
+    },
+    std::forward<Func>(f), std::forward<Args>(args)...};
+}
+
+//------------------------------------------------------------------------------
+
+// Hands out memory from blocks bound to one NUMA node. Blocks are never
+// returned before destruction, so put a pool resource on top of it;
+// off Linux it degrades to the default resource;
+class Numa_block_resource : public std::pmr::memory_resource {
+  int node_;
+  std::size_t block_size_;
+  std::vector<std::pair<void*, std::size_t>> blocks_;
+  std::byte* cur_{nullptr};
+  std::size_t left_{0};
+
+  void* new_block(std::size_t bytes)
+  {
+#ifdef __linux__
+    void* p{::mmap(nullptr, bytes, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)};
+    if (p == MAP_FAILED)
+      throw std::bad_alloc();
+    constexpr int mpol_preferred{1};
+    unsigned long mask{1UL << node_};
+    // Best effort: without NUMA support the block just stays local to whoever touches it
+    ::syscall(SYS_mbind, p, bytes, mpol_preferred, &mask, sizeof(mask) * 8, 0);
+    blocks_.emplace_back(p, bytes);
+    return p;
+#else
+    void* p{std::pmr::new_delete_resource()->allocate(bytes)};
+    blocks_.emplace_back(p, bytes);
+    return p;
+#endif
+  }
+
+  void* do_allocate(std::size_t bytes, std::size_t align) override
+  {
+    auto pad{(0 - reinterpret_cast<std::uintptr_t>(cur_)) & (align - 1)};
+    if (pad + bytes > left_) {
+      const auto size{bytes + align > block_size_ ? bytes + align : block_size_};
+      cur_ = static_cast<std::byte*>(new_block(size));
+      left_ = size;
+      pad = 0;
+    }
+    auto* p{cur_ + pad};
+    cur_ += pad + bytes;
+    left_ -= pad + bytes;
+    return p;
+  }
+
+  void do_deallocate(void*, std::size_t, std::size_t) override {}
+
+  bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+    { return this == &other; }
+public:
+  explicit Numa_block_resource(int node, std::size_t block_size = 1 << 20)
+    : node_{node >= 0 && node < 64 ? node : 0}, block_size_{block_size} {}
+
+  Numa_block_resource(const Numa_block_resource&) = delete;
+  Numa_block_resource& operator=(const Numa_block_resource&) = delete;
+
+  ~Numa_block_resource() override
+  {
+    for (auto [p, bytes] : blocks_)
+#ifdef __linux__
+      ::munmap(p, bytes);
+#else
+      std::pmr::new_delete_resource()->deallocate(p, bytes);
+#endif
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Everything needed to keep one receiver's queue storage on a node;
+// must outlive the receiver it is given to;
+class Numa_queue_storage {
+  Numa_block_resource blocks_;
+  std::pmr::synchronized_pool_resource pool_; // Producers allocate,
+                                              // the consumer frees
+public:
+  explicit Numa_queue_storage(int node) : blocks_{node}, pool_{&blocks_} {}
+
+  std::pmr::memory_resource* resource() noexcept { return &pool_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_PLACEMENT_HPP
@@ -0,0 +1,180 @@
+#ifndef CASHBOX_PREFIX_ROUTES_HPP
+#define CASHBOX_PREFIX_ROUTES_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Longest-prefix match of keys (card numbers, account names) to route
+// numbers, for prefixes of up to 8 bytes: enough for any issuer number.
+// A key is read as the big-endian number of its first 8 bytes, padded
+// with zeros, and a prefix then covers a range of those numbers. Ranges
+// of prefixes nest or are disjoint, so they flatten into a sorted list of
+// range starts, each with the route of the longest prefix covering it;
+// a lookup finds the last start not after the key. The starts are laid
+// out as a static B-tree of 8-key nodes (one cache line each) and a node
+// is searched by counting the keys not after the key, so a lookup is a
+// few cache lines and no unpredictable branches whatever the table's size.
+// Immutable once built: share it, and build a new one to change routes;
+class Prefix_routes {
+public:
+  static constexpr std::uint32_t no_route{std::numeric_limits<std::uint32_t>::max()};
+  static constexpr std::size_t max_prefix{8};
+
+  struct Entry {
+    std::string prefix;             // Empty: the default route
+    std::uint32_t route;
+  };
+private:
+  static constexpr std::size_t node{8};
+
+  struct Range {
+    std::uint64_t start;
+    std::uint32_t route;
+  };
+
+  std::vector<std::uint64_t> keys_;     // Every level, top first
+  std::vector<std::size_t> levels_;     // Offset of each level in keys_
+  std::vector<std::size_t> sizes_;      // Keys in each level, without padding
+  std::vector<std::uint32_t> routes_;   // For each bottom level key
+  std::size_t prefixes_;
+
+  static std::uint64_t pack(std::string_view s, unsigned char fill) noexcept
+  {
+    std::uint64_t res{0};
+    for (std::size_t i{0}; i < max_prefix; ++i)
+      res = res << 8 | (i < s.size() ? static_cast<unsigned char>(s[i]) : fill);
+    return res;
+  }
+
+  // Flattens the nested ranges with a stack of the prefixes open at the
+  // current position
+  static std::vector<Range> flatten(std::vector<Entry>& entries)
+  {
+    struct Open {
+      std::uint64_t last;
+      std::uint32_t route;
+    };
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+      const auto pa{pack(a.prefix, 0)}, pb{pack(b.prefix, 0)};
+      return pa != pb ? pa < pb : a.prefix.size() < b.prefix.size();
+    });
+    std::vector<Range> res{{0, no_route}};
+    const auto emit{[&](std::uint64_t start, std::uint32_t route) {
+      if (res.back().start == start)
+        res.back().route = route;
+      else if (res.back().route != route)
+        res.push_back({start, route});
+      if (res.size() > 1 && res[res.size() - 2].route == res.back().route)
+        res.pop_back();
+    }};
+    std::vector<Open> open;
+    const auto close_until{[&](std::uint64_t pos) {
+      while (!open.empty() && open.back().last < pos) {
+        const auto last{open.back().last};
+        open.pop_back();
+        if (last != std::numeric_limits<std::uint64_t>::max())
+          emit(last + 1, open.empty() ? no_route : open.back().route);
+      }
+    }};
+    for (std::size_t i{0}; i < entries.size(); ++i) {
+      const auto& e{entries[i]};
+      if (e.prefix.size() > max_prefix)
+        throw std::invalid_argument("Prefix_routes: prefix longer than 8 bytes: " + e.prefix);
+      if (i && entries[i - 1].prefix == e.prefix)
+        throw std::invalid_argument("Prefix_routes: duplicate prefix " + e.prefix);
+      const auto first{pack(e.prefix, 0)};
+      close_until(first);
+      open.push_back({pack(e.prefix, 0xff), e.route});
+      emit(first, e.route);
+    }
+    close_until(std::numeric_limits<std::uint64_t>::max());
+    return res;
+  }
+
+  // Keys of the node at keys that are not after key; a branch-free count,
+  // which the compiler turns into vector compares where the target has
+  // them
+  static std::size_t count_le(const std::uint64_t* keys, std::uint64_t key) noexcept
+  {
+    std::size_t n{0};
+    for (std::size_t i{0}; i < node; ++i)
+      n += keys[i] <= key;
+    return n;
+  }
+public:
+  explicit Prefix_routes(std::vector<Entry> entries) : prefixes_{entries.size()}
+  {
+    const auto ranges{flatten(entries)};
+    routes_.reserve(ranges.size());
+    for (const auto& r : ranges)
+      routes_.push_back(r.route);
+
+    // Levels bottom up, each holding the first key of every node below
+    std::vector<std::vector<std::uint64_t>> levels(1);
+    for (const auto& r : ranges)
+      levels[0].push_back(r.start);
+    while (levels.back().size() > node) {
+      std::vector<std::uint64_t> up;
+      for (std::size_t i{0}; i < levels.back().size(); i += node)
+        up.push_back(levels.back()[i]);
+      levels.push_back(std::move(up));
+    }
+    std::reverse(levels.begin(), levels.end());
+    for (auto& l : levels) {
+      levels_.push_back(keys_.size());
+      sizes_.push_back(l.size());
+      l.resize((l.size() + node - 1) / node * node, std::numeric_limits<std::uint64_t>::max());
+      keys_.insert(keys_.end(), l.begin(), l.end());
+    }
+  }
+
+  // Route of the longest prefix of key, or no_route
+  std::uint32_t find(std::string_view key) const noexcept
+  {
+    const auto k{pack(key, 0)};
+    std::size_t at{0};              // Position in the current level
+    for (std::size_t l{0}; l < levels_.size(); ++l) {
+      const auto first{at * node};
+      const auto n{count_le(keys_.data() + levels_[l] + first, k)};
+      // The node's first key is never after k; padding may count as
+      // not after a key of all ones
+      at = std::min(first + n, sizes_[l]) - 1;
+    }
+    return routes_[at];
+  }
+
+  // Prefixes given
+  std::size_t size() const noexcept { return prefixes_; }
+
+  // Ranges they flattened into
+  std::size_t ranges() const noexcept { return routes_.size(); }
+
+  std::size_t bytes() const noexcept
+  {
+    return sizeof(*this) + keys_.capacity() * sizeof(std::uint64_t)
+           + routes_.capacity() * sizeof(std::uint32_t)
+           + (levels_.capacity() + sizes_.capacity()) * sizeof(std::size_t);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_PREFIX_ROUTES_HPP
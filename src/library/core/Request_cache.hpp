@@ -0,0 +1,182 @@
+#ifndef CASHBOX_REQUEST_CACHE_HPP
+#define CASHBOX_REQUEST_CACHE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+struct Request_cache_stats {
+  std::uint64_t lookups;
+  std::uint64_t hits;               // Requests seen before
+  std::uint64_t evictions;
+  std::uint64_t early_evictions;    // Of requests still within the window
+};
+
+//------------------------------------------------------------------------------
+
+// What became of recent requests, by request id, so that a request
+// delivered twice is answered twice but carried out once. Bounded: it
+// tracks up to capacity requests in a ring, in the order they came, and
+// makes room by CLOCK eviction. The hand passes over a request seen again
+// since it came (clearing the mark) unless it is older than the window,
+// so the oldest requests go first and duplicated ones stay a round
+// longer. Size it for the window times the peak request rate;
+// early_evictions counts the requests it had to forget too soon, after
+// which a duplicate would be carried out again. The ring is found into
+// through an open-addressing index of ring positions with linear probing,
+// kept at most half full and deleting by shifting the rest of a run back,
+// so that lookups never see tombstones. The index keeps the hash of each
+// id beside its position, so probing and shifting stay in the index and
+// the ring is read once per hit. Id 0 means no id and is never tracked;
+// times are in whatever unit the window is;
+template<class T>
+class Request_cache {
+  static_assert(std::is_trivially_copyable_v<T>);
+
+  struct Entry {
+    std::uint64_t id;
+    std::uint32_t stamp;            // When it came
+    bool referenced;                // Seen again since
+    T value;
+  };
+
+  struct Slot {
+    std::uint32_t pos;              // In ring_, or empty
+    std::uint32_t hash;
+  };
+
+  static constexpr std::uint32_t empty{std::numeric_limits<std::uint32_t>::max()};
+
+  std::vector<Entry> ring_;
+  std::vector<Slot> index_;
+  std::size_t mask_;
+  std::size_t capacity_;
+  std::size_t hand_{0};
+  std::uint32_t window_;
+  Request_cache_stats stats_{};
+
+  // Ids are mostly consecutive; spread them over the index
+  static std::uint32_t hash(std::uint64_t id) noexcept
+  {
+    id ^= id >> 33;
+    id *= 0xff51afd7ed558ccdULL;
+    id ^= id >> 33;
+    return static_cast<std::uint32_t>(id);
+  }
+
+  // Takes ring position pos out of the index, moving back those of its
+  // run that would no longer be found past the hole
+  void unindex(std::uint32_t pos) noexcept
+  {
+    auto i{hash(ring_[pos].id) & mask_};
+    while (index_[i].pos != pos)
+      i = (i + 1) & mask_;
+    for (auto j{(i + 1) & mask_}; index_[j].pos != empty; j = (j + 1) & mask_) {
+      const auto h{index_[j].hash & mask_};
+      if (((j - h) & mask_) >= ((j - i) & mask_)) {
+        index_[i] = index_[j];
+        i = j;
+      }
+    }
+    index_[i].pos = empty;
+  }
+
+  // The ring position to reuse
+  std::uint32_t evict(std::uint32_t now) noexcept
+  {
+    for (;; hand_ = hand_ + 1 == capacity_ ? 0 : hand_ + 1) {
+      auto& e{ring_[hand_]};
+      const bool expired{now - e.stamp >= window_};
+      if (e.referenced && !expired) {
+        e.referenced = false;
+        continue;
+      }
+      ++stats_.evictions;
+      stats_.early_evictions += !expired;
+      const auto pos{static_cast<std::uint32_t>(hand_)};
+      unindex(pos);
+      hand_ = hand_ + 1 == capacity_ ? 0 : hand_ + 1;
+      return pos;
+    }
+  }
+public:
+  Request_cache(std::size_t capacity, std::uint32_t window)
+    : index_(std::bit_ceil(std::max<std::size_t>(2 * capacity, 2)), Slot{empty, 0}),
+      mask_{index_.size() - 1}, capacity_{capacity}, window_{window}
+  {
+    if (!capacity || capacity > empty / 2)
+      throw std::invalid_argument("Request_cache: capacity out of range");
+    ring_.reserve(capacity);
+  }
+
+  // What was recorded for id, or null; the pointer is good until the
+  // next insert()
+  T* find(std::uint64_t id) noexcept
+  {
+    if (!id)
+      return nullptr;
+    ++stats_.lookups;
+    const auto h{hash(id)};
+    for (auto i{h & mask_}; index_[i].pos != empty; i = (i + 1) & mask_)
+      if (index_[i].hash == h)
+        if (auto& e{ring_[index_[i].pos]}; e.id == id) {
+          ++stats_.hits;
+          e.referenced = true;
+          return &e.value;
+        }
+    return nullptr;
+  }
+
+  // Records a request find() did not know, at time now; ignores id 0
+  void insert(std::uint64_t id, T value, std::uint32_t now)
+  {
+    if (!id)
+      return;
+    std::uint32_t pos;
+    if (ring_.size() < capacity_) {
+      pos = static_cast<std::uint32_t>(ring_.size());
+      ring_.push_back({id, now, false, value});
+    }
+    else {
+      pos = evict(now);
+      ring_[pos] = {id, now, false, value};
+    }
+    const auto h{hash(id)};
+    auto i{h & mask_};
+    while (index_[i].pos != empty)
+      i = (i + 1) & mask_;
+    index_[i] = {pos, h};
+  }
+
+  std::size_t size() const noexcept { return ring_.size(); }
+  std::size_t capacity() const noexcept { return capacity_; }
+  std::uint32_t window() const noexcept { return window_; }
+  const Request_cache_stats& stats() const noexcept { return stats_; }
+
+  // What it takes once full
+  std::size_t bytes() const noexcept
+  {
+    return sizeof(*this) + capacity_ * sizeof(Entry) + index_.capacity() * sizeof(Slot);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_REQUEST_CACHE_HPP
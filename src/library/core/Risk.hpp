@@ -0,0 +1,210 @@
+#ifndef CASHBOX_RISK_HPP
+#define CASHBOX_RISK_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+
+#include "Money.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+// Limits applied before the ledger is touched; times are in seconds of
+// whatever clock the owner of the checks goes by
+struct Risk_policy {
+  Money max_amount{Money::major(1'000)};    // Withdrawn within window
+  std::uint32_t max_withdrawals{10};        // Within window
+  std::uint32_t window{24 * 3600};
+  std::uint32_t max_pin_failures{3};        // Within pin_window, then locked
+  std::uint32_t pin_window{15 * 60};
+  std::uint32_t lockout{30 * 60};
+};
+
+enum class Risk_verdict : std::uint8_t {
+  allow,
+  over_amount,
+  over_count,
+  locked
+};
+
+struct Risk_stats {
+  std::uint64_t checks;
+  std::uint64_t over_amount;
+  std::uint64_t over_count;
+  std::uint64_t locked;             // Requests refused while locked out
+  std::uint64_t lockouts;           // Times an account got locked
+};
+
+//------------------------------------------------------------------------------
+
+// Sliding windows over a ring of buckets: a window of w seconds is kept as
+// buckets of w / size seconds each, the newest one being filled. Moving to
+// a later bucket clears those skipped over, so the sum is over the last
+// size buckets (the window, give or take the part of a bucket) and each
+// update is O(1) whatever the traffic;
+namespace detail {
+  // Moves a ring of n buckets on to bucket now, clear(k) emptying bucket
+  // k of every ring sharing the epoch
+  template<class Clear>
+  void roll(std::uint32_t& epoch, std::uint32_t now, std::size_t n, Clear&& clear) noexcept
+  {
+    if (now <= epoch)
+      return;
+    const auto stale{std::min<std::uint64_t>(now - epoch, n)};
+    for (std::uint64_t k{1}; k <= stale; ++k)
+      clear((epoch + k) % n);
+    epoch = now;
+  }
+
+  template<class T, std::size_t N>
+  std::int64_t window_sum(const std::array<T, N>& buckets) noexcept
+  {
+    std::int64_t sum{0};
+    for (const auto b : buckets)
+      sum += b;
+    return sum;
+  }
+}
+
+// Everything the checks know about one account, in one cache line
+struct alignas(64) Account_risk {
+  static constexpr std::size_t buckets{4};
+
+  std::array<std::int64_t, buckets> amount{};       // Minor units
+  std::array<std::uint16_t, buckets> count{};
+  std::uint32_t epoch{0};                           // Newest withdrawal bucket
+  std::array<std::uint8_t, buckets> pin_failures{};
+  std::uint32_t pin_epoch{0};
+  std::uint32_t locked_until{0};
+};
+
+static_assert(sizeof(Account_risk) == 64);
+
+//------------------------------------------------------------------------------
+
+// Per-account withdrawal limits and PIN lockout for a fixed number of
+// accounts, addressed by index (see Balance_board::find()). Meant to be
+// owned by the actor that owns those accounts, a shard of them: it takes
+// no locks and shares nothing, and each check or update touches the one
+// cache line of its account;
+class Risk_checks {
+  Risk_policy policy_;
+  std::uint32_t width_;             // Seconds per withdrawal bucket
+  std::uint32_t pin_width_;
+  std::unique_ptr<Account_risk[]> accounts_;
+  std::size_t size_;
+  Risk_stats stats_{};
+
+  static std::uint32_t seconds(std::uint64_t now) noexcept
+    { return static_cast<std::uint32_t>(std::min<std::uint64_t>(now, UINT32_MAX)); }
+
+  void roll_withdrawals(Account_risk& a, std::uint32_t t) const noexcept
+  {
+    detail::roll(a.epoch, t / width_, Account_risk::buckets, [&](std::size_t k) {
+      a.amount[k] = 0;
+      a.count[k] = 0;
+    });
+  }
+
+  void roll_pin_failures(Account_risk& a, std::uint32_t t) const noexcept
+  {
+    detail::roll(a.pin_epoch, t / pin_width_, Account_risk::buckets,
+                 [&](std::size_t k) { a.pin_failures[k] = 0; });
+  }
+public:
+  Risk_checks(std::size_t accounts, const Risk_policy& policy = {})
+    : policy_{policy},
+      width_{std::max<std::uint32_t>(1, policy.window / Account_risk::buckets)},
+      pin_width_{std::max<std::uint32_t>(1, policy.pin_window / Account_risk::buckets)},
+      accounts_{std::make_unique<Account_risk[]>(accounts)}, size_{accounts}
+  {
+    if (policy.max_withdrawals > UINT16_MAX || policy.max_pin_failures > UINT8_MAX)
+      throw std::invalid_argument("Risk_checks: limit too high to count");
+  }
+
+  // Would withdrawing amount from account i now be within the limits?
+  // Records nothing; see record_withdrawal()
+  Risk_verdict check_withdrawal(std::size_t i, Money amount, std::uint64_t now)
+  {
+    ++stats_.checks;
+    auto& a{accounts_[i]};
+    const auto t{seconds(now)};
+    if (t < a.locked_until) {
+      ++stats_.locked;
+      return Risk_verdict::locked;
+    }
+    roll_withdrawals(a, t);
+    if (detail::window_sum(a.count) + 1 > std::int64_t{policy_.max_withdrawals}) {
+      ++stats_.over_count;
+      return Risk_verdict::over_count;
+    }
+    std::int64_t total{0};
+    if (add_overflows(detail::window_sum(a.amount), amount.minor_units(), total)
+        || total > policy_.max_amount.minor_units()) {
+      ++stats_.over_amount;
+      return Risk_verdict::over_amount;
+    }
+    return Risk_verdict::allow;
+  }
+
+  // A withdrawal check_withdrawal() allowed went through
+  void record_withdrawal(std::size_t i, Money amount, std::uint64_t now) noexcept
+  {
+    auto& a{accounts_[i]};
+    roll_withdrawals(a, seconds(now));
+    a.amount[a.epoch % Account_risk::buckets] += amount.minor_units();
+    ++a.count[a.epoch % Account_risk::buckets];
+  }
+
+  // False while account i is locked out; it is then not worth checking
+  // the PIN at all
+  bool pin_allowed(std::size_t i, std::uint64_t now)
+  {
+    ++stats_.checks;
+    if (seconds(now) >= accounts_[i].locked_until)
+      return true;
+    ++stats_.locked;
+    return false;
+  }
+
+  // Locks the account once max_pin_failures fall within pin_window
+  void record_pin_failure(std::size_t i, std::uint64_t now) noexcept
+  {
+    auto& a{accounts_[i]};
+    const auto t{seconds(now)};
+    roll_pin_failures(a, t);
+    auto& bucket{a.pin_failures[a.pin_epoch % Account_risk::buckets]};
+    bucket = static_cast<std::uint8_t>(std::min<unsigned>(bucket + 1u, UINT8_MAX));
+    if (detail::window_sum(a.pin_failures) >= std::int64_t{policy_.max_pin_failures}) {
+      a.locked_until = seconds(std::uint64_t{t} + policy_.lockout);
+      a.pin_failures = {};
+      ++stats_.lockouts;
+    }
+  }
+
+  // A right PIN forgives earlier mistakes
+  void record_pin_success(std::size_t i) noexcept { accounts_[i].pin_failures = {}; }
+
+  std::size_t size() const noexcept { return size_; }
+
+  const Risk_policy& policy() const noexcept { return policy_; }
+
+  Risk_stats stats() const noexcept { return stats_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_RISK_HPP
@@ -0,0 +1,89 @@
+#ifndef CASHBOX_SEQLOCK_HPP
+#define CASHBOX_SEQLOCK_HPP
+
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// A small value published by one writer to any number of readers. The
+// writer bumps a sequence number to odd, stores, and bumps it to even
+// again; a reader copies the value between two reads of the sequence and
+// tries again if it was odd or moved. Writers never wait for readers and
+// readers never write shared memory, so reads scale with the number of
+// cores and cost a writer nothing; a read only repeats if it overlapped a
+// write, which takes a few nanoseconds. The value is kept in relaxed
+// atomic words, so a torn copy is never a data race, only thrown away.
+// Writers must be serialized by the caller (typically: one actor);
+template<class T>
+class Seqlock {
+  static_assert(std::is_trivially_copyable_v<T> && std::is_default_constructible_v<T>);
+
+  static constexpr std::size_t words{(sizeof(T) + 7) / 8};
+  using Raw = std::array<std::uint64_t, words>;
+
+  std::atomic<std::uint64_t> seq_{0};
+  std::array<std::atomic<std::uint64_t>, words> data_{};
+public:
+  Seqlock() : Seqlock{T{}} {}
+
+  explicit Seqlock(const T& value) noexcept { store(value); }
+
+  Seqlock(const Seqlock&) = delete;
+  Seqlock& operator=(const Seqlock&) = delete;
+
+  void store(const T& value) noexcept
+  {
+    Raw raw{};
+    std::memcpy(raw.data(), &value, sizeof(T));
+    const auto seq{seq_.load(std::memory_order_relaxed)};
+    seq_.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (std::size_t i{0}; i < words; ++i)
+      data_[i].store(raw[i], std::memory_order_relaxed);
+    seq_.store(seq + 2, std::memory_order_release);
+  }
+
+  T load() const noexcept
+  {
+    Raw raw;
+    for (;;) {
+      const auto before{seq_.load(std::memory_order_acquire)};
+      if (before & 1) {
+        cpu_relax();
+        continue;
+      }
+      for (std::size_t i{0}; i < words; ++i)
+        raw[i] = data_[i].load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (seq_.load(std::memory_order_relaxed) == before)
+        break;
+    }
+    T res;
+    std::memcpy(static_cast<void*>(&res), raw.data(), sizeof(T));
+    return res;
+  }
+
+  // Stores so far
+  std::uint64_t version() const noexcept { return seq_.load(std::memory_order_acquire) / 2; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_SEQLOCK_HPP
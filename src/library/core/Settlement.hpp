@@ -0,0 +1,453 @@
+#ifndef CASHBOX_SETTLEMENT_HPP
+#define CASHBOX_SETTLEMENT_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Dispense.hpp"
+#include "File_image.hpp"
+#include "Money.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Accounting {
+
+//------------------------------------------------------------------------------
+
+enum class Journal_kind : std::uint8_t {
+  debit,                            // The bank took a withdrawal off an account
+  refund,                           // and gave it back when it was cancelled
+  dispensed                         // An atm paid it out
+};
+
+// Something that moved money, as the bank or an atm saw it; entries of one
+// withdrawal share its request id, whose top half is the atm's number (see
+// atm_count). One cache line, so that a day's journal is an array of them
+// that can be mapped and scanned in place;
+struct Journal_entry {
+  static constexpr std::uint32_t no_account{std::numeric_limits<std::uint32_t>::max()};
+
+  std::uint64_t request_id;
+  std::int64_t amount;              // Minor units
+  std::uint32_t account;            // Index among the bank's accounts, or no_account
+  Currency currency;
+  Journal_kind kind;
+  std::array<std::uint8_t, 7> reserved;
+  Dispense_plan notes;              // What was paid out in, for dispensed
+
+  std::uint32_t terminal() const noexcept { return static_cast<std::uint32_t>(request_id >> 32); }
+};
+
+static_assert(sizeof(Journal_entry) == 64, "Journal_entry must stay one cache line");
+static_assert(std::is_trivially_copyable_v<Journal_entry>);
+
+inline constexpr std::array<char, 8> journal_magic{'C','B','J','R','N','L','1','\0'};
+
+//------------------------------------------------------------------------------
+
+// Collects entries into a preallocated buffer and writes it out in whole
+// blocks, as Trace_recorder does with messages; shared by the bank and the
+// atms, each recording from its own thread;
+class Journal_recorder {
+  std::mutex m_;
+  std::FILE* file_;
+  std::vector<Journal_entry> buf_;
+  std::size_t used_{0};
+  std::uint64_t total_{0};
+
+  void write_block()                // Requires m_ to be held
+  {
+    if (used_ && std::fwrite(buf_.data(), sizeof(Journal_entry), used_, file_) != used_)
+      throw std::runtime_error("Journal_recorder: write failed");
+    used_ = 0;
+  }
+public:
+  explicit Journal_recorder(const std::string& fname, std::size_t capacity = 1 << 12)
+    : file_{std::fopen(fname.c_str(), "wb")}, buf_(capacity ? capacity : 1)
+  {
+    if (!file_)
+      throw std::runtime_error("Journal_recorder: cannot open " + fname);
+    std::setvbuf(file_, nullptr, _IONBF, 0);
+    std::array<char, sizeof(Journal_entry)> header{};  // Entries stay aligned
+    std::memcpy(header.data(), journal_magic.data(), journal_magic.size());
+    if (std::fwrite(header.data(), 1, header.size(), file_) != header.size())
+      throw std::runtime_error("Journal_recorder: write failed");
+  }
+
+  Journal_recorder(const Journal_recorder&) = delete;
+  Journal_recorder& operator=(const Journal_recorder&) = delete;
+
+  void record(std::uint64_t request_id, Journal_kind kind, Money amount,
+              std::uint32_t account = Journal_entry::no_account,
+              const Dispense_plan& notes = {})
+  {
+    std::lock_guard lk{m_};
+    buf_[used_] = {request_id, amount.minor_units(), account, amount.currency(), kind, {}, notes};
+    ++total_;
+    if (++used_ == buf_.size())
+      write_block();
+  }
+
+  void flush()
+  {
+    std::lock_guard lk{m_};
+    write_block();
+    std::fflush(file_);
+  }
+
+  std::uint64_t recorded() const noexcept { return total_; }
+
+  ~Journal_recorder()
+  {
+    try {
+      flush();
+    }
+    catch (...) {
+    }
+    std::fclose(file_);
+  }
+};
+
+// A journal written by Journal_recorder, mapped
+class Journal_file {
+  Messaging::File_image image_;
+public:
+  explicit Journal_file(const std::string& fname)
+    : image_{Messaging::File_image::map(fname, Messaging::File_access::sequential)}
+  {
+    if (image_.size() < sizeof(Journal_entry)
+        || std::memcmp(image_.data(), journal_magic.data(), journal_magic.size()) != 0)
+      throw std::runtime_error("Journal_file: not a cashbox journal: " + fname);
+  }
+
+  std::span<const Journal_entry> entries() const noexcept
+  {
+    return {reinterpret_cast<const Journal_entry*>(image_.data()) + 1,
+            image_.size() / sizeof(Journal_entry) - 1};
+  }
+};
+
+//------------------------------------------------------------------------------
+
+enum class Discrepancy_kind : std::uint8_t {
+  unpaid,                           // Debited (net of refunds), nothing paid out
+  unbooked,                         // Paid out, nothing debited
+  mismatch,                         // Both, but not the same amount
+  bad_notes                         // The notes do not add up to what was paid out
+};
+
+struct Discrepancy {
+  std::uint64_t request_id;
+  std::int64_t debited;             // Net of refunds, minor units
+  std::int64_t dispensed;
+  Discrepancy_kind kind;
+};
+
+struct Terminal_totals {
+  std::uint32_t terminal;
+  std::uint64_t withdrawals;        // Request ids seen
+  std::int64_t debited;             // Net of refunds
+  std::int64_t dispensed;
+};
+
+struct Denomination_totals {
+  std::uint32_t denomination;       // Minor units
+  std::uint64_t notes;
+};
+
+// What a day's journal adds up to, all amounts in minor units of the
+// day's one currency
+struct Settlement {
+  std::uint64_t entries{0};
+  std::int64_t debited{0};
+  std::int64_t refunded{0};
+  std::int64_t dispensed{0};
+  std::vector<std::int64_t> account_debited;    // Per account, refunds taken off
+  std::vector<Terminal_totals> terminals;       // By terminal; 0 is untracked requests
+  std::vector<Denomination_totals> denominations;   // By denomination
+  std::vector<Discrepancy> discrepancies;       // By request id
+};
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+  constexpr std::uint64_t settle_mix(std::uint64_t x) noexcept
+  {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+  }
+
+  // One entry reduced to what the cross-check needs
+  struct Settle_item {
+    std::uint64_t request_id;
+    std::int64_t debited;
+    std::int64_t dispensed;
+  };
+
+  // What one thread adds up, merged at the end. Notes are counted in a
+  // small direct-mapped table by denomination, a machine's few
+  // denominations rarely sharing a slot, and in denominations past that
+  struct Settle_part {
+    std::int64_t debited{0};
+    std::int64_t refunded{0};
+    std::int64_t dispensed{0};
+    std::array<Denomination_totals, 16> notes{};
+    std::vector<Terminal_totals> terminals;
+    std::vector<Denomination_totals> denominations;
+    std::vector<Discrepancy> discrepancies;
+
+    Terminal_totals& terminal(std::uint32_t t)
+    {
+      if (t >= terminals.size())
+        terminals.resize(t + 1);
+      return terminals[t];
+    }
+
+    void add_notes(std::uint32_t denomination, std::uint64_t count)
+    {
+      auto& slot{notes[(denomination * 0x9e3779b9u) >> 28]};
+      if (slot.denomination == denomination || !slot.notes) {
+        slot.denomination = denomination;
+        slot.notes += count;
+        return;
+      }
+      auto it{std::find_if(denominations.begin(), denominations.end(),
+                           [&](const Denomination_totals& d) { return d.denomination == denomination; })};
+      if (it == denominations.end())
+        it = denominations.insert(denominations.end(), {denomination, 0});
+      it->notes += count;
+    }
+
+    // What notes add up to, counting them
+    std::int64_t add_notes(const Dispense_plan& plan)
+    {
+      std::int64_t sum{0};
+      for (const auto& b : plan.bundles)
+        if (b.count) {
+          add_notes(b.denomination, b.count);
+          sum += std::int64_t{b.denomination} * b.count;
+        }
+      return sum;
+    }
+  };
+
+  template<class Fn>
+  void in_parallel(unsigned threads, Fn&& fn)
+  {
+    std::vector<std::jthread> workers;
+    for (unsigned t{1}; t < threads; ++t)
+      workers.emplace_back([&fn, t] { fn(t); });
+    fn(0);
+  }
+}
+
+// Adds up a day's journal for a bank of so many accounts: totals per
+// account, per terminal and per denomination, and every withdrawal whose
+// debits (net of refunds) and cash paid out disagree. The entries are cut
+// into one run per thread; each thread adds up its run, and hands the
+// items of each withdrawal to one of many partitions by a hash of the
+// request id (counted first, so that each thread knows where in one
+// shared array its items go). Then each thread takes whole partitions,
+// small enough to group by request id in a table that stays in cache. The
+// accounts being too many for a copy per thread, their totals are added
+// into one array with relaxed atomic adds, which collide rarely;
+inline Settlement settle(std::span<const Journal_entry> entries, std::size_t accounts,
+                         unsigned threads = std::max(1u, std::thread::hardware_concurrency()))
+{
+  using detail::Settle_item;
+  using detail::Settle_part;
+  constexpr std::uint32_t max_terminals{1u << 20};
+
+  const auto n{entries.size()};
+  threads = static_cast<unsigned>(std::clamp<std::size_t>(n / 4096, 1, threads));
+  const auto partitions{std::bit_ceil(std::max<std::size_t>(n / 32'768, 1))};
+  const auto shift{64 - std::countr_zero(partitions)};
+  const auto partition_of{[&](std::uint64_t request_id) -> std::size_t {
+    return partitions == 1 ? 0 : detail::settle_mix(request_id) >> shift;
+  }};
+  const auto run{[&](unsigned t) {
+    return std::pair{n * t / threads, n * (t + 1) / threads};
+  }};
+
+  Settlement res;
+  res.entries = n;
+  res.account_debited.assign(accounts, 0);
+  std::vector<Settle_part> parts(threads);
+  std::vector<std::size_t> counts(std::size_t{threads} * partitions);
+  const Currency currency{n ? entries[0].currency : usd};
+  std::atomic<bool> bad_input{false};
+
+  // Totals and where each item goes
+  detail::in_parallel(threads, [&](unsigned t) {
+    auto& part{parts[t]};
+    auto* const count{counts.data() + std::size_t{t} * partitions};
+    std::int64_t debited{0}, refunded{0}, dispensed{0};  // Not aliased by the accounts
+    const auto [first, last]{run(t)};
+    for (auto i{first}; i < last; ++i) {
+      const auto& e{entries[i]};
+      if (e.currency != currency || e.terminal() >= max_terminals
+          || (e.kind != Journal_kind::dispensed && e.account >= accounts)) {
+        bad_input.store(true, std::memory_order_relaxed);
+        break;
+      }
+      ++count[partition_of(e.request_id)];
+      switch (e.kind) {
+      case Journal_kind::debit:
+        debited += e.amount;
+        std::atomic_ref{res.account_debited[e.account]}.fetch_add(e.amount, std::memory_order_relaxed);
+        break;
+      case Journal_kind::refund:
+        refunded += e.amount;
+        std::atomic_ref{res.account_debited[e.account]}.fetch_sub(e.amount, std::memory_order_relaxed);
+        break;
+      case Journal_kind::dispensed:
+        dispensed += e.amount;
+        if (part.add_notes(e.notes) != e.amount)
+          part.discrepancies.push_back({e.request_id, 0, e.amount, Discrepancy_kind::bad_notes});
+        break;
+      }
+    }
+    part.debited = debited;
+    part.refunded = refunded;
+    part.dispensed = dispensed;
+  });
+  if (bad_input.load())
+    throw std::invalid_argument("settle(): an entry is in another currency, or its "
+                                "account or terminal is out of range");
+
+  // Each thread's place in each partition: partition by partition, and
+  // within one, thread by thread
+  std::vector<std::size_t> starts(partitions + 1);
+  {
+    std::size_t at{0};
+    for (std::size_t p{0}; p < partitions; ++p) {
+      starts[p] = at;
+      for (unsigned t{0}; t < threads; ++t)
+        at += std::exchange(counts[std::size_t{t} * partitions + p], at);
+    }
+    starts[partitions] = at;
+  }
+  const std::unique_ptr<Settle_item[]> items{new Settle_item[n]};  // Left uninitialized
+  detail::in_parallel(threads, [&](unsigned t) {
+    auto* const next{counts.data() + std::size_t{t} * partitions};
+    const auto [first, last]{run(t)};
+    for (auto i{first}; i < last; ++i) {
+      const auto& e{entries[i]};
+      const auto signed_amount{e.kind == Journal_kind::refund ? -e.amount : e.amount};
+      items[next[partition_of(e.request_id)]++] =
+        e.kind == Journal_kind::dispensed ? Settle_item{e.request_id, 0, signed_amount}
+                                          : Settle_item{e.request_id, signed_amount, 0};
+    }
+  });
+
+  // Withdrawal by withdrawal, partitions shared out between the threads
+  std::atomic<std::size_t> next_partition{0};
+  detail::in_parallel(threads, [&](unsigned t) {
+    auto& part{parts[t]};
+    std::vector<Settle_item> table;
+    for (std::size_t p; (p = next_partition.fetch_add(1, std::memory_order_relaxed)) < partitions;) {
+      const auto size{starts[p + 1] - starts[p]};
+      const auto mask{std::bit_ceil(std::max<std::size_t>(2 * size, 2)) - 1};
+      table.assign(mask + 1, Settle_item{});
+      for (auto i{starts[p]}; i < starts[p + 1]; ++i) {
+        const auto& item{items[i]};
+        if (!item.request_id) {             // Nothing to match it with
+          auto& untracked{part.terminal(0)};
+          untracked.debited += item.debited;
+          untracked.dispensed += item.dispensed;
+          continue;
+        }
+        // The hash's top bits chose the partition; its bottom ones the slot
+        auto slot{detail::settle_mix(item.request_id) & mask};
+        while (table[slot].request_id && table[slot].request_id != item.request_id)
+          slot = (slot + 1) & mask;
+        auto& w{table[slot]};
+        w.request_id = item.request_id;
+        w.debited += item.debited;
+        w.dispensed += item.dispensed;
+      }
+      for (const auto& w : table) {
+        if (!w.request_id)
+          continue;
+        auto& terminal{part.terminal(static_cast<std::uint32_t>(w.request_id >> 32))};
+        ++terminal.withdrawals;
+        terminal.debited += w.debited;
+        terminal.dispensed += w.dispensed;
+        if (w.debited != w.dispensed)
+          part.discrepancies.push_back({w.request_id, w.debited, w.dispensed,
+                                        !w.dispensed ? Discrepancy_kind::unpaid
+                                        : !w.debited ? Discrepancy_kind::unbooked
+                                                     : Discrepancy_kind::mismatch});
+      }
+    }
+  });
+
+  for (auto& part : parts) {
+    res.debited += part.debited;
+    res.refunded += part.refunded;
+    res.dispensed += part.dispensed;
+    if (res.terminals.size() < part.terminals.size())
+      res.terminals.resize(part.terminals.size());
+    for (std::size_t t{0}; t < part.terminals.size(); ++t) {
+      res.terminals[t].withdrawals += part.terminals[t].withdrawals;
+      res.terminals[t].debited += part.terminals[t].debited;
+      res.terminals[t].dispensed += part.terminals[t].dispensed;
+    }
+    for (const auto& slot : part.notes)
+      if (slot.notes)
+        part.denominations.push_back(slot);
+    for (const auto& d : part.denominations) {
+      auto it{std::find_if(res.denominations.begin(), res.denominations.end(),
+                           [&](const Denomination_totals& r) { return r.denomination == d.denomination; })};
+      if (it == res.denominations.end())
+        res.denominations.push_back(d);
+      else
+        it->notes += d.notes;
+    }
+    res.discrepancies.insert(res.discrepancies.end(), part.discrepancies.begin(),
+                             part.discrepancies.end());
+  }
+  for (std::uint32_t t{0}; t < res.terminals.size(); ++t)
+    res.terminals[t].terminal = t;
+  std::erase_if(res.terminals, [](const Terminal_totals& t) {
+    return !t.withdrawals && !t.debited && !t.dispensed;
+  });
+  std::sort(res.denominations.begin(), res.denominations.end(),
+            [](const Denomination_totals& a, const Denomination_totals& b) {
+              return a.denomination < b.denomination;
+            });
+  std::sort(res.discrepancies.begin(), res.discrepancies.end(),
+            [](const Discrepancy& a, const Discrepancy& b) {
+              return a.request_id != b.request_id ? a.request_id < b.request_id : a.kind < b.kind;
+            });
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_SETTLEMENT_HPP
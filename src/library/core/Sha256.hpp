@@ -0,0 +1,381 @@
+#ifndef CASHBOX_SHA256_HPP
+#define CASHBOX_SHA256_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+#include <string>
+#include <string_view>
+
+//------------------------------------------------------------------------------
+
+namespace Crypto {
+
+//------------------------------------------------------------------------------
+
+using Digest = std::array<std::uint8_t, 32>;
+
+namespace detail {
+  inline constexpr std::array<std::uint32_t, 64> k{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2};
+
+  using State = std::array<std::uint32_t, 8>;
+
+  inline constexpr State initial{
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+  inline std::uint32_t load_be(const std::uint8_t* p) noexcept
+  {
+    return std::uint32_t{p[0]} << 24 | std::uint32_t{p[1]} << 16 | std::uint32_t{p[2]} << 8 | p[3];
+  }
+
+  inline void store_be(std::uint8_t* p, std::uint32_t v) noexcept
+  {
+    p[0] = static_cast<std::uint8_t>(v >> 24);
+    p[1] = static_cast<std::uint8_t>(v >> 16);
+    p[2] = static_cast<std::uint8_t>(v >> 8);
+    p[3] = static_cast<std::uint8_t>(v);
+  }
+
+  // One compression of the block w into state. W is std::uint32_t, or a
+  // vector of them to hash one block of several messages at once (see
+  // Lanes). The schedule is expanded up front and the rounds unrolled so
+  // that the working variables stay in registers
+  template<class W>
+  void compress(std::array<W, 8>& state, const std::array<W, 16>& block) noexcept
+  {
+    const auto rotr{[](const W& x, int n) { return (x >> n) | (x << (32 - n)); }};
+    std::array<W, 64> w;
+    std::copy(block.begin(), block.end(), w.begin());
+#pragma GCC unroll 48
+    for (std::size_t i{16}; i < 64; ++i)
+      w[i] = w[i - 16] + (rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3))
+             + w[i - 7] + (rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10));
+    auto [a, b, c, d, e, f, g, h] = state;
+#pragma GCC unroll 64
+    for (std::size_t i{0}; i < 64; ++i) {
+      const auto t1{h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g))
+                    + k[i] + w[i]};
+      const auto t2{(rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c))};
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+  }
+
+  inline void compress_block(State& state, const std::uint8_t* block) noexcept
+  {
+    std::array<std::uint32_t, 16> w;
+    for (std::size_t i{0}; i < 16; ++i)
+      w[i] = load_be(block + 4 * i);
+    compress(state, w);
+  }
+
+#if defined(__GNUC__) || defined(__clang__)
+  // As wide as the target's vector registers, so that no operation is
+  // split in two
+#if defined(__AVX2__)
+  inline constexpr std::size_t lanes{8};
+#else
+  inline constexpr std::size_t lanes{4};
+#endif
+  typedef std::uint32_t Lanes __attribute__((vector_size(lanes * sizeof(std::uint32_t))));
+#endif
+}
+
+//------------------------------------------------------------------------------
+
+// Incremental SHA-256 (FIPS 180-4);
+class Sha256 {
+  detail::State state_{detail::initial};
+  std::array<std::uint8_t, 64> block_{};
+  std::size_t used_{0};
+  std::uint64_t length_{0};         // Bytes so far
+public:
+  Sha256() = default;
+
+  // Carries on from a state reached after length bytes, a multiple of 64
+  Sha256(const detail::State& state, std::uint64_t length) noexcept
+    : state_{state}, length_{length} {}
+
+  Sha256& update(const void* data, std::size_t n) noexcept
+  {
+    auto p{static_cast<const std::uint8_t*>(data)};
+    length_ += n;
+    if (used_) {
+      const auto take{std::min(n, block_.size() - used_)};
+      std::memcpy(block_.data() + used_, p, take);
+      used_ += take;
+      p += take;
+      n -= take;
+      if (used_ < block_.size())
+        return *this;
+      detail::compress_block(state_, block_.data());
+      used_ = 0;
+    }
+    for (; n >= 64; p += 64, n -= 64)
+      detail::compress_block(state_, p);
+    std::memcpy(block_.data(), p, n);
+    used_ = n;
+    return *this;
+  }
+
+  Sha256& update(std::string_view s) noexcept { return update(s.data(), s.size()); }
+
+  Sha256& update(std::span<const std::uint8_t> s) noexcept { return update(s.data(), s.size()); }
+
+  // The object is spent afterwards
+  Digest finish() noexcept
+  {
+    const auto bits{length_ * 8};
+    block_[used_++] = 0x80;
+    if (used_ > 56) {
+      std::fill(block_.begin() + static_cast<std::ptrdiff_t>(used_), block_.end(), 0);
+      detail::compress_block(state_, block_.data());
+      used_ = 0;
+    }
+    std::fill(block_.begin() + static_cast<std::ptrdiff_t>(used_), block_.begin() + 56, 0);
+    detail::store_be(block_.data() + 56, static_cast<std::uint32_t>(bits >> 32));
+    detail::store_be(block_.data() + 60, static_cast<std::uint32_t>(bits));
+    detail::compress_block(state_, block_.data());
+    Digest res;
+    for (std::size_t i{0}; i < 8; ++i)
+      detail::store_be(res.data() + 4 * i, state_[i]);
+    return res;
+  }
+
+  const detail::State& state() const noexcept { return state_; }
+};
+
+inline Digest sha256(std::string_view s) noexcept { return Sha256{}.update(s).finish(); }
+
+inline std::string to_hex(const Digest& d)
+{
+  constexpr std::string_view digits{"0123456789abcdef"};
+  std::string res;
+  res.reserve(2 * d.size());
+  for (const auto b : d) {
+    res += digits[b >> 4];
+    res += digits[b & 0xf];
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+// HMAC-SHA256 (RFC 2104) keyed once: the states after the inner and
+// outer padded keys, so each message costs no more than hashing it
+class Hmac_sha256 {
+  detail::State inner_;
+  detail::State outer_;
+public:
+  explicit Hmac_sha256(std::string_view key) noexcept
+  {
+    std::array<std::uint8_t, 64> pad{};
+    if (key.size() > pad.size()) {
+      const auto d{sha256(key)};
+      std::memcpy(pad.data(), d.data(), d.size());
+    }
+    else
+      std::memcpy(pad.data(), key.data(), key.size());
+    for (auto& b : pad)
+      b ^= 0x36;
+    inner_ = detail::initial;
+    detail::compress_block(inner_, pad.data());
+    for (auto& b : pad)
+      b ^= 0x36 ^ 0x5c;
+    outer_ = detail::initial;
+    detail::compress_block(outer_, pad.data());
+  }
+
+  template<class... Parts>
+  Digest operator()(const Parts&... parts) const noexcept
+  {
+    Sha256 inner{inner_, 64};
+    (inner.update(parts), ...);
+    const auto d{inner.finish()};
+    return Sha256{outer_, 64}.update(std::span<const std::uint8_t>{d}).finish();
+  }
+
+  const detail::State& inner() const noexcept { return inner_; }
+
+  const detail::State& outer() const noexcept { return outer_; }
+};
+
+//------------------------------------------------------------------------------
+
+namespace detail {
+  // PBKDF2 rounds 2 to rounds + 1 on words: u is the previous HMAC output
+  // and t their running xor. Each round hashes a 32-byte message from
+  // the keyed states, one block with fixed padding, inner then outer
+  template<class W>
+  void pbkdf2_rounds(const std::array<W, 8>& inner, const std::array<W, 8>& outer,
+                     std::array<W, 8>& u, std::array<W, 8>& t, std::uint32_t rounds) noexcept
+  {
+    std::array<W, 16> w{};
+    w[8] += 0x80000000u;
+    w[15] += (64 + 32) * 8;
+    for (std::uint32_t r{0}; r < rounds; ++r) {
+      std::copy(u.begin(), u.end(), w.begin());
+      auto s{inner};
+      compress(s, w);
+      std::copy(s.begin(), s.end(), w.begin());
+      u = outer;
+      compress(u, w);
+      for (std::size_t i{0}; i < 8; ++i)
+        t[i] ^= u[i];
+    }
+  }
+
+  inline State words(const Digest& d) noexcept
+  {
+    State res;
+    for (std::size_t i{0}; i < 8; ++i)
+      res[i] = load_be(d.data() + 4 * i);
+    return res;
+  }
+
+  inline Digest bytes(const State& s) noexcept
+  {
+    Digest res;
+    for (std::size_t i{0}; i < 8; ++i)
+      store_be(res.data() + 4 * i, s[i]);
+    return res;
+  }
+}
+
+// PBKDF2-HMAC-SHA256 (RFC 8018), first block of output: 32 bytes are
+// more than a stored hash needs;
+inline Digest pbkdf2_sha256(std::string_view password, std::span<const std::uint8_t> salt,
+                            std::uint32_t iterations) noexcept
+{
+  const Hmac_sha256 hmac{password};
+  constexpr std::array<std::uint8_t, 4> block_index{0, 0, 0, 1};
+  auto u{detail::words(hmac(salt, std::span<const std::uint8_t>{block_index}))};
+  auto t{u};
+  detail::pbkdf2_rounds(hmac.inner(), hmac.outer(), u, t,
+                        iterations > 1 ? iterations - 1 : 0);
+  return detail::bytes(t);
+}
+
+struct Pbkdf2_job {
+  std::string_view password;
+  std::span<const std::uint8_t> salt;
+};
+
+// PBKDF2 of several passwords at once with the same iteration count,
+// out[i] for jobs[i]. Groups of detail::lanes jobs go through the rounds
+// side by side, one job per SIMD lane, for little more than one job
+// costs on its own; a lone job takes the scalar path;
+inline void pbkdf2_sha256(std::span<const Pbkdf2_job> jobs, std::uint32_t iterations,
+                          std::span<Digest> out) noexcept
+{
+  std::size_t i{0};
+#if defined(__GNUC__) || defined(__clang__)
+  using detail::Lanes;
+  constexpr std::array<std::uint8_t, 4> block_index{0, 0, 0, 1};
+  while (jobs.size() - i > 1) {
+    const auto n{std::min(detail::lanes, jobs.size() - i)};
+    std::array<Lanes, 8> inner, outer, u;
+    for (std::size_t l{0}; l < detail::lanes; ++l) {
+      const auto& job{jobs[i + std::min(l, n - 1)]}; // Idle lanes redo the last
+      const Hmac_sha256 hmac{job.password};
+      const auto first{detail::words(hmac(job.salt, std::span<const std::uint8_t>{block_index}))};
+      for (std::size_t w{0}; w < 8; ++w) {
+        inner[w][l] = hmac.inner()[w];
+        outer[w][l] = hmac.outer()[w];
+        u[w][l] = first[w];
+      }
+    }
+    auto t{u};
+    detail::pbkdf2_rounds(inner, outer, u, t, iterations > 1 ? iterations - 1 : 0);
+    for (std::size_t l{0}; l < n; ++l) {
+      detail::State s;
+      for (std::size_t w{0}; w < 8; ++w)
+        s[w] = t[w][l];
+      out[i + l] = detail::bytes(s);
+    }
+    i += n;
+  }
+#endif
+  for (; i < jobs.size(); ++i)
+    out[i] = pbkdf2_sha256(jobs[i].password, jobs[i].salt, iterations);
+}
+
+//------------------------------------------------------------------------------
+
+// SHA-256 of messages of exactly 64 bytes each, out[i] of bytes
+// [64 i, 64 i + 64) of blocks: the shape of a Merkle tree's leaves and
+// nodes alike. The second block is all padding, the same for every
+// message. Groups of detail::lanes messages go through side by side, one
+// per SIMD lane; what is left over takes the scalar path;
+inline void sha256_64(std::span<const std::uint8_t> blocks, std::span<Digest> out) noexcept
+{
+  const auto n{std::min(out.size(), blocks.size() / 64)};
+  std::size_t i{0};
+#if defined(__GNUC__) || defined(__clang__)
+  using detail::Lanes;
+  for (; n - i >= detail::lanes; i += detail::lanes) {
+    std::array<Lanes, 16> w;
+    for (std::size_t l{0}; l < detail::lanes; ++l)
+      for (std::size_t j{0}; j < 16; ++j)
+        w[j][l] = detail::load_be(blocks.data() + 64 * (i + l) + 4 * j);
+    std::array<Lanes, 8> state;
+    for (std::size_t j{0}; j < 8; ++j)
+      state[j] = Lanes{} + detail::initial[j];
+    detail::compress(state, w);
+    std::array<Lanes, 16> padding{};
+    padding[0] += 0x80000000u;
+    padding[15] += 64 * 8;
+    detail::compress(state, padding);
+    for (std::size_t l{0}; l < detail::lanes; ++l) {
+      detail::State s;
+      for (std::size_t j{0}; j < 8; ++j)
+        s[j] = state[j][l];
+      out[i + l] = detail::bytes(s);
+    }
+  }
+#endif
+  for (; i < n; ++i) {
+    auto state{detail::initial};
+    detail::compress_block(state, blocks.data() + 64 * i);
+    std::array<std::uint32_t, 16> padding{};
+    padding[0] = 0x80000000u;
+    padding[15] = 64 * 8;
+    detail::compress(state, padding);
+    out[i] = detail::bytes(state);
+  }
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_SHA256_HPP
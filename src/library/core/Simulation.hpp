@@ -0,0 +1,119 @@
+#ifndef CASHBOX_SIMULATION_HPP
+#define CASHBOX_SIMULATION_HPP
+
+//------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// splitmix64: small, fast, and the same sequence from a seed on every
+// platform and standard library (unlike the <random> distributions);
+class Sim_random {
+  std::uint64_t state_;
+public:
+  explicit Sim_random(std::uint64_t seed) noexcept : state_{seed} {}
+
+  std::uint64_t next() noexcept
+  {
+    auto z{state_ += 0x9e3779b97f4a7c15ULL};
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // Uniform enough in [0, n) for scheduling, n > 0
+  std::uint64_t below(std::uint64_t n) noexcept
+  {
+    const auto x{next()};
+#if defined(__SIZEOF_INT128__)
+    __extension__ using Wide = unsigned __int128;
+    return static_cast<std::uint64_t>((static_cast<Wide>(x) * n) >> 64);
+#else
+    // No 128-bit type (MSVC): the same high half from 32-bit halves, so
+    // that a seed gives the same run everywhere
+    const auto x_lo{x & 0xFFFF'FFFF};
+    const auto x_hi{x >> 32};
+    const auto n_lo{n & 0xFFFF'FFFF};
+    const auto n_hi{n >> 32};
+    const auto lo_lo{x_lo * n_lo};
+    const auto hi_lo{x_hi * n_lo};
+    const auto mid{(lo_lo >> 32) + (hi_lo & 0xFFFF'FFFF) + x_lo * n_hi};
+    return x_hi * n_hi + (hi_lo >> 32) + (mid >> 32);
+#endif
+  }
+
+  // True with probability percent/100
+  bool chance(unsigned percent) noexcept { return below(100) < percent; }
+};
+
+//------------------------------------------------------------------------------
+
+// Runs actors on the calling thread: each step picks one of the actors with
+// mail at random and lets it handle one message; the mailboxes must be
+// single-threaded (see Simple_queue::set_single_threaded()). An actor is
+// anything with bool step() (false if it had nothing to do) and
+// mailbox().pending(). The same seed and the same actors give the same
+// interleaving, and schedule_hash() tells interleavings apart;
+class Sim_scheduler {
+  struct Entry {
+    void* actor;
+    bool (*step)(void*);
+    std::size_t (*pending)(const void*);
+  };
+
+  std::vector<Entry> actors_;
+  std::vector<std::uint32_t> ready_;
+  Sim_random rng_;
+  std::uint64_t steps_{0};
+  std::uint64_t hash_{0xcbf29ce484222325ULL};   // FNV-1a of the choices
+public:
+  explicit Sim_scheduler(std::uint64_t seed) noexcept : rng_{seed} {}
+
+  template<class Actor>
+  void add(Actor& actor)
+  {
+    actors_.push_back({&actor,
+      [](void* a) { return static_cast<Actor*>(a)->step(); },
+      [](const void* a) { return static_cast<const Actor*>(a)->mailbox().pending(); }});
+    ready_.reserve(actors_.size());
+  }
+
+  // Steps until no actor has mail or max_steps were taken; returns
+  // the number of steps taken by this call
+  std::uint64_t run(std::uint64_t max_steps = std::numeric_limits<std::uint64_t>::max())
+  {
+    const auto start{steps_};
+    while (steps_ - start < max_steps) {
+      ready_.clear();
+      for (std::uint32_t i{0}; i < actors_.size(); ++i)
+        if (actors_[i].pending(actors_[i].actor))
+          ready_.push_back(i);
+      if (ready_.empty())
+        break;
+      const auto pick{ready_[ready_.size() == 1 ? 0 : rng_.below(ready_.size())]};
+      actors_[pick].step(actors_[pick].actor);
+      hash_ = (hash_ ^ pick) * 0x100000001b3ULL;
+      ++steps_;
+    }
+    return steps_ - start;
+  }
+
+  std::uint64_t steps() const noexcept { return steps_; }
+
+  std::uint64_t schedule_hash() const noexcept { return hash_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_SIMULATION_HPP
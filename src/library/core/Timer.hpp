@@ -0,0 +1,308 @@
+#ifndef CASHBOX_TIMER_HPP
+#define CASHBOX_TIMER_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Handle of a scheduled timer; a default constructed id refers to no timer;
+struct Timer_id {
+  std::uint32_t index{0};
+  std::uint32_t generation{0};  // Node reuse makes stale ids harmless
+};
+
+//------------------------------------------------------------------------------
+
+// One thread serving any number of timers from a hierarchical timing wheel:
+// 256 slots of one tick each, then three levels of 64 slots, each slot
+// covering a whole lap of the level below (2^26 ticks, ~18 hours at 1 ms).
+// Timers are intrusive list nodes, so schedule and cancel are O(1); a slot
+// of an upper level is spread over the lower ones once per lap of the level
+// below it. A timer never fires early and fires at most about one tick late
+// (plus scheduling delays). Expired timers run on the timer thread outside
+// the lock; a timer cancelled while firing can still be delivered, so
+// timeout messages should carry something to recognize stale ones;
+class Timer_service {
+public:
+  using Clock = std::chrono::steady_clock;
+private:
+  static constexpr unsigned level0_bits{8};
+  static constexpr unsigned level_bits{6};
+  static constexpr unsigned levels{4};
+  static constexpr std::uint64_t level0_slots{1u << level0_bits};
+  static constexpr std::uint64_t level_slots{1u << level_bits};
+  static constexpr std::uint64_t max_ticks{
+    (std::uint64_t{1} << (level0_bits + (levels - 1) * level_bits)) - 1};
+  static constexpr std::uint32_t npos{std::numeric_limits<std::uint32_t>::max()};
+
+  struct Node {
+    std::uint64_t expires{0};   // Tick
+    std::uint32_t prev{npos};
+    std::uint32_t next{npos};   // Also links the free list
+    std::uint32_t generation{0};
+    std::uint32_t slot{npos};   // npos when not scheduled
+    std::function<void()> fire;
+  };
+
+  const Clock::time_point start_;
+  const Clock::duration resolution_;
+
+  mutable std::mutex m_;
+  std::condition_variable cv_;
+  std::vector<Node> nodes_;
+  std::uint32_t free_{npos};
+  std::array<std::uint32_t, level0_slots + (levels - 1) * level_slots> slots_;
+  std::uint64_t base_{0};       // Next tick to expire
+  std::uint64_t wake_at_{0};    // Tick the timer thread sleeps until
+  std::size_t pending_{0};
+  bool stopping_{false};
+  std::thread thread_;
+
+  std::uint64_t tick_of(Clock::time_point t) const noexcept
+    { return t <= start_ ? 0 : static_cast<std::uint64_t>((t - start_) / resolution_); }
+
+  std::uint64_t tick_at_or_after(Clock::time_point t) const noexcept
+  {
+    if (t <= start_)
+      return 0;
+    const auto since{t - start_};
+    return static_cast<std::uint64_t>((since + resolution_ - Clock::duration{1}) / resolution_);
+  }
+
+  Clock::time_point time_of(std::uint64_t tick) const noexcept
+    { return start_ + resolution_ * static_cast<Clock::rep>(tick); }
+
+  std::size_t slot_for(std::uint64_t expires) const noexcept
+  {
+    const auto delta{expires - base_};
+    if (delta < level0_slots)
+      return expires & (level0_slots - 1);
+    auto shift{level0_bits};
+    std::size_t first{level0_slots};
+    for (unsigned l{1}; l < levels; ++l, shift += level_bits, first += level_slots)
+      if (delta < (std::uint64_t{1} << (shift + level_bits)) || l == levels - 1)
+        return first + ((expires >> shift) & (level_slots - 1));
+    return first;               // Not reached
+  }
+
+  void link(std::uint32_t i) noexcept
+  {
+    auto& n{nodes_[i]};
+    n.slot = static_cast<std::uint32_t>(slot_for(n.expires));
+    n.prev = npos;
+    n.next = slots_[n.slot];
+    if (n.next != npos)
+      nodes_[n.next].prev = i;
+    slots_[n.slot] = i;
+  }
+
+  void unlink(std::uint32_t i) noexcept
+  {
+    auto& n{nodes_[i]};
+    if (n.prev != npos)
+      nodes_[n.prev].next = n.next;
+    else
+      slots_[n.slot] = n.next;
+    if (n.next != npos)
+      nodes_[n.next].prev = n.prev;
+    n.slot = npos;
+  }
+
+  void release(std::uint32_t i) noexcept
+  {
+    auto& n{nodes_[i]};
+    n.fire = nullptr;
+    n.next = free_;
+    free_ = i;
+    --pending_;
+  }
+
+  // Re-spreads one slot of an upper level over the levels below
+  void cascade(std::size_t slot) noexcept
+  {
+    auto i{slots_[slot]};
+    slots_[slot] = npos;
+    while (i != npos) {
+      const auto next{nodes_[i].next};
+      link(i);
+      i = next;
+    }
+  }
+
+  // Expires tick base_, moving what is due into due
+  void advance(std::vector<std::function<void()>>& due)
+  {
+    const auto index{base_ & (level0_slots - 1)};
+    if (!index) {               // A lap of level 0 is over
+      auto shift{level0_bits};
+      std::size_t first{level0_slots};
+      for (unsigned l{1}; l < levels; ++l, shift += level_bits, first += level_slots) {
+        const auto i{(base_ >> shift) & (level_slots - 1)};
+        cascade(first + i);
+        if (i)
+          break;
+      }
+    }
+    ++base_;
+
+    auto i{slots_[index]};
+    slots_[index] = npos;
+    while (i != npos) {
+      auto& n{nodes_[i]};
+      const auto next{n.next};
+      n.slot = npos;
+      due.push_back(std::move(n.fire));
+      release(i);
+      i = next;
+    }
+  }
+
+  // First tick with something to expire, or the end of the level 0 lap
+  std::uint64_t next_due() const noexcept
+  {
+    const auto lap_end{(base_ | (level0_slots - 1)) + 1};
+    for (auto t{base_}; t < lap_end; ++t)
+      if (slots_[t & (level0_slots - 1)] != npos)
+        return t;
+    return lap_end;
+  }
+
+  void run()
+  {
+    std::vector<std::function<void()>> due;
+    std::unique_lock lk{m_};
+    while (!stopping_) {
+      if (!pending_) {
+        wake_at_ = std::numeric_limits<std::uint64_t>::max();
+        cv_.wait(lk, [&] { return stopping_ || pending_; });
+        continue;
+      }
+      const auto now{tick_of(Clock::now())};
+      const auto target{next_due()};
+      if (target > now) {
+        wake_at_ = target;
+        cv_.wait_until(lk, time_of(target));
+        continue;
+      }
+      while (base_ <= now)
+        advance(due);
+      if (due.empty())
+        continue;
+      lk.unlock();
+      for (auto& f : due)
+        f();
+      due.clear();
+      lk.lock();
+    }
+  }
+public:
+  explicit Timer_service(Clock::duration resolution = std::chrono::milliseconds{1})
+    : start_{Clock::now()},
+      resolution_{resolution > Clock::duration::zero() ? resolution : Clock::duration{1}}
+  {
+    slots_.fill(npos);
+    thread_ = std::thread{&Timer_service::run, this};
+  }
+
+  Timer_service(const Timer_service&) = delete;
+  Timer_service& operator=(const Timer_service&) = delete;
+
+  ~Timer_service() { stop(); }
+
+  // Runs f on the timer thread once delay has passed; delays beyond
+  // the wheel's range are cut to it;
+  Timer_id call_after(Clock::duration delay, std::function<void()> f)
+  {
+    const auto when{Clock::now() + std::max(delay, Clock::duration::zero())};
+    std::lock_guard lk{m_};
+    if (!pending_)              // Nothing to cascade, skip the idle ticks
+      base_ = std::max(base_, tick_of(Clock::now()));
+    const auto expires{std::clamp(tick_at_or_after(when), base_, base_ + max_ticks)};
+
+    std::uint32_t i{free_};
+    if (i != npos)
+      free_ = nodes_[i].next;
+    else {
+      i = static_cast<std::uint32_t>(nodes_.size());
+      nodes_.emplace_back();
+    }
+    auto& n{nodes_[i]};
+    if (++n.generation == 0)    // 0 is the default constructed id
+      n.generation = 1;
+    n.expires = expires;
+    n.fire = std::move(f);
+    link(i);
+
+    if (!pending_++ || expires < wake_at_)
+      cv_.notify_one();
+    return {i, n.generation};
+  }
+
+  // Sends msg to `to` once delay has passed
+  template<class Msg>
+  Timer_id schedule(Clock::duration delay, Sender to, Msg msg)
+  {
+    return call_after(delay, [to, msg = std::move(msg)]() mutable {
+      to.send(std::move(msg));
+    });
+  }
+
+  // False if the timer already fired, was cancelled, or id is empty
+  bool cancel(Timer_id id) noexcept
+  {
+    std::lock_guard lk{m_};
+    if (!id.generation || id.index >= nodes_.size())
+      return false;
+    auto& n{nodes_[id.index]};
+    if (n.generation != id.generation || n.slot == npos)
+      return false;
+    unlink(id.index);
+    release(id.index);
+    return true;
+  }
+
+  std::size_t pending() const
+  {
+    std::lock_guard lk{m_};
+    return pending_;
+  }
+
+  // Stops the timer thread, dropping whatever is still pending; call it
+  // before the receivers the timers send to go away
+  void stop()
+  {
+    {
+      std::lock_guard lk{m_};
+      stopping_ = true;
+    }
+    cv_.notify_one();
+    if (thread_.joinable())
+      thread_.join();
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_TIMER_HPP
@@ -0,0 +1,393 @@
+#ifndef CASHBOX_TRACE_HPP
+#define CASHBOX_TRACE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// One delivered message in a binary trace, or the start of one: a
+// payload that does not fit goes on in the continued records after it,
+// each of type trace_continuation. Fixed-size so the recorder can fill a
+// preallocated buffer without touching the heap;
+struct Trace_record {
+  static constexpr std::size_t payload_capacity{48};
+
+  std::uint64_t timestamp_ns;   // Time since the recorder was started
+  std::uint16_t queue;          // Which receiver got the message
+  std::uint16_t type;           // Trace_codec<Msg>::type
+  std::uint16_t size;           // Used bytes of payload
+  std::uint8_t continued;       // Records still to come with the rest
+  std::uint8_t truncated;       // The message did not fit (see Trace_payload)
+  std::array<char, payload_capacity> payload;
+};
+
+static_assert(sizeof(Trace_record) == 64, "Trace_record must stay one cache line");
+static_assert(std::is_trivially_copyable_v<Trace_record>);
+
+//------------------------------------------------------------------------------
+
+inline constexpr std::array<char, 8> trace_magic{'C','B','T','R','A','C','E','4'};
+
+inline constexpr std::uint16_t trace_continuation{0xFFFF};
+
+//------------------------------------------------------------------------------
+
+// A message's payload as encoded, before it is cut into records; at most
+// max_records records' worth. What does not fit is dropped and the
+// message marked truncated rather than thrown about: encoding happens on
+// the sending thread, inside send();
+struct Trace_payload {
+  static constexpr std::size_t max_records{16};
+  static constexpr std::size_t capacity{Trace_record::payload_capacity * max_records};
+
+  std::array<char, capacity> bytes;
+  std::size_t size{0};
+  bool truncated{false};
+};
+
+// Hands emit the records of one message: head, with as much of payload
+// as it holds, and the continuation records after it
+template<class F>
+void trace_records(Trace_record head, const Trace_payload& payload, F emit)
+{
+  constexpr auto cap{Trace_record::payload_capacity};
+  auto left{(payload.size + cap - 1) / cap};
+  std::size_t at{0};
+  head.truncated = payload.truncated;
+  do {
+    const auto n{std::min(cap, payload.size - at)};
+    head.size = static_cast<std::uint16_t>(n);
+    head.continued = static_cast<std::uint8_t>(left ? left - 1 : 0);
+    std::memcpy(head.payload.data(), payload.bytes.data() + at, n);
+    std::memset(head.payload.data() + n, 0, cap - n);
+    emit(head);
+    head.type = trace_continuation;
+    at += n;
+  } while (left && --left);
+}
+
+// A message read back from a trace, its records joined again
+struct Trace_message {
+  std::uint64_t timestamp_ns;
+  std::uint16_t queue;
+  std::uint16_t type;
+  bool truncated;
+  std::string payload;
+};
+
+//------------------------------------------------------------------------------
+
+// Appends primitives into a payload; never throws: too much for the
+// payload, or a string longer than 255 bytes, is cut short and the
+// payload marked truncated;
+class Trace_out {
+  Trace_payload& p_;
+public:
+  explicit Trace_out(Trace_payload& p) noexcept : p_{p} { p_.size = 0; p_.truncated = false; }
+
+  void put_bytes(const void* data, std::size_t n) noexcept
+  {
+    const auto fits{std::min(n, p_.bytes.size() - p_.size)};
+    std::memcpy(p_.bytes.data() + p_.size, data, fits);
+    p_.size += fits;
+    if (fits != n)
+      p_.truncated = true;
+  }
+
+  template<class T>
+  void put(const T& value) noexcept
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    put_bytes(&value, sizeof(T));
+  }
+
+  void put_string(std::string_view s) noexcept
+  {
+    if (s.size() > 0xFF) {
+      s = s.substr(0, 0xFF);
+      p_.truncated = true;
+    }
+    put(static_cast<std::uint8_t>(s.size()));
+    put_bytes(s.data(), s.size());
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Reads back what Trace_out wrote;
+class Trace_in {
+  std::string_view payload_;
+  std::size_t pos_{0};
+
+  const char* take(std::size_t n)
+  {
+    if (pos_ + n > payload_.size())
+      throw std::runtime_error("Trace_in: truncated payload");
+    const auto* p{payload_.data() + pos_};
+    pos_ += n;
+    return p;
+  }
+public:
+  explicit Trace_in(const Trace_message& msg) noexcept : payload_{msg.payload} {}
+
+  template<class T>
+  T get()
+  {
+    static_assert(std::is_trivially_copyable_v<T>);
+    T value;
+    std::memcpy(&value, take(sizeof(T)), sizeof(T));
+    return value;
+  }
+
+  std::string get_string()
+  {
+    const auto n{get<std::uint8_t>()};
+    return std::string(take(n), n);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Each traceable message type has a specialization with:
+//   static constexpr std::uint16_t type;
+//   static void encode(const Msg&, Trace_out&);
+//   static Msg decode(Trace_in&, Sender reply_to);
+// reply_to replaces Sender members, which cannot outlive the recording;
+template<class Msg>
+struct Trace_codec;
+
+template<class Msg>
+concept Traceable = requires { Trace_codec<Msg>::type; };
+
+//------------------------------------------------------------------------------
+
+// A closed list of traceable types; replay() decodes a message of any of
+// them and sends it on. A truncated message is not sent: it would not be
+// the one recorded;
+template<class... Msgs>
+struct Trace_types {
+  template<class Target, class Reply>
+  static bool replay(const Trace_message& rec, Target& to, const Reply& reply_to)
+  {
+    return !rec.truncated && (replay_as<Msgs>(rec, to, reply_to) || ...);
+  }
+private:
+  template<class Msg, class Target, class Reply>
+  static bool replay_as(const Trace_message& rec, Target& to, const Reply& reply_to)
+  {
+    if (rec.type != Trace_codec<Msg>::type)
+      return false;
+    if constexpr (requires { to.send(std::declval<Msg>()); }) {
+      Trace_in in{rec};
+      to.send(Trace_codec<Msg>::decode(in, reply_to));
+      return true;
+    }
+    else                            // A closed-set target that does not
+      return false;                 // take Msg (see Typed_sender)
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// Collects records into a ring of blocks, all allocated up front, and
+// hands each full one to a writer thread, which writes it out while
+// record() goes on filling the next. record() never allocates and takes
+// no more than a short lock, so it is safe on the messaging hot path,
+// under a queue's lock, except when the writer still has every other
+// block: then it waits for one rather than drop what a replay needs. A
+// write that fails is reported by flush();
+class Trace_recorder {
+  using Block = std::vector<Trace_record>;
+
+  std::mutex m_;
+  std::condition_variable work_;    // Wakes the writer
+  std::condition_variable written_; // Wakes flush() and record()
+  const std::size_t capacity_;      // Records per block
+  std::vector<Block> blocks_;       // Filled and written in turn
+  std::uint64_t handed_over_{0};    // Blocks; the next is the open one
+  std::uint64_t blocks_written_{0};
+  bool stopping_{false};
+  std::exception_ptr error_;
+  std::atomic<std::uint64_t> total_{0};
+  std::FILE* file_;
+  const std::chrono::steady_clock::time_point start_;
+  std::jthread writer_;
+
+  Block& open() noexcept { return blocks_[handed_over_ % blocks_.size()]; }
+
+  // Hands the open block over unless it has room for room more records,
+  // waiting for the writer to free the block after it first; others may
+  // fill or hand over the open block meanwhile. Requires lk to hold m_
+  void hand_over(std::unique_lock<std::mutex>& lk, std::size_t room)
+  {
+    written_.wait(lk, [&] {
+      return handed_over_ - blocks_written_ + 1 < blocks_.size() || open().size() + room <= capacity_;
+    });
+    if (open().size() + room > capacity_) {
+      ++handed_over_;
+      work_.notify_one();
+    }
+  }
+
+  void write()
+  {
+    std::unique_lock lk{m_};
+    for (;;) {
+      work_.wait(lk, [&] { return stopping_ || blocks_written_ != handed_over_; });
+      if (blocks_written_ == handed_over_)
+        return;
+      auto& block{blocks_[blocks_written_ % blocks_.size()]};
+      lk.unlock();                  // Nobody else touches it till it is written
+      const bool ok{std::fwrite(block.data(), sizeof(Trace_record), block.size(), file_) == block.size()};
+      block.clear();
+      lk.lock();
+      if (!ok && !error_)
+        error_ = std::make_exception_ptr(std::runtime_error("Trace_recorder: write failed"));
+      ++blocks_written_;
+      written_.notify_all();
+    }
+  }
+public:
+  // capacity is in records, at least a whole message's worth
+  explicit Trace_recorder(const std::string& fname, std::size_t capacity = 1 << 14,
+                          std::size_t blocks = 4)
+    : capacity_{std::max(capacity, Trace_payload::max_records)}, blocks_(std::max<std::size_t>(blocks, 2)),
+      file_{std::fopen(fname.c_str(), "wb")}, start_{std::chrono::steady_clock::now()}
+  {
+    if (!file_)
+      throw std::runtime_error("Trace_recorder: cannot open " + fname);
+    std::setvbuf(file_, nullptr, _IONBF, 0); // We buffer ourselves
+    if (std::fwrite(trace_magic.data(), 1, trace_magic.size(), file_) != trace_magic.size()) {
+      std::fclose(file_);
+      throw std::runtime_error("Trace_recorder: write failed");
+    }
+    for (auto& block : blocks_)
+      block.reserve(capacity_);
+    writer_ = std::jthread{[this] { write(); }};
+  }
+
+  Trace_recorder(const Trace_recorder&) = delete;
+  Trace_recorder& operator=(const Trace_recorder&) = delete;
+
+  template<class Msg>
+  void record(std::uint16_t queue, const Msg& msg)
+  {
+    if constexpr (Traceable<Msg>) {
+      const auto ts{std::chrono::steady_clock::now() - start_};
+      Trace_record head;
+      head.timestamp_ns = static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(ts).count());
+      head.queue = queue;
+      head.type = Trace_codec<Msg>::type;
+      Trace_payload payload;
+      Trace_out out{payload};
+      Trace_codec<Msg>::encode(msg, out);
+      // A message's records go into one block, never split by others'
+      const auto n{std::max<std::size_t>((payload.size + Trace_record::payload_capacity - 1)
+                                         / Trace_record::payload_capacity, 1)};
+      std::unique_lock lk{m_};
+      if (open().size() + n > capacity_)
+        hand_over(lk, n);
+      auto& block{open()};
+      trace_records(head, payload, [&](const Trace_record& rec) { block.push_back(rec); });
+      total_.fetch_add(1, std::memory_order_relaxed);
+    }
+  }
+
+  // Writes out everything recorded so far; rethrows what went wrong
+  // writing, if anything did
+  void flush()
+  {
+    std::unique_lock lk{m_};
+    if (!open().empty())
+      hand_over(lk, capacity_);
+    const auto until{handed_over_};
+    written_.wait(lk, [&] { return blocks_written_ >= until; });
+    if (error_)
+      std::rethrow_exception(error_);
+  }
+
+  // Any thread
+  std::uint64_t recorded() const noexcept { return total_.load(std::memory_order_relaxed); }
+
+  ~Trace_recorder()
+  {
+    try {
+      flush();
+    }
+    catch (...) {
+    }
+    {
+      std::lock_guard lk{m_};
+      stopping_ = true;
+    }
+    work_.notify_one();
+    writer_.join();
+    std::fclose(file_);
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// The messages of a trace, in the order recorded
+inline std::vector<Trace_message> read_trace(const std::string& fname)
+{
+  std::unique_ptr<std::FILE, int(*)(std::FILE*)> file{
+    std::fopen(fname.c_str(), "rb"), &std::fclose};
+  if (!file)
+    throw std::runtime_error("read_trace(): cannot open " + fname);
+
+  std::array<char, trace_magic.size()> magic{};
+  if (std::fread(magic.data(), 1, magic.size(), file.get()) != magic.size()
+      || magic != trace_magic)
+    throw std::runtime_error("read_trace(): not a cashbox trace");
+
+  std::vector<Trace_message> messages;
+  Trace_record rec;
+  const auto payload{[&] {
+    return std::string_view{rec.payload.data(), std::min<std::size_t>(rec.size, rec.payload.size())};
+  }};
+  while (std::fread(&rec, sizeof(rec), 1, file.get()) == 1) {
+    if (rec.type == trace_continuation)
+      throw std::runtime_error("read_trace(): stray continuation record");
+    messages.push_back({rec.timestamp_ns, rec.queue, rec.type, rec.truncated != 0, std::string{payload()}});
+    auto& msg{messages.back()};
+    for (auto more{rec.continued}; more; --more) {
+      if (std::fread(&rec, sizeof(rec), 1, file.get()) != 1 || rec.type != trace_continuation)
+        throw std::runtime_error("read_trace(): message cut short");
+      msg.payload += payload();
+    }
+  }
+  return messages;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_TRACE_HPP
@@ -0,0 +1,319 @@
+#ifndef CASHBOX_TYPED_MESSAGING_HPP
+#define CASHBOX_TYPED_MESSAGING_HPP
+
+//------------------------------------------------------------------------------
+
+#include <atomic>
+#include <bit>
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <memory_resource>
+#include <mutex>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "Messaging.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Messaging {
+
+//------------------------------------------------------------------------------
+
+// Opt-in closed-set counterpart of Receiver/Sender: an actor that accepts
+// a fixed list of message types keeps them by value in a ring of
+// std::variant slots; sending anything else does not compile, and handling
+// is a single std::visit; no per-message allocation, no RTTI;
+
+template<class Msg, class... Msgs>
+concept One_of = (std::same_as<Msg, Msgs> || ...);
+
+// The handlers of a visit, as one overloaded callable
+template<class... Fs>
+struct Overloaded : Fs... {
+  using Fs::operator()...;
+};
+
+template<class... Fs>
+Overloaded(Fs...) -> Overloaded<Fs...>;
+
+//------------------------------------------------------------------------------
+
+// Multiple producers, a single consumer, as Simple_queue; the ring grows
+// (doubling) when full, so allocation happens only until it has reached
+// the queue's high-water mark;
+template<class... Msgs>
+class Typed_queue {
+public:
+  using Slot = std::variant<Close_queue, Msgs...>;
+private:
+  std::mutex m_;
+  std::condition_variable cv_;
+  std::pmr::vector<Slot> ring_;                 // Size is a power of two
+  std::size_t head_{0};
+  std::size_t count_{0};
+  std::atomic<std::size_t> size_{0};            // Lets the consumer poll
+                                                // without taking m_
+  bool parked_{false};
+  bool single_threaded_{false};
+  std::atomic<std::uint64_t> pushed_{0};
+  std::atomic<std::uint64_t> wakeups_{0};
+  Adaptive_wait waiter_;                        // Consumer side only
+  Trace_recorder* tap_{nullptr};
+  std::uint16_t tap_queue_{0};
+  Audit_log* audit_{nullptr};
+  std::uint16_t audit_queue_{0};
+  Handler_timing* timing_{nullptr};
+  std::unique_ptr<Queue_metrics> metrics_;
+
+  void grow()                                   // Requires m_ to be held
+  {
+    std::pmr::vector<Slot> bigger(ring_.size() * 2, ring_.get_allocator());
+    for (std::size_t i{0}; i < count_; ++i)
+      bigger[i] = std::move(ring_[(head_ + i) & (ring_.size() - 1)]);
+    ring_ = std::move(bigger);
+    head_ = 0;
+  }
+
+  template<class T>
+  void enqueue(T&& msg)             // Requires m_ unless single-threaded
+  {
+    using Msg = std::decay_t<T>;
+    if (tap_)
+      tap_->record(tap_queue_, static_cast<const Msg&>(msg));
+    if constexpr (Audited<Msg>)
+      if (audit_)
+        audit_->record(audit_queue_, static_cast<const Msg&>(msg));
+    if (count_ == ring_.size())
+      grow();
+    ring_[(head_ + count_) & (ring_.size() - 1)].template emplace<Msg>(std::forward<T>(msg));
+    ++count_;
+    size_.store(count_, std::memory_order_release);
+  }
+
+  Slot take_front()
+  {
+    Slot res{std::move(ring_[head_])};
+    head_ = (head_ + 1) & (ring_.size() - 1);
+    --count_;
+    size_.store(count_, std::memory_order_relaxed);
+    return res;
+  }
+
+  bool ready() const noexcept { return size_.load(std::memory_order_acquire) != 0; }
+public:
+  explicit Typed_queue(std::size_t capacity = 64)
+    : ring_(std::bit_ceil(capacity ? capacity : 1)) {}
+
+  template<class T>
+    requires One_of<std::decay_t<T>, Close_queue, Msgs...>
+  void push(T&& msg)
+  {
+    if (single_threaded_) {
+      enqueue(std::forward<T>(msg));
+      pushed_.store(pushed_.load(std::memory_order_relaxed) + 1,
+                    std::memory_order_relaxed);
+      if (metrics_)
+        metrics_->messages.add();
+      return;
+    }
+    bool wake;
+    {
+      std::lock_guard lk{m_};
+      enqueue(std::forward<T>(msg));
+      wake = parked_ && count_ == 1;
+    }
+    pushed_.fetch_add(1, std::memory_order_relaxed);
+    if (metrics_)
+      metrics_->messages.add();
+    if (wake) {
+      wakeups_.fetch_add(1, std::memory_order_relaxed);
+      cv_.notify_one();
+    }
+  }
+
+  Slot wait_and_pop()
+  {
+    if (single_threaded_) {
+      if (!count_)
+        throw Mailbox_empty{};
+      return take_front();
+    }
+    // Spin, yield or poll as the policy says; parking is left to the cv below
+    if (!ready())
+      waiter_.await([this] { return ready(); });
+    std::unique_lock lk{m_};
+    while (!count_) {
+      parked_ = true;
+      cv_.wait(lk);
+      parked_ = false;
+    }
+    return take_front();
+  }
+
+  // See Simple_queue::set_single_threaded()
+  void set_single_threaded(bool on)
+  {
+    std::lock_guard lk{m_};
+    single_threaded_ = on;
+  }
+
+  std::size_t pending() const noexcept { return size_.load(std::memory_order_relaxed); }
+
+  // See Simple_queue::use_memory
+  void use_memory(std::pmr::memory_resource* mem)
+  {
+    std::lock_guard lk{m_};
+    if (count_)
+      throw std::logic_error("Typed_queue::use_memory(): queue is not empty");
+    ring_ = std::pmr::vector<Slot>(ring_.size(), mem ? mem : std::pmr::get_default_resource());
+    head_ = 0;
+  }
+
+  void set_wait_policy(const Wait_policy& policy)
+  {
+    std::lock_guard lk{m_};
+    waiter_.set_policy(policy);
+  }
+
+  void record_to(Trace_recorder* tap, std::uint16_t queue_id)
+  {
+    std::lock_guard lk{m_};
+    tap_ = tap;
+    tap_queue_ = queue_id;
+  }
+
+  void audit_to(Audit_log* audit, std::uint16_t queue_id)
+  {
+    std::lock_guard lk{m_};
+    audit_ = audit;
+    audit_queue_ = queue_id;
+  }
+
+  void time_handlers(Handler_timing* timing)
+  {
+    std::lock_guard lk{m_};
+    timing_ = timing;
+  }
+
+  // See Simple_queue::publish_metrics()
+  void publish_metrics(std::string_view name)
+  {
+    std::lock_guard lk{m_};
+    const auto labels{Metrics::label("queue", name)};
+    metrics_ = std::make_unique<Queue_metrics>(Queue_metrics{
+      Metrics::counter("cashbox_queue_messages_total", "Messages pushed", labels),
+      Metrics::histogram("cashbox_handler_seconds", "Time in handlers per message",
+                         labels, 1e-9),
+      Metrics::Callback{"cashbox_queue_depth", "Messages waiting", labels,
+                        [this] { return static_cast<double>(size_.load(std::memory_order_relaxed)); }}});
+  }
+
+  bool timed() const noexcept { return timing_ || metrics_; }
+
+  void handled_in(Handler_timing::Clock::duration took)
+  {
+    if (timing_)
+      timing_->record(took);
+    if (metrics_)
+      metrics_->handler_ns.record(static_cast<std::uint64_t>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(took).count()));
+  }
+
+  Queue_stats stats() const noexcept
+  {
+    return {pushed_.load(std::memory_order_relaxed),
+            wakeups_.load(std::memory_order_relaxed), 0,
+            size_.load(std::memory_order_relaxed)};
+  }
+};
+
+//------------------------------------------------------------------------------
+
+template<class... Msgs>
+class Typed_sender {
+  Typed_queue<Msgs...>* q_;
+public:
+  Typed_sender() noexcept : q_{nullptr} {}
+
+  explicit Typed_sender(Typed_queue<Msgs...>* q) noexcept : q_{q} {}
+
+  template<class Msg>
+    requires One_of<std::decay_t<Msg>, Close_queue, Msgs...>
+  void send(Msg&& msg)
+  {
+    if (q_)
+      q_->push(std::forward<Msg>(msg));
+  }
+};
+
+//------------------------------------------------------------------------------
+
+template<class... Msgs>
+class Typed_receiver {
+  Typed_queue<Msgs...> q_;
+public:
+  using sender_type = Typed_sender<Msgs...>;
+
+  explicit Typed_receiver(std::size_t capacity = 64) : q_{capacity} {}
+
+  operator sender_type() noexcept { return sender_type{&q_}; }
+
+  // Takes one message and calls the matching overload of handlers;
+  // handlers must take every type of the set; throws Close_queue as
+  // Dispatcher does;
+  template<class Handlers>
+  void wait(Handlers&& handlers)
+  {
+    static_assert((std::is_invocable_v<Handlers&, Msgs&> && ...),
+                  "Typed_receiver::wait(): a message type has no handler");
+    auto msg{q_.wait_and_pop()};
+    if (std::holds_alternative<Close_queue>(msg))
+      throw Close_queue{};
+    const bool timed{q_.timed()};
+    const auto start{timed ? Handler_timing::Clock::now() : Handler_timing::Clock::time_point{}};
+    std::visit([&](auto& m) {
+      if constexpr (!std::is_same_v<std::decay_t<decltype(m)>, Close_queue>)
+        handlers(m);
+    }, msg);
+    if (timed)
+      q_.handled_in(Handler_timing::Clock::now() - start);
+  }
+
+  // Same setup interface as Receiver, minus dispatch modes (a visit has
+  // no handler order to tune)
+  void record_to(Trace_recorder* tap, std::uint16_t queue_id)
+    { q_.record_to(tap, queue_id); }
+
+  void audit_to(Audit_log* audit, std::uint16_t queue_id)
+    { q_.audit_to(audit, queue_id); }
+
+  void time_handlers(Handler_timing* timing) { q_.time_handlers(timing); }
+
+  void publish_metrics(std::string_view name) { q_.publish_metrics(name); }
+
+  void use_memory(std::pmr::memory_resource* mem) { q_.use_memory(mem); }
+
+  void set_wait_policy(const Wait_policy& policy) { q_.set_wait_policy(policy); }
+
+  void set_single_threaded(bool on) { q_.set_single_threaded(on); }
+
+  std::size_t pending() const noexcept { return q_.pending(); }
+
+  Queue_stats stats() const noexcept { return q_.stats(); }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // CASHBOX_TYPED_MESSAGING_HPP
@@ -0,0 +1,167 @@
+#ifndef POS_BASKET_HPP
+#define POS_BASKET_HPP
+
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+#include "../library/core/Money.hpp"
+#include "Catalog.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+// Tax rates by tax class, in basis points (1/100 of a percent)
+using Tax_rates = std::array<std::uint32_t, tax_classes>;
+
+struct Basket_totals {
+  Accounting::Money subtotal;       // Sum of the lines
+  Accounting::Money promotions;     // See Promotion_engine
+  Accounting::Money discount;       // On what is left after promotions
+  Accounting::Money tax;            // On what is left after both
+  Accounting::Money total;          // subtotal - promotions - discount + tax
+};
+
+struct Basket_line {
+  const Product* product;           // Into the catalog, which outlives baskets
+  std::int32_t quantity;            // Negative for a return
+  Accounting::Money amount;         // price x quantity
+};
+
+// basis_points of amount, rounded half away from zero; the result must
+// fit. Whole ten-thousandths of amount and the rest are scaled apart, so
+// that no product needs more than 64 bits
+inline std::int64_t basis_points_of(std::int64_t amount, std::uint32_t basis_points) noexcept
+{
+  const auto magnitude{amount < 0 ? 0 - static_cast<std::uint64_t>(amount)
+                                  : static_cast<std::uint64_t>(amount)};
+  const auto scaled{magnitude / 10'000 * basis_points
+                    + (magnitude % 10'000 * basis_points + 5'000) / 10'000};
+  return static_cast<std::int64_t>(amount < 0 ? 0 - scaled : scaled);
+}
+
+//------------------------------------------------------------------------------
+
+// The lines being rung up and their totals. Promotions come off first,
+// then the basket discount, then tax is added; all three are rounded per
+// tax class, and each change touches only the class of the line it adds
+// or removes, so totals() is always current and a scan costs the same
+// with three lines or three hundred. All arithmetic is checked Money;
+class Basket {
+  struct Class_totals {
+    Accounting::Money gross;
+    Accounting::Money promotion;
+    Accounting::Money discount;
+    Accounting::Money tax;
+  };
+
+  Accounting::Currency currency_;
+  Tax_rates rates_;
+  std::uint32_t discount_bp_{0};
+  std::vector<Basket_line> lines_;
+  std::array<Class_totals, tax_classes> by_class_;
+  Basket_totals totals_;
+
+  Accounting::Money zero() const noexcept { return Accounting::Money::minor(0, currency_); }
+
+  // Redoes discount and tax of class c after its gross changed by delta
+  void refresh(std::size_t c, Accounting::Money delta)
+  {
+    auto& k{by_class_[c]};
+    k.gross += delta;
+    const auto net{k.gross - k.promotion};
+    const auto discount{Accounting::Money::minor(
+      basis_points_of(net.minor_units(), discount_bp_), currency_)};
+    const auto tax{Accounting::Money::minor(
+      basis_points_of((net - discount).minor_units(), rates_[c]), currency_)};
+    totals_.subtotal += delta;
+    totals_.discount += discount - k.discount;
+    totals_.tax += tax - k.tax;
+    totals_.total = totals_.subtotal - totals_.promotions - totals_.discount + totals_.tax;
+    k.discount = discount;
+    k.tax = tax;
+  }
+public:
+  explicit Basket(Accounting::Currency currency = Accounting::usd, const Tax_rates& rates = {})
+    : currency_{currency}, rates_{rates}
+  {
+    clear();
+  }
+
+  const Basket_line& add(const Product& product, std::int32_t quantity = 1)
+  {
+    if (product.tax_class >= tax_classes)
+      throw std::out_of_range("Basket::add(): tax class out of range");
+    const auto amount{Accounting::Money::minor(product.price, currency_) * quantity};
+    refresh(product.tax_class, amount);
+    lines_.push_back({&product, quantity, amount});
+    return lines_.back();
+  }
+
+  // Takes the last line off; false if there was none
+  bool void_last()
+  {
+    if (lines_.empty())
+      return false;
+    const auto line{lines_.back()};
+    refresh(line.product->tax_class, -line.amount);
+    lines_.pop_back();
+    return true;
+  }
+
+  // A discount on the whole basket, up to 10000 (100%)
+  void set_discount(std::uint32_t basis_points)
+  {
+    if (basis_points > 10'000)
+      throw std::invalid_argument("Basket::set_discount(): over 100%");
+    discount_bp_ = basis_points;
+    for (std::size_t c{0}; c < tax_classes; ++c)
+      refresh(c, zero());
+  }
+
+  // What promotions take off the lines of tax class c, before the basket
+  // discount and tax; replaces the amount set before
+  void set_promotion(std::size_t c, Accounting::Money amount)
+  {
+    if (c >= tax_classes)
+      throw std::out_of_range("Basket::set_promotion(): tax class out of range");
+    auto& k{by_class_[c]};
+    if (amount == k.promotion)
+      return;
+    totals_.promotions += amount - k.promotion;
+    k.promotion = amount;
+    refresh(c, zero());
+  }
+
+  void clear()
+  {
+    lines_.clear();
+    discount_bp_ = 0;
+    by_class_.fill({zero(), zero(), zero(), zero()});
+    totals_ = {zero(), zero(), zero(), zero(), zero()};
+  }
+
+  const Basket_totals& totals() const noexcept { return totals_; }
+
+  std::span<const Basket_line> lines() const noexcept { return lines_; }
+
+  std::uint32_t discount() const noexcept { return discount_bp_; }
+
+  Accounting::Currency currency() const noexcept { return currency_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_BASKET_HPP
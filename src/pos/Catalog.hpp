@@ -0,0 +1,440 @@
+#ifndef POS_CATALOG_HPP
+#define POS_CATALOG_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "../library/core/File_image.hpp"
+#include "../library/core/Money.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+// Products fall into one of so many tax classes (see Basket)
+inline constexpr std::size_t tax_classes{8};
+
+// One catalog entry; fixed size, so that an index file is an array of them
+// that can be mapped and used in place;
+struct Product {
+  static constexpr std::size_t name_capacity{44};
+
+  std::uint64_t barcode{0};         // EAN/UPC or an internal SKU
+  std::int64_t price{0};            // Minor units of the catalog currency
+  std::uint16_t category{0};        // Department, for promotions
+  std::uint8_t tax_class{0};
+  char name[name_capacity + 1]{};   // NUL terminated, cut to fit
+
+  Product() = default;
+
+  Product(std::uint64_t barcode_, std::string_view name_, std::int64_t price_,
+          std::uint8_t tax_class_ = 0, std::uint16_t category_ = 0) noexcept
+    : barcode{barcode_}, price{price_}, category{category_}, tax_class{tax_class_}
+  {
+    const auto n{std::min(name_.size(), name_capacity)};
+    std::memcpy(name, name_.data(), n);
+  }
+
+  std::string_view name_view() const noexcept { return {name, ::strnlen(name, sizeof(name))}; }
+};
+
+static_assert(sizeof(Product) == 64, "Product must stay one cache line");
+static_assert(std::is_trivially_copyable_v<Product>);
+
+//------------------------------------------------------------------------------
+
+using Messaging::File_image;
+
+//------------------------------------------------------------------------------
+
+inline constexpr std::array<char, 8> catalog_magic{'C','B','C','A','T','L','G','2'};
+
+// Start of an index file; offsets are in bytes from the start of the file
+struct Catalog_header {
+  std::array<char, 8> magic;
+  std::uint64_t count;              // Products, and slots of the final table
+  std::uint64_t slots;              // Positions the hash spreads keys over
+  std::uint64_t buckets;
+  std::uint64_t seed;
+  Accounting::Currency currency;
+  std::uint32_t reserved;
+  std::uint64_t pilots_at;          // buckets x uint32
+  std::uint64_t remap_at;           // (slots - count) x uint32
+  std::uint64_t products_at;        // count x Product, in slot order
+};
+
+static_assert(std::is_trivially_copyable_v<Catalog_header>);
+
+namespace detail {
+  // murmur3's finalizer
+  constexpr std::uint64_t mix(std::uint64_t x) noexcept
+  {
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccdULL;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53ULL;
+    return x ^ (x >> 33);
+  }
+
+  // x scaled into [0, n) without a division: the high half of x * n
+  constexpr std::uint64_t reduce(std::uint64_t x, std::uint64_t n) noexcept
+  {
+#if defined(__SIZEOF_INT128__)
+    __extension__ using Wide = unsigned __int128;
+    return static_cast<std::uint64_t>((static_cast<Wide>(x) * n) >> 64);
+#else
+    // No 128-bit type (MSVC): from 32-bit halves, the same slots
+    const auto x_lo{x & 0xFFFF'FFFF};
+    const auto x_hi{x >> 32};
+    const auto n_lo{n & 0xFFFF'FFFF};
+    const auto n_hi{n >> 32};
+    const auto lo_lo{x_lo * n_lo};
+    const auto hi_lo{x_hi * n_lo};
+    const auto mid{(lo_lo >> 32) + (hi_lo & 0xFFFF'FFFF) + x_lo * n_hi};
+    return x_hi * n_hi + (hi_lo >> 32) + (mid >> 32);
+#endif
+  }
+
+  constexpr std::uint64_t position(std::uint64_t h, std::uint32_t pilot, std::uint64_t slots) noexcept
+    { return reduce(mix(h ^ (pilot * 0x9e3779b97f4a7c15ULL)), slots); }
+
+  constexpr std::uint64_t align64(std::uint64_t n) noexcept { return (n + 63) & ~std::uint64_t{63}; }
+}
+
+//------------------------------------------------------------------------------
+
+// Products indexed by barcode with a minimal perfect hash (hash and
+// displace, as in PTHash): keys are split into buckets of about four; each
+// bucket gets the first "pilot" value that sends all its keys to free
+// slots, largest buckets first. Slots are spread over a table 3% larger
+// than needed, so the last pilots are found quickly, and the few keys past
+// the end are remapped into the holes. A lookup is two hashes, a pilot, at
+// most one remap entry and the product itself, which is then checked
+// against the barcode, so unknown codes are reported as such. The same
+// bytes are used in memory and on disk: open() maps a saved index and is
+// ready at once;
+class Catalog {
+  File_image image_;
+  const Catalog_header* header_{nullptr};
+  const std::uint32_t* pilots_{nullptr};
+  const std::uint32_t* remap_{nullptr};
+  const Product* products_{nullptr};
+
+  static constexpr std::uint64_t bucket_size{4};
+  static constexpr double load{0.97};
+  static constexpr std::uint32_t max_pilot{1u << 22};
+
+  void attach()
+  {
+    if (image_.size() < sizeof(Catalog_header))
+      throw std::runtime_error("Catalog: not a cashbox catalog");
+    header_ = reinterpret_cast<const Catalog_header*>(image_.data());
+    const auto& h{*header_};
+    if (h.magic != catalog_magic || h.slots < h.count
+        || h.pilots_at + h.buckets * 4 > image_.size()
+        || h.remap_at + (h.slots - h.count) * 4 > image_.size()
+        || h.products_at + h.count * sizeof(Product) > image_.size()
+        || h.products_at % alignof(Product) || h.pilots_at % 4 || h.remap_at % 4)
+      throw std::runtime_error("Catalog: not a cashbox catalog");
+    pilots_ = reinterpret_cast<const std::uint32_t*>(image_.data() + h.pilots_at);
+    remap_ = reinterpret_cast<const std::uint32_t*>(image_.data() + h.remap_at);
+    products_ = reinterpret_cast<const Product*>(image_.data() + h.products_at);
+  }
+
+  // Slot of every key (products order), pilots of every bucket and the
+  // remap table; false if this seed runs into trouble
+  static bool place(std::span<const Product> products, std::uint64_t seed,
+                    std::uint64_t slots, std::uint64_t buckets,
+                    std::vector<std::uint32_t>& pilots,
+                    std::vector<std::uint32_t>& remap,
+                    std::vector<std::uint32_t>& slot_of)
+  {
+    const auto n{products.size()};
+    std::vector<std::uint64_t> hashes(n);
+    std::vector<std::uint32_t> start(buckets + 1);
+    for (std::size_t i{0}; i < n; ++i) {
+      hashes[i] = detail::mix(products[i].barcode ^ seed);
+      ++start[detail::reduce(hashes[i], buckets) + 1];
+    }
+    std::uint32_t largest{0};
+    for (std::uint64_t b{0}; b < buckets; ++b) {
+      largest = std::max(largest, start[b + 1]);
+      start[b + 1] += start[b];
+    }
+    std::vector<std::uint32_t> keys(n);           // Key indexes by bucket
+    {
+      auto fill{start};
+      for (std::uint32_t i{0}; i < n; ++i)
+        keys[fill[detail::reduce(hashes[i], buckets)]++] = i;
+    }
+    std::vector<std::uint32_t> by_size(buckets);  // Largest buckets first
+    {
+      std::vector<std::uint32_t> at(largest + 2);
+      for (std::uint64_t b{0}; b < buckets; ++b)
+        ++at[largest - (start[b + 1] - start[b]) + 1];
+      for (std::uint32_t s{0}; s <= largest; ++s)
+        at[s + 1] += at[s];
+      for (std::uint32_t b{0}; b < buckets; ++b)
+        by_size[at[largest - (start[b + 1] - start[b])]++] = b;
+    }
+
+    std::vector<std::uint64_t> taken((slots + 63) / 64);
+    const auto is_taken{[&](std::uint64_t p) { return (taken[p / 64] >> (p % 64)) & 1; }};
+    pilots.assign(buckets, 0);
+    slot_of.assign(n, 0);
+    std::vector<std::uint64_t> pos;
+    for (const auto b : by_size) {
+      const auto first{start[b]};
+      const auto size{start[b + 1] - first};
+      if (!size)
+        break;
+      for (std::uint32_t pilot{0};; ++pilot) {
+        if (pilot == max_pilot)
+          return false;
+        pos.clear();
+        bool ok{true};
+        for (auto k{first}; ok && k < first + size; ++k) {
+          const auto p{detail::position(hashes[keys[k]], pilot, slots)};
+          ok = !is_taken(p) && std::find(pos.begin(), pos.end(), p) == pos.end();
+          pos.push_back(p);
+        }
+        if (!ok)
+          continue;
+        for (std::uint32_t k{0}; k < size; ++k) {
+          taken[pos[k] / 64] |= std::uint64_t{1} << (pos[k] % 64);
+          slot_of[keys[first + k]] = static_cast<std::uint32_t>(pos[k]);
+        }
+        pilots[b] = pilot;
+        break;
+      }
+    }
+
+    remap.assign(slots - n, 0);
+    std::uint64_t hole{0};
+    for (auto p{n}; p < slots; ++p) {
+      if (!is_taken(p))
+        continue;
+      while (is_taken(hole))
+        ++hole;
+      remap[p - n] = static_cast<std::uint32_t>(hole++);
+    }
+    for (auto& s : slot_of)
+      if (s >= n)
+        s = remap[s - n];
+    return true;
+  }
+public:
+  Catalog() = default;
+
+  // Indexes products; barcodes must be unique
+  static Catalog build(std::span<const Product> products,
+                       Accounting::Currency currency = Accounting::usd)
+  {
+    const auto n{products.size()};
+    if (n >= 0xffff'ffffULL)
+      throw std::invalid_argument("Catalog: too many products");
+    {
+      std::vector<std::uint64_t> codes(n);
+      for (std::size_t i{0}; i < n; ++i) {
+        if (products[i].tax_class >= tax_classes)
+          throw std::invalid_argument("Catalog: tax class out of range");
+        codes[i] = products[i].barcode;
+      }
+      std::sort(codes.begin(), codes.end());
+      if (std::adjacent_find(codes.begin(), codes.end()) != codes.end())
+        throw std::invalid_argument("Catalog: duplicate barcode");
+    }
+
+    const std::uint64_t slots{n ? std::max<std::uint64_t>(n, static_cast<std::uint64_t>(
+                                    static_cast<double>(n) / load)) : 0};
+    const std::uint64_t buckets{std::max<std::uint64_t>(1, n / bucket_size)};
+    std::vector<std::uint32_t> pilots;
+    std::vector<std::uint32_t> remap;
+    std::vector<std::uint32_t> slot_of;
+    std::uint64_t seed{0x5eed'cb0c'a7a1'0600ULL};
+    while (!place(products, seed, slots, buckets, pilots, remap, slot_of))
+      seed = detail::mix(seed);
+
+    Catalog_header h{};
+    h.magic = catalog_magic;
+    h.count = n;
+    h.slots = slots;
+    h.buckets = buckets;
+    h.seed = seed;
+    h.currency = currency;
+    h.pilots_at = detail::align64(sizeof(Catalog_header));
+    h.remap_at = detail::align64(h.pilots_at + buckets * 4);
+    h.products_at = detail::align64(h.remap_at + remap.size() * 4);
+
+    Catalog res;
+    res.image_ = File_image{h.products_at + n * sizeof(Product)};
+    auto* out{res.image_.writable()};
+    std::memcpy(out, &h, sizeof(h));
+    std::memcpy(out + h.pilots_at, pilots.data(), pilots.size() * 4);
+    std::memcpy(out + h.remap_at, remap.data(), remap.size() * 4);
+    auto* placed{reinterpret_cast<Product*>(out + h.products_at)};
+    for (std::size_t i{0}; i < n; ++i)
+      placed[slot_of[i]] = products[i];
+    res.attach();
+    return res;
+  }
+
+  // A saved index, mapped rather than read
+  static Catalog open(const std::string& path)
+  {
+    Catalog res;
+    res.image_ = File_image::map(path);
+    res.attach();
+    return res;
+  }
+
+  void save(const std::string& path) const
+  {
+    std::unique_ptr<std::FILE, int(*)(std::FILE*)> file{
+      std::fopen(path.c_str(), "wb"), &std::fclose};
+    if (!file || std::fwrite(image_.data(), 1, image_.size(), file.get()) != image_.size())
+      throw std::runtime_error("Catalog: cannot write " + path);
+  }
+
+  // nullptr for an unknown barcode
+  const Product* find(std::uint64_t barcode) const noexcept
+  {
+    if (!header_ || !header_->count)
+      return nullptr;
+    const auto& h{*header_};
+    const auto hash{detail::mix(barcode ^ h.seed)};
+    auto slot{detail::position(hash, pilots_[detail::reduce(hash, h.buckets)], h.slots)};
+    if (slot >= h.count)
+      slot = remap_[slot - h.count];
+    const auto& p{products_[slot]};
+    return p.barcode == barcode ? &p : nullptr;
+  }
+
+  std::size_t size() const noexcept { return header_ ? header_->count : 0; }
+
+  Accounting::Currency currency() const noexcept
+    { return header_ ? header_->currency : Accounting::Currency{}; }
+
+  std::span<const Product> products() const noexcept { return {products_, size()}; }
+
+  bool is_mapped() const noexcept { return image_.is_mapped(); }
+
+  std::size_t bytes() const noexcept { return image_.size(); }
+};
+
+//------------------------------------------------------------------------------
+
+// A catalog as text, one product a line: barcode,price,tax class,category,name
+// (the name last, so it may hold commas); blank lines and lines starting
+// with '#' are skipped;
+inline std::vector<Product> read_catalog_csv(const std::string& path,
+                                             Accounting::Currency currency = Accounting::usd)
+{
+  std::ifstream in{path};
+  if (!in)
+    throw std::runtime_error("read_catalog_csv(): cannot open " + path);
+  std::vector<Product> res;
+  std::string line;
+  for (std::size_t line_no{1}; std::getline(in, line); ++line_no) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line.front() == '#')
+      continue;
+    const auto bad{[&] {
+      return std::runtime_error("read_catalog_csv(): " + path + ':'
+                                + std::to_string(line_no) + ": bad line");
+    }};
+    std::string_view rest{line};
+    std::array<std::string_view, 4> field;
+    for (auto& f : field) {
+      const auto comma{rest.find(',')};
+      if (comma == std::string_view::npos)
+        throw bad();
+      f = rest.substr(0, comma);
+      rest.remove_prefix(comma + 1);
+    }
+    const auto number{[](std::string_view f, auto& value) {
+      return !f.empty() && std::from_chars(f.data(), f.data() + f.size(), value).ptr == f.data() + f.size();
+    }};
+    std::uint64_t barcode{0};
+    unsigned tax_class{0};
+    std::uint16_t category{0};
+    if (!number(field[0], barcode) || !number(field[2], tax_class) || tax_class >= tax_classes
+        || !number(field[3], category))
+      throw bad();
+    const auto price{Accounting::parse_money(field[1], currency)};
+    if (!price)
+      throw bad();
+    res.emplace_back(barcode, rest, price->minor_units(), static_cast<std::uint8_t>(tax_class),
+                     category);
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+// EAN-13 check digit of a 12-digit body
+constexpr std::uint64_t ean13(std::uint64_t body) noexcept
+{
+  std::uint64_t sum{0};
+  auto b{body};
+  for (int i{0}; i < 12; ++i, b /= 10)
+    sum += (b % 10) * (i % 2 ? 1 : 3);    // Rightmost body digit weighs 3
+  return body * 10 + (10 - sum % 10) % 10;
+}
+
+static_assert(ean13(400638133393) == 4006381333931);
+
+inline constexpr std::uint16_t synthetic_categories{1'000};
+
+// n made-up products with distinct valid EAN-13 codes, spread over
+// synthetic_categories categories, for trying out and benchmarking big
+// catalogs
+inline std::vector<Product> synthetic_catalog(std::size_t n, std::uint64_t seed = 1)
+{
+  constexpr std::uint64_t bodies{1'000'000'000'000};
+  if (n > bodies)
+    throw std::invalid_argument("synthetic_catalog(): too many products");
+  std::vector<Product> res;
+  res.reserve(n);
+  const auto offset{detail::mix(seed) % bodies};
+  char name[32];
+  for (std::uint64_t i{0}; i < n; ++i) {
+    // i -> body is a bijection on [0, bodies): 999999999989 is prime;
+    // the product goes in two parts, 999999 x 10^6 + 999989, each of
+    // which fits in 64 bits
+    const auto body{((i * 999'999 % bodies) * 1'000'000 + i * 999'989 + offset) % bodies};
+    const auto len{std::snprintf(name, sizeof(name), "Item %llu", static_cast<unsigned long long>(i))};
+    res.emplace_back(ean13(body), std::string_view{name, static_cast<std::size_t>(len)},
+                     static_cast<std::int64_t>(99 + detail::mix(body) % 10'000),
+                     static_cast<std::uint8_t>(i % 3),
+                     static_cast<std::uint16_t>(detail::mix(body ^ seed) % synthetic_categories));
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_CATALOG_HPP
@@ -0,0 +1,90 @@
+#ifndef POS_DISPLAY_HPP
+#define POS_DISPLAY_HPP
+
+//------------------------------------------------------------------------------
+
+#include <iomanip>
+#include <ostream>
+
+#include "../library/core/Messaging.hpp"
+#include "Messages.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+// The customer and cashier display of one lane; prints what the register
+// tells it, nothing more;
+class Display {
+  mutable Messaging::Receiver incoming_;
+  std::ostream& out_;
+
+  void print_totals(const Basket_totals& t)
+  {
+    out_ << "  subtotal " << t.subtotal;
+    if (!t.promotions.is_zero())
+      out_ << "  promotions " << t.promotions;
+    if (!t.discount.is_zero())
+      out_ << "  discount " << t.discount;
+    out_ << "  tax " << t.tax << "  total " << t.total << '\n';
+  }
+
+  void handle_one()
+  {
+    incoming_.wait()
+      .handle<line_added>([&](const line_added& msg) {
+        out_ << std::setw(4) << msg.line.quantity << " x "
+             << msg.line.product->name_view() << "  " << msg.line.amount << '\n';
+        print_totals(msg.totals);
+      })
+      .handle<line_voided>([&](const line_voided& msg) {
+        out_ << "VOID " << msg.line.product->name_view() << "  " << -msg.line.amount << '\n';
+        print_totals(msg.totals);
+      })
+      .handle<unknown_item>([&](const unknown_item& msg) {
+        out_ << "Unknown item " << msg.barcode << '\n';
+      })
+      .handle<totals_changed>([&](const totals_changed& msg) {
+        print_totals(msg.totals);
+      })
+      .handle<receipt>([&](const receipt& msg) {
+        out_ << "Receipt #" << msg.number << ", " << msg.lines << " lines\n";
+        print_totals(msg.totals);
+      })
+      .handle<basket_cancelled>([&](const basket_cancelled&) {
+        out_ << "Basket cancelled\n";
+      });
+    out_.flush();
+  }
+public:
+  explicit Display(std::ostream& out) : out_{out} {}
+
+  Display(const Display&) = delete;
+  Display& operator=(const Display&) = delete;
+
+  void done() const { get_sender().send(Messaging::Close_queue{}); }
+
+  void run()
+  {
+    try {
+      for (;;)
+        handle_one();
+    }
+    catch (const Messaging::Close_queue&) {
+    }
+  }
+
+  Messaging::Sender get_sender() const noexcept { return incoming_; }
+
+  Messaging::Receiver& mailbox() const noexcept { return incoming_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_DISPLAY_HPP
@@ -0,0 +1,125 @@
+#ifndef POS_MESSAGES_HPP
+#define POS_MESSAGES_HPP
+
+//------------------------------------------------------------------------------
+
+#include <array>
+#include <cstdint>
+
+#include "../library/core/Messaging.hpp"
+#include "Basket.hpp"
+#include "Catalog.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+// Into the register, from the scanner and the keyboard
+
+struct scan
+{
+  std::uint64_t barcode;
+  std::int32_t quantity{1};
+};
+
+struct void_last_line
+{};
+
+struct set_discount
+{
+  std::uint32_t basis_points;
+};
+
+struct checkout
+{};
+
+struct cancel_basket
+{};
+
+// Stops the register once what was sent before is done with
+struct close_lane
+{};
+
+//------------------------------------------------------------------------------
+
+// Out of the register, to the display
+
+struct line_added
+{
+  Basket_line line;
+  Basket_totals totals;
+};
+
+struct line_voided
+{
+  Basket_line line;
+  Basket_totals totals;
+};
+
+struct unknown_item
+{
+  std::uint64_t barcode;
+};
+
+struct totals_changed
+{
+  Basket_totals totals;
+};
+
+struct receipt
+{
+  std::uint64_t number;             // Baskets checked out so far
+  std::uint32_t lines;
+  Basket_totals totals;
+};
+
+struct basket_cancelled
+{};
+
+//------------------------------------------------------------------------------
+
+// Between the registers and the promotion engine; a basket is named by
+// its lane and its number on the lane
+
+struct promotion_scan
+{
+  mutable Messaging::Sender reply;
+  std::uint64_t basket;
+  const Product* product;
+  std::int32_t quantity;            // Negative when a line is voided
+};
+
+struct promotion_checkout
+{
+  mutable Messaging::Sender reply;
+  std::uint64_t basket;
+};
+
+struct promotion_cancel
+{
+  std::uint64_t basket;
+};
+
+// Sent when a scan changed what the promotions save
+struct promotions_changed
+{
+  std::uint64_t basket;
+  std::array<Accounting::Money, tax_classes> by_class;
+};
+
+// The answer to promotion_checkout, after every change sent before it
+struct promotions_final
+{
+  std::uint64_t basket;
+  std::array<Accounting::Money, tax_classes> by_class;
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_MESSAGES_HPP
@@ -0,0 +1,118 @@
+#ifndef POS_PROMOTION_ENGINE_HPP
+#define POS_PROMOTION_ENGINE_HPP
+
+//------------------------------------------------------------------------------
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "../library/core/Messaging.hpp"
+#include "Messages.hpp"
+#include "Promotions.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+struct Promotion_stats {
+  std::uint64_t scans;
+  std::uint64_t changes;            // promotions_changed sent
+  std::uint64_t evaluations;        // Rules evaluated, over all baskets
+  std::uint64_t baskets;            // Checked out or cancelled
+};
+
+// Works out what promotions save on the open baskets of every lane: the
+// registers tell it each scan and void, it tells a register back when the
+// saving of its basket changed, and once more at checkout. One engine
+// serves all lanes from one compiled, read-only Promotion_table;
+class Promotion_engine {
+  const Promotion_table& table_;
+  mutable Messaging::Receiver incoming_;
+  std::unordered_map<std::uint64_t, Promotion_basket> baskets_;
+  Promotion_stats stats_{};
+  std::uint64_t retired_evaluations_{0};
+
+  Promotion_basket& basket(std::uint64_t key)
+    { return baskets_.try_emplace(key, table_).first->second; }
+
+  void retire(std::uint64_t key)
+  {
+    const auto it{baskets_.find(key)};
+    if (it == baskets_.end())
+      return;
+    retired_evaluations_ += it->second.evaluations();
+    baskets_.erase(it);
+  }
+
+  void handle_one()
+  {
+    incoming_.wait()
+      .handle<promotion_scan>([&](const promotion_scan& msg) {
+        ++stats_.scans;
+        auto& b{basket(msg.basket)};
+        if (!b.add(*msg.product, msg.quantity))
+          return;
+        ++stats_.changes;
+        msg.reply.send(promotions_changed{msg.basket, b.by_class()});
+      })
+      .handle<promotion_checkout>([&](const promotion_checkout& msg) {
+        ++stats_.baskets;
+        msg.reply.send(promotions_final{msg.basket, basket(msg.basket).by_class()});
+        retire(msg.basket);
+      })
+      .handle<promotion_cancel>([&](const promotion_cancel& msg) {
+        ++stats_.baskets;
+        retire(msg.basket);
+      });
+  }
+public:
+  explicit Promotion_engine(const Promotion_table& table) : table_{table} {}
+
+  Promotion_engine(const Promotion_engine&) = delete;
+  Promotion_engine& operator=(const Promotion_engine&) = delete;
+
+  void done() const { get_sender().send(Messaging::Close_queue{}); }
+
+  void run()
+  {
+    try {
+      for (;;)
+        handle_one();
+    }
+    catch (const Messaging::Close_queue&) {
+    }
+  }
+
+  // Simulation (see Messaging::Sim_scheduler); false if there was no mail
+  bool step()
+  {
+    if (!incoming_.pending())
+      return false;
+    handle_one();
+    return true;
+  }
+
+  Messaging::Sender get_sender() const noexcept { return incoming_; }
+
+  Messaging::Receiver& mailbox() const noexcept { return incoming_; }
+
+  // Only meaningful once run() has returned
+  Promotion_stats stats() const noexcept
+  {
+    auto res{stats_};
+    res.evaluations = retired_evaluations_;
+    for (const auto& [key, b] : baskets_)
+      res.evaluations += b.evaluations();
+    return res;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_PROMOTION_ENGINE_HPP
@@ -0,0 +1,539 @@
+#ifndef POS_PROMOTIONS_HPP
+#define POS_PROMOTIONS_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "../library/core/Money.hpp"
+#include "Basket.hpp"
+#include "Catalog.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+enum class Promotion_kind : std::uint8_t {
+  buy_x_get_y,                      // Of one product: every buy + get, get are free
+  bundle,                           // Products sold together for one price
+  percent_off                       // A percentage off a whole category
+};
+
+struct Promotion_item {
+  std::uint64_t barcode;
+  std::uint32_t quantity{1};
+};
+
+// A promotion as written by the merchant, products named by barcode
+struct Promotion_rule {
+  Promotion_kind kind{Promotion_kind::percent_off};
+  std::vector<Promotion_item> items;    // One for buy_x_get_y, the parts of a bundle
+  std::uint32_t buy{0};
+  std::uint32_t get{0};
+  std::int64_t price{0};                // Of a bundle, minor units
+  std::uint16_t category{0};
+  std::uint32_t basis_points{0};        // percent_off
+
+  static Promotion_rule buy_x_get_y(std::uint64_t barcode, std::uint32_t buy, std::uint32_t get)
+  {
+    Promotion_rule r;
+    r.kind = Promotion_kind::buy_x_get_y;
+    r.items.push_back({barcode, 1});
+    r.buy = buy;
+    r.get = get;
+    return r;
+  }
+
+  static Promotion_rule bundle(std::int64_t price, std::vector<Promotion_item> items)
+  {
+    Promotion_rule r;
+    r.kind = Promotion_kind::bundle;
+    r.items = std::move(items);
+    r.price = price;
+    return r;
+  }
+
+  static Promotion_rule percent_off(std::uint16_t category, std::uint32_t basis_points)
+  {
+    Promotion_rule r;
+    r.category = category;
+    r.basis_points = basis_points;
+    return r;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// A rule as compiled: products by catalog position, prices folded in, so
+// that evaluating it is a few multiplications and no catalog lookups
+struct Promotion {
+  Promotion_kind kind;
+  std::uint8_t classes;             // Bit per tax class the saving goes to,
+                                    // none for percent_off (any class)
+  std::uint16_t category;
+  std::uint32_t first;              // Parts, in Promotion_table::parts()
+  std::uint32_t count;
+  std::uint32_t buy;                // buy_x_get_y; percent_off: basis points
+  std::uint32_t get;
+  std::int64_t saving;              // Per free item, or per bundle
+};
+
+static_assert(sizeof(Promotion) == 32);
+static_assert(tax_classes <= 8, "Promotion::classes has a bit per tax class");
+
+struct Promotion_part {
+  std::uint32_t product;            // Position in Catalog::products()
+  std::uint32_t quantity;
+  std::int64_t saving;              // Bundle: this part's share, per bundle
+  std::uint8_t tax_class;           // The product's
+};
+
+// Promotions compiled against one catalog into flat tables: the rules and
+// their parts in two arrays, and which rules a product or a category takes
+// part in as runs of rule numbers in a third. Products with rules are found
+// through an open-addressed table on catalog position (half full, linear
+// probing), categories through an offset array, so finding the rules a
+// scan affects is one or two cache misses however many rules there are;
+class Promotion_table {
+  struct Product_slot {
+    std::uint32_t product;
+    std::uint32_t first;            // Into matches_
+    std::uint32_t count;
+  };
+
+  static constexpr std::uint32_t no_product{0xffff'ffff};
+  static constexpr std::size_t categories{0x1'0000};
+
+  const Catalog* catalog_{nullptr};
+  std::vector<Promotion> rules_;
+  std::vector<Promotion_part> parts_;
+  std::vector<Product_slot> slots_;
+  std::uint64_t slot_mask_{0};
+  std::vector<std::uint32_t> category_start_;
+  std::vector<std::uint32_t> matches_;        // Rule numbers: by product, then by category
+
+  static std::uint64_t slot_hash(std::uint32_t product) noexcept
+    { return detail::mix(product); }
+
+  [[noreturn]] static void bad(std::size_t rule, const char* what)
+  {
+    throw std::invalid_argument("Promotion_table: rule " + std::to_string(rule + 1) + ": " + what);
+  }
+
+  void compile(std::size_t i, const Promotion_rule& in)
+  {
+    const auto products{catalog_->products()};
+    Promotion out{in.kind, 0, in.category, static_cast<std::uint32_t>(parts_.size()),
+                  0, in.buy, in.get, 0};
+    if (in.kind == Promotion_kind::percent_off) {
+      if (in.basis_points == 0 || in.basis_points > 10'000)
+        bad(i, "percentage out of range");
+      out.buy = in.basis_points;
+      out.get = 0;
+      rules_.push_back(out);
+      return;
+    }
+    if (in.items.empty() || (in.kind == Promotion_kind::buy_x_get_y && in.items.size() != 1))
+      bad(i, "wrong number of products");
+    std::int64_t full{0};
+    for (const auto& item : in.items) {
+      const auto* p{catalog_->find(item.barcode)};
+      if (!p)
+        bad(i, "unknown barcode");
+      if (item.quantity == 0)
+        bad(i, "zero quantity");
+      const auto product{static_cast<std::uint32_t>(p - products.data())};
+      for (auto k{out.first}; k < parts_.size(); ++k)
+        if (parts_[k].product == product)
+          bad(i, "product listed twice");
+      parts_.push_back({product, item.quantity, 0, p->tax_class});
+      full += p->price * item.quantity;
+      out.classes = static_cast<std::uint8_t>(out.classes | 1u << p->tax_class);
+    }
+    out.count = static_cast<std::uint32_t>(in.items.size());
+    if (in.kind == Promotion_kind::buy_x_get_y) {
+      if (in.buy == 0 || in.get == 0)
+        bad(i, "buy and get must be at least 1");
+      out.saving = full;
+    }
+    else {
+      out.saving = full - in.price;
+      if (out.saving <= 0)
+        bad(i, "bundle is not cheaper than its parts");
+      // Each part takes its price's share of the saving, for the tax
+      // class it is in; what rounding leaves goes to the dearest part
+      std::int64_t shared{0};
+      auto dearest{out.first};
+      for (auto k{out.first}; k < parts_.size(); ++k) {
+        auto& part{parts_[k]};
+        const auto part_full{products[part.product].price * part.quantity};
+        std::int64_t scaled{0};
+        if (Accounting::mul_overflows(out.saving, part_full, scaled))
+          bad(i, "prices too large to share the saving out");
+        part.saving = scaled / full;
+        shared += part.saving;
+        if (part_full > products[parts_[dearest].product].price * parts_[dearest].quantity)
+          dearest = k;
+      }
+      parts_[dearest].saving += out.saving - shared;
+    }
+    rules_.push_back(out);
+  }
+
+  void index()
+  {
+    std::vector<std::pair<std::uint32_t, std::uint32_t>> by_product;   // product, rule
+    std::vector<std::uint32_t> per_category(categories + 1);
+    for (std::uint32_t r{0}; r < rules_.size(); ++r) {
+      const auto& rule{rules_[r]};
+      if (rule.kind == Promotion_kind::percent_off)
+        ++per_category[rule.category + 1];
+      for (auto k{rule.first}; k < rule.first + rule.count; ++k)
+        by_product.emplace_back(parts_[k].product, r);
+    }
+    std::sort(by_product.begin(), by_product.end());
+
+    std::size_t distinct{0};
+    for (std::size_t k{0}; k < by_product.size(); ++k)
+      distinct += k == 0 || by_product[k].first != by_product[k - 1].first;
+    std::size_t size{16};
+    while (size < 2 * distinct)
+      size *= 2;
+    slots_.assign(size, {no_product, 0, 0});
+    slot_mask_ = size - 1;
+    matches_.reserve(by_product.size() + rules_.size());
+    for (std::size_t k{0}; k < by_product.size();) {
+      const auto product{by_product[k].first};
+      const auto first{static_cast<std::uint32_t>(matches_.size())};
+      for (; k < by_product.size() && by_product[k].first == product; ++k)
+        matches_.push_back(by_product[k].second);
+      auto s{slot_hash(product) & slot_mask_};
+      while (slots_[s].product != no_product)
+        s = (s + 1) & slot_mask_;
+      slots_[s] = {product, first, static_cast<std::uint32_t>(matches_.size()) - first};
+    }
+
+    const auto base{static_cast<std::uint32_t>(matches_.size())};
+    for (std::size_t c{0}; c < categories; ++c)
+      per_category[c + 1] += per_category[c];
+    category_start_.resize(categories + 1);
+    for (std::size_t c{0}; c <= categories; ++c)
+      category_start_[c] = base + per_category[c];
+    matches_.resize(base + per_category[categories]);
+    for (std::uint32_t r{0}; r < rules_.size(); ++r)
+      if (rules_[r].kind == Promotion_kind::percent_off)
+        matches_[base + per_category[rules_[r].category]++] = r;
+  }
+public:
+  Promotion_table() = default;
+
+  // Checks and compiles rules; the catalog must outlive the table
+  Promotion_table(const Catalog& catalog, std::span<const Promotion_rule> rules)
+    : catalog_{&catalog}
+  {
+    if (rules.size() >= no_product)
+      throw std::invalid_argument("Promotion_table: too many rules");
+    rules_.reserve(rules.size());
+    for (std::size_t i{0}; i < rules.size(); ++i)
+      compile(i, rules[i]);
+    index();
+  }
+
+  const Catalog& catalog() const noexcept { return *catalog_; }
+
+  std::uint32_t position(const Product& product) const noexcept
+    { return static_cast<std::uint32_t>(&product - catalog_->products().data()); }
+
+  // Rules with this product (by position) among their parts
+  std::span<const std::uint32_t> rules_for_product(std::uint32_t product) const noexcept
+  {
+    if (rules_.empty())
+      return {};
+    for (auto s{slot_hash(product) & slot_mask_};; s = (s + 1) & slot_mask_) {
+      const auto& slot{slots_[s]};
+      if (slot.product == product)
+        return {matches_.data() + slot.first, slot.count};
+      if (slot.product == no_product)
+        return {};
+    }
+  }
+
+  std::span<const std::uint32_t> rules_for_category(std::uint16_t category) const noexcept
+  {
+    if (rules_.empty())
+      return {};
+    return {matches_.data() + category_start_[category],
+            category_start_[category + 1u] - category_start_[category]};
+  }
+
+  std::span<const Promotion> rules() const noexcept { return rules_; }
+
+  std::span<const Promotion_part> parts(const Promotion& rule) const noexcept
+    { return {parts_.data() + rule.first, rule.count}; }
+
+  std::size_t size() const noexcept { return rules_.size(); }
+
+  std::size_t bytes() const noexcept
+  {
+    return rules_.size() * sizeof(Promotion) + parts_.size() * sizeof(Promotion_part)
+         + slots_.size() * sizeof(Product_slot) + category_start_.size() * 4 + matches_.size() * 4;
+  }
+};
+
+//------------------------------------------------------------------------------
+
+// The promotions of one basket. Every scan or void updates the quantity of
+// its product and the gross of its category, then evaluates again only the
+// rules found through those two, keeping the saving of each rule that
+// applies so that the change in the total is known without looking at the
+// others. A saving goes to the tax class of the goods it is on; a bundle's
+// is shared out over its parts' classes in proportion to their prices. All
+// rules that apply are granted, but together they never take more off a
+// tax class than its lines come to;
+class Promotion_basket {
+  using Class_amounts = std::array<Accounting::Money, tax_classes>;
+
+  const Promotion_table* table_;
+  Accounting::Currency currency_;
+  std::unordered_map<std::uint32_t, std::int32_t> quantity_;   // By product position
+  std::unordered_map<std::uint32_t, std::int64_t> gross_;      // By category x tax class
+  std::unordered_map<std::uint64_t, std::int64_t> applied_;    // By rule x tax class
+  Class_amounts class_gross_;
+  Class_amounts stacked_;           // Every saving applied, uncapped
+  Class_amounts by_class_;          // stacked_, capped at class_gross_
+  Accounting::Money total_;
+  std::uint64_t evaluations_{0};
+
+  static std::uint32_t key(std::uint16_t category, std::uint8_t tax_class) noexcept
+    { return static_cast<std::uint32_t>(category * tax_classes + tax_class); }   // < 2^20
+
+  Accounting::Money money(std::int64_t minor) const noexcept
+    { return Accounting::Money::minor(minor, currency_); }
+
+  template<class Map>
+  static auto value(const Map& map, typename Map::key_type k) noexcept
+  {
+    const auto it{map.find(k)};
+    return it == map.end() ? typename Map::mapped_type{0} : it->second;
+  }
+
+  // What the rules together may take off a tax class
+  Accounting::Money capped(Accounting::Money saving, Accounting::Money gross) const
+    { return std::min(saving, std::max(gross, money(0))); }
+
+  // Saving of rule r in tax class c for what is in the basket now
+  Accounting::Money saving(const Promotion& rule, std::uint8_t c) const
+  {
+    switch (rule.kind) {
+    case Promotion_kind::buy_x_get_y: {
+      const std::int64_t n{std::max(0, value(quantity_, table_->parts(rule)[0].product))};
+      return money(rule.saving) * (n / (std::int64_t{rule.buy} + rule.get) * rule.get);
+    }
+    case Promotion_kind::bundle: {
+      std::int64_t bundles{INT64_MAX};
+      std::int64_t share{0};
+      for (const auto& part : table_->parts(rule)) {
+        bundles = std::min(bundles, std::int64_t{std::max(0, value(quantity_, part.product))}
+                                      / part.quantity);
+        if (part.tax_class == c)
+          share += part.saving;
+      }
+      return money(share) * bundles;
+    }
+    case Promotion_kind::percent_off:
+      return money(basis_points_of(std::max<std::int64_t>(0, value(gross_, key(rule.category, c))),
+                                   rule.buy));
+    }
+    return money(0);
+  }
+
+  void evaluate(std::uint32_t r, std::uint8_t c)
+  {
+    ++evaluations_;
+    const auto now{saving(table_->rules()[r], c)};
+    const auto k{std::uint64_t{r} * tax_classes + c};
+    const auto it{applied_.find(k)};
+    const auto before{money(it == applied_.end() ? 0 : it->second)};
+    if (now == before)
+      return;
+    stacked_[c] += now - before;
+    if (now.is_zero())
+      applied_.erase(it);
+    else if (it == applied_.end())
+      applied_.emplace(k, now.minor_units());
+    else
+      it->second = now.minor_units();
+  }
+public:
+  explicit Promotion_basket(const Promotion_table& table)
+    : table_{&table}, currency_{table.catalog().currency()}
+  {
+    clear();
+  }
+
+  // quantity of product added (negative: taken off); true if the saving
+  // changed
+  bool add(const Product& product, std::int32_t quantity)
+  {
+    const auto before{total_};
+    const auto position{table_->position(product)};
+    quantity_[position] += quantity;
+    const auto amount{money(product.price) * quantity};
+    auto& gross{gross_[key(product.category, product.tax_class)]};
+    gross = (money(gross) + amount).minor_units();
+    class_gross_[product.tax_class] += amount;
+    for (const auto r : table_->rules_for_product(position))
+      for (auto classes{table_->rules()[r].classes}; classes; classes &= classes - 1)
+        evaluate(r, static_cast<std::uint8_t>(std::countr_zero(classes)));
+    for (const auto r : table_->rules_for_category(product.category))
+      evaluate(r, product.tax_class);
+    total_ = money(0);
+    for (std::size_t c{0}; c < tax_classes; ++c) {
+      by_class_[c] = capped(stacked_[c], class_gross_[c]);
+      total_ += by_class_[c];
+    }
+    return total_ != before;
+  }
+
+  void clear()
+  {
+    quantity_.clear();
+    gross_.clear();
+    applied_.clear();
+    class_gross_.fill(money(0));
+    stacked_.fill(money(0));
+    by_class_.fill(money(0));
+    total_ = money(0);
+  }
+
+  // Every rule from scratch, without the bookkeeping add() relies on: for
+  // checking it, and to see what it saves
+  Class_amounts evaluate_all() const
+  {
+    Class_amounts res;
+    res.fill(money(0));
+    for (const auto& rule : table_->rules()) {
+      if (rule.kind == Promotion_kind::percent_off) {
+        for (std::uint8_t c{0}; c < tax_classes; ++c)
+          res[c] += saving(rule, c);
+      }
+      else
+        for (std::uint8_t c{0}; c < tax_classes; ++c)
+          if (rule.classes >> c & 1)
+            res[c] += saving(rule, c);
+    }
+    Class_amounts gross;
+    gross.fill(money(0));
+    const auto products{table_->catalog().products()};
+    for (const auto& [position, quantity] : quantity_)
+      gross[products[position].tax_class] += money(products[position].price) * quantity;
+    for (std::size_t c{0}; c < tax_classes; ++c)
+      res[c] = capped(res[c], gross[c]);
+    return res;
+  }
+
+  const Class_amounts& by_class() const noexcept { return by_class_; }
+
+  Accounting::Money total() const noexcept { return total_; }
+
+  // Rules evaluated by add() so far
+  std::uint64_t evaluations() const noexcept { return evaluations_; }
+};
+
+//------------------------------------------------------------------------------
+
+// Promotions as text, one a line (blank lines and lines starting with '#'
+// are skipped):
+//   bxgy,<barcode>,<buy>,<get>          buy 2 get 1: bxgy,4006381333931,2,1
+//   bundle,<price>,[<n>*]<barcode>,...  bundle,5.00,4006381333931,2*4006381333948
+//   percent,<category>,<percent>        percent,12,15
+inline std::vector<Promotion_rule> read_promotions(const std::string& path,
+                                                   Accounting::Currency currency = Accounting::usd)
+{
+  std::ifstream in{path};
+  if (!in)
+    throw std::runtime_error("read_promotions(): cannot open " + path);
+  std::vector<Promotion_rule> res;
+  std::string line;
+  for (std::size_t line_no{1}; std::getline(in, line); ++line_no) {
+    if (!line.empty() && line.back() == '\r')
+      line.pop_back();
+    if (line.empty() || line.front() == '#')
+      continue;
+    const auto bad{[&] {
+      return std::runtime_error("read_promotions(): " + path + ':'
+                                + std::to_string(line_no) + ": bad line");
+    }};
+    std::vector<std::string_view> field;
+    for (std::string_view rest{line};;) {
+      const auto comma{rest.find(',')};
+      field.push_back(rest.substr(0, comma));
+      if (comma == std::string_view::npos)
+        break;
+      rest.remove_prefix(comma + 1);
+    }
+    const auto number{[](std::string_view f, auto& value) {
+      return !f.empty() && std::from_chars(f.data(), f.data() + f.size(), value).ptr == f.data() + f.size();
+    }};
+    if (field[0] == "bxgy" && field.size() == 4) {
+      std::uint64_t barcode{0};
+      std::uint32_t buy{0};
+      std::uint32_t get{0};
+      if (!number(field[1], barcode) || !number(field[2], buy) || !number(field[3], get))
+        throw bad();
+      res.push_back(Promotion_rule::buy_x_get_y(barcode, buy, get));
+    }
+    else if (field[0] == "bundle" && field.size() >= 3) {
+      const auto price{Accounting::parse_money(field[1], currency)};
+      if (!price)
+        throw bad();
+      std::vector<Promotion_item> items;
+      for (std::size_t f{2}; f < field.size(); ++f) {
+        Promotion_item item{};
+        const auto star{field[f].find('*')};
+        if (star != std::string_view::npos && !number(field[f].substr(0, star), item.quantity))
+          throw bad();
+        if (!number(star == std::string_view::npos ? field[f] : field[f].substr(star + 1), item.barcode))
+          throw bad();
+        items.push_back(item);
+      }
+      res.push_back(Promotion_rule::bundle(price->minor_units(), std::move(items)));
+    }
+    else if (field[0] == "percent" && field.size() == 3) {
+      std::uint16_t category{0};
+      // Percent with up to two decimals is basis points as minor units
+      const auto percent{Accounting::parse_money(field[2], Accounting::usd)};
+      if (!number(field[1], category) || !percent || percent->minor_units() <= 0
+          || percent->minor_units() > 10'000)
+        throw bad();
+      res.push_back(Promotion_rule::percent_off(category,
+                                                static_cast<std::uint32_t>(percent->minor_units())));
+    }
+    else
+      throw bad();
+  }
+  return res;
+}
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_PROMOTIONS_HPP
@@ -0,0 +1,172 @@
+#ifndef POS_REGISTER_HPP
+#define POS_REGISTER_HPP
+
+//------------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdint>
+#include <optional>
+
+#include "../library/core/Messaging.hpp"
+#include "Basket.hpp"
+#include "Catalog.hpp"
+#include "Messages.hpp"
+
+//------------------------------------------------------------------------------
+
+namespace Pos {
+
+//------------------------------------------------------------------------------
+
+struct Register_stats {
+  std::uint64_t scans;
+  std::uint64_t unknown;
+  std::uint64_t baskets;
+};
+
+// The checkout lane: looks scans up in the catalog, keeps the basket and
+// tells the display about every change; one actor per lane, all sharing
+// one read-only catalog. With a Promotion_engine, every scan and void is
+// passed on to it, savings it reports are shown as they come, and
+// checkout waits for its final word on the basket;
+class Register {
+  const Catalog& catalog_;
+  mutable Messaging::Receiver incoming_;
+  Messaging::Sender display_;
+  std::optional<Messaging::Sender> promotions_;
+  std::uint64_t lane_;
+  std::uint64_t basket_number_{0};
+  Basket basket_;
+  Register_stats stats_{};
+
+  std::uint64_t basket_key() const noexcept { return lane_ << 32 | (basket_number_ & 0xffff'ffff); }
+
+  void tell_promotions(const Product& product, std::int32_t quantity)
+  {
+    if (promotions_)
+      promotions_->send(promotion_scan{incoming_, basket_key(), &product, quantity});
+  }
+
+  bool apply_promotions(std::uint64_t basket, const std::array<Accounting::Money, tax_classes>& by_class)
+  {
+    if (basket != basket_key())
+      return false;                 // Left over from a basket already done
+    for (std::size_t c{0}; c < tax_classes; ++c)
+      basket_.set_promotion(c, by_class[c]);
+    return true;
+  }
+
+  void next_basket()
+  {
+    basket_.clear();
+    ++basket_number_;
+  }
+
+  void handle_one()
+  {
+    incoming_.wait()
+      .handle<scan>([&](const scan& msg) {
+        ++stats_.scans;
+        const auto* product{catalog_.find(msg.barcode)};
+        if (!product) {
+          ++stats_.unknown;
+          display_.send(unknown_item{msg.barcode});
+          return;
+        }
+        const auto line{basket_.add(*product, msg.quantity)};
+        display_.send(line_added{line, basket_.totals()});
+        tell_promotions(*product, msg.quantity);
+      })
+      .handle<void_last_line>([&](const void_last_line&) {
+        if (basket_.lines().empty())
+          return;
+        const auto line{basket_.lines().back()};
+        basket_.void_last();
+        display_.send(line_voided{line, basket_.totals()});
+        tell_promotions(*line.product, -line.quantity);
+      })
+      .handle<set_discount>([&](const set_discount& msg) {
+        basket_.set_discount(std::min<std::uint32_t>(msg.basis_points, 10'000));
+        display_.send(totals_changed{basket_.totals()});
+      })
+      .handle<promotions_changed>([&](const promotions_changed& msg) {
+        if (apply_promotions(msg.basket, msg.by_class))
+          display_.send(totals_changed{basket_.totals()});
+      })
+      .handle<checkout>([&](const checkout&) {
+        if (promotions_) {
+          // Scans queued behind the checkout wait for the next basket
+          promotions_->send(promotion_checkout{incoming_, basket_key()});
+          incoming_.receive()
+            .handle<promotions_final>([&](const promotions_final& msg) {
+              apply_promotions(msg.basket, msg.by_class);
+            });
+        }
+        display_.send(receipt{++stats_.baskets,
+                              static_cast<std::uint32_t>(basket_.lines().size()),
+                              basket_.totals()});
+        next_basket();
+      })
+      .handle<cancel_basket>([&](const cancel_basket&) {
+        if (promotions_)
+          promotions_->send(promotion_cancel{basket_key()});
+        next_basket();
+        display_.send(basket_cancelled{});
+      })
+      .handle<close_lane>([&](const close_lane&) {
+        throw Messaging::Close_queue{};
+      });
+  }
+public:
+  // promotions: the engine to consult, if any, which must be working on
+  // this catalog; lane tells this register's baskets from others' there
+  Register(const Catalog& catalog, Messaging::Sender display, const Tax_rates& rates = {},
+           std::optional<Messaging::Sender> promotions = std::nullopt, std::uint32_t lane = 0)
+    : catalog_{catalog}, display_{display}, promotions_{promotions}, lane_{lane},
+      basket_{catalog.currency(), rates} {}
+
+  Register(const Register&) = delete;
+  Register& operator=(const Register&) = delete;
+
+  // Unlike a Close_queue, which would cut short a checkout waiting for the
+  // promotion engine, lets everything sent before finish
+  void done() const { get_sender().send(close_lane{}); }
+
+  void run()
+  {
+    try {
+      for (;;)
+        handle_one();
+    }
+    catch (const Messaging::Close_queue&) {
+    }
+  }
+
+  // Simulation (see Messaging::Sim_scheduler); false if there was no mail.
+  // Not with a promotion engine: checkout blocks for its answer
+  bool step()
+  {
+    if (!incoming_.pending())
+      return false;
+    handle_one();
+    return true;
+  }
+
+  Messaging::Sender get_sender() const noexcept { return incoming_; }
+
+  // For setting up the queue (tracing, placement) before run()
+  Messaging::Receiver& mailbox() const noexcept { return incoming_; }
+
+  // Only meaningful once run() has returned
+  const Basket& basket() const noexcept { return basket_; }
+
+  Register_stats stats() const noexcept { return stats_; }
+};
+
+//------------------------------------------------------------------------------
+
+}
+
+//------------------------------------------------------------------------------
+
+#endif // POS_REGISTER_HPP
@@ -0,0 +1,137 @@
+#include "Catalog.hpp"
+#include "Display.hpp"
+#include "Promotion_engine.hpp"
+#include "Promotions.hpp"
+#include "Register.hpp"
+
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <charconv>
+#include <cmath>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <thread>
+
+//------------------------------------------------------------------------------
+
+// One line of keyboard or scanner input as a message for the register;
+// "4006381333931", "3*4006381333931" (quantity), "v" (void last line),
+// "d 10" (10% off the basket), "t" (total, checkout), "c" (cancel)
+template<class Send>
+bool dispatch_input(std::string_view in, Send&& send)
+{
+  const auto number{[](std::string_view s, auto& value) {
+    return !s.empty() && std::from_chars(s.data(), s.data() + s.size(), value).ptr == s.data() + s.size();
+  }};
+  if (in == "v")
+    send(Pos::void_last_line{});
+  else if (in == "t")
+    send(Pos::checkout{});
+  else if (in == "c")
+    send(Pos::cancel_basket{});
+  else if (in.starts_with("d ")) {
+    double percent{0};
+    const std::string s{in.substr(2)};
+    try {
+      percent = std::stod(s);
+    }
+    catch (const std::exception&) {
+      return false;
+    }
+    if (percent < 0 || percent > 100)
+      return false;
+    send(Pos::set_discount{static_cast<std::uint32_t>(std::lround(percent * 100))});
+  }
+  else {
+    Pos::scan msg{};
+    const auto star{in.find('*')};
+    if (star != std::string_view::npos && !number(in.substr(0, star), msg.quantity))
+      return false;
+    if (!number(star == std::string_view::npos ? in : in.substr(star + 1), msg.barcode))
+      return false;
+    send(msg);
+  }
+  return true;
+}
+
+//------------------------------------------------------------------------------
+
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox register"};
+  std::optional<std::string> csv_file;
+  std::optional<std::string> index_file;
+  auto* csv_opt{app.add_option("-c,--catalog", csv_file,
+                               "Catalog as text: barcode,price,tax class,category,name per line")};
+  app.add_option("-i,--index", index_file,
+                 "Catalog index built by pos_index (memory mapped)")->excludes(csv_opt);
+  std::vector<double> tax_percent;
+  app.add_option("-t,--tax", tax_percent,
+                 "Tax rate in percent of each tax class, in class order");
+  std::optional<std::string> promotions_file;
+  app.add_option("-p,--promotions", promotions_file,
+                 "Promotions as text: bxgy, bundle and percent rules, one per line");
+  CLI11_PARSE(app, argc, argv);
+  if (!csv_file && !index_file) {
+    std::cerr << "Need a catalog (--catalog or --index)\n";
+    return 2;
+  }
+  if (tax_percent.size() > Pos::tax_classes) {
+    std::cerr << "At most " << Pos::tax_classes << " tax rates\n";
+    return 2;
+  }
+  Pos::Tax_rates rates{};
+  for (std::size_t c{0}; c < tax_percent.size(); ++c)
+    rates[c] = static_cast<std::uint32_t>(std::lround(tax_percent[c] * 100));
+
+  const auto start{std::chrono::steady_clock::now()};
+  const auto catalog{index_file ? Pos::Catalog::open(*index_file)
+                                : Pos::Catalog::build(Pos::read_catalog_csv(*csv_file))};
+  const std::chrono::duration<double, std::milli> loaded{std::chrono::steady_clock::now() - start};
+  std::cout << catalog.size() << " products " << (catalog.is_mapped() ? "mapped" : "indexed")
+            << " in " << loaded.count() << " ms\n";
+
+  std::optional<Pos::Promotion_table> promotions;
+  std::unique_ptr<Pos::Promotion_engine> engine;
+  std::thread engine_thread;
+  if (promotions_file) {
+    promotions.emplace(catalog, Pos::read_promotions(*promotions_file, catalog.currency()));
+    engine = std::make_unique<Pos::Promotion_engine>(*promotions);
+    engine_thread = std::thread{&Pos::Promotion_engine::run, engine.get()};
+    std::cout << promotions->size() << " promotions\n";
+  }
+
+  Pos::Display display{std::cout};
+  Pos::Register lane{catalog, display.get_sender(), rates,
+                     engine ? std::optional{engine->get_sender()} : std::nullopt};
+  std::thread display_thread{&Pos::Display::run, &display};
+  std::thread lane_thread{&Pos::Register::run, &lane};
+
+  Messaging::Sender to_lane{lane.get_sender()};
+  std::string line;
+  while (std::getline(std::cin, line) && line != "q") {
+    if (!dispatch_input(line, [&](auto msg) { to_lane.send(msg); }))
+      std::cerr << "? barcode, n*barcode, v, d <percent>, t, c or q\n";
+  }
+
+  lane.done();
+  lane_thread.join();
+  display.done();
+  display_thread.join();
+  const auto stats{lane.stats()};
+  std::cout << stats.scans << " scans, " << stats.unknown << " unknown, "
+            << stats.baskets << " baskets\n";
+  if (engine) {
+    engine->done();
+    engine_thread.join();
+    const auto promo{engine->stats()};
+    std::cout << promo.evaluations << " promotion evaluations for " << promo.scans << " scans\n";
+  }
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << e.what() << '\n';
+  return 1;
+}
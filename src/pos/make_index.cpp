@@ -0,0 +1,51 @@
+#include "Catalog.hpp"
+
+#include <CLI/CLI.hpp>
+#include <chrono>
+#include <iostream>
+#include <optional>
+#include <string>
+
+//------------------------------------------------------------------------------
+
+// Builds the perfect-hash index of a catalog once, so that registers can
+// map it at startup instead of reading and hashing the text every time
+int main(int argc, const char** argv)
+try {
+  CLI::App app{"cashbox catalog indexer"};
+  std::optional<std::string> csv_file;
+  std::optional<std::size_t> generate;
+  auto* csv_opt{app.add_option("-c,--catalog", csv_file,
+                               "Catalog as text: barcode,price,tax class,category,name per line")};
+  app.add_option("-g,--generate", generate,
+                 "Make up this many products instead (for trying out big catalogs)")
+    ->excludes(csv_opt);
+  std::string out_file;
+  app.add_option("-o,--output", out_file, "Index file to write")->required();
+  CLI11_PARSE(app, argc, argv);
+  if (!csv_file && !generate) {
+    std::cerr << "Need --catalog or --generate\n";
+    return 2;
+  }
+
+  using Clock = std::chrono::steady_clock;
+  using Ms = std::chrono::duration<double, std::milli>;
+  auto t{Clock::now()};
+  const auto products{csv_file ? Pos::read_catalog_csv(*csv_file) : Pos::synthetic_catalog(*generate)};
+  const Ms read{Clock::now() - t};
+  t = Clock::now();
+  const auto catalog{Pos::Catalog::build(products)};
+  const Ms built{Clock::now() - t};
+  t = Clock::now();
+  catalog.save(out_file);
+  const Ms saved{Clock::now() - t};
+
+  std::cout << catalog.size() << " products: read " << read.count() << " ms, indexed "
+            << built.count() << " ms, written " << saved.count() << " ms ("
+            << catalog.bytes() << " bytes)\n";
+  return 0;
+}
+catch (const std::exception& e) {
+  std::cerr << e.what() << '\n';
+  return 1;
+}
@@ -1,7 +1,15 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <cstdint>
+#include <limits>
+
 #include <cashbox/sample_library.hpp>
 
+#include "library/core/Dispense.hpp"
+#include "library/core/Money.hpp"
+
+using namespace Accounting;
+
 TEST_CASE("Factorials are computed with constexpr", "[factorial]")
 {
   STATIC_REQUIRE(factorial_constexpr(0) == 1);
@@ -10,3 +18,120 @@ TEST_CASE("Factorials are computed with constexpr", "[factorial]")
   STATIC_REQUIRE(factorial_constexpr(3) == 6);
   STATIC_REQUIRE(factorial_constexpr(10) == 3628800);
 }
+
+namespace {
+
+constexpr std::int64_t max{std::numeric_limits<std::int64_t>::max()};
+constexpr std::int64_t min{std::numeric_limits<std::int64_t>::min()};
+
+constexpr bool add_flags(std::int64_t a, std::int64_t b)
+{
+  std::int64_t res{0};
+  return add_overflows(a, b, res);
+}
+
+constexpr bool sub_flags(std::int64_t a, std::int64_t b)
+{
+  std::int64_t res{0};
+  return sub_overflows(a, b, res);
+}
+
+constexpr bool mul_flags(std::int64_t a, std::int64_t b)
+{
+  std::int64_t res{0};
+  return mul_overflows(a, b, res);
+}
+
+}
+
+TEST_CASE("Money overflow checks are computed with constexpr", "[money]")
+{
+  STATIC_REQUIRE(!add_flags(max - 1, 1));
+  STATIC_REQUIRE(add_flags(max, 1));
+  STATIC_REQUIRE(add_flags(min, -1));
+  STATIC_REQUIRE(!add_flags(max, min));
+
+  STATIC_REQUIRE(!sub_flags(min + 1, 1));
+  STATIC_REQUIRE(sub_flags(min, 1));
+  STATIC_REQUIRE(sub_flags(0, min));
+  STATIC_REQUIRE(!sub_flags(-1, min));
+
+  STATIC_REQUIRE(!mul_flags(max, 1));
+  STATIC_REQUIRE(!mul_flags(0, min));
+  STATIC_REQUIRE(mul_flags(max / 2 + 1, 2));
+  STATIC_REQUIRE(mul_flags(min, -1));
+  STATIC_REQUIRE(mul_flags(-1, min));
+  STATIC_REQUIRE(!mul_flags(min / 2, 2));
+}
+
+TEST_CASE("Money arithmetic is computed with constexpr", "[money]")
+{
+  STATIC_REQUIRE(Money::major(12) + Money::minor(34) == Money::minor(1234));
+  STATIC_REQUIRE(Money::major(5, jpy).minor_units() == 5);
+  STATIC_REQUIRE(Money::major(5, eur).minor_units() == 500);
+  STATIC_REQUIRE(Money::minor(250) - Money::minor(300) == -Money::minor(50));
+  STATIC_REQUIRE((Money::minor(250) - Money::minor(300)).is_negative());
+  STATIC_REQUIRE(Money::minor(125) * 4 == Money::major(5));
+  STATIC_REQUIRE(3 * Money::minor(7, gbp) == Money::minor(21, gbp));
+  STATIC_REQUIRE(Money::minor(max - 1) + Money::minor(1) == Money::minor(max));
+  STATIC_REQUIRE(Money::minor(99) < Money::major(1));
+  STATIC_REQUIRE(Money::minor(1, usd) != Money::minor(1, eur));
+  STATIC_REQUIRE(Money{}.is_zero());
+}
+
+namespace {
+
+using Note_table_100_50_20 = Note_table<100'000, 10'000, 5'000, 2'000>;
+using Note_table_50_20_10_5 = Note_table<100'000, 5'000, 2'000, 1'000, 500>;
+
+constexpr const Note_entry& entry(const Note_table_view& t, std::int64_t amount)
+{
+  return t.entries[static_cast<std::size_t>(amount / t.step)];
+}
+
+// How many notes of denomination the table's combination for amount takes
+constexpr int notes_of(const Note_table_view& t, std::int64_t amount, std::int64_t denomination)
+{
+  int n{0};
+  for (auto i{static_cast<std::size_t>(amount / t.step)}; i != 0;) {
+    const auto first{t.entries[i].first};
+    if (t.denominations[first] == denomination)
+      ++n;
+    i -= t.strides[first];
+  }
+  return n;
+}
+
+}
+
+TEST_CASE("Dispense note tables are built with constexpr", "[dispense]")
+{
+  constexpr const auto& t{Note_table_100_50_20::view};
+  STATIC_REQUIRE(t.step == 1'000);
+  STATIC_REQUIRE(t.entries.size() == 101);
+  STATIC_REQUIRE(entry(t, 0).notes == 0);
+  STATIC_REQUIRE(entry(t, 1'000).notes == Note_entry::unreachable);
+  STATIC_REQUIRE(entry(t, 3'000).notes == Note_entry::unreachable);
+  STATIC_REQUIRE(entry(t, 100'000).notes == 10);
+
+  // Where taking the largest note first strands the rest
+  STATIC_REQUIRE(entry(t, 6'000).notes == 3);
+  STATIC_REQUIRE(notes_of(t, 6'000, 2'000) == 3);
+  STATIC_REQUIRE(entry(t, 11'000).notes == 4);
+  STATIC_REQUIRE(notes_of(t, 11'000, 5'000) == 1);
+  STATIC_REQUIRE(notes_of(t, 11'000, 2'000) == 3);
+  STATIC_REQUIRE(entry(t, 13'000).notes == 5);
+  STATIC_REQUIRE(notes_of(t, 13'000, 10'000) == 0);
+
+  constexpr const auto& u{Note_table_50_20_10_5::view};
+  STATIC_REQUIRE(u.step == 500);
+  STATIC_REQUIRE(entry(u, 500).notes == 1);
+  STATIC_REQUIRE(entry(u, 8'500).notes == 4);
+  STATIC_REQUIRE(notes_of(u, 8'500, 5'000) == 1);
+  STATIC_REQUIRE(notes_of(u, 8'500, 2'000) == 1);
+  STATIC_REQUIRE(notes_of(u, 8'500, 1'000) == 1);
+  STATIC_REQUIRE(notes_of(u, 8'500, 500) == 1);
+
+  STATIC_REQUIRE(common_note_tables[1] == &t);
+  STATIC_REQUIRE(common_note_tables[3] == &u);
+}
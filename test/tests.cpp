@@ -1,8 +1,49 @@
 #include <catch2/catch_test_macros.hpp>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <random>
+#include <sstream>
+#include <utility>
+#include <vector>
 
 #include <cashbox/sample_library.hpp>
 
+#include "atm/Bank_machine.hpp"
+#include "atm/Trace_codec.hpp"
+#include "library/core/Account_snapshot.hpp"
+#include "library/core/Audit.hpp"
+#include "library/core/Balance_board.hpp"
+#include "library/core/Broadcast.hpp"
+#include "library/core/Messaging.hpp"
+#include "library/core/Metrics.hpp"
+#include "library/core/Money.hpp"
+#include "library/core/Pin_store.hpp"
+#include "library/core/Prefix_routes.hpp"
+#include "library/core/Request_cache.hpp"
+#include "library/core/Risk.hpp"
+#include "library/core/Seqlock.hpp"
+#include "library/core/Settlement.hpp"
+#include "library/core/Simulation.hpp"
+#include "library/core/Timer.hpp"
+#include "library/core/Typed_messaging.hpp"
+#include "pos/Catalog.hpp"
+#include "pos/Promotions.hpp"
+
+using namespace Accounting;
+
 
 TEST_CASE("Factorials are computed", "[factorial]")
 {
@@ -12,3 +53,1222 @@ TEST_CASE("Factorials are computed", "[factorial]")
   REQUIRE(factorial(3) == 6);
   REQUIRE(factorial(10) == 3628800);
 }
+
+TEST_CASE("Money arithmetic throws on overflow and mixed currencies", "[money]")
+{
+  constexpr auto max{std::numeric_limits<std::int64_t>::max()};
+  constexpr auto min{std::numeric_limits<std::int64_t>::min()};
+
+  REQUIRE_THROWS_AS(Money::minor(max) + Money::minor(1), std::overflow_error);
+  REQUIRE_THROWS_AS(Money::minor(min) - Money::minor(1), std::overflow_error);
+  REQUIRE_THROWS_AS(Money::minor(max / 2 + 1) * 2, std::overflow_error);
+  REQUIRE_THROWS_AS(-Money::minor(min), std::overflow_error);
+  REQUIRE_THROWS_AS(Money::major(max / 10), std::overflow_error);
+  REQUIRE_THROWS_AS(Money::minor(1, usd) + Money::minor(1, eur), std::invalid_argument);
+  REQUIRE_THROWS_AS(Money::minor(1, usd) < Money::minor(1, eur), std::invalid_argument);
+
+  auto m{Money::minor(max)};
+  REQUIRE_THROWS_AS(m += Money::minor(1), std::overflow_error);
+  REQUIRE(m == Money::minor(max));   // Left as it was
+}
+
+TEST_CASE("Money is parsed from text", "[money]")
+{
+  REQUIRE(parse_money("12.34") == Money::minor(1234));
+  REQUIRE(parse_money("-12.3") == Money::minor(-1230));
+  REQUIRE(parse_money("12") == Money::major(12));
+  REQUIRE(parse_money("7", jpy) == Money::minor(7, jpy));
+  REQUIRE_FALSE(parse_money("7.5", jpy));
+  REQUIRE_FALSE(parse_money("1.234"));
+  REQUIRE_FALSE(parse_money(""));
+  REQUIRE_FALSE(parse_money("12a"));
+  REQUIRE_FALSE(parse_money("99999999999999999999"));
+}
+
+TEST_CASE("checked_sum() flags only sums that do not fit", "[money]")
+{
+  constexpr auto max{std::numeric_limits<std::int64_t>::max()};
+
+  std::vector<std::int64_t> amounts(37, 3);
+  REQUIRE(checked_sum(amounts) == 111);
+
+  // An excursion past max that comes back is not an overflow
+  amounts.assign(20, 0);
+  amounts[0] = max;
+  amounts[8] = 1;
+  amounts[16] = -1;
+  REQUIRE(checked_sum(amounts) == max);
+
+  amounts[16] = 1;
+  REQUIRE_FALSE(checked_sum(amounts));
+
+  // Below min, and past both ends more than once on the way
+  constexpr auto min{std::numeric_limits<std::int64_t>::min()};
+  amounts.assign(20, 0);
+  amounts[0] = min;
+  amounts[9] = -1;
+  REQUIRE_FALSE(checked_sum(amounts));
+  amounts[1] = max;
+  amounts[2] = max;
+  amounts[3] = max;
+  amounts[10] = min;
+  amounts[11] = min;
+  REQUIRE(checked_sum(amounts) == -4);
+}
+
+TEST_CASE("Timers on every level of the wheel fire in order and never early", "[timer]")
+{
+  using namespace std::chrono_literals;
+  using Clock = Messaging::Timer_service::Clock;
+
+  // At 10 us a tick, level 0 covers 2.56 ms and level 1 164 ms; the later
+  // timers start out on levels 1 and 2 and only fire if they cascade down
+  Messaging::Timer_service timers{10us};
+  const std::vector<Clock::duration> delays{1ms, 2ms, 5ms, 40ms, 120ms, 250ms};
+
+  std::mutex m;
+  std::vector<std::size_t> order;
+  std::vector<Clock::duration> late(delays.size());
+  const auto start{Clock::now()};
+  for (std::size_t i{delays.size()}; i-- != 0;)
+    timers.call_after(delays[i], [&, i] {
+      const auto now{Clock::now()};
+      std::lock_guard lk{m};
+      order.push_back(i);
+      late[i] = now - start - delays[i];
+    });
+  const auto cancelled{timers.call_after(60ms, [&] {
+    std::lock_guard lk{m};
+    order.push_back(delays.size());
+  })};
+  REQUIRE(timers.cancel(cancelled));
+  REQUIRE_FALSE(timers.cancel(cancelled));
+
+  for (int i{0}; i < 200 && timers.pending() != 0; ++i)
+    std::this_thread::sleep_for(5ms);
+  REQUIRE(timers.pending() == 0);
+
+  std::lock_guard lk{m};
+  REQUIRE(order == std::vector<std::size_t>{0, 1, 2, 3, 4, 5});
+  for (const auto l : late)
+    REQUIRE(l >= Clock::duration::zero());
+}
+
+TEST_CASE("The catalog's perfect hash finds every product and only those", "[catalog]")
+{
+  const auto products{Pos::synthetic_catalog(10'000)};
+  const auto catalog{Pos::Catalog::build(products)};
+  REQUIRE(catalog.size() == products.size());
+
+  for (const auto& p : products) {
+    const auto* found{catalog.find(p.barcode)};
+    REQUIRE(found != nullptr);
+    REQUIRE(found->barcode == p.barcode);
+    REQUIRE(found->price == p.price);
+  }
+  // Every slot holds a different product, so each was placed exactly once
+  for (const auto& p : catalog.products())
+    REQUIRE(catalog.find(p.barcode) == &p);
+
+  for (const auto& p : Pos::synthetic_catalog(1'000, 2))
+    if (std::ranges::none_of(products, [&](const auto& q) { return q.barcode == p.barcode; }))
+      REQUIRE(catalog.find(p.barcode) == nullptr);
+  REQUIRE(catalog.find(0) == nullptr);
+
+  REQUIRE(Pos::Catalog::build({}).find(products[0].barcode) == nullptr);
+  const std::vector<Pos::Product> twice{products[0], products[0]};
+  REQUIRE_THROWS_AS(Pos::Catalog::build(twice), std::invalid_argument);
+
+  const auto path{std::filesystem::temp_directory_path() / "cashbox_test_catalog.idx"};
+  catalog.save(path.string());
+  const auto mapped{Pos::Catalog::open(path.string())};
+  std::filesystem::remove(path);
+  REQUIRE(mapped.size() == products.size());
+  for (const auto& p : products)
+    REQUIRE(mapped.find(p.barcode)->barcode == p.barcode);
+}
+
+namespace {
+
+// Products of every tax class over four categories, priced 1.00 to 12.00
+std::vector<Pos::Product> promotion_products()
+{
+  auto products{Pos::synthetic_catalog(12)};
+  for (std::size_t i{0}; i < products.size(); ++i) {
+    products[i].price = static_cast<std::int64_t>(100 * (i + 1));
+    products[i].tax_class = static_cast<std::uint8_t>(i % 3);
+    products[i].category = static_cast<std::uint16_t>(i % 4);
+  }
+  return products;
+}
+
+}
+
+TEST_CASE("A bundle's saving is shared out over its parts' tax classes", "[promotions]")
+{
+  const auto products{promotion_products()};
+  const auto catalog{Pos::Catalog::build(products)};
+  // 3.00 in class 2 and 2 x 2.00 in class 1 for 6.00: 1.00 off, 3:4
+  const std::vector rules{Pos::Promotion_rule::bundle(
+    600, {{products[2].barcode, 1}, {products[1].barcode, 2}})};
+  const Pos::Promotion_table table{catalog, rules};
+  REQUIRE(table.rules()[0].classes == 0b110);
+
+  Pos::Promotion_basket basket{table};
+  REQUIRE_FALSE(basket.add(*catalog.find(products[2].barcode), 1));
+  REQUIRE(basket.add(*catalog.find(products[1].barcode), 2));
+  REQUIRE(basket.by_class()[2] == Money::minor(42));
+  REQUIRE(basket.by_class()[1] == Money::minor(58));  // And what rounding left
+  REQUIRE(basket.total() == Money::minor(100));
+  REQUIRE(basket.by_class() == basket.evaluate_all());
+}
+
+TEST_CASE("Promotions never take more off a tax class than its lines come to", "[promotions]")
+{
+  const auto products{promotion_products()};
+  const auto catalog{Pos::Catalog::build(products)};
+  const std::vector rules{Pos::Promotion_rule::buy_x_get_y(products[0].barcode, 1, 1),
+                          Pos::Promotion_rule::percent_off(0, 10'000)};
+  const Pos::Promotion_table table{catalog, rules};
+  Pos::Promotion_basket basket{table};
+  basket.add(*catalog.find(products[0].barcode), 2);
+  REQUIRE(basket.by_class()[0] == Money::minor(200));   // Not 100 + 200
+  REQUIRE(basket.total() == Money::minor(200));
+  REQUIRE(basket.by_class() == basket.evaluate_all());
+  basket.add(*catalog.find(products[0].barcode), -2);   // Taken back
+  REQUIRE(basket.total() == Money::minor(0));
+}
+
+TEST_CASE("Promotion_basket::add() agrees with evaluating every rule", "[promotions]")
+{
+  const auto products{promotion_products()};
+  const auto catalog{Pos::Catalog::build(products)};
+  std::vector<Pos::Promotion_rule> rules;
+  for (std::size_t i{0}; i < 6; ++i)
+    rules.push_back(Pos::Promotion_rule::buy_x_get_y(products[i].barcode,
+                                                     static_cast<std::uint32_t>(1 + i % 3), 1));
+  rules.push_back(Pos::Promotion_rule::bundle(1'000, {{products[6].barcode, 1},
+                                                      {products[7].barcode, 1}}));
+  rules.push_back(Pos::Promotion_rule::bundle(2'500, {{products[8].barcode, 2},
+                                                      {products[0].barcode, 1},
+                                                      {products[10].barcode, 1}}));
+  rules.push_back(Pos::Promotion_rule::bundle(1'000, {{products[9].barcode, 1},
+                                                      {products[1].barcode, 1}}));
+  for (std::uint16_t c{0}; c < 3; ++c)
+    rules.push_back(Pos::Promotion_rule::percent_off(c, 2'500 * (c + 1u)));
+  const Pos::Promotion_table table{catalog, rules};
+
+  std::mt19937_64 rng{5};
+  Pos::Promotion_basket basket{table};
+  for (int basket_no{0}; basket_no < 50; ++basket_no) {
+    basket.clear();
+    std::vector<const Pos::Product*> lines;
+    for (int step{0}; step < 40; ++step) {
+      if (!lines.empty() && rng() % 4 == 0) {      // Void a line
+        const auto at{rng() % lines.size()};
+        basket.add(*lines[at], -1);
+        lines.erase(lines.begin() + static_cast<std::ptrdiff_t>(at));
+      }
+      else {
+        lines.push_back(&catalog.products()[rng() % catalog.size()]);
+        basket.add(*lines.back(), 1);
+      }
+      const auto all{basket.evaluate_all()};
+      REQUIRE(basket.by_class() == all);
+      Money total{Money::minor(0)};
+      for (const auto& saving : all)
+        total += saving;
+      REQUIRE(basket.total() == total);
+    }
+  }
+}
+
+TEST_CASE("Pin_store accepts only an account's own PIN", "[pins]")
+{
+  const std::vector<std::pair<std::string, std::string>> pins{
+    {"acc1234", "1937"}, {"acc0001", "0000"}, {"acc0002", "1937"},
+    {"acc0003", "4242"}, {"acc0004", "9999"}};
+  const Accounting::Pin_store store{pins, 16};
+  REQUIRE(store.size() == pins.size());
+
+  for (const auto& [account, pin] : pins) {
+    REQUIRE(store.verify(account, pin));
+    REQUIRE_FALSE(store.verify(account, "1111"));
+  }
+  REQUIRE_FALSE(store.verify("acc1234", "19370"));
+  REQUIRE_FALSE(store.verify("acc1234", ""));
+  REQUIRE_FALSE(store.verify("acc9999", "1937"));   // Unknown, hashed all the same
+
+  // A batch answers each check as verify() does, unknown accounts included
+  const std::array<Accounting::Pin_check, 7> checks{{{"acc0003", "4242"}, {"acc0003", "4243"},
+    {"acc0002", "1937"}, {"nobody", "1937"}, {"acc1234", "1937"}, {"acc0004", "0000"},
+    {"acc0001", "0000"}}};
+  std::array<bool, 7> out{};
+  store.verify(checks, out);
+  REQUIRE(out == std::array<bool, 7>{true, false, true, false, true, false, true});
+
+  REQUIRE_THROWS_AS((Accounting::Pin_store{std::vector<std::pair<std::string, std::string>>{
+                      {"acc1", "1"}, {"acc1", "2"}}, 16}),
+                    std::invalid_argument);
+}
+
+TEST_CASE("Pin records survive a PIN file", "[pins]")
+{
+  const auto path{std::filesystem::temp_directory_path() / "cashbox_test.pins"};
+  {
+    std::ofstream out{path};
+    out << "# account,iterations,salt,hash\n\n"
+        << Accounting::pin_line("acc1234", Accounting::Pin_store::make_record("1937", 16), 16) << '\n'
+        << Accounting::pin_line("acc0001", Accounting::Pin_store::make_record("0000", 16), 16) << '\n';
+  }
+  const auto store{Accounting::read_pins(path.string())};
+  REQUIRE(store.size() == 2);
+  REQUIRE(store.iterations() == 16);
+  REQUIRE(store.verify("acc1234", "1937"));
+  REQUIRE(store.verify("acc0001", "0000"));
+  REQUIRE_FALSE(store.verify("acc0001", "1937"));
+
+  {
+    std::ofstream out{path, std::ios::app};
+    out << Accounting::pin_line("acc0002", Accounting::Pin_store::make_record("1111", 32), 32) << '\n';
+  }
+  REQUIRE_THROWS_AS(Accounting::read_pins(path.string()), std::runtime_error);
+  {
+    std::ofstream out{path};
+    out << "acc1234,16,00,00\n";
+  }
+  REQUIRE_THROWS_AS(Accounting::read_pins(path.string()), std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Prefix_routes picks the longest matching prefix", "[routes]")
+{
+  using Messaging::Prefix_routes;
+
+  const Prefix_routes routes{{{"", 0}, {"4", 1}, {"45", 2}, {"4539", 3}, {"5", 4},
+                              {"51", 5}, {"51234567", 6}, {"6011", 7}}};
+  REQUIRE(routes.size() == 8);
+  REQUIRE(routes.find("4111111111111111") == 1);
+  REQUIRE(routes.find("4556") == 2);
+  REQUIRE(routes.find("4539000000000000") == 3);
+  REQUIRE(routes.find("4540") == 2);
+  REQUIRE(routes.find("4") == 1);
+  REQUIRE(routes.find("51234567") == 6);
+  REQUIRE(routes.find("512345679999") == 6);
+  REQUIRE(routes.find("51234568") == 5);
+  REQUIRE(routes.find("5") == 4);
+  REQUIRE(routes.find("6011000") == 7);
+  REQUIRE(routes.find("6012") == 0);
+  REQUIRE(routes.find("") == 0);
+  REQUIRE(routes.find("\xff\xff\xff\xff\xff\xff\xff\xff\xff") == 0);
+
+  const Prefix_routes no_default{{{"acc1", 1}, {"acc12", 2}}};
+  REQUIRE(no_default.find("acc0") == Prefix_routes::no_route);
+  REQUIRE(no_default.find("acc19") == 1);
+  REQUIRE(no_default.find("acc123") == 2);
+  REQUIRE(no_default.find("acc2") == Prefix_routes::no_route);
+
+  REQUIRE_THROWS_AS(Prefix_routes({{"4", 1}, {"4", 2}}), std::invalid_argument);
+  REQUIRE_THROWS_AS(Prefix_routes({{"123456789", 1}}), std::invalid_argument);
+}
+
+TEST_CASE("Prefix_routes agrees with a linear scan on a deep table", "[routes]")
+{
+  using Messaging::Prefix_routes;
+
+  // Enough nested prefixes for a B-tree of several levels
+  std::vector<Prefix_routes::Entry> entries;
+  for (std::uint32_t i{0}; i < 3'000; ++i) {
+    auto digits{std::to_string(i * 7'919 % 100'000)};
+    digits.resize(1 + i % 6, '0');
+    if (std::ranges::none_of(entries, [&](const auto& e) { return e.prefix == digits; }))
+      entries.push_back({digits, i});
+  }
+  const Prefix_routes routes{entries};
+  REQUIRE(routes.ranges() > 512);
+
+  Messaging::Sim_random rng{7};
+  for (int n{0}; n < 20'000; ++n) {
+    const auto key{std::to_string(rng.below(10'000'000'000'000'000))};
+    std::size_t best_length{0};
+    std::uint32_t best{Prefix_routes::no_route};
+    for (const auto& e : entries)
+      if (key.starts_with(e.prefix) && (best == Prefix_routes::no_route
+                                        || e.prefix.size() > best_length)) {
+        best = e.route;
+        best_length = e.prefix.size();
+      }
+    REQUIRE(routes.find(key) == best);
+  }
+}
+
+TEST_CASE("Request_cache evicts the oldest unreferenced request first", "[dedup]")
+{
+  Messaging::Request_cache<int> cache{4, 10};
+  for (std::uint64_t id{1}; id <= 4; ++id)
+    cache.insert(id, static_cast<int>(id), 0);
+  REQUIRE(cache.find(2) != nullptr);   // Referenced: passed over once
+
+  cache.insert(5, 5, 1);                // Takes 1's place
+  cache.insert(6, 6, 1);                // Clears 2's mark and takes 3's
+  REQUIRE(cache.find(1) == nullptr);
+  REQUIRE(cache.find(3) == nullptr);
+  REQUIRE(*cache.find(2) == 2);
+  REQUIRE(*cache.find(4) == 4);
+  REQUIRE(cache.stats().early_evictions == 2);
+
+  // Past the window a mark no longer saves anything
+  REQUIRE(cache.find(4) != nullptr);
+  cache.insert(7, 7, 20);
+  cache.insert(8, 8, 20);
+  REQUIRE(cache.find(4) == nullptr);
+  REQUIRE(cache.stats().evictions == 4);
+  REQUIRE(cache.stats().early_evictions == 2);
+
+  cache.insert(0, 0, 20);               // No id, not tracked
+  REQUIRE(cache.find(0) == nullptr);
+  REQUIRE(cache.size() == 4);
+}
+
+TEST_CASE("Request_cache finds every id it holds after many evictions", "[dedup]")
+{
+  // With a window of 0 every request has expired, so eviction is first
+  // in, first out, and the cache holds exactly the last capacity ids. The
+  // ids are random, so the index has long probe runs that every eviction
+  // has to shift back
+  constexpr std::size_t capacity{1'000};
+  Messaging::Request_cache<std::uint64_t> cache{capacity, 0};
+  Messaging::Sim_random rng{3};
+  std::vector<std::uint64_t> ids;
+  for (std::size_t i{0}; i < 50'000; ++i) {
+    const auto id{rng.next() | 1};
+    ids.push_back(id);
+    REQUIRE(cache.find(id) == nullptr);
+    cache.insert(id, ~id, static_cast<std::uint32_t>(i));
+  }
+  for (std::size_t i{ids.size() - capacity}; i < ids.size(); ++i) {
+    const auto* const value{cache.find(ids[i])};
+    REQUIRE(value != nullptr);
+    REQUIRE(*value == ~ids[i]);
+  }
+  for (std::size_t i{0}; i < ids.size() - capacity; i += 7)
+    REQUIRE(cache.find(ids[i]) == nullptr);
+  REQUIRE(cache.stats().evictions == ids.size() - capacity);
+}
+
+TEST_CASE("The bank refunds what it took and answers duplicates as it did", "[dedup]")
+{
+  bank_machine bank{Accounting::Money::major(199)};
+  std::thread bank_thread{&bank_machine::run, &bank};
+  struct Stop {                         // Also when a REQUIRE fails
+    bank_machine& bank;
+    std::thread& thread;
+    void operator()()
+    {
+      if (thread.joinable()) {
+        bank.done();
+        thread.join();
+      }
+    }
+    ~Stop() { (*this)(); }
+  } stop{bank, bank_thread};
+  Messaging::Receiver replies;
+  auto to_bank{bank.get_sender()};
+  const auto answer{[&] {
+    bool ok{false};
+    replies.wait()
+      .handle<withdraw_ok>([&](const withdraw_ok&) { ok = true; })
+      .handle<withdraw_denied>([&](const withdraw_denied&) { ok = false; });
+    return ok;
+  }};
+
+  const auto fifty{Accounting::Money::major(50)};
+  to_bank.send(withdraw("acc1234", fifty, replies, 1));
+  REQUIRE(answer());
+  to_bank.send(withdraw("acc1234", fifty, replies, 1));
+  REQUIRE(answer());                    // Approved, and not taken twice
+
+  // The cancel claims more than was taken, and of another account
+  to_bank.send(cancel_withdrawal("nobody", Accounting::Money::major(150), 1));
+  to_bank.send(withdraw("acc1234", fifty, replies, 1));
+  REQUIRE_FALSE(answer());              // Given back, so no longer ok
+  to_bank.send(cancel_withdrawal("acc1234", fifty, 1));   // Only once
+
+  to_bank.send(withdraw("acc1234", fifty, replies, 2));
+  REQUIRE(answer());
+  to_bank.send(withdrawal_processed("acc1234", fifty, 2));
+  to_bank.send(cancel_withdrawal("acc1234", fifty, 2));   // Too late
+  to_bank.send(withdraw("acc1234", fifty, replies, 2));
+  REQUIRE(answer());
+
+  stop();
+  REQUIRE(bank.current_balance() == Accounting::Money::major(149));
+}
+
+TEST_CASE("Risk_checks limits withdrawals within a sliding window", "[risk]")
+{
+  Risk_policy policy;
+  policy.max_amount = Money::major(100);
+  policy.max_withdrawals = 3;
+  policy.window = 400;              // Buckets of 100 s
+  Risk_checks risk{2, policy};
+  const auto withdraw{[&](std::size_t i, std::int64_t major, std::uint64_t now) {
+    const auto verdict{risk.check_withdrawal(i, Money::major(major), now)};
+    if (verdict == Risk_verdict::allow)
+      risk.record_withdrawal(i, Money::major(major), now);
+    return verdict;
+  }};
+
+  REQUIRE(withdraw(0, 40, 1'000) == Risk_verdict::allow);
+  REQUIRE(withdraw(0, 40, 1'010) == Risk_verdict::allow);
+  REQUIRE(withdraw(0, 30, 1'020) == Risk_verdict::over_amount);
+  REQUIRE(withdraw(0, 20, 1'020) == Risk_verdict::allow);     // Exactly the limit
+  REQUIRE(withdraw(0, 1, 1'050) == Risk_verdict::over_count);
+  REQUIRE(withdraw(1, 100, 1'050) == Risk_verdict::allow);    // Each account its own
+  REQUIRE(withdraw(0, 1, 1'399) == Risk_verdict::over_count); // Still the same window
+  REQUIRE(withdraw(0, 100, 1'400) == Risk_verdict::allow);    // Rolled over
+  REQUIRE(withdraw(0, 1, 1'401) == Risk_verdict::over_amount);
+  REQUIRE(withdraw(0, 1, 9'999) == Risk_verdict::allow);      // Long after
+
+  const auto stats{risk.stats()};
+  REQUIRE(stats.checks == 10);
+  REQUIRE(stats.over_amount == 2);
+  REQUIRE(stats.over_count == 2);
+  REQUIRE(stats.locked == 0);
+}
+
+TEST_CASE("Risk_checks locks an account out after repeated PIN failures", "[risk]")
+{
+  Risk_policy policy;
+  policy.max_pin_failures = 3;
+  policy.pin_window = 40;           // Buckets of 10 s
+  policy.lockout = 60;
+  Risk_checks risk{3, policy};
+
+  risk.record_pin_failure(0, 2'000);
+  risk.record_pin_failure(0, 2'005);
+  REQUIRE(risk.pin_allowed(0, 2'006));
+  risk.record_pin_failure(0, 2'010);                          // Locked until 2070
+  REQUIRE_FALSE(risk.pin_allowed(0, 2'011));
+  REQUIRE(risk.check_withdrawal(0, Money::major(10), 2'069) == Risk_verdict::locked);
+  REQUIRE(risk.pin_allowed(0, 2'070));                        // Expired
+  REQUIRE(risk.check_withdrawal(0, Money::major(10), 2'070) == Risk_verdict::allow);
+  risk.record_pin_failure(0, 2'071);                          // Starts again from one
+  REQUIRE(risk.pin_allowed(0, 2'072));
+
+  // Failures that fall out of the PIN window do not count
+  risk.record_pin_failure(1, 3'000);
+  risk.record_pin_failure(1, 3'010);
+  risk.record_pin_failure(1, 3'040);
+  REQUIRE(risk.pin_allowed(1, 3'041));
+
+  // A right PIN forgives what went before
+  risk.record_pin_failure(2, 4'000);
+  risk.record_pin_failure(2, 4'001);
+  risk.record_pin_success(2);
+  risk.record_pin_failure(2, 4'002);
+  risk.record_pin_failure(2, 4'003);
+  REQUIRE(risk.pin_allowed(2, 4'004));
+  risk.record_pin_failure(2, 4'004);
+  REQUIRE_FALSE(risk.pin_allowed(2, 4'005));
+
+  const auto stats{risk.stats()};
+  REQUIRE(stats.lockouts == 2);
+  REQUIRE(stats.locked == 3);
+}
+
+TEST_CASE("Accounts are parsed from text in parallel and saved as a snapshot", "[accounts]")
+{
+  using Accounting::Money;
+
+  const auto dir{std::filesystem::temp_directory_path()};
+  const auto text{dir / "cashbox_test_accounts.csv"};
+  {
+    std::ofstream out{text, std::ios::binary};
+    out << "# account,balance\n"
+        << "acc0003,12.50\r\n"
+        << "\n"
+        << "acc0001,-3.07\n";
+    for (int i{10}; i < 60; ++i)
+      out << "acc00" << i << ',' << i << ".0" << i % 10 << '\n';
+    out << "acc0002,0";                  // No end of line
+  }
+  for (const unsigned threads : {1u, 4u, 16u}) {
+    const auto accounts{Accounting::read_accounts_csv(text.string(), Accounting::usd, threads)};
+    REQUIRE(accounts.size() == 53);
+    for (std::size_t i{1}; i < accounts.size(); ++i)
+      REQUIRE(accounts.name(i - 1) < accounts.name(i));
+    REQUIRE(accounts.name(0) == "acc0001");
+    REQUIRE(accounts.balance(0) == Money::minor(-307));
+    REQUIRE(accounts.balance(*accounts.find("acc0003")) == Money::minor(1'250));
+    REQUIRE(accounts.balance(*accounts.find("acc0002")) == Money::minor(0));
+    REQUIRE(accounts.balance(*accounts.find("acc0047")) == Money::minor(4'707));
+    REQUIRE_FALSE(accounts.find("acc0004"));
+    REQUIRE_FALSE(accounts.find("acc00470"));
+  }
+
+  // Written out, then saved and mapped, it reads the same
+  const auto accounts{Accounting::load_accounts(text.string())};
+  const auto again{dir / "cashbox_test_accounts_again.csv"};
+  const auto snapshot{dir / "cashbox_test_accounts.snapshot"};
+  Accounting::write_accounts_csv(again.string(), accounts);
+  accounts.save(snapshot.string());
+  for (const auto& path : {again, snapshot}) {
+    const auto loaded{Accounting::load_accounts(path.string())};
+    REQUIRE(loaded.is_mapped() == (path == snapshot));
+    REQUIRE(loaded.size() == accounts.size());
+    for (std::size_t i{0}; i < accounts.size(); ++i) {
+      REQUIRE(loaded.name(i) == accounts.name(i));
+      REQUIRE(loaded.balance(i) == accounts.balance(i));
+    }
+  }
+
+  for (const auto* bad : {"acc1,1.234\n", "acc1\n", ",5\n", "acc1,12x\n", "acc1,1\nacc1,2\n"}) {
+    {
+      std::ofstream out{text, std::ios::binary};
+      out << "acc0,1\n" << bad;
+    }
+    REQUIRE_THROWS(Accounting::read_accounts_csv(text.string(), Accounting::usd, 2));
+  }
+  for (const auto& path : {text, again, snapshot})
+    std::filesystem::remove(path);
+}
+
+namespace {
+
+Accounting::Journal_entry journal_entry(std::uint64_t request_id, Accounting::Journal_kind kind,
+                                        std::int64_t amount, std::uint32_t account,
+                                        std::uint32_t note = 0, std::uint16_t notes = 0)
+{
+  Accounting::Journal_entry e{};
+  e.request_id = request_id;
+  e.amount = amount;
+  e.account = account;
+  e.currency = Accounting::usd;
+  e.kind = kind;
+  e.notes.bundles[0] = {note, notes, 0};
+  return e;
+}
+
+}
+
+TEST_CASE("settle() reports every withdrawal whose books and cash disagree", "[settlement]")
+{
+  using Accounting::Discrepancy_kind;
+  using Accounting::Journal_entry;
+  using enum Accounting::Journal_kind;
+  constexpr auto none{Journal_entry::no_account};
+  const auto id{[](std::uint64_t atm, std::uint64_t n) { return atm << 32 | n; }};
+
+  const std::vector<Journal_entry> odd{
+    journal_entry(id(1, 1), debit, 5'000, 0),
+    journal_entry(id(1, 1), dispensed, 5'000, none, 5'000, 1),
+    journal_entry(id(1, 2), debit, 5'000, 1),           // Cancelled: nothing owed
+    journal_entry(id(1, 2), refund, 5'000, 1),
+    journal_entry(id(1, 3), debit, 2'000, 0),           // Unpaid
+    journal_entry(id(2, 1), dispensed, 1'000, none, 1'000, 1),   // Unbooked
+    journal_entry(id(2, 2), debit, 3'000, 1),           // Mismatch
+    journal_entry(id(2, 3), debit, 5'000, 0),           // Notes short of the amount
+    journal_entry(0, debit, 100, 2),                    // No id, no cross-check
+    journal_entry(id(2, 3), dispensed, 5'000, none, 2'000, 2),
+    journal_entry(id(2, 2), dispensed, 2'000, none, 2'000, 1)};
+
+  // The same, then split around enough clean withdrawals for several
+  // threads and partitions, so that entries of one withdrawal are added
+  // up on different threads
+  constexpr std::int64_t clean{100'000};
+  std::vector<Journal_entry> big(odd.begin(), odd.begin() + 8);
+  for (std::int64_t i{1}; i <= clean; ++i) {
+    big.push_back(journal_entry(id(3, static_cast<std::uint64_t>(i)), debit, 2'000,
+                                static_cast<std::uint32_t>(i % 3)));
+    big.push_back(journal_entry(id(3, static_cast<std::uint64_t>(i)), dispensed, 2'000, none,
+                                1'000, 2));
+  }
+  big.insert(big.end(), odd.begin() + 8, odd.end());
+
+  using Run = std::pair<std::span<const Journal_entry>, std::int64_t>;
+  for (const auto& [entries, n] : {Run{odd, 0}, Run{big, clean}})
+    for (const unsigned threads : {1u, 8u}) {
+      const auto day{Accounting::settle(entries, 3, threads)};
+      REQUIRE(day.entries == entries.size());
+      REQUIRE(day.debited == 20'100 + 2'000 * n);
+      REQUIRE(day.refunded == 5'000);
+      REQUIRE(day.dispensed == 13'000 + 2'000 * n);
+      const std::vector<std::int64_t> accounts{12'000 + 2'000 * (n / 3),
+                                               3'000 + 2'000 * ((n + 2) / 3),
+                                               100 + 2'000 * ((n + 1) / 3)};
+      REQUIRE(day.account_debited == accounts);
+
+      const auto& d{day.discrepancies};
+      REQUIRE(d.size() == 4);
+      REQUIRE(d[0].request_id == id(1, 3));
+      REQUIRE(d[0].kind == Discrepancy_kind::unpaid);
+      REQUIRE(d[0].debited == 2'000);
+      REQUIRE(d[1].request_id == id(2, 1));
+      REQUIRE(d[1].kind == Discrepancy_kind::unbooked);
+      REQUIRE(d[1].dispensed == 1'000);
+      REQUIRE(d[2].request_id == id(2, 2));
+      REQUIRE(d[2].kind == Discrepancy_kind::mismatch);
+      REQUIRE(d[2].debited == 3'000);
+      REQUIRE(d[2].dispensed == 2'000);
+      REQUIRE(d[3].request_id == id(2, 3));
+      REQUIRE(d[3].kind == Discrepancy_kind::bad_notes);
+
+      REQUIRE(day.terminals.size() == (n ? 4 : 3));
+      REQUIRE(day.terminals[0].terminal == 0);
+      REQUIRE(day.terminals[0].debited == 100);
+      REQUIRE(day.terminals[1].withdrawals == 3);
+      REQUIRE(day.terminals[1].debited == 7'000);
+      REQUIRE(day.terminals[1].dispensed == 5'000);
+      REQUIRE(day.terminals[2].debited == 8'000);
+      REQUIRE(day.terminals[2].dispensed == 8'000);
+      REQUIRE(day.denominations.size() == 3);
+      REQUIRE(day.denominations[0].notes == 1 + 2 * static_cast<std::uint64_t>(n));   // 10.00
+      REQUIRE(day.denominations[1].notes == 3);                                    // 20.00
+    }
+
+  auto foreign{odd};
+  foreign[3].currency = Accounting::eur;
+  REQUIRE_THROWS_AS(Accounting::settle(foreign, 3), std::invalid_argument);
+  REQUIRE_THROWS_AS(Accounting::settle(odd, 2), std::invalid_argument);   // Account 2
+}
+
+TEST_CASE("verify_audit() finds the first batch that was tampered with", "[audit]")
+{
+  using Messaging::Audit_batch_header;
+  using Messaging::Trace_record;
+
+  const auto path{std::filesystem::temp_directory_path() / "cashbox_test.audit"};
+  constexpr std::size_t batch{16};
+  Crypto::Digest head{};
+  {
+    Messaging::Audit_log log{path.string(), batch, std::chrono::hours{1}};
+    for (std::uint64_t i{1}; i <= 100; ++i)
+      log.record(atm_trace_queue::bank,
+                 withdrawal_processed("acc1234", Accounting::Money::major(50), i));
+    log.record(atm_trace_queue::bank, card_inserted("acc1234"));   // Not audited
+    log.flush();
+    REQUIRE(log.recorded() == 100);
+    head = log.head();
+  }
+
+  for (const unsigned threads : {1u, 4u}) {
+    const auto verdict{Messaging::verify_audit(path.string(), threads)};
+    REQUIRE(verdict.ok());
+    REQUIRE(verdict.batches == 7);
+    REQUIRE(verdict.records == 100);
+    REQUIRE(verdict.head == head);
+  }
+
+  std::string bytes;
+  {
+    std::ifstream in{path, std::ios::binary | std::ios::ate};
+    bytes.resize(static_cast<std::size_t>(in.tellg()));
+    in.seekg(0);
+    in.read(bytes.data(), static_cast<std::streamsize>(bytes.size()));
+  }
+  const auto rewrite{[&](const std::string& b) {
+    std::ofstream out{path, std::ios::binary | std::ios::trunc};
+    out.write(b.data(), static_cast<std::streamsize>(b.size()));
+  }};
+  const auto batch_at{[](std::size_t b) {
+    return sizeof(Trace_record) + b * (sizeof(Audit_batch_header) + batch * sizeof(Trace_record));
+  }};
+
+  // One byte of a record of the fourth batch
+  auto tampered{bytes};
+  tampered[batch_at(3) + sizeof(Audit_batch_header) + 5 * sizeof(Trace_record) + 20] ^= 1;
+  rewrite(tampered);
+  for (const unsigned threads : {1u, 4u}) {
+    const auto verdict{Messaging::verify_audit(path.string(), threads)};
+    REQUIRE_FALSE(verdict.ok());
+    REQUIRE(verdict.bad_batch == 3);
+    REQUIRE(verdict.batches == 3);
+    REQUIRE(verdict.records == 3 * batch);
+    REQUIRE(verdict.head != head);
+  }
+
+  // A header changed
+  tampered = bytes;
+  tampered[batch_at(5) + offsetof(Audit_batch_header, root)] ^= 1;
+  rewrite(tampered);
+  REQUIRE(Messaging::verify_audit(path.string()).bad_batch == 5);
+
+  // Two batches swapped
+  tampered = bytes;
+  const auto size{sizeof(Audit_batch_header) + batch * sizeof(Trace_record)};
+  std::swap_ranges(tampered.begin() + static_cast<std::ptrdiff_t>(batch_at(1)),
+                   tampered.begin() + static_cast<std::ptrdiff_t>(batch_at(1) + size),
+                   tampered.begin() + static_cast<std::ptrdiff_t>(batch_at(2)));
+  rewrite(tampered);
+  REQUIRE(Messaging::verify_audit(path.string()).bad_batch == 1);
+
+  // Cut short in the last batch
+  rewrite(bytes.substr(0, bytes.size() - 10));
+  const auto cut{Messaging::verify_audit(path.string())};
+  REQUIRE(cut.bad_batch == 6);
+  REQUIRE(cut.problem == "truncated");
+  REQUIRE(cut.records == 6 * batch);
+
+  rewrite("not an audit file, but long enough to look like one's header....");
+  REQUIRE(Messaging::verify_audit(path.string()).problem == "not a cashbox audit file");
+  std::filesystem::remove(path);
+}
+
+TEST_CASE("Traced messages are read back whole, continuation records and all", "[trace]")
+{
+  const auto path{std::filesystem::temp_directory_path() / "cashbox_test.trace"};
+  const auto account{[](std::uint64_t i) {
+    return std::string(i % 250, static_cast<char>('a' + i % 26));
+  }};
+  constexpr std::uint64_t per_thread{500};
+  {
+    // Small blocks, so that record() runs out of them and waits
+    Messaging::Trace_recorder tap{path.string(), 16, 2};
+    tap.record(atm_trace_queue::atm, digit_pressed('7'));
+    tap.record(atm_trace_queue::interface, card_inserted(std::string(300, 'x')));
+    {
+      std::vector<std::jthread> threads;
+      for (std::uint64_t t{0}; t != 2; ++t)
+        threads.emplace_back([&, t] {
+          for (std::uint64_t i{0}; i != per_thread; ++i)
+            tap.record(atm_trace_queue::bank,
+                       withdraw(account(i), Money::minor(static_cast<std::int64_t>(i + 1)),
+                                Messaging::Sender{}, t * per_thread + i));
+        });
+    }
+    tap.flush();
+    REQUIRE(tap.recorded() == 2 + 2 * per_thread);
+  }
+
+  const auto messages{Messaging::read_trace(path.string())};
+  REQUIRE(messages.size() == 2 + 2 * per_thread);
+  const Messaging::Sender no_reply{};
+
+  REQUIRE(messages[0].type == Messaging::Trace_codec<digit_pressed>::type);
+  Messaging::Trace_in digit{messages[0]};
+  REQUIRE(Messaging::Trace_codec<digit_pressed>::decode(digit, no_reply).digit == '7');
+
+  REQUIRE(messages[1].queue == atm_trace_queue::interface);
+  REQUIRE(messages[1].truncated);
+  Messaging::Trace_in card{messages[1]};
+  REQUIRE(Messaging::Trace_codec<card_inserted>::decode(card, no_reply).account == std::string(255, 'x'));
+
+  std::array<std::uint64_t, 2> next{0, 0};
+  for (auto it{messages.begin() + 2}; it != messages.end(); ++it) {
+    REQUIRE(it->type == Messaging::Trace_codec<withdraw>::type);
+    REQUIRE_FALSE(it->truncated);
+    Messaging::Trace_in in{*it};
+    const auto msg{Messaging::Trace_codec<withdraw>::decode(in, no_reply)};
+    const auto t{msg.request_id / per_thread};
+    const auto i{msg.request_id % per_thread};
+    REQUIRE(t < 2);
+    REQUIRE(i == next[t]);          // Each thread's in the order it recorded them
+    ++next[t];
+    REQUIRE(msg.account == account(i));
+    REQUIRE(msg.amount == Money::minor(static_cast<std::int64_t>(i + 1)));
+  }
+  REQUIRE(next[0] == per_thread);
+  REQUIRE(next[1] == per_thread);
+  std::filesystem::remove(path);
+}
+
+namespace {
+
+struct msg_a { int n; };
+struct msg_b { int n; };
+struct msg_c { int n; };
+
+}
+
+TEST_CASE("receive() takes the oldest match and leaves the rest for later", "[messaging]")
+{
+  Messaging::Receiver box;
+  box.set_single_threaded(true);
+  Messaging::Sender to_box{box};
+  to_box.send(msg_a{1});
+  to_box.send(msg_b{2});
+  to_box.send(msg_c{3});
+  to_box.send(msg_a{4});
+  to_box.send(msg_c{5});
+
+  std::vector<int> got;
+  const auto take{[&] { return [&](const auto& msg) { got.push_back(msg.n); }; }};
+  box.receive().handle<msg_c>(take());                 // Sets a and b aside
+  REQUIRE(got == std::vector<int>{3});
+  REQUIRE(box.pending() == 4);
+  box.receive().handle<msg_b>(take()).handle<msg_a>(take());
+  REQUIRE(got == std::vector<int>{3, 1});            // The older of the two set aside
+  box.receive().handle<msg_c>(take()).handle<msg_b>(take());
+  REQUIRE(got == std::vector<int>{3, 1, 2});
+  for (int i{0}; i != 2; ++i)                        // Plain waits, in order
+    box.wait().handle<msg_a>(take()).handle<msg_b>(take()).handle<msg_c>(take());
+  REQUIRE(got == std::vector<int>{3, 1, 2, 4, 5});
+  REQUIRE(box.pending() == 0);
+  REQUIRE(box.stats().stash_dropped == 0);
+}
+
+TEST_CASE("Messages set aside past the stash limit are dropped oldest first", "[messaging]")
+{
+  Messaging::Receiver box;
+  box.set_single_threaded(true);
+  box.set_stash_limit(2);
+  Messaging::Sender to_box{box};
+  for (int i{1}; i <= 4; ++i)
+    to_box.send(msg_a{i});
+  to_box.send(msg_b{5});
+
+  std::vector<int> got;
+  const auto take{[&] { return [&](const auto& msg) { got.push_back(msg.n); }; }};
+  box.receive().handle<msg_b>(take());
+  REQUIRE(got == std::vector<int>{5});
+  REQUIRE(box.stats().stash_dropped == 2);
+  REQUIRE(box.pending() == 2);
+  box.wait().handle<msg_a>(take());
+  box.wait().handle<msg_a>(take());
+  REQUIRE(got == std::vector<int>{5, 3, 4});
+
+  box.set_stash_limit(0);                            // Nothing is kept
+  to_box.send(msg_a{6});
+  to_box.send(msg_b{7});
+  box.receive().handle<msg_b>(take());
+  REQUIRE(got == std::vector<int>{5, 3, 4, 7});
+  REQUIRE(box.stats().stash_dropped == 3);
+  REQUIRE(box.pending() == 0);
+}
+
+TEST_CASE("Typed_receiver keeps order while its ring grows around the wrap", "[messaging]")
+{
+  Messaging::Typed_receiver<msg_a, msg_b> box{4};
+  box.set_single_threaded(true);
+  Messaging::Typed_receiver<msg_a, msg_b>::sender_type to_box{box};
+
+  std::vector<int> got;
+  const Messaging::Overloaded take{[&](const msg_a& msg) { got.push_back(msg.n); },
+                                   [&](const msg_b& msg) { got.push_back(-msg.n); }};
+  int sent{0};
+  std::vector<int> expected;
+  const auto send{[&](int n) {
+    for (int i{0}; i != n; ++i, ++sent) {
+      if (sent % 3)
+        to_box.send(msg_a{sent});
+      else
+        to_box.send(msg_b{sent});
+      expected.push_back(sent % 3 ? sent : -sent);
+    }
+  }};
+  send(3);
+  box.wait(take);
+  box.wait(take);                   // The head is now two slots in
+  send(9);                          // Wraps, then grows twice
+  REQUIRE(box.pending() == 10);
+  while (box.pending())
+    box.wait(take);
+  REQUIRE(got == expected);
+
+  to_box.send(Messaging::Close_queue{});
+  REQUIRE_THROWS_AS(box.wait(take), Messaging::Close_queue);
+  REQUIRE_THROWS_AS(box.wait(take), Messaging::Mailbox_empty);
+  REQUIRE(box.stats().pushed == 13);
+}
+
+TEST_CASE("Typed_receiver hands a producer's messages over until it is closed", "[messaging]")
+{
+  Messaging::Typed_receiver<msg_a, msg_b> box{2};
+  Messaging::Typed_receiver<msg_a, msg_b>::sender_type to_box{box};
+  constexpr int count{20'000};
+  std::jthread producer{[to_box]() mutable {
+    for (int i{0}; i != count; ++i)
+      to_box.send(msg_a{i});
+    to_box.send(Messaging::Close_queue{});
+  }};
+
+  int next{0};
+  bool in_order{true};
+  try {
+    for (;;)
+      box.wait(Messaging::Overloaded{[&](const msg_a& msg) { in_order = in_order && msg.n == next++; },
+                                     [&](const msg_b&) { in_order = false; }});
+  }
+  catch (const Messaging::Close_queue&) {
+  }
+  REQUIRE(in_order);
+  REQUIRE(next == count);
+  REQUIRE(box.pending() == 0);
+}
+
+TEST_CASE("A late subscriber sees only what is published after it joined", "[broadcast]")
+{
+  Messaging::Broadcast_channel<int> ch{4};
+  ch.publish_new(1);
+  ch.publish_new(2);
+  auto sub{ch.subscribe("late")};
+  REQUIRE(sub.try_next() == nullptr);
+  ch.publish_new(3);
+  REQUIRE(sub.lag() == 1);
+  const auto msg{sub.try_next()};
+  REQUIRE(msg);
+  REQUIRE(*msg == 3);
+  REQUIRE(sub.try_next() == nullptr);
+  ch.close();
+  REQUIRE(sub.next() == nullptr);
+}
+
+TEST_CASE("A blocking subscriber holds the publisher back and loses nothing", "[broadcast]")
+{
+  Messaging::Broadcast_channel<int> ch{4};
+  auto sub{ch.subscribe("slow")};
+  constexpr int count{10'000};
+  std::jthread publisher{[&ch] {
+    for (int i{0}; i != count; ++i)
+      ch.publish_new(i);
+    ch.close();
+  }};
+  int next{0};
+  bool in_order{true};
+  while (const auto msg{sub.next()})
+    in_order = in_order && *msg == next++;
+  REQUIRE(in_order);
+  REQUIRE(next == count);
+  REQUIRE(sub.dropped() == 0);
+  REQUIRE_FALSE(sub.disconnected());
+}
+
+TEST_CASE("A dropping subscriber skips what was overwritten", "[broadcast]")
+{
+  Messaging::Broadcast_channel<int> ch{4};
+  auto slow{ch.subscribe("slow", Messaging::Slow_subscriber::drop)};
+  for (int i{0}; i != 10; ++i)      // Never waits for slow
+    ch.publish_new(i);
+  ch.close();
+  std::vector<int> got;
+  while (const auto msg{slow.next()})
+    got.push_back(*msg);
+  REQUIRE(got == std::vector<int>{6, 7, 8, 9});
+  REQUIRE(slow.dropped() == 6);
+  const auto stats{ch.stats()};
+  REQUIRE(stats.size() == 1);
+  REQUIRE(stats[0].received == 4);
+  REQUIRE(stats[0].dropped == 6);
+  REQUIRE_FALSE(stats[0].disconnected);
+}
+
+TEST_CASE("A disconnecting subscriber is cut off, the others go on", "[broadcast]")
+{
+  Messaging::Broadcast_channel<int> ch{4};
+  auto fast{ch.subscribe("fast", Messaging::Slow_subscriber::drop)};
+  auto slow{ch.subscribe("slow", Messaging::Slow_subscriber::disconnect)};
+  REQUIRE(slow.try_next() == nullptr);
+  ch.publish_new(0);
+  REQUIRE(*slow.next() == 0);
+  std::vector<int> got{*fast.next()};
+  for (int i{1}; i != 10; ++i) {
+    ch.publish_new(i);
+    got.push_back(*fast.next());
+  }
+  REQUIRE(slow.disconnected());
+  REQUIRE(slow.next() == nullptr);
+  REQUIRE(got == std::vector<int>{0, 1, 2, 3, 4, 5, 6, 7, 8, 9});
+  REQUIRE(fast.dropped() == 0);
+  const auto stats{ch.stats()};
+  REQUIRE(stats.size() == 2);
+  REQUIRE(stats[1].name == "slow");
+  REQUIRE(stats[1].disconnected);
+  REQUIRE(stats[1].received == 1);
+}
+
+TEST_CASE("Unsubscribed and empty subscriptions take nothing and hold nobody up", "[broadcast]")
+{
+  Messaging::Broadcast_channel<int> ch{4};
+  Messaging::Broadcast_channel<int>::Subscription none;
+  REQUIRE(none.next() == nullptr);
+  REQUIRE(none.try_next() == nullptr);
+  REQUIRE(none.lag() == 0);
+  REQUIRE_FALSE(none.disconnected());
+
+  auto gone{ch.subscribe("gone")};
+  ch.publish_new(0);
+  gone.unsubscribe();
+  REQUIRE(ch.stats().empty());
+  for (int i{1}; i != 10; ++i)      // Would block for a subscriber still there
+    ch.publish_new(i);
+  REQUIRE(gone.next() == nullptr);
+
+  none = ch.subscribe("moved");
+  ch.publish_new(10);
+  REQUIRE(*none.next() == 10);
+  REQUIRE(ch.stats().size() == 1);
+}
+
+TEST_CASE("Seqlock readers never see a torn value while the writer stores", "[seqlock]")
+{
+  struct Triple {                   // Three words that must agree
+    std::uint64_t n, inverse, scaled;
+  };
+  constexpr std::uint64_t stores{200'000};
+  Messaging::Seqlock<Triple> value{Triple{0, ~std::uint64_t{0}, 0}};
+  std::atomic<bool> done{false};
+  std::atomic<std::uint64_t> torn{0};
+  std::atomic<std::uint64_t> reads{0};
+  {
+    std::vector<std::jthread> readers;
+    for (int r{0}; r != 2; ++r)
+      readers.emplace_back([&] {
+        std::uint64_t last{0};
+        std::uint64_t n_reads{0};
+        do {
+          const auto t{value.load()};
+          if (t.inverse != ~t.n || t.scaled != t.n * 0x9e3779b97f4a7c15ULL || t.n < last)
+            torn.fetch_add(1, std::memory_order_relaxed);
+          last = t.n;
+          ++n_reads;
+        } while (!done.load(std::memory_order_relaxed));
+        reads.fetch_add(n_reads, std::memory_order_relaxed);
+      });
+    std::jthread writer{[&] {
+      for (std::uint64_t n{1}; n <= stores; ++n)
+        value.store({n, ~n, n * 0x9e3779b97f4a7c15ULL});
+      done.store(true, std::memory_order_relaxed);
+    }};
+  }
+  REQUIRE(torn == 0);
+  REQUIRE(reads > 0);
+  REQUIRE(value.load().n == stores);
+  REQUIRE(value.version() == stores + 1);
+}
+
+TEST_CASE("Balance_board readers see whole balances while the bank publishes", "[seqlock]")
+{
+  Accounting::Balance_board board{{"acc1", "acc2"}, Money::major(100)};
+  constexpr std::int64_t stores{200'000};
+  std::atomic<bool> done{false};
+  std::atomic<std::uint64_t> torn{0};
+  {
+    std::vector<std::jthread> readers;
+    for (int r{0}; r != 2; ++r)
+      readers.emplace_back([&] {
+        do {
+          // Odd amounts are published in euros: amount and currency must match
+          const auto balance{board.balance(0)};
+          if ((balance.minor_units() % 2 != 0) != (balance.currency() == eur))
+            torn.fetch_add(1, std::memory_order_relaxed);
+        } while (!done.load(std::memory_order_relaxed));
+      });
+    std::jthread bank{[&] {         // The one writer, as the bank actor is
+      for (std::int64_t n{1}; n <= stores; ++n)
+        board.publish(0, Money::minor(n, n % 2 ? eur : usd));
+      done.store(true, std::memory_order_relaxed);
+    }};
+  }
+  REQUIRE(torn == 0);
+  REQUIRE(board.balance(0) == Money::minor(stores, usd));
+  REQUIRE(board.balance("acc2") == Money::major(100));
+}
+
+TEST_CASE("Metrics added on many threads are merged from every shard", "[metrics]")
+{
+  const auto added{Metrics::counter("test_merged_total", "Added by every thread")};
+  const auto open{Metrics::gauge("test_merged_open", "Up and down on every thread")};
+  const auto values{Metrics::histogram("test_merged_values", "Recorded by every thread")};
+  constexpr std::uint64_t threads{8};
+  constexpr std::uint64_t adds{20'000};
+  for (int round{0}; round != 2; ++round) {   // The second round reuses shards handed back
+    std::vector<std::jthread> workers;
+    for (std::uint64_t t{0}; t != threads; ++t)
+      workers.emplace_back([&, t] {
+        for (std::uint64_t n{0}; n != adds; ++n) {
+          added.add();
+          open.add(2);
+          open.sub(1);
+          values.record(t);
+        }
+      });
+  }
+  REQUIRE(added.value() == 2 * threads * adds);
+  REQUIRE(open.value() == static_cast<std::int64_t>(2 * threads * adds));
+  const auto h{values.value()};
+  REQUIRE(h.count == 2 * threads * adds);
+  REQUIRE(h.sum == 2 * adds * (threads * (threads - 1) / 2));
+  for (std::uint64_t t{0}; t != threads; ++t)
+    REQUIRE(h.counts[Metrics::Log_buckets::index(t)] == 2 * adds);
+}
+
+TEST_CASE("Metrics added by exiting threads after their shard is handed back are kept", "[metrics]")
+{
+  const auto added{Metrics::counter("test_late_total", "Added as threads exit")};
+  const auto values{Metrics::histogram("test_late_values", "Recorded as threads exit")};
+  constexpr std::uint64_t threads{8};
+  constexpr std::uint64_t adds{160'000};
+  // Made before the thread's shard is leased, so destroyed after it is
+  // handed back: what the destructor adds goes to the shared shard
+  struct At_exit {
+    std::function<void()> run;
+    ~At_exit() { if (run) run(); }
+  };
+  std::atomic<std::uint64_t> started{0};
+  {
+    std::vector<std::jthread> workers;
+    for (std::uint64_t t{0}; t != threads; ++t)
+      workers.emplace_back([&] {
+        thread_local At_exit at_exit;
+        at_exit.run = [&] {
+          started.fetch_add(1);
+          while (started.load() != threads) // All exit at once, to race
+            std::this_thread::yield();
+          for (std::uint64_t n{0}; n != adds; ++n) {
+            added.add();
+            values.record(n % 16);
+          }
+        };
+        added.add();                // Leases the shard
+      });
+  }
+  REQUIRE(added.value() == threads * (adds + 1));
+  const auto h{values.value()};
+  REQUIRE(h.count == threads * adds);
+  REQUIRE(h.sum == threads * (adds / 16) * (15 * 16 / 2));
+  REQUIRE(h.counts[Metrics::Log_buckets::index(15)] == threads * adds / 16);
+}
+
+TEST_CASE("Prometheus text has cumulative buckets and escaped labels", "[metrics]")
+{
+  const auto labels{Metrics::label("path", "C:\\cash \"box\"\nnext")};
+  REQUIRE(labels == R"(path="C:\\cash \"box\"\nnext")");
+  const auto sizes{Metrics::histogram("test_prometheus_bytes", "Sizes seen", labels)};
+  for (const std::uint64_t v : {0u, 3u, 100u, 1000u, 5000u})
+    sizes.record(v);
+  Metrics::counter("test_prometheus_total", "Counted", Metrics::label("kind", "a,b=c")).add(7);
+
+  const auto text{Metrics::Registry::instance().prometheus()};
+  REQUIRE(text.find("# TYPE test_prometheus_bytes histogram\n") != std::string::npos);
+  REQUIRE(text.find("test_prometheus_total{kind=\"a,b=c\"} 7\n") != std::string::npos);
+
+  std::istringstream lines{text};
+  std::vector<std::pair<std::string, std::uint64_t>> buckets;
+  for (std::string line; std::getline(lines, line);) {
+    const std::string prefix{"test_prometheus_bytes_bucket{" + labels + ",le=\""};
+    if (line.rfind(prefix, 0) != 0)
+      continue;
+    const auto le_end{line.find('"', prefix.size())};
+    buckets.emplace_back(line.substr(prefix.size(), le_end - prefix.size()),
+                         std::stoull(line.substr(line.rfind(' ') + 1)));
+  }
+  REQUIRE(buckets.size() == 42);    // 2^0 to 2^40, and +Inf
+  for (std::size_t i{1}; i < buckets.size(); ++i)
+    REQUIRE(buckets[i - 1].second <= buckets[i].second);
+  const auto count_of = [&](std::string_view le) {
+    for (const auto& [bound, count] : buckets)
+      if (bound == le)
+        return count;
+    FAIL("no bucket le=" << le);
+    return std::uint64_t{0};
+  };
+  REQUIRE(count_of("1") == 1);
+  REQUIRE(count_of("4") == 2);
+  REQUIRE(count_of("128") == 3);
+  REQUIRE(count_of("1024") == 4);
+  REQUIRE(count_of("8192") == 5);
+  REQUIRE(count_of("+Inf") == 5);
+  REQUIRE(text.find("test_prometheus_bytes_sum{" + labels + "} 6103\n") != std::string::npos);
+  REQUIRE(text.find("test_prometheus_bytes_count{" + labels + "} 5\n") != std::string::npos);
+}